@@ -53,13 +53,15 @@
 
 struct _block_state_t {
     unsigned int times_used, waiting;
-    int status;
+    int status, prefetched; /* prefetched is cleared once the block is read */
 };
 typedef struct _block_state_t block_state_t;
 
 struct _sxfs_cache_t {
     size_t nthreads, lfu_entries[3], lfu_max[3];
     ssize_t used, lru_size; /* can be negative due to race conditions with small size */
+    ssize_t inflight; /* bytes being prefetched, guarded by lru_mutex like the counters below */
+    unsigned long long int hits, misses, prefetched, wasted;
     char *tempdir, *dir_small, *dir_medium, *dir_large, *dir_lfu_small, *dir_lfu_medium, *dir_lfu_large;
     pthread_mutex_t mutex, lru_mutex, lfu_mutex;
     sxi_ht *blocks_lru, *blocks_lfu[3];
@@ -283,7 +285,11 @@ sxfs_cache_init_err:
 } /* sxfs_cache_init */
 
 void sxfs_cache_free (sxfs_state_t *sxfs) {
-    cache_free(sxfs, sxfs->cache);
+    sxfs_cache_t *cache = sxfs->cache;
+
+    if(cache)
+        SXFS_LOG("Block cache: %llu hits, %llu misses, %llu blocks prefetched, %llu evicted unused", cache->hits, cache->misses, cache->prefetched, cache->wasted);
+    cache_free(sxfs, cache);
 } /* sxfs_cache_free */
 
 static void ENOSPC_handler (sxfs_state_t *sxfs) {
@@ -428,6 +434,8 @@ static int cache_make_space (sxfs_state_t *sxfs, unsigned int size) {
             if(sxi_ht_get(sxfs->cache->blocks_lru, block_name, strlen(block_name), (void**)&block_state)) {
                 SXFS_ERROR("Cannot get LRU block state: %s", block_name);
             } else if(block_state->status == BLOCK_STATUS_DONE && !block_state->waiting) {
+                if(block_state->prefetched)
+                    sxfs->cache->wasted++;
                 sxi_ht_del(sxfs->cache->blocks_lru, block_name, strlen(block_name));
                 free(block_state);
                 if(unlink(path)) {
@@ -858,7 +866,7 @@ cache_download_err:
     return ret;
 } /* cache_download */
 
-#define MAXBLOCKS MAX(MAX(SXFS_BS_SMALL_AMOUNT, SXFS_BS_MEDIUM_AMOUNT), SXFS_BS_LARGE_AMOUNT)
+#define MAXBLOCKS MAX(MAX(SXFS_BS_SMALL_AMOUNT, SXFS_BS_MEDIUM_AMOUNT), SXFS_BS_LARGE_AMOUNT) /* blocks of a single prefetch download */
 struct _cache_thread_data_t {
     int fds[MAXBLOCKS];
     unsigned int nblocks, blocks[MAXBLOCKS];
@@ -965,6 +973,7 @@ cache_download_thread_err:
             SXFS_ERROR("Cannot remove '%s' file: %s", path, strerror(errno));
     }
     pthread_mutex_lock(&cache->lru_mutex);
+    cache->inflight -= cdata->nblocks * fdata->blocksize;
     for(i=0; i<cdata->nblocks; i++) {
         if(fdata2.ha)
             free(fdata2.ha[i]);
@@ -1011,9 +1020,11 @@ cache_download_thread_err:
     pthread_exit(NULL);
 } /* cache_download_thread */
 
-static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, unsigned int block) {
-    int err, end_reached = 0, duplicate, cache_locked = 0, got_sem = 0;
-    unsigned int i, j, nblocks, tmp_nblocks = 0;
+/* prefetch up to nblocks blocks starting at given block with one download,
+ * fails when the download limits do not allow it now */
+static int cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, unsigned int block, unsigned int nblocks) {
+    int err, duplicate, cache_locked = 0, got_sem = 0, inflight_added = 0;
+    unsigned int i, j, tmp_nblocks = 0;
     char *path;
     const char *dir = "foo"; /* shut up warnings */
     sxfs_cache_t *cache = sxfs->cache;
@@ -1023,30 +1034,29 @@ static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, u
     pthread_t thread;
 
     if(block >= fdata->nhashes)
-        return;
+        return 0;
     switch(fdata->blocksize) {
         case SX_BS_SMALL:
             dir = "small";
-            nblocks = SXFS_BS_SMALL_AMOUNT;
             break;
         case SX_BS_MEDIUM:
             dir = "medium";
-            nblocks = SXFS_BS_MEDIUM_AMOUNT;
             break;
         case SX_BS_LARGE:
             dir = "large";
-            nblocks = SXFS_BS_LARGE_AMOUNT;
             break;
         default:
             SXFS_ERROR("Unknown block size");
-            return;
+            return -EINVAL;
     }
+    if(nblocks > MAXBLOCKS)
+        nblocks = MAXBLOCKS;
     if(block + nblocks > fdata->nhashes)
         nblocks = fdata->nhashes - block;
     path = (char*)malloc(strlen(cache->tempdir) + 1 + lenof("lfu") + 1 + strlen(dir) + 1 + SXI_SHA1_TEXT_LEN + 1);
     if(!path) {
         SXFS_ERROR("Out of memory");
-        return;
+        return -ENOMEM;
     }
     cdata = (cache_thread_data_t*)calloc(1, sizeof(cache_thread_data_t));
     if(!cdata) {
@@ -1075,13 +1085,7 @@ static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, u
     got_sem = 1;
     pthread_mutex_lock(&cache->lru_mutex);
     cache_locked = 1;
-    for(i=0; cdata->nblocks < nblocks; i++) {
-        if(block + i == fdata->nhashes) {
-            end_reached = 1;
-            break;
-        }
-        if(i > 2 * nblocks) /* do not try to read too far from given block */
-            break;
+    for(i=0; i<nblocks; i++) {
         duplicate = 0;
         for(j=0; j<cdata->nblocks; j++)
             if(!strcmp(fdata->ha[block+i], fdata->ha[cdata->blocks[j]])) {
@@ -1115,7 +1119,12 @@ static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, u
                 SXFS_ERROR("Cannot update mtime of '%s' file: %s", path, strerror(errno));
         }
     }
-    if(cdata->nblocks && (end_reached || 2 * (cdata->blocks[0] - block) < nblocks || cdata->nblocks == nblocks)) { /* near to EOF  OR  filling holes  OR  limit reached */
+    if(cdata->nblocks) {
+        if(cache->inflight + (ssize_t)cdata->nblocks * fdata->blocksize > SXFS_READAHEAD_INFLIGHT) {
+            SXFS_VERBOSE("Read-ahead data limit reached");
+            err = -EAGAIN;
+            goto cache_read_background_err;
+        }
         if(cache_make_space(sxfs, cdata->nblocks * fdata->blocksize)) {
             err = -ENOMSG;
             goto cache_read_background_err;
@@ -1128,6 +1137,7 @@ static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, u
                 goto cache_read_background_err;
             }
             block_state->status = BLOCK_STATUS_BUSY;
+            block_state->prefetched = 1;
             if(sxi_ht_add(cache->blocks_lru, fdata->ha[cdata->blocks[i]], strlen(fdata->ha[cdata->blocks[i]]), block_state)) {
                 SXFS_ERROR("Out of memory");
                 err = -ENOMEM;
@@ -1147,6 +1157,10 @@ static void cache_read_background (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, u
             }
             cache->used += fdata->blocksize;
         }
+        /* released by the download thread */
+        cache->inflight += cdata->nblocks * fdata->blocksize;
+        cache->prefetched += cdata->nblocks;
+        inflight_added = 1;
         pthread_mutex_unlock(&cache->lru_mutex);
         cache_locked = 0;
         pthread_mutex_lock(&sxfs->limits_mutex);
@@ -1177,6 +1191,10 @@ cache_read_background_err:
     if(!cache_locked)
         pthread_mutex_lock(&cache->lru_mutex);
     if(err && cdata) {
+        if(inflight_added) {
+            cache->inflight -= cdata->nblocks * fdata->blocksize;
+            cache->prefetched -= cdata->nblocks;
+        }
         for(i=0; i<cdata->nblocks; i++) {
             if(i < tmp_nblocks) {
                 if(sxi_ht_get(cache->blocks_lru, fdata->ha[cdata->blocks[i]], strlen(fdata->ha[cdata->blocks[i]]), (void**)&block_state)) {
@@ -1215,8 +1233,67 @@ cache_read_background_err:
         free(cdata);
     }
     free(path);
+    return err;
 } /* cache_read_background */
 
+/* every next block of a sequential stream doubles the read-ahead window,
+ * any other access drops it so random reads fetch only the blocks they need */
+static void cache_read_ahead (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, unsigned int block) {
+    unsigned int batch, window_max, start, end, n;
+    sxfs_cache_t *cache = sxfs->cache;
+    sxi_sxfs_data_t *fdata = sxfs_file->fdata;
+
+    switch(fdata->blocksize) {
+        case SX_BS_SMALL:
+            batch = SXFS_BS_SMALL_AMOUNT;
+            break;
+        case SX_BS_MEDIUM:
+            batch = SXFS_BS_MEDIUM_AMOUNT;
+            break;
+        case SX_BS_LARGE:
+            batch = SXFS_BS_LARGE_AMOUNT;
+            break;
+        default:
+            SXFS_ERROR("Unknown block size");
+            return;
+    }
+    window_max = MIN(SXFS_READAHEAD_MAX, cache->lru_size / 4) / fdata->blocksize; /* leave the LRU space for the data being read */
+    if(window_max < batch)
+        window_max = batch;
+    pthread_mutex_lock(&cache->mutex);
+    if(sxfs_file->ra_next && block == sxfs_file->ra_next - 1) { /* another part of the last block */
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    if(block == sxfs_file->ra_next) {
+        if(!sxfs_file->ra_window)
+            sxfs_file->ra_window = batch;
+        else
+            sxfs_file->ra_window = MIN(2 * sxfs_file->ra_window, window_max);
+    } else {
+        if(sxfs_file->ra_window)
+            SXFS_VERBOSE("'%s': Random access, read-ahead disabled", sxfs_file->remote_path);
+        sxfs_file->ra_window = 0;
+        sxfs_file->ra_end = 0;
+    }
+    sxfs_file->ra_next = block + 1;
+    start = MAX(block + 1, sxfs_file->ra_end);
+    end = MIN(block + 1 + sxfs_file->ra_window, fdata->nhashes);
+    pthread_mutex_unlock(&cache->mutex);
+
+    /* the blocks already scheduled are skipped, the ones refused by the limits are retried with the next block */
+    while(start < end) {
+        n = MIN(batch, end - start);
+        if(cache_read_background(sxfs, sxfs_file, start, n))
+            break;
+        start += n;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    if(sxfs_file->ra_next == block + 1 && start > sxfs_file->ra_end)
+        sxfs_file->ra_end = start;
+    pthread_mutex_unlock(&cache->mutex);
+} /* cache_read_ahead */
+
 static char* calculate_block_name (sxfs_state_t *sxfs, const void *buff, size_t size) {
     char *ret;
     unsigned char sha_hash[SXI_SHA1_BIN_LEN];
@@ -1254,7 +1331,7 @@ static ssize_t cache_read_block (sxfs_state_t *sxfs, sxi_sxfs_data_t *fdata, uns
     ssize_t ret;
     char *path = NULL, *local_buff = NULL;
     const char *block_name = fdata->ha[block], *dir = "foo"; /* shut up warnings */
-    block_state_t *block_state = NULL;
+    block_state_t *block_state = NULL, *used_state;
     sxfs_cache_t *cache = sxfs->cache;
 
     local_buff = (char*)malloc(fdata->blocksize);
@@ -1330,6 +1407,9 @@ static ssize_t cache_read_block (sxfs_state_t *sxfs, sxi_sxfs_data_t *fdata, uns
                 goto cache_read_block_err;
             }
             block_state->times_used++;
+            block_state->prefetched = 0;
+        } else if(!sxi_ht_get(cache->blocks_lru, block_name, strlen(block_name), (void**)&used_state)) {
+            used_state->prefetched = 0;
         }
         /* do it inside the lock to avoid races */
         if((ret = wait_for_block(sxfs, fd, block_name, fdata->blocksize))) {
@@ -1348,6 +1428,12 @@ static ssize_t cache_read_block (sxfs_state_t *sxfs, sxi_sxfs_data_t *fdata, uns
         pthread_mutex_unlock(&cache->lru_mutex);
         locked &= ~CACHE_LRU_MUTEX;
     }
+    pthread_mutex_lock(&cache->lru_mutex);
+    if(fd < 0)
+        cache->misses++;
+    else
+        cache->hits++;
+    pthread_mutex_unlock(&cache->lru_mutex);
     if(fd < 0) { /* file does not exist or block failed to download in another thread */
         sprintf(path, "%s/%s/%s", cache->tempdir, dir, block_name);
         if((ret = cache_download(sxfs, fdata, block, &path, &fd, offset))) {
@@ -1411,12 +1497,11 @@ ssize_t sxfs_cache_read (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, void *buff,
     }
     cache = sxfs->cache;
     fdata = sxfs_file->fdata;
-    if(!sxfs->need_file) {
-        if(!cache) { /* cache can be NULL when sxfs->need_file is true */
-            SXFS_ERROR("NULL argument");
-            return -EINVAL;
-        }
-    } else if(sxfs_file->write_fd < 0 && (ret = sxfs_get_file(sxfs, sxfs_file))) {
+    if(!sxfs->need_file && !cache) { /* cache can be NULL when sxfs->need_file is true */
+        SXFS_ERROR("NULL argument");
+        return -EINVAL;
+    }
+    if((sxfs->need_file || !fdata) && sxfs_file->write_fd < 0 && (ret = sxfs_get_file(sxfs, sxfs_file))) { /* no fdata after a failure in sxfs_stream_finish() */
         SXFS_ERROR("Cannot get '%s' file", sxfs_file->remote_path);
         return ret;
     }
@@ -1439,7 +1524,7 @@ ssize_t sxfs_cache_read (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, void *buff,
     }
     SXFS_VERBOSE("Offset: %lld, block number: %llu", (long long int)offset, (unsigned long long int)block);
     if(!sxfs->args->fuse_single_threaded_given) /* SXFS sets *_flag to 1 on OS X */
-        cache_read_background(sxfs, sxfs_file, block+1);
+        cache_read_ahead(sxfs, sxfs_file, block);
 
     /* reading the block is inside so sxfs can use the data it needs to read anyway */
     /* TODO: made it in loop to read all requested data */
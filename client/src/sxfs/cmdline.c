@@ -44,6 +44,7 @@ const char *gengetopt_args_info_full_help[] = {
   "  -q, --use-queues            Enable queues for upload and delete operations\n                                (default=off)",
   "  -C, --cache-size=SIZE       Set size for local cache  (default=`512M')",
   "  -d, --cache-dir=PATH        Set directory for cache (sxfs tempdir by default)",
+  "      --write-behind=SIZE     Upload sequentially written files of at least\n                                128M in the background while they are being\n                                written, keeping about SIZE of their data\n                                locally",
   "      --replica-wait          Wait for full data replication on the cluster\n                                (default=off)",
   "  -f, --foreground            Run in foreground  (default=off)",
   "  -D, --debug                 Enable debug messages  (default=off)",
@@ -75,11 +76,12 @@ init_help_array(void)
   gengetopt_args_info_help[10] = gengetopt_args_info_full_help[10];
   gengetopt_args_info_help[11] = gengetopt_args_info_full_help[11];
   gengetopt_args_info_help[12] = gengetopt_args_info_full_help[12];
-  gengetopt_args_info_help[13] = 0; 
+  gengetopt_args_info_help[13] = gengetopt_args_info_full_help[13];
+  gengetopt_args_info_help[14] = 0; 
   
 }
 
-const char *gengetopt_args_info_help[14];
+const char *gengetopt_args_info_help[15];
 
 typedef enum {ARG_NO
   , ARG_FLAG
@@ -115,6 +117,7 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->use_queues_given = 0 ;
   args_info->cache_size_given = 0 ;
   args_info->cache_dir_given = 0 ;
+  args_info->write_behind_given = 0 ;
   args_info->replica_wait_given = 0 ;
   args_info->foreground_given = 0 ;
   args_info->debug_given = 0 ;
@@ -146,6 +149,8 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->cache_size_orig = NULL;
   args_info->cache_dir_arg = NULL;
   args_info->cache_dir_orig = NULL;
+  args_info->write_behind_arg = NULL;
+  args_info->write_behind_orig = NULL;
   args_info->replica_wait_flag = 0;
   args_info->foreground_flag = 0;
   args_info->debug_flag = 0;
@@ -181,18 +186,19 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->use_queues_help = gengetopt_args_info_full_help[7] ;
   args_info->cache_size_help = gengetopt_args_info_full_help[8] ;
   args_info->cache_dir_help = gengetopt_args_info_full_help[9] ;
-  args_info->replica_wait_help = gengetopt_args_info_full_help[10] ;
-  args_info->foreground_help = gengetopt_args_info_full_help[11] ;
-  args_info->debug_help = gengetopt_args_info_full_help[12] ;
-  args_info->verbose_help = gengetopt_args_info_full_help[13] ;
-  args_info->sx_debug_help = gengetopt_args_info_full_help[14] ;
-  args_info->open_limit_help = gengetopt_args_info_full_help[15] ;
-  args_info->fuse_help_help = gengetopt_args_info_full_help[16] ;
-  args_info->fuse_version_help = gengetopt_args_info_full_help[17] ;
-  args_info->fuse_single_threaded_help = gengetopt_args_info_full_help[18] ;
-  args_info->fuse_debug_help = gengetopt_args_info_full_help[19] ;
-  args_info->config_dir_help = gengetopt_args_info_full_help[20] ;
-  args_info->filter_dir_help = gengetopt_args_info_full_help[21] ;
+  args_info->write_behind_help = gengetopt_args_info_full_help[10] ;
+  args_info->replica_wait_help = gengetopt_args_info_full_help[11] ;
+  args_info->foreground_help = gengetopt_args_info_full_help[12] ;
+  args_info->debug_help = gengetopt_args_info_full_help[13] ;
+  args_info->verbose_help = gengetopt_args_info_full_help[14] ;
+  args_info->sx_debug_help = gengetopt_args_info_full_help[15] ;
+  args_info->open_limit_help = gengetopt_args_info_full_help[16] ;
+  args_info->fuse_help_help = gengetopt_args_info_full_help[17] ;
+  args_info->fuse_version_help = gengetopt_args_info_full_help[18] ;
+  args_info->fuse_single_threaded_help = gengetopt_args_info_full_help[19] ;
+  args_info->fuse_debug_help = gengetopt_args_info_full_help[20] ;
+  args_info->config_dir_help = gengetopt_args_info_full_help[21] ;
+  args_info->filter_dir_help = gengetopt_args_info_full_help[22] ;
   
 }
 
@@ -344,6 +350,8 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_string_field (&(args_info->cache_size_orig));
   free_string_field (&(args_info->cache_dir_arg));
   free_string_field (&(args_info->cache_dir_orig));
+  free_string_field (&(args_info->write_behind_arg));
+  free_string_field (&(args_info->write_behind_orig));
   free_string_field (&(args_info->open_limit_orig));
   free_string_field (&(args_info->config_dir_arg));
   free_string_field (&(args_info->config_dir_orig));
@@ -411,6 +419,8 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "cache-size", args_info->cache_size_orig, 0);
   if (args_info->cache_dir_given)
     write_into_file(outfile, "cache-dir", args_info->cache_dir_orig, 0);
+  if (args_info->write_behind_given)
+    write_into_file(outfile, "write-behind", args_info->write_behind_orig, 0);
   if (args_info->replica_wait_given)
     write_into_file(outfile, "replica-wait", 0, 0 );
   if (args_info->foreground_given)
@@ -973,6 +983,7 @@ cmdline_parser_internal (
         { "use-queues",	0, NULL, 'q' },
         { "cache-size",	1, NULL, 'C' },
         { "cache-dir",	1, NULL, 'd' },
+        { "write-behind",	1, NULL, 0 },
         { "replica-wait",	0, NULL, 0 },
         { "foreground",	0, NULL, 'f' },
         { "debug",	0, NULL, 'D' },
@@ -1152,8 +1163,22 @@ cmdline_parser_internal (
             exit (EXIT_SUCCESS);
           }
 
+          /* Upload sequentially written files while they are being written, keeping at most SIZE of their data locally.  */
+          if (strcmp (long_options[option_index].name, "write-behind") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->write_behind_arg), 
+                 &(args_info->write_behind_orig), &(args_info->write_behind_given),
+                &(local_args_info.write_behind_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "write-behind", '-',
+                additional_error))
+              goto failure;
+          
+          }
           /* Wait for full data replication on the cluster.  */
-          if (strcmp (long_options[option_index].name, "replica-wait") == 0)
+          else if (strcmp (long_options[option_index].name, "replica-wait") == 0)
           {
           
           
@@ -62,6 +62,9 @@ struct gengetopt_args_info
   char * cache_dir_arg;	/**< @brief Set directory for cache (sxfs tempdir by default).  */
   char * cache_dir_orig;	/**< @brief Set directory for cache (sxfs tempdir by default) original value given at command line.  */
   const char *cache_dir_help; /**< @brief Set directory for cache (sxfs tempdir by default) help description.  */
+  char * write_behind_arg;	/**< @brief Upload sequentially written files while they are being written, keeping at most SIZE of their data locally.  */
+  char * write_behind_orig;	/**< @brief Upload sequentially written files while they are being written, keeping at most SIZE of their data locally original value given at command line.  */
+  const char *write_behind_help; /**< @brief Upload sequentially written files while they are being written, keeping at most SIZE of their data locally help description.  */
   int replica_wait_flag;	/**< @brief Wait for full data replication on the cluster (default=off).  */
   const char *replica_wait_help; /**< @brief Wait for full data replication on the cluster help description.  */
   int foreground_flag;	/**< @brief Run in foreground (default=off).  */
@@ -100,6 +103,7 @@ struct gengetopt_args_info
   unsigned int use_queues_given ;	/**< @brief Whether use-queues was given.  */
   unsigned int cache_size_given ;	/**< @brief Whether cache-size was given.  */
   unsigned int cache_dir_given ;	/**< @brief Whether cache-dir was given.  */
+  unsigned int write_behind_given ;	/**< @brief Whether write-behind was given.  */
   unsigned int replica_wait_given ;	/**< @brief Whether replica-wait was given.  */
   unsigned int foreground_given ;	/**< @brief Whether foreground was given.  */
   unsigned int debug_given ;	/**< @brief Whether debug was given.  */
@@ -38,6 +38,10 @@
 #include <dirent.h>
 #include <limits.h>
 #include "libsxclient/src/fileops.h"
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/falloc.h>
+#endif
 
 #define SXFS_DOWNLOAD_IN_PROGRESS 0x1
 #define SXFS_DOWNLOAD_FINISHED 0x2
@@ -73,12 +77,16 @@
 int delete_flag, upload_flag, delete_stop, upload_stop;
 size_t threads_del, threads_up;
 sxfs_queue_entry_t delete_queue, upload_queue;
+/* bumped under the queue mutex when entries leave the queue, a listing
+ * fetched without ls_lock is only merged if they did not change meanwhile */
+static unsigned int delete_gen, upload_gen;
 
 struct _sxfs_queue_entry_t {
     int state;
     unsigned int waiting;
     uint64_t mtime;
     char *local_path, *remote_path;
+    sxi_sxfs_delta_t *delta;
     sxfs_queue_entry_t *prev, *next;
 };
 
@@ -92,6 +100,7 @@ static void sxfs_queue_free (sxfs_queue_entry_t *entry, int all_queue) {
         return;
     free(entry->local_path);
     free(entry->remote_path);
+    sxfs_delta_free(entry->delta);
     if(all_queue)
         sxfs_queue_free(entry->next, 1);
     free(entry);
@@ -460,6 +469,7 @@ int sxfs_get_file (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
             SXFS_ERROR("Cannot read from '%s' file: %s", local_file_path, strerror(errno));
             goto sxfs_get_file_err;
         }
+        sxfs_file->delta = 1;
     }
     sxfs_file->write_fd = fd;
     sxfs_file->write_path = local_file_path;
@@ -485,6 +495,9 @@ void sxfs_file_free (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
 
     if(!sxfs_file)
         return;
+    pthread_mutex_lock(&sxfs_file->mutex);
+    sxfs_stream_abort(sxfs_file); /* stops the upload thread */
+    pthread_mutex_unlock(&sxfs_file->mutex);
     pthread_mutex_lock(&sxfs->limits_mutex);
     while(sxfs_file->threads_num) {
         pthread_mutex_unlock(&sxfs->limits_mutex);
@@ -506,11 +519,486 @@ void sxfs_file_free (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
     } else
         sxfs_file->ls_file->opened = 0;
     sxi_sxfs_download_finish(sxfs_file->fdata);
+    free(sxfs_file->dirty);
     if((err = pthread_mutex_destroy(&sxfs_file->mutex)))
         SXFS_ERROR("Cannot destroy mutex: %s", strerror(err));
     free(sxfs_file);
 } /* sxfs_file_free */
 
+/* gives up on the delta when out of memory, the file is then hashed as a whole */
+void sxfs_file_mark_dirty (sxfs_file_t *sxfs_file, off_t offset, off_t size) {
+    size_t first, last, need;
+
+    if(!sxfs_file->delta || !sxfs_file->fdata || size <= 0)
+        return;
+    first = offset / sxfs_file->fdata->blocksize;
+    last = (offset + size - 1) / sxfs_file->fdata->blocksize;
+    need = last / 8 + 1;
+    if(need > sxfs_file->dirty_size) {
+        uint8_t *dirty = (uint8_t*)realloc(sxfs_file->dirty, need);
+
+        if(!dirty) {
+            free(sxfs_file->dirty);
+            sxfs_file->dirty = NULL;
+            sxfs_file->dirty_size = 0;
+            sxfs_file->delta = 0;
+            return;
+        }
+        memset(dirty + sxfs_file->dirty_size, 0, need - sxfs_file->dirty_size);
+        sxfs_file->dirty = dirty;
+        sxfs_file->dirty_size = need;
+    }
+    for(; first <= last; first++)
+        sxfs_file->dirty[first / 8] |= 1 << (first % 8);
+} /* sxfs_file_mark_dirty */
+
+void sxfs_delta_free (sxi_sxfs_delta_t *delta) {
+    unsigned int i;
+
+    if(!delta)
+        return;
+    if(delta->ha) {
+        for(i=0; i<delta->nhashes; i++)
+            free(delta->ha[i]);
+        free(delta->ha);
+    }
+    free(delta->dirty);
+    free(delta);
+} /* sxfs_delta_free */
+
+/* snapshot of the current state, the hashes of dirty blocks are filled in during the upload */
+sxi_sxfs_delta_t* sxfs_file_delta (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
+    unsigned int i;
+    struct stat st;
+    sxi_sxfs_delta_t *delta;
+
+    if(!sxfs_file->delta || !sxfs_file->fdata || sxfs_file->write_fd < 0)
+        return NULL;
+    if(fstat(sxfs_file->write_fd, &st)) {
+        SXFS_ERROR("Cannot stat '%s' file: %s", sxfs_file->write_path, strerror(errno));
+        return NULL;
+    }
+    delta = (sxi_sxfs_delta_t*)calloc(1, sizeof(sxi_sxfs_delta_t));
+    if(!delta)
+        goto sxfs_file_delta_err;
+    delta->blocksize = sxfs_file->fdata->blocksize;
+    delta->nhashes = (st.st_size + delta->blocksize - 1) / delta->blocksize;
+    delta->ha = (char**)calloc(delta->nhashes + 1, sizeof(char*));
+    delta->dirty = (uint8_t*)calloc(delta->nhashes / 8 + 1, 1);
+    if(!delta->ha || !delta->dirty)
+        goto sxfs_file_delta_err;
+    for(i=0; i<delta->nhashes; i++) {
+        delta->ha[i] = (char*)malloc(SXI_SHA1_TEXT_LEN + 1);
+        if(!delta->ha[i])
+            goto sxfs_file_delta_err;
+        if(i >= sxfs_file->fdata->nhashes || (i / 8 < sxfs_file->dirty_size && sxfs_file->dirty[i / 8] & (1 << (i % 8)))) {
+            delta->dirty[i / 8] |= 1 << (i % 8);
+            delta->ha[i][0] = '\0';
+        } else {
+            memcpy(delta->ha[i], sxfs_file->fdata->ha[i], SXI_SHA1_TEXT_LEN);
+            delta->ha[i][SXI_SHA1_TEXT_LEN] = '\0';
+        }
+    }
+    return delta;
+sxfs_file_delta_err:
+    SXFS_ERROR("Out of memory");
+    sxfs_delta_free(delta);
+    return NULL;
+} /* sxfs_file_delta */
+
+typedef struct {
+    sxfs_state_t *sxfs;
+    sxfs_file_t *sxfs_file;
+} stream_thread_data_t;
+
+/* sends the full blocks between stream_pos and stream_end, the uploaded data is removed from write_fd;
+ * the file mutex is only held between the requests, the data being sent is not changed by the writers
+ * because sxfs_stream_check() refuses to write below stream_end */
+static void* sxfs_stream_thread (void *ptr) {
+    int err = 0;
+    unsigned int nblocks, blocksize;
+    size_t need;
+    ssize_t rd;
+    off_t pos;
+    char *buff = NULL;
+    uint8_t *hashes = NULL, *tmp;
+    sxc_client_t *sx;
+    sxc_cluster_t *cluster;
+    stream_thread_data_t *sdata = (stream_thread_data_t*)ptr;
+    sxfs_state_t *sxfs = sdata->sxfs;
+    sxfs_file_t *sxfs_file = sdata->sxfs_file;
+
+    free(sdata);
+    pthread_mutex_lock(&sxfs_file->mutex);
+    blocksize = sxi_sxfs_stream_blocksize(sxfs_file->stream);
+    pthread_mutex_unlock(&sxfs_file->mutex);
+    if((err = sxfs_get_sx_data(sxfs, &sx, &cluster))) {
+        SXFS_ERROR("Cannot get SX data");
+        goto sxfs_stream_thread_err;
+    }
+    buff = (char*)malloc((size_t)blocksize * SXFS_WRITE_BEHIND_BLOCKS);
+    hashes = (uint8_t*)malloc(SXFS_WRITE_BEHIND_BLOCKS * SXI_SHA1_BIN_LEN);
+    if(!buff || !hashes) {
+        SXFS_ERROR("Out of memory");
+        err = -ENOMEM;
+        goto sxfs_stream_thread_err;
+    }
+    pthread_mutex_lock(&sxfs_file->mutex);
+    while(!sxfs_file->stream_stop) {
+        if(sxfs_file->stream_pos + blocksize > sxfs_file->stream_end) {
+            pthread_cond_wait(&sxfs_file->stream_cond, &sxfs_file->mutex);
+            continue;
+        }
+        pos = sxfs_file->stream_pos;
+        nblocks = MIN((sxfs_file->stream_end - pos) / blocksize, SXFS_WRITE_BEHIND_BLOCKS);
+        need = (size_t)(pos / blocksize + nblocks) * SXI_SHA1_BIN_LEN;
+        if(need > sxfs_file->stream_hashes_size) {
+            tmp = (uint8_t*)realloc(sxfs_file->stream_hashes, MAX(need, 2 * sxfs_file->stream_hashes_size));
+            if(!tmp) {
+                SXFS_ERROR("Out of memory");
+                err = -ENOMEM;
+                break;
+            }
+            sxfs_file->stream_hashes = tmp;
+            sxfs_file->stream_hashes_size = MAX(need, 2 * sxfs_file->stream_hashes_size);
+        }
+        pthread_mutex_unlock(&sxfs_file->mutex);
+        rd = sxi_pread_hard(sxfs_file->write_fd, buff, (size_t)nblocks * blocksize, pos);
+        if(rd != (ssize_t)nblocks * blocksize) {
+            err = rd < 0 ? -errno : -EIO;
+            SXFS_ERROR("Cannot read from '%s' file: %s", sxfs_file->write_path, rd < 0 ? strerror(errno) : "Unexpected end of file");
+        } else if(sxi_sxfs_stream_append(sxfs_file->stream, cluster, buff, nblocks, hashes)) {
+            SXFS_ERROR("Cannot upload '%s' file: %s", sxfs_file->remote_path, sxc_geterrmsg(sx));
+            err = -sxfs_sx_err(sx);
+        }
+        pthread_mutex_lock(&sxfs_file->mutex);
+        if(err)
+            break;
+        memcpy(sxfs_file->stream_hashes + (size_t)(pos / blocksize) * SXI_SHA1_BIN_LEN, hashes, (size_t)nblocks * SXI_SHA1_BIN_LEN);
+        /* moved before punching the holes, sxfs_read() reads this data from the cluster from now on */
+        sxfs_file->stream_pos += (off_t)nblocks * blocksize;
+#if defined(__linux__) && defined(SYS_fallocate)
+        if(syscall(SYS_fallocate, sxfs_file->write_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, (off_t)nblocks * blocksize))
+            SXFS_DEBUG("Cannot release uploaded data of '%s' file: %s", sxfs_file->write_path, strerror(errno));
+#endif
+        SXFS_VERBOSE("'%s': %lld bytes uploaded", sxfs_file->remote_path, (long long int)sxfs_file->stream_pos);
+        pthread_cond_broadcast(&sxfs_file->stream_cond);
+    }
+    pthread_mutex_unlock(&sxfs_file->mutex);
+
+sxfs_stream_thread_err:
+    free(buff);
+    free(hashes);
+    pthread_mutex_lock(&sxfs_file->mutex);
+    sxfs_file->stream_err = err;
+    sxfs_file->stream_running = 0;
+    pthread_cond_broadcast(&sxfs_file->stream_cond);
+    pthread_mutex_unlock(&sxfs_file->mutex);
+    pthread_mutex_lock(&sxfs->limits_mutex);
+    sxfs->threads_num--;
+    sxfs_file->threads_num--;
+    pthread_mutex_unlock(&sxfs->limits_mutex);
+    pthread_exit(NULL);
+} /* sxfs_stream_thread */
+
+/* file mutex must be held */
+static int sxfs_stream_start (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, sxc_client_t *sx, sxc_cluster_t *cluster) {
+    int err;
+    pthread_t thread;
+    stream_thread_data_t *sdata;
+    sxc_file_t *file_remote = sxc_file_remote(cluster, sxfs->uri->volume, sxfs_file->remote_path+1, NULL);
+
+    if(!file_remote) {
+        SXFS_ERROR("Cannot create file object: %s", sxc_geterrmsg(sx));
+        return -sxfs_sx_err(sx);
+    }
+    sxfs_file->stream = sxi_sxfs_stream_begin(file_remote);
+    sxc_file_free(file_remote);
+    if(!sxfs_file->stream) {
+        SXFS_ERROR("Cannot start uploading '%s' file: %s", sxfs_file->remote_path, sxc_geterrmsg(sx));
+        return -sxfs_sx_err(sx);
+    }
+    if((err = pthread_cond_init(&sxfs_file->stream_cond, NULL))) {
+        SXFS_ERROR("Cannot initialize condition variable: %s", strerror(err));
+        sxi_sxfs_stream_free(sxfs_file->stream);
+        sxfs_file->stream = NULL;
+        return -err;
+    }
+    sdata = (stream_thread_data_t*)malloc(sizeof(stream_thread_data_t));
+    if(!sdata) {
+        SXFS_ERROR("Out of memory");
+        sxfs_stream_abort(sxfs_file);
+        return -ENOMEM;
+    }
+    sdata->sxfs = sxfs;
+    sdata->sxfs_file = sxfs_file;
+    sxfs_file->stream_running = 1;
+    pthread_mutex_lock(&sxfs->limits_mutex);
+    sxfs_file->threads_num++;
+    pthread_mutex_unlock(&sxfs->limits_mutex);
+    if((err = sxfs_thread_create(sxfs, &thread, sxfs_stream_thread, (void*)sdata))) {
+        pthread_mutex_lock(&sxfs->limits_mutex);
+        sxfs_file->threads_num--;
+        pthread_mutex_unlock(&sxfs->limits_mutex);
+        SXFS_ERROR("Cannot start new thread");
+        free(sdata);
+        sxfs_file->stream_running = 0;
+        sxfs_stream_abort(sxfs_file);
+        return err;
+    }
+    if((err = pthread_detach(thread)))
+        SXFS_ERROR("Cannot detach the thread: %s", strerror(err));
+    SXFS_DEBUG("'%s': Uploading the file while it is written", sxfs_file->remote_path);
+    return 0;
+} /* sxfs_stream_start */
+
+/* file mutex must be held, it is released while waiting */
+static void sxfs_stream_stop (sxfs_file_t *sxfs_file) {
+    if(!sxfs_file->stream)
+        return;
+    sxfs_file->stream_stop = 1;
+    pthread_cond_broadcast(&sxfs_file->stream_cond);
+    while(sxfs_file->stream_running)
+        pthread_cond_wait(&sxfs_file->stream_cond, &sxfs_file->mutex);
+} /* sxfs_stream_stop */
+
+int sxfs_stream_check (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, off_t offset) {
+    int ret;
+    struct stat st;
+
+    if(!sxfs->write_behind || sxfs_file->nostream || sxfs_file->write_fd < 0)
+        return 0;
+    if(sxfs_file->stream) {
+        if(offset < sxfs_file->stream_end) {
+            SXFS_ERROR("'%s': Data below %lld has already been uploaded", sxfs_file->remote_path, (long long int)sxfs_file->stream_end);
+            return -ESPIPE;
+        }
+        return 0;
+    }
+    if(fstat(sxfs_file->write_fd, &st)) {
+        ret = -errno;
+        SXFS_ERROR("Cannot stat '%s' file: %s", sxfs_file->write_path, strerror(errno));
+        return ret;
+    }
+    if(offset != st.st_size) {
+        SXFS_DEBUG("'%s': Not written sequentially, the file will be uploaded when closed", sxfs_file->remote_path);
+        sxfs_file->nostream = 1;
+    }
+    return 0;
+} /* sxfs_stream_check */
+
+int sxfs_stream_write (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
+    int ret;
+    unsigned int blocksize;
+    off_t end;
+    struct stat st;
+    sxc_client_t *sx;
+    sxc_cluster_t *cluster;
+
+    if(!sxfs->write_behind || sxfs_file->nostream || sxfs_file->write_fd < 0)
+        return 0;
+    if(sxfs_file->stream && sxfs_file->stream_err) {
+        ret = sxfs_file->stream_err;
+        if(sxfs_file->stream_pos)
+            return ret;
+        /* write_fd is still complete */
+        SXFS_ERROR("'%s': The file will be uploaded when closed", sxfs_file->remote_path);
+        sxfs_stream_abort(sxfs_file);
+        sxfs_file->nostream = 1;
+        return 0;
+    }
+    if(fstat(sxfs_file->write_fd, &st)) {
+        ret = -errno;
+        SXFS_ERROR("Cannot stat '%s' file: %s", sxfs_file->write_path, strerror(errno));
+        return ret;
+    }
+    if(st.st_size - sxfs_file->stream_end < sxfs->write_behind)
+        return 0;
+    if(!sxfs_file->stream) {
+        if((ret = sxfs_get_sx_data(sxfs, &sx, &cluster))) {
+            SXFS_ERROR("Cannot get SX data");
+            return ret;
+        }
+        if(sxfs_stream_start(sxfs, sxfs_file, sx, cluster)) {
+            sxfs_file->nostream = 1;
+            return 0;
+        }
+    }
+    /* the file is created with the growable size of the volume, it cannot be made smaller later */
+    if(st.st_size < sxi_sxfs_stream_minsize(sxfs_file->stream))
+        return 0;
+    blocksize = sxi_sxfs_stream_blocksize(sxfs_file->stream);
+    end = (st.st_size - sxfs->write_behind / 2) / blocksize * blocksize;
+    if(end > sxfs_file->stream_end) {
+        sxfs_file->stream_end = end;
+        pthread_cond_broadcast(&sxfs_file->stream_cond);
+    }
+    /* the writer waits when the upload falls behind, write_fd keeps at most twice the window */
+    while(sxfs_file->stream_running && !sxfs_file->stream_err && st.st_size - sxfs_file->stream_pos > 2 * sxfs->write_behind)
+        pthread_cond_wait(&sxfs_file->stream_cond, &sxfs_file->mutex);
+    return 0;
+} /* sxfs_stream_write */
+
+ssize_t sxfs_stream_read (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, void *buff, size_t length, off_t offset) {
+    ssize_t ret;
+    unsigned int blocksize, skip;
+    char *block = NULL;
+    sxc_client_t *sx;
+    sxc_cluster_t *cluster;
+
+    pthread_mutex_lock(&sxfs_file->mutex);
+    if(!sxfs_file->stream || offset >= sxfs_file->stream_pos) {
+        pthread_mutex_unlock(&sxfs_file->mutex);
+        return 0;
+    }
+    if((ret = sxfs_get_sx_data(sxfs, &sx, &cluster))) {
+        SXFS_ERROR("Cannot get SX data");
+        goto sxfs_stream_read_err;
+    }
+    blocksize = sxi_sxfs_stream_blocksize(sxfs_file->stream);
+    block = (char*)malloc(blocksize);
+    if(!block) {
+        SXFS_ERROR("Out of memory");
+        ret = -ENOMEM;
+        goto sxfs_stream_read_err;
+    }
+    /* the mutex keeps the stream alive while the block is downloaded */
+    if(sxi_sxfs_stream_read(sxfs_file->stream, cluster, sxfs_file->stream_hashes + (size_t)(offset / blocksize) * SXI_SHA1_BIN_LEN, block)) {
+        SXFS_ERROR("Cannot download the part of '%s' file: %s", sxfs_file->remote_path, sxc_geterrmsg(sx));
+        ret = -sxfs_sx_err(sx);
+        goto sxfs_stream_read_err;
+    }
+    skip = offset % blocksize;
+    ret = MIN(length, blocksize - skip); /* stream_pos is block aligned */
+    memcpy(buff, block + skip, ret);
+sxfs_stream_read_err:
+    pthread_mutex_unlock(&sxfs_file->mutex);
+    free(block);
+    return ret;
+} /* sxfs_stream_read */
+
+int sxfs_stream_uploaded (sxfs_file_t *sxfs_file, off_t offset) {
+    int ret;
+
+    pthread_mutex_lock(&sxfs_file->mutex);
+    ret = sxfs_file->stream && offset < sxfs_file->stream_pos;
+    pthread_mutex_unlock(&sxfs_file->mutex);
+    return ret;
+} /* sxfs_stream_uploaded */
+
+int sxfs_stream_finish (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file) {
+    int ret;
+    unsigned int tail, blocksize;
+    uint64_t mtime;
+    struct stat st;
+    char *buff = NULL;
+    sxc_client_t *sx;
+    sxc_cluster_t *cluster;
+    sxc_meta_t *meta = NULL;
+    sxc_file_t *file_remote = NULL;
+
+    if((ret = sxfs_get_sx_data(sxfs, &sx, &cluster))) {
+        SXFS_ERROR("Cannot get SX data");
+        return ret;
+    }
+    if(fstat(sxfs_file->write_fd, &st)) {
+        ret = -errno;
+        SXFS_ERROR("Cannot stat '%s' file: %s", sxfs_file->write_path, strerror(errno));
+        return ret;
+    }
+    blocksize = sxi_sxfs_stream_blocksize(sxfs_file->stream);
+    if(st.st_size / blocksize * blocksize > sxfs_file->stream_end) {
+        sxfs_file->stream_end = st.st_size / blocksize * blocksize;
+        pthread_cond_broadcast(&sxfs_file->stream_cond);
+    }
+    while(sxfs_file->stream_running && !sxfs_file->stream_err && sxfs_file->stream_pos < sxfs_file->stream_end)
+        pthread_cond_wait(&sxfs_file->stream_cond, &sxfs_file->mutex);
+    if(sxfs_file->stream_err)
+        return sxfs_file->stream_err;
+    if(sxfs_file->stream_pos < sxfs_file->stream_end) {
+        SXFS_ERROR("'%s': Upload thread is not running", sxfs_file->remote_path);
+        return -EIO;
+    }
+    sxfs_stream_stop(sxfs_file);
+    tail = st.st_size - sxfs_file->stream_pos;
+    if(tail) {
+        buff = (char*)malloc(tail);
+        if(!buff) {
+            SXFS_ERROR("Out of memory");
+            ret = -ENOMEM;
+            goto sxfs_stream_finish_err;
+        }
+        if(sxi_pread_hard(sxfs_file->write_fd, buff, tail, sxfs_file->stream_pos) != (ssize_t)tail) {
+            ret = -EIO;
+            SXFS_ERROR("Cannot read from '%s' file", sxfs_file->write_path);
+            goto sxfs_stream_finish_err;
+        }
+    }
+    meta = sxc_meta_new(sx);
+    if(!meta) {
+        SXFS_ERROR("Out of memory");
+        ret = -ENOMEM;
+        goto sxfs_stream_finish_err;
+    }
+    mtime = sxi_swapu64((uint64_t)sxfs_file->ls_file->st.st_mtime);
+    if(sxc_meta_setval(meta, "sxfsMtime", &mtime, sizeof(mtime))) {
+        SXFS_ERROR("Cannot add filemeta entry: %s", sxc_geterrmsg(sx));
+        ret = -sxfs_sx_err(sx);
+        goto sxfs_stream_finish_err;
+    }
+    if(sxfs->args->use_queues_flag)
+        sxfs_upload_del_path(sxfs_file->remote_path); /* older version of the file */
+    if(sxi_sxfs_stream_finish(sxfs_file->stream, cluster, buff, tail, meta)) {
+        SXFS_ERROR("Cannot upload '%s' file: %s", sxfs_file->remote_path, sxc_geterrmsg(sx));
+        ret = -sxfs_sx_err(sx);
+        goto sxfs_stream_finish_err;
+    }
+    SXFS_DEBUG("'%s': Upload finished (%lld bytes)", sxfs_file->remote_path, (long long int)st.st_size);
+    sxfs_file->ls_file->remote = 1;
+    sxfs_stream_abort(sxfs_file);
+    /* write_fd is incomplete, the file is read from the cluster from now on */
+    if(close(sxfs_file->write_fd))
+        SXFS_ERROR("Cannot close '%s' file: %s", sxfs_file->write_path, strerror(errno));
+    if(unlink(sxfs_file->write_path) && errno != ENOENT)
+        SXFS_ERROR("Cannot remove '%s' file: %s", sxfs_file->write_path, strerror(errno));
+    free(sxfs_file->write_path);
+    sxfs_file->write_path = NULL;
+    sxfs_file->write_fd = -1;
+    sxfs_file->flush = 0;
+    sxfs_file->delta = 0;
+    free(sxfs_file->dirty);
+    sxfs_file->dirty = NULL;
+    sxfs_file->dirty_size = 0;
+    sxi_sxfs_download_finish(sxfs_file->fdata);
+    sxfs_file->fdata = NULL;
+    file_remote = sxc_file_remote(cluster, sxfs->uri->volume, sxfs_file->remote_path+1, NULL);
+    if(!file_remote || !(sxfs_file->fdata = sxi_sxfs_download_init(file_remote)))
+        SXFS_ERROR("Cannot initialize file downloading: %s", sxc_geterrmsg(sx)); /* sxfs_cache_read() downloads the whole file then */
+
+    ret = 0;
+sxfs_stream_finish_err:
+    free(buff);
+    sxc_meta_free(meta);
+    sxc_file_free(file_remote);
+    return ret;
+} /* sxfs_stream_finish */
+
+void sxfs_stream_abort (sxfs_file_t *sxfs_file) {
+    if(!sxfs_file->stream)
+        return;
+    sxfs_stream_stop(sxfs_file);
+    pthread_cond_destroy(&sxfs_file->stream_cond);
+    sxi_sxfs_stream_free(sxfs_file->stream);
+    sxfs_file->stream = NULL;
+    sxfs_file->stream_pos = 0;
+    sxfs_file->stream_end = 0;
+    sxfs_file->stream_stop = 0;
+    sxfs_file->stream_err = 0;
+    free(sxfs_file->stream_hashes);
+    sxfs_file->stream_hashes = NULL;
+    sxfs_file->stream_hashes_size = 0;
+} /* sxfs_stream_abort */
+
 void sxfs_sx_data_destroy (void *ptr) {
     sxfs_sx_data_t *sx_data = (sxfs_sx_data_t*)ptr;
     if(sx_data) {
@@ -966,89 +1454,168 @@ static uint64_t swapu64 (uint64_t v) {
 #define swapu64(x) (x)
 #endif
 
-int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
+struct _sxfs_lsentry_t {
+    char *path; /* directories end with '/' */
+    time_t created_at;
+    struct stat st;
+};
+
+struct _sxfs_lslist_t {
+    int unchanged; /* etag matched, nothing to merge */
+    unsigned int remote_files;
+    size_t nentries, maxentries;
+    struct _sxfs_lsentry_t *entries;
+};
+typedef struct _sxfs_lslist_t sxfs_lslist_t;
+
+static void sxfs_lslist_free (sxfs_lslist_t *list) {
+    size_t i;
+
+    for(i=0; i<list->nentries; i++)
+        free(list->entries[i].path);
+    free(list->entries);
+    memset(list, 0, sizeof(*list));
+} /* sxfs_lslist_free */
+
+/* downloads the listing of the directory containing absolute_path with all the file attributes,
+ * does not touch the ls cache so it can run without ls_lock */
+static int sxfs_ls_fetch (sxfs_state_t *sxfs, const char *absolute_path, const char *etag, int init, sxfs_lslist_t *list) {
     const void *value;
-    int ret, delete_locked = 0, upload_locked = 0, found, tmp, *check_files = NULL, *check_dirs = NULL;
-    unsigned int remote_files, val_len;
+    int ret, tmp;
+    unsigned int val_len;
     uint64_t mtime;
-    ssize_t index;
-    size_t i, j, ncfiles, ncdirs, len, pathlen;
-    time_t tmptime;
-    char *path = NULL, *ptr, *fpath = NULL, *fname;
-    struct stat st;
-    struct timeval tv;
+    size_t len;
+    char *path, *fpath = NULL;
+    struct _sxfs_lsentry_t *entry;
     sxc_client_t *sx;
     sxc_cluster_t *cluster;
     sxc_cluster_lf_t *flist = NULL;
     sxc_file_t *file = NULL;
     sxc_meta_t *fmeta = NULL;
-    sxfs_lsdir_t *dir = NULL, *subdir;
-    sxfs_state_t *sxfs = SXFS_DATA;
-    sxfs_queue_entry_t *entry;
 
     if((ret = sxfs_get_sx_data(sxfs, &sx, &cluster))) {
         SXFS_ERROR("Cannot get SX data");
         return ret;
     }
-    pathlen = strlen(sxfs->tempdir) + 1 + lenof(SXFS_UPLOAD_DIR) + strlen(absolute_path) + 1;
-    path = (char*)malloc(pathlen);
+    path = strdup(absolute_path);
     if(!path) {
         SXFS_ERROR("Out of memory");
         return -ENOMEM;
     }
-
-    /* check whether directory is already loaded */
-    if((ret = sxfs_ls_ftw(sxfs, absolute_path, &dir))) { /* FUSE checks each directory in the path */
-        SXFS_ERROR("File tree walk failed");
-        goto sxfs_ls_update_err;
-    }
-    if(dir->init) {
-        if(gettimeofday(&tv, NULL)) {
-            ret = -errno;
-            SXFS_ERROR("Cannot get current time: %s", strerror(errno));
-            goto sxfs_ls_update_err;
+    *(strrchr(path, '/') + 1) = '\0';
+    flist = sxc_cluster_listfiles_etag(cluster, sxfs->uri->volume, path, 0, &list->remote_files, 0, 1, etag);
+    if(!flist) {
+        if(sxc_geterrnum(sx) != SXE_SKIP) {
+            SXFS_ERROR("%s", sxc_geterrmsg(sx));
+            ret = -sxfs_sx_err(sx);
+            goto sxfs_ls_fetch_err;
         }
-        if(sxi_timediff(&tv, &dir->tv) < SXFS_LS_RELOAD) {
+        if(init) {
+            list->unchanged = 1;
             ret = 0;
-            *given_dir = dir;
-            dir = NULL; /* do not convert remote flag (2 -> 1) */
-            goto sxfs_ls_update_err; /* this is not a failure */
+            goto sxfs_ls_fetch_err; /* this is not a failure */
         }
-    }
-
-    sprintf(path, "%s", absolute_path);
-    ptr = strrchr(path, '/') + 1;
-    *ptr = '\0';
-    pthread_mutex_lock(&sxfs->delete_mutex); /* there can be entry removed from delete_queue between sxc_cluster_listfiles_etag() and sxc_cluster_listfiles_next() */
-    delete_locked = 1;
-    flist = sxc_cluster_listfiles_etag(cluster, sxfs->uri->volume, path, 0, &remote_files, 0, 1, dir->etag);
-    if(!flist) {
-        if(sxc_geterrnum(sx) != SXE_SKIP) {
+        flist = sxc_cluster_listfiles(cluster, sxfs->uri->volume, path, 0, &list->remote_files, 0, 1);
+        if(!flist) {
             SXFS_ERROR("%s", sxc_geterrmsg(sx));
             ret = -sxfs_sx_err(sx);
-            goto sxfs_ls_update_err;
+            goto sxfs_ls_fetch_err;
         }
-        if(!dir->init) {
-            flist = sxc_cluster_listfiles(cluster, sxfs->uri->volume, path, 0, &remote_files, 0, 1);
-            if(!flist) {
-                SXFS_ERROR("%s", sxc_geterrmsg(sx));
+    }
+
+    while(1) {
+        file = NULL;
+        tmp = sxc_cluster_listfiles_next(cluster, sxfs->uri->volume, flist, &file);
+        if(tmp <= 0) {
+            if(tmp) {
+                SXFS_ERROR("Failed to retrieve file name: %s", sxc_geterrmsg(sx));
                 ret = -sxfs_sx_err(sx);
-                goto sxfs_ls_update_err;
+                goto sxfs_ls_fetch_err;
             }
-        } else {
-            if(gettimeofday(&tv, NULL)) {
-                ret = -errno;
-                SXFS_ERROR("Cannot get current time: %s", strerror(errno));
-                goto sxfs_ls_update_err;
+            break;
+        }
+        fpath = strdup(sxc_file_get_path(file));
+        if(!fpath) {
+            SXFS_ERROR("Out of memory duplicating remote file path");
+            ret = -ENOMEM;
+            goto sxfs_ls_fetch_err;
+        }
+        len = strlen(fpath) - 1;
+        sxc_meta_free(fmeta);
+        fmeta = NULL;
+        if(fpath[len] != '/') {
+            fmeta = sxc_filemeta_new(file);
+            if(!fmeta && sxc_geterrnum(sx) != SXE_ECOMM) { /* workaround for race condition (remote file can be deleted between listing and sxc_filemeta_new()) */
+                SXFS_ERROR("Cannot get '%s' filemeta: %s", fpath, sxc_geterrmsg(sx));
+                ret = -sxfs_sx_err(sx);
+                goto sxfs_ls_fetch_err;
             }
-            *given_dir = dir;
-            dir->tv = tv;
-            dir = NULL; /* do not convert remote flag (2 -> 1) */
-            goto sxfs_ls_update_err; /* this is not a failure */
         }
+        if(list->nentries == list->maxentries && sxfs_resize(&list->entries, &list->maxentries, sizeof(struct _sxfs_lsentry_t))) {
+            SXFS_ERROR("OOM growing the listing");
+            ret = -ENOMEM;
+            goto sxfs_ls_fetch_err;
+        }
+        entry = &list->entries[list->nentries];
+        entry->created_at = sxc_file_get_created_at(file);
+        entry->st.st_size = sxc_file_get_size(file);
+        entry->st.st_uid = sxc_file_get_uid(file) == (uid_t)SXC_UINT32_UNDEFINED ? getuid() : sxc_file_get_uid(file);
+        entry->st.st_gid = sxc_file_get_gid(file) == (gid_t)SXC_UINT32_UNDEFINED ? getgid() : sxc_file_get_gid(file);
+        if(!fmeta || sxc_meta_getval(fmeta, "sxfsMtime", &value, &val_len) || val_len != 8) {
+            entry->st.st_mtime = sxc_file_get_mtime(file) == (time_t)SXC_UINT64_UNDEFINED ? entry->created_at : sxc_file_get_mtime(file);
+        } else {
+            mtime = *((const uint64_t*)value); /* savely cast the pointer (size is correct) */
+            entry->st.st_mtime = sxi_swapu64(mtime); /* copy by the value */
+        }
+        if(fpath[len] == '/')
+            entry->st.st_mode = SXFS_DIR_ATTR;
+        else
+            entry->st.st_mode = sxc_file_get_mode(file) == (mode_t)SXC_UINT32_UNDEFINED ? SXFS_FILE_ATTR : sxc_file_get_mode(file);
+        entry->path = fpath;
+        fpath = NULL;
+        list->nentries++;
+        sxc_file_free(file);
+        file = NULL;
     }
 
-    if(remote_files)
+    ret = 0;
+sxfs_ls_fetch_err:
+    free(path);
+    free(fpath);
+    sxc_cluster_listfiles_free(flist);
+    sxc_file_free(file);
+    sxc_meta_free(fmeta);
+    return ret;
+} /* sxfs_ls_fetch */
+
+/* applies the listing to the cache, needs ls_lock for writing and delete_mutex */
+static int sxfs_ls_merge (sxfs_state_t *sxfs, const char *absolute_path, sxfs_lsdir_t *dir, sxfs_lslist_t *list) {
+    int ret, found, tmp, upload_locked = 0, *check_files = NULL, *check_dirs = NULL;
+    ssize_t index;
+    size_t i, j, n, ncfiles, ncdirs, len, pathlen;
+    time_t tmptime;
+    char *path = NULL, *ptr, *fpath, *fname;
+    struct stat st;
+    struct timeval tv;
+    sxfs_lsdir_t *subdir;
+    sxfs_queue_entry_t *entry;
+
+    if(list->unchanged) {
+        if(gettimeofday(&tv, NULL)) {
+            ret = -errno;
+            SXFS_ERROR("Cannot get current time: %s", strerror(errno));
+            return ret;
+        }
+        dir->tv = tv;
+        return 0;
+    }
+    pathlen = strlen(sxfs->tempdir) + 1 + lenof(SXFS_UPLOAD_DIR) + strlen(absolute_path) + 1;
+    path = (char*)malloc(pathlen);
+    if(!path) {
+        SXFS_ERROR("Out of memory");
+        return -ENOMEM;
+    }
+    if(list->remote_files)
         dir->remote = 1;
     else
         dir->remote = 0;
@@ -1060,13 +1627,13 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
     if(!check_files) {
         SXFS_ERROR("Out of memory");
         ret = -ENOMEM;
-        goto sxfs_ls_update_err;
+        goto sxfs_ls_merge_err;
     }
     check_dirs = (int*)calloc(ncdirs, sizeof(int));
     if(!check_dirs) {
         SXFS_ERROR("Out of memory");
         ret = -ENOMEM;
-        goto sxfs_ls_update_err;
+        goto sxfs_ls_merge_err;
     }
     /* save opened but not yet uploaded files */
     for(i=0; i<ncfiles; i++)
@@ -1097,7 +1664,7 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
                         if(sxfs_resize((void**)&path, &pathlen, sizeof(char))) {
                             SXFS_ERROR("OOM growing the path: %s", strerror(errno));
                             ret = -ENOMEM;
-                            goto sxfs_ls_update_err;
+                            goto sxfs_ls_merge_err;
                         }
                     snprintf(path, pathlen, "%s", entry->remote_path + len);
                     ptr = strchr(path, '/');
@@ -1111,7 +1678,7 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
                     } else {
                         SXFS_ERROR("'%s' directory is missing in ls cache", path);
                         ret = -EAGAIN;
-                        goto sxfs_ls_update_err;
+                        goto sxfs_ls_merge_err;
                     }
                     entry = entry->next;
                 } else { /* file */
@@ -1127,7 +1694,7 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
                         } else {
                             SXFS_ERROR("'%s' file is missing in ls cache", ptr);
                             ret = -EAGAIN;
-                            goto sxfs_ls_update_err;
+                            goto sxfs_ls_merge_err;
                         }
                     }
                     entry = sxfs_queue_cleanup_single(entry, 1);
@@ -1141,55 +1708,15 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
     }
 
     /* load the content of the directory */
-    while(1) {
-        file = NULL;
-        tmp = sxc_cluster_listfiles_next(cluster, sxfs->uri->volume, flist, &file);
-        if(tmp <= 0) {
-            if(tmp) {
-                SXFS_ERROR("Failed to retrieve file name: %s", sxc_geterrmsg(sx));
-                ret = -sxfs_sx_err(sx);
-                goto sxfs_ls_update_err;
-            }
-            break;
-        }
-        free(fpath);
-        fpath = strdup(sxc_file_get_path(file));
-        if(!fpath) {
-            SXFS_ERROR("Out of memory duplicating remote file path");
-            sxc_file_free(file);
-            ret = -ENOMEM;
-            goto sxfs_ls_update_err;
-        }
+    for(n=0; n<list->nentries; n++) {
+        fpath = list->entries[n].path;
+        st = list->entries[n].st;
+        tmptime = list->entries[n].created_at;
         len = strlen(fpath) - 1;
-        sxc_meta_free(fmeta);
-        fmeta = NULL;
-        if(fpath[len] != '/') {
-            fmeta = sxc_filemeta_new(file);
-            if(!fmeta && sxc_geterrnum(sx) != SXE_ECOMM) { /* workaround for race condition (remote file can be deleted between listing and sxc_filemeta_new()) */
-                SXFS_ERROR("Cannot get '%s' filemeta: %s", fpath, sxc_geterrmsg(sx));
-                ret = -sxfs_sx_err(sx);
-                goto sxfs_ls_update_err;
-            }
-        }
-        tmptime = sxc_file_get_created_at(file);
-        st.st_size = sxc_file_get_size(file);
-        st.st_uid = sxc_file_get_uid(file) == (uid_t)SXC_UINT32_UNDEFINED ? getuid() : sxc_file_get_uid(file);
-        st.st_gid = sxc_file_get_gid(file) == (gid_t)SXC_UINT32_UNDEFINED ? getgid() : sxc_file_get_gid(file);
-        if(!fmeta || sxc_meta_getval(fmeta, "sxfsMtime", &value, &val_len) || val_len != 8) {
-            st.st_mtime = sxc_file_get_mtime(file) == (time_t)SXC_UINT64_UNDEFINED ? tmptime : sxc_file_get_mtime(file);
-        } else {
-            mtime = *((const uint64_t*)value); /* savely cast the pointer (size is correct) */
-            st.st_mtime = sxi_swapu64(mtime); /* copy by the value */
-        }
-        if(fpath[len] == '/') {
+        if(fpath[len] == '/')
             fpath[len] = '\0';
-            st.st_mode = SXFS_DIR_ATTR;
-        } else {
+        else
             len = 0;
-            st.st_mode = sxc_file_get_mode(file) == (mode_t)SXC_UINT32_UNDEFINED ? SXFS_FILE_ATTR : sxc_file_get_mode(file);
-        }
-        sxc_file_free(file);
-        file = NULL;
         fname = strrchr(fpath, '/');
         if(!fname)
             fname = fpath + 1;
@@ -1225,7 +1752,7 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
                     } else {
                         if((ret = sxfs_lsdir_add_dir(dir, fpath))) {
                             SXFS_ERROR("Cannot add new directory to cache: %s", fpath);
-                            goto sxfs_ls_update_err;
+                            goto sxfs_ls_merge_err;
                         }
                         dir->dirs[dir->ndirs-1]->remote = 2;
                     }
@@ -1248,46 +1775,34 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
                     } else {
                         if((ret = sxfs_lsdir_add_file(dir, fpath, &st))) {
                             SXFS_ERROR("Cannot add new file to cache: %s", fpath);
-                            goto sxfs_ls_update_err;
+                            goto sxfs_ls_merge_err;
                         }
                         dir->files[dir->nfiles-1]->remote = 2;
                     }
                 }
             }
         }
-        free(fpath);
-        fpath = NULL;
     }
-    pthread_mutex_unlock(&sxfs->delete_mutex);
-    delete_locked = 0;
 
     /* remove files */
-    for(i=0; i<ncfiles; i++)
-        if(!check_files[i]) {
+    for(i=0, j=0; i<dir->nfiles; i++) {
+        if(i < ncfiles && !check_files[i])
             sxfs_lsfile_free(dir->files[i]);
-            dir->files[i] = NULL;
-        }
-    for(i=0; i<ncdirs; i++)
-        if(!check_dirs[i]) {
+        else
+            dir->files[j++] = dir->files[i];
+    }
+    for(i=j; i<dir->nfiles; i++)
+        dir->files[i] = NULL;
+    dir->nfiles = j;
+    for(i=0, j=0; i<dir->ndirs; i++) {
+        if(i < ncdirs && !check_dirs[i])
             sxfs_lsdir_free(dir->dirs[i]);
-            dir->dirs[i] = NULL;
-        }
-    for(i=0; i<dir->nfiles; i++)
-        if(!dir->files[i]) {
-            for(j=i+1; j<dir->nfiles; j++)
-                dir->files[j-1] = dir->files[j];
-            dir->files[dir->nfiles-1] = NULL;
-            dir->nfiles--;
-            i--;
-        }
-    for(i=0; i<dir->ndirs; i++)
-        if(!dir->dirs[i]) {
-            for(j=i+1; j<dir->ndirs; j++)
-                dir->dirs[j-1] = dir->dirs[j];
-            dir->dirs[dir->ndirs-1] = NULL;
-            dir->ndirs--;
-            i--;
-        }
+        else
+            dir->dirs[j++] = dir->dirs[i];
+    }
+    for(i=j; i<dir->ndirs; i++)
+        dir->dirs[i] = NULL;
+    dir->ndirs = j;
     if(dir->nfiles)
         qsort(dir->files, dir->nfiles, sizeof(sxfs_lsfile_t*), sxfs_lsfile_compare);
     if(dir->ndirs)
@@ -1367,39 +1882,162 @@ int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
         pthread_mutex_unlock(&sxfs->upload_mutex);
     }
 
-    *given_dir = dir;
     ret = 0;
-sxfs_ls_update_err:
-    if(delete_locked)
-        pthread_mutex_unlock(&sxfs->delete_mutex);
+sxfs_ls_merge_err:
     if(upload_locked)
         pthread_mutex_unlock(&sxfs->upload_mutex);
     free(path);
-    free(fpath);
     free(check_files);
     free(check_dirs);
-    sxc_cluster_listfiles_free(flist);
-    sxc_file_free(file);
-    sxc_meta_free(fmeta);
-    if(dir) {
-        for(i=0; i<dir->nfiles; i++) {
-            if(dir->files[i]->remote == 2) {
-                dir->files[i]->remote = 1;
-            } else if(ret) {
-                dir->files[i]->remote = 0;
-            }
+    for(i=0; i<dir->nfiles; i++) {
+        if(dir->files[i]->remote == 2) {
+            dir->files[i]->remote = 1;
+        } else if(ret) {
+            dir->files[i]->remote = 0;
         }
-        for(i=0; i<dir->ndirs; i++) {
-            if(dir->dirs[i]->remote == 2) {
-                dir->dirs[i]->remote = 1;
-            } else if(ret) {
-                dir->dirs[i]->remote = 0;
-            }
+    }
+    for(i=0; i<dir->ndirs; i++) {
+        if(dir->dirs[i]->remote == 2) {
+            dir->dirs[i]->remote = 1;
+        } else if(ret) {
+            dir->dirs[i]->remote = 0;
         }
     }
     return ret;
+} /* sxfs_ls_merge */
+
+/* needs ls_lock for writing */
+int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **given_dir) {
+    int ret;
+    struct timeval tv;
+    sxfs_lsdir_t *dir = NULL;
+    sxfs_lslist_t list;
+    sxfs_state_t *sxfs = SXFS_DATA;
+
+    memset(&list, 0, sizeof(list));
+    /* check whether directory is already loaded */
+    if((ret = sxfs_ls_ftw(sxfs, absolute_path, &dir))) { /* FUSE checks each directory in the path */
+        SXFS_ERROR("File tree walk failed");
+        return ret;
+    }
+    if(dir->init) {
+        if(gettimeofday(&tv, NULL)) {
+            ret = -errno;
+            SXFS_ERROR("Cannot get current time: %s", strerror(errno));
+            return ret;
+        }
+        if(sxi_timediff(&tv, &dir->tv) < SXFS_LS_RELOAD) {
+            *given_dir = dir;
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&sxfs->delete_mutex); /* there can be entry removed from delete_queue between sxc_cluster_listfiles_etag() and sxc_cluster_listfiles_next() */
+    if(!(ret = sxfs_ls_fetch(sxfs, absolute_path, dir->etag, dir->init, &list)))
+        ret = sxfs_ls_merge(sxfs, absolute_path, dir, &list);
+    pthread_mutex_unlock(&sxfs->delete_mutex);
+    sxfs_lslist_free(&list);
+    if(!ret)
+        *given_dir = dir;
+    return ret;
 } /* sxfs_ls_update */
 
+/* Like sxfs_ls_update() but for the callers which only read the cache.
+ * Returns with ls_lock held for reading. The remote listing is downloaded
+ * without the lock, meanwhile other readers keep using the cached entries. */
+int sxfs_ls_read (const char *absolute_path, sxfs_lsdir_t **given_dir) {
+    int ret, tmp, refreshed = 0, init;
+    unsigned int dgen, ugen;
+    char *etag;
+    struct timeval tv;
+    sxfs_lsdir_t *dir;
+    sxfs_lslist_t list;
+    sxfs_state_t *sxfs = SXFS_DATA;
+
+    while(1) {
+        pthread_rwlock_rdlock(&sxfs->ls_lock);
+        if((ret = sxfs_ls_ftw(sxfs, absolute_path, &dir))) {
+            SXFS_ERROR("File tree walk failed");
+            pthread_rwlock_unlock(&sxfs->ls_lock);
+            return ret;
+        }
+        if(dir->init) {
+            if(refreshed || dir->refreshing) { /* stale entries are better than waiting */
+                *given_dir = dir;
+                return 0;
+            }
+            if(gettimeofday(&tv, NULL)) {
+                ret = -errno;
+                SXFS_ERROR("Cannot get current time: %s", strerror(errno));
+                pthread_rwlock_unlock(&sxfs->ls_lock);
+                return ret;
+            }
+            if(sxi_timediff(&tv, &dir->tv) < SXFS_LS_RELOAD) {
+                *given_dir = dir;
+                return 0;
+            }
+        }
+        pthread_rwlock_unlock(&sxfs->ls_lock);
+
+        pthread_rwlock_wrlock(&sxfs->ls_lock);
+        if((ret = sxfs_ls_ftw(sxfs, absolute_path, &dir))) {
+            SXFS_ERROR("File tree walk failed");
+            pthread_rwlock_unlock(&sxfs->ls_lock);
+            return ret;
+        }
+        if(dir->refreshing) { /* another thread is loading the directory for the first time */
+            pthread_rwlock_unlock(&sxfs->ls_lock);
+            usleep(SXFS_THREAD_WAIT);
+            continue;
+        }
+        dir->refreshing = 1;
+        init = dir->init;
+        etag = dir->etag ? strdup(dir->etag) : NULL;
+        pthread_rwlock_unlock(&sxfs->ls_lock);
+        if(init && !etag) /* out of memory, the full listing is fetched */
+            init = 0;
+
+        pthread_mutex_lock(&sxfs->delete_mutex);
+        dgen = delete_gen;
+        pthread_mutex_unlock(&sxfs->delete_mutex);
+        pthread_mutex_lock(&sxfs->upload_mutex);
+        ugen = upload_gen;
+        pthread_mutex_unlock(&sxfs->upload_mutex);
+        memset(&list, 0, sizeof(list));
+        ret = sxfs_ls_fetch(sxfs, absolute_path, etag, init, &list);
+        free(etag);
+
+        pthread_rwlock_wrlock(&sxfs->ls_lock);
+        if(sxfs_ls_ftw(sxfs, absolute_path, &dir)) { /* removed in the meantime */
+            sxfs_lslist_free(&list);
+            pthread_rwlock_unlock(&sxfs->ls_lock);
+            refreshed = 1;
+            continue;
+        }
+        dir->refreshing = 0;
+        if(!ret) {
+            pthread_mutex_lock(&sxfs->delete_mutex);
+            pthread_mutex_lock(&sxfs->upload_mutex);
+            tmp = dgen != delete_gen || ugen != upload_gen;
+            pthread_mutex_unlock(&sxfs->upload_mutex);
+            if(tmp) {
+                /* the etag stored by the discarded listing is already current, do not use it */
+                SXFS_DEBUG("Queues changed while listing, reloading: %s", absolute_path);
+                sxfs_lslist_free(&list);
+                ret = sxfs_ls_fetch(sxfs, absolute_path, NULL, 0, &list);
+            }
+            if(!ret)
+                ret = sxfs_ls_merge(sxfs, absolute_path, dir, &list);
+            pthread_mutex_unlock(&sxfs->delete_mutex);
+        }
+        sxfs_lslist_free(&list);
+        pthread_rwlock_unlock(&sxfs->ls_lock);
+        if(ret)
+            return ret;
+        refreshed = 1;
+    }
+} /* sxfs_ls_read */
+
 /* return values:
  * negative - error
  * 0 - not found
@@ -1414,19 +2052,17 @@ int sxfs_ls_stat (const char *path, struct stat *st) {
 
     if(!strcmp(path, "/")) {
         if(st) {
-            pthread_mutex_lock(&sxfs->ls_mutex);
+            pthread_rwlock_rdlock(&sxfs->ls_lock);
             memcpy(st, &sxfs->root->st, sizeof(struct stat));
-            pthread_mutex_unlock(&sxfs->ls_mutex);
+            pthread_rwlock_unlock(&sxfs->ls_lock);
         }
         return 2;
     }
-    pthread_mutex_lock(&sxfs->ls_mutex);
-    if((ret = sxfs_ls_update(path, &dir))) {
+    if((ret = sxfs_ls_read(path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", path);
-        pthread_mutex_unlock(&sxfs->ls_mutex);
         return ret;
     }
-    file_name = strrchr(path, '/') + 1; /* already checked in sxfs_ls_update() */
+    file_name = strrchr(path, '/') + 1; /* already checked in sxfs_ls_read() */
     index = sxfs_find_entry(dir->dirs, dir->ndirs, file_name, sxfs_lsdir_cmp);
     if(index >= 0) {
         if(st)
@@ -1441,11 +2077,11 @@ int sxfs_ls_stat (const char *path, struct stat *st) {
         } else
             ret = -ENOENT;
     }
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     return ret;
 } /* sxfs_ls_stat */
 
-int sxfs_upload_force (const char *local_file_path, const char *remote_file_path, sxfs_lsfile_t *lsfile) {
+int sxfs_upload_force (const char *local_file_path, const char *remote_file_path, sxfs_lsfile_t *lsfile, sxi_sxfs_delta_t *delta) {
     int ret;
     struct stat st;
     sxc_client_t *sx;
@@ -1490,6 +2126,11 @@ int sxfs_upload_force (const char *local_file_path, const char *remote_file_path
             goto sxfs_upload_force_err;
         }
     }
+    if(delta && sxi_file_set_delta(file_local, delta)) {
+        SXFS_ERROR("Cannot set the block hashes of '%s'", local_file_path);
+        ret = -EINVAL;
+        goto sxfs_upload_force_err;
+    }
     SXFS_DEBUG("Uploading '%s'", remote_file_path);
     if(sxc_copy_single(file_local, file_remote, 0, 0, 0, NULL, 0)) {
         SXFS_ERROR("Cannot upload '%s' file: %s", local_file_path, sxc_geterrmsg(sx));
@@ -1743,6 +2384,7 @@ int sxfs_delete (const char *path, int is_remote, int upload_checked) {
                 while(entry) {
                     if(!strncmp(path, entry->remote_path, len) && entry != new_entry) {
                         entry->state |= SXFS_QUEUE_DONE;
+                        delete_gen++;
                         SXFS_DEBUG("File marked as done in deletion queue: %s", entry->remote_path);
                         entry = sxfs_queue_cleanup_single(entry, 1);
                     } else {
@@ -1882,6 +2524,8 @@ static void* sxfs_delete_worker (void *ctx) {
                         entry->state |= SXFS_QUEUE_DONE;
                     sxfs_queue_cleanup_single(entry, 1);
                 }
+                if(!err)
+                    delete_gen++;
                 nfiles = 0;
                 entry = &delete_queue;
                 sxc_file_list_free(flist);
@@ -2140,6 +2784,7 @@ int sxfs_delete_check_path (const char *path) {
                     pthread_mutex_lock(&sxfs->delete_mutex);
                     entry->state &= ~SXFS_QUEUE_IN_PROGRESS;
                     entry->state |= SXFS_QUEUE_DONE;
+                    delete_gen++;
                     SXFS_DEBUG("File marked as done in deletion queue: %s", entry->remote_path);
                     sxfs_queue_cleanup_single(entry, 1);
                 }
@@ -2160,6 +2805,7 @@ sxfs_delete_check_path_err:
             entry = array[i];
             if(!ret) {
                 entry->state |= SXFS_QUEUE_DONE;
+                delete_gen++;
                 SXFS_DEBUG("File marked as done in deletion queue: %s", entry->remote_path);
             }
             entry->state &= ~SXFS_QUEUE_IN_PROGRESS;
@@ -2257,6 +2903,8 @@ int sxfs_upload_get_file (const char *path, sxfs_file_t *sxfs_file) {
             sxfs_file->write_fd = fd;
             sxfs_file->write_path = entry->local_path;
             entry->local_path = NULL;
+            sxfs_delta_free(entry->delta);
+            entry->delta = NULL;
             sxfs_file->flush = 1;
             entry->state |= SXFS_QUEUE_DONE;
             sxfs_queue_cleanup_single(entry, 0);
@@ -2339,6 +2987,8 @@ int sxfs_upload_truncate (const char *path, off_t length) {
                     pthread_mutex_unlock(&sxfs->upload_mutex);
                     return ret;
                 }
+                sxfs_delta_free(entry->delta);
+                entry->delta = NULL;
                 pthread_mutex_unlock(&sxfs->upload_mutex);
                 return 0;
             } else {
@@ -2355,7 +3005,7 @@ int sxfs_upload_truncate (const char *path, off_t length) {
 
 /* src - local path
  * dest - remote path */
-int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int force) {
+int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int force, sxi_sxfs_delta_t *delta) {
     int ret;
     sxfs_state_t *sxfs = SXFS_DATA;
     sxfs_queue_entry_t *entry, *new_entry = NULL;
@@ -2454,6 +3104,9 @@ int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int f
             free(new_entry->local_path);
             new_entry->local_path = path;
         }
+        sxfs_delta_free(new_entry->delta);
+        new_entry->delta = delta;
+        delta = NULL;
 
         if(lsfile && sxfs->attribs) {
             char *ptr = strrchr(new_entry->remote_path, '/');
@@ -2481,7 +3134,7 @@ int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int f
         SXFS_DEBUG("File added: %s", dest);
 
     } else {
-        if((ret = sxfs_upload_force(src ? src : sxfs->empty_file_path, dest, lsfile))) {
+        if((ret = sxfs_upload_force(src ? src : sxfs->empty_file_path, dest, lsfile, delta))) {
             SXFS_ERROR("Cannot upload %s file", dest);
             goto sxfs_upload_err;
         }
@@ -2495,6 +3148,7 @@ int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int f
     ret = 0;
 sxfs_upload_err:
     sxfs_queue_free(new_entry, 0);
+    sxfs_delta_free(delta);
     if(sxfs->args->use_queues_flag)
         pthread_mutex_unlock(&sxfs->upload_mutex);
     return ret;
@@ -2561,6 +3215,11 @@ static void* sxfs_upload_worker (void *ctx) {
                 err = 1;
                 goto sxfs_upload_worker_err;
             }
+            if(entry->delta && sxi_file_set_delta(src, entry->delta)) {
+                SXFS_ERROR("Cannot set the block hashes of '%s'", entry->local_path);
+                err = 1;
+                goto sxfs_upload_worker_err;
+            }
             err = sxc_copy_single(src, dest, 0, 0, 0, NULL, 0);
             pthread_mutex_lock(&sxfs->upload_mutex);
             if(err)
@@ -2568,8 +3227,10 @@ static void* sxfs_upload_worker (void *ctx) {
             else
                 SXFS_DEBUG("'%s' file uploaded", remote_path);
             entry->state &= ~SXFS_QUEUE_IN_PROGRESS;
-            if(!err)
+            if(!err) {
                 entry->state |= (SXFS_QUEUE_DONE | SXFS_QUEUE_REMOTE);
+                upload_gen++;
+            }
             entry = sxfs_queue_cleanup_single(entry, 0);
         } else {
             entry = entry->next;
@@ -2601,7 +3262,7 @@ static void sxfs_upload_clean (sxfs_state_t *sxfs) {
     sxfs_lsdir_t *dir;
     sxfs_queue_entry_t *entry;
 
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     pthread_mutex_lock(&sxfs->upload_mutex);
     entry = upload_queue.next;
     while(entry) {
@@ -2651,7 +3312,7 @@ static void sxfs_upload_clean (sxfs_state_t *sxfs) {
 
 sxfs_upload_clean_err:
     pthread_mutex_unlock(&sxfs->upload_mutex);
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
 } /* sxfs_upload_clean */
 
 static void* sxfs_upload_thread (void *ptr) {
@@ -50,6 +50,15 @@ int sxfs_clear_path (const char *path);
 
 int sxfs_get_file (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file);
 void sxfs_file_free (sxfs_state_t* sxfs, sxfs_file_t *sxfs_file);
+void sxfs_file_mark_dirty (sxfs_file_t *sxfs_file, off_t offset, off_t size);
+sxi_sxfs_delta_t* sxfs_file_delta (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file); /* NULL if the whole file must be hashed */
+void sxfs_delta_free (sxi_sxfs_delta_t *delta);
+int sxfs_stream_check (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, off_t offset); /* before writing at offset */
+int sxfs_stream_write (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file); /* after writing */
+int sxfs_stream_finish (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file); /* uploads the rest of the file and drops write_fd */
+ssize_t sxfs_stream_read (sxfs_state_t *sxfs, sxfs_file_t *sxfs_file, void *buff, size_t length, off_t offset); /* data below stream_pos from the cluster, 0 above it */
+int sxfs_stream_uploaded (sxfs_file_t *sxfs_file, off_t offset); /* offset is no longer in write_fd */
+void sxfs_stream_abort (sxfs_file_t *sxfs_file); /* file mutex must be held */
 
 void sxfs_sx_data_destroy (void *ptr);
 int sxfs_get_sx_data (sxfs_state_t *sxfs, sxc_client_t **sx, sxc_cluster_t **cluster);
@@ -67,8 +76,9 @@ int sxfs_lsdir_cmp (const void *dirs, size_t index, const char *dir_name);
 ssize_t sxfs_find_entry (const void *table, size_t size, const char *name, int (*compare)(const void*, size_t, const char*));
 
 int sxfs_ls_update (const char *absolute_path, sxfs_lsdir_t **dir);
+int sxfs_ls_read (const char *absolute_path, sxfs_lsdir_t **dir); /* returns with ls_lock held for reading */
 int sxfs_ls_stat (const char *path, struct stat *st); /* returned values: <0 - error /  0 - not found / 1 - file / 2 - directory */
-int sxfs_upload_force (const char *local_file_path, const char *remote_file_path, sxfs_lsfile_t *lsfile);
+int sxfs_upload_force (const char *local_file_path, const char *remote_file_path, sxfs_lsfile_t *lsfile, sxi_sxfs_delta_t *delta);
 
 int sxfs_delete_check_path (const char *path);
 int sxfs_delete_rename_prepare (const char *path, const char *newpath);
@@ -85,7 +95,7 @@ int sxfs_upload_truncate (const char *path, off_t length);
 int sxfs_upload_rename_prepare (const char *path, const char *newpath);
 void sxfs_upload_rename (const char *path, const char *newpath);
 void sxfs_upload_rename_abort (const char *path);
-int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int force);
+int sxfs_upload (const char *src, const char *dest, sxfs_lsfile_t *lsfile, int force, sxi_sxfs_delta_t *delta); /* takes the ownership of delta */
 int sxfs_upload_start (void);
 void sxfs_upload_stop (void);
 
@@ -53,9 +53,14 @@
 #define SXFS_DIR_ATTR (S_IFDIR|S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IWGRP|S_IXGRP|S_IROTH|S_IWOTH|S_IXOTH)
 #define SXFS_DIR_SIZE SX_BS_SMALL
 
+/* blocks prefetched together with a single download */
 #define SXFS_BS_SMALL_AMOUNT 32     /*  4 kB *  32 = 128KB (whole file) */
 #define SXFS_BS_MEDIUM_AMOUNT 128   /* 16 kB * 128 = 2MB */
 #define SXFS_BS_LARGE_AMOUNT 4      /*  1 MB *  4  = 4MB */
+#define SXFS_READAHEAD_MAX (64 * 1024 * 1024) /* read-ahead window limit of a sequentially read file */
+#define SXFS_READAHEAD_INFLIGHT (128 * 1024 * 1024) /* data being prefetched at once for all files */
+#define SXFS_WRITE_BEHIND_MIN (2 * SX_BS_LARGE) /* smallest --write-behind window */
+#define SXFS_WRITE_BEHIND_BLOCKS 16 /* blocks sent with a single write-behind request */
 
 #define SXFS_THREAD_WAIT 200000L /* microseconds to wait for other threads (200000 -> 0.2s) */
 #define SXFS_THREAD_SLEEP 5000000L /* microseconds deletion and upload threads wait for next turn */
@@ -80,8 +85,9 @@ struct _sxfs_lsfile_t {
 typedef struct _sxfs_lsfile_t sxfs_lsfile_t;
 
 struct _sxfs_lsdir_t {
-    int init, remote, sxnewdir; /* init - directory loaded correctly
-                         * sxnewdir - directory has '.sxnewdir' file */
+    int init, remote, sxnewdir, refreshing; /* init - directory loaded correctly
+                         * sxnewdir - directory has '.sxnewdir' file
+                         * refreshing - listing is being downloaded by sxfs_ls_read() */
     size_t ndirs, maxdirs, nfiles, maxfiles;
     char *name, *etag;
     struct stat st;
@@ -93,9 +99,21 @@ typedef struct _sxfs_lsdir_t sxfs_lsdir_t;
 
 struct _sxfs_file_t {
     int flush, is_dir, write_fd; /* one structure is used for both files and dirs to count descriptors easily */
+    int delta; /* write_fd holds the fdata revision with only the blocks marked in dirty changed */
     unsigned long int num_open, threads_num;
     char *write_path, *remote_path;
     sxi_sxfs_data_t *fdata;
+    uint8_t *dirty;
+    size_t dirty_size;
+    unsigned int ra_next, ra_end, ra_window; /* read-ahead state guarded by the cache mutex, see cache_read_ahead() */
+    int nostream; /* the file is not written sequentially, see sxfs_stream_write() */
+    off_t stream_pos; /* data below this offset is already uploaded and no longer in write_fd */
+    off_t stream_end; /* data below this offset is handed to the upload thread and cannot be written */
+    int stream_running, stream_stop, stream_err; /* upload thread state, see sxfs_stream_write() */
+    uint8_t *stream_hashes; /* binary hashes of the blocks below stream_pos */
+    size_t stream_hashes_size;
+    sxi_sxfs_stream_t *stream;
+    pthread_cond_t stream_cond; /* signals the upload thread and the writers waiting for it */
     sxfs_lsfile_t *ls_file;
     pthread_mutex_t mutex;
 };
@@ -107,11 +125,13 @@ typedef struct _sxfs_cache_t sxfs_cache_t;
 struct _sxfs_state {
     int pipefd[2], need_file, attribs, recovery_failed, *threads;
     size_t fh_limit, threads_num, threads_max;
+    int64_t write_behind; /* 0 when disabled */
     char *pname, *tempdir, *lostdir, *empty_file_path;
     const char *cluster_uuid;
     pthread_key_t sxkey, tid_key;
     /* mutex priority: ls > delete > upload */
-    pthread_mutex_t sx_data_mutex, ls_mutex, delete_mutex, delete_thread_mutex, upload_mutex, upload_thread_mutex, files_mutex, limits_mutex;
+    pthread_mutex_t sx_data_mutex, delete_mutex, delete_thread_mutex, upload_mutex, upload_thread_mutex, files_mutex, limits_mutex;
+    pthread_rwlock_t ls_lock; /* readers only look up the cache, see sxfs_ls_read() */
     pthread_cond_t delete_cond, upload_cond;
     sem_t download_sem;
     sxc_uri_t *uri;
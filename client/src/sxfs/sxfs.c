@@ -200,7 +200,7 @@ static int sxfs_mkdir (const char *path, mode_t mode) {
         return -ENOMEM;
     }
     sprintf(remote_file_path, "%s/%s", path, SXFS_SXNEWDIR);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", path);
         goto sxfs_mkdir_err;
@@ -224,7 +224,7 @@ static int sxfs_mkdir (const char *path, mode_t mode) {
         dir->dirs[dir->ndirs-1]->st.st_uid = fuse_get_context()->uid;
         dir->dirs[dir->ndirs-1]->st.st_gid = fuse_get_context()->gid;
     }
-    if((ret = sxfs_upload(NULL, remote_file_path, NULL, 0))) {
+    if((ret = sxfs_upload(NULL, remote_file_path, NULL, 0, NULL))) {
         SXFS_ERROR("Cannot upload empty file: %s", remote_file_path);
         sxfs_lsdir_free(dir->dirs[dir->ndirs-1]);
         dir->dirs[dir->ndirs-1] = NULL;
@@ -245,7 +245,7 @@ static int sxfs_mkdir (const char *path, mode_t mode) {
 
     ret = 0;
 sxfs_mkdir_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     free(remote_file_path);
     return ret;
 } /* sxfs_mkdir */
@@ -287,7 +287,7 @@ static int sxfs_unlink (const char *path) {
         return -EINVAL;
     }
     file_name++;
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", path);
         goto sxfs_unlink_err;
@@ -318,7 +318,7 @@ static int sxfs_unlink (const char *path) {
         ptr++;
         *ptr = '\0';
         strcat(newdir_file, SXFS_SXNEWDIR);
-        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0))) {
+        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0, NULL))) {
             SXFS_ERROR("Cannot upload empty file: %s", newdir_file);
             free(newdir_file);
             goto sxfs_unlink_err;
@@ -355,7 +355,7 @@ static int sxfs_unlink (const char *path) {
 
     ret = 0;
 sxfs_unlink_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     return ret;
 } /* sxfs_unlink */
 
@@ -401,7 +401,7 @@ static int sxfs_rmdir (const char *path) {
         return -ENOMEM;
     }
     sprintf(dirpath, "%s/", path);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(dirpath, &dir))) { /* loading content of deleting directory */
         SXFS_ERROR("Cannot load file tree: %s", dirpath);
         goto sxfs_rmdir_err;
@@ -443,7 +443,7 @@ static int sxfs_rmdir (const char *path) {
         ptr++;
         *ptr = '\0';
         strcat(newdir_file, SXFS_SXNEWDIR);
-        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0))) {
+        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0, NULL))) {
             SXFS_ERROR("Cannot upload empty file: %s", newdir_file);
             free(newdir_file);
             goto sxfs_rmdir_err;
@@ -472,7 +472,7 @@ static int sxfs_rmdir (const char *path) {
 
     ret = 0;
 sxfs_rmdir_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     free(dirpath);
     return ret;
 } /* sxfs_rmdir */
@@ -566,7 +566,7 @@ static int sxfs_rename (const char *path, const char *newpath) {
         ret = -ENOMEM;
         goto sxfs_rename_err;
     }
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     locked |= SXFS_LS_MUTEX;
     if((ret = sxfs_ls_update(path, &dir_from))) {
         SXFS_ERROR("Cannot load file tree: %s", path);
@@ -656,7 +656,7 @@ static int sxfs_rename (const char *path, const char *newpath) {
             goto sxfs_rename_err;
         }
         sprintf(newdir_file, "%s/%s", path, SXFS_SXNEWDIR);
-        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0))) {
+        if((ret = sxfs_upload(NULL, newdir_file, NULL, 0, NULL))) {
             SXFS_ERROR("Cannot upload empty file: %s", newdir_file);
             free(newdir_file);
             goto sxfs_rename_err;
@@ -700,6 +700,20 @@ static int sxfs_rename (const char *path, const char *newpath) {
             strcat(dst_path2, "/");
     }
     pthread_mutex_lock(&sxfs->files_mutex);
+    if(!sxi_ht_get(sxfs->files, path, strlen(path), (void**)&sxfs_file)) {
+        int streamed;
+
+        pthread_mutex_lock(&sxfs_file->mutex);
+        streamed = sxfs_file->stream != NULL;
+        pthread_mutex_unlock(&sxfs_file->mutex);
+        if(streamed) { /* the upload already goes to the old name */
+            pthread_mutex_unlock(&sxfs->files_mutex);
+            SXFS_ERROR("'%s' file is being uploaded", path);
+            sxfs_file = NULL;
+            ret = -EBUSY;
+            goto sxfs_rename_err;
+        }
+    }
     locked |= SXFS_FILES_MUTEX;
     if(!sxi_ht_get(sxfs->files, path, strlen(path), (void**)&sxfs_file)) {
         if(sxi_ht_add(sxfs->files, newpath, strlen(newpath), sxfs_file)) {
@@ -860,7 +874,7 @@ sxfs_rename_err:
         pthread_mutex_unlock(&sxfs->files_mutex);
     }
     if(locked & SXFS_LS_MUTEX)
-        pthread_mutex_unlock(&sxfs->ls_mutex);
+        pthread_rwlock_unlock(&sxfs->ls_lock);
     free(new_remote_path);
     free(file_name_to);
     free(src_path);
@@ -927,7 +941,7 @@ static int sxfs_update_filemeta (const char *path, int function, mode_t mode, ui
         return ret;
     }
     if(!strcmp(path, "/")) {
-        pthread_mutex_lock(&sxfs->ls_mutex);
+        pthread_rwlock_wrlock(&sxfs->ls_lock);
         switch(function) {
             case SXFS_CHMOD:
                 if(sxfs->attribs)
@@ -947,7 +961,7 @@ static int sxfs_update_filemeta (const char *path, int function, mode_t mode, ui
             default: break;
         }
         sxfs->root->st.st_ctime = ctime;
-        pthread_mutex_unlock(&sxfs->ls_mutex);
+        pthread_rwlock_unlock(&sxfs->ls_lock);
         return 0;
     }
     if(strlen(path) > 1 && path[strlen(path)-1] == '/') {
@@ -965,7 +979,7 @@ static int sxfs_update_filemeta (const char *path, int function, mode_t mode, ui
         return -EINVAL;
     }
     file_name++;
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(path2 ? path2 : path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", path2 ? path2 : path);
         goto sxfs_update_filemeta_err;
@@ -1125,7 +1139,7 @@ static int sxfs_update_filemeta (const char *path, int function, mode_t mode, ui
 
     ret = 0;
 sxfs_update_filemeta_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     if(files_locked)
         pthread_mutex_unlock(&sxfs->files_mutex);
     free(path2);
@@ -1183,7 +1197,7 @@ static int sxfs_truncate (const char *path, off_t length) {
         return -EINVAL;
     }
     file_name++;
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", path);
         goto sxfs_truncate_err;
@@ -1205,7 +1219,21 @@ static int sxfs_truncate (const char *path, off_t length) {
         locked |= SXFS_FILES_MUTEX;
         if(!sxi_ht_get(sxfs->files, path, strlen(path), (void**)&sxfs_file)) {
             if(sxfs_file->write_fd >= 0) {
+                struct stat st;
+
                 SXFS_DEBUG("'%s': Using file descriptor: %d", path, sxfs_file->write_fd);
+                pthread_mutex_lock(&sxfs_file->mutex);
+                if(sxfs_file->stream_end && (length < sxfs_file->stream_end || length < sxi_sxfs_stream_minsize(sxfs_file->stream))) {
+                    pthread_mutex_unlock(&sxfs_file->mutex);
+                    SXFS_ERROR("'%s': Cannot shrink the file being uploaded to %lld bytes", path, (long long int)length);
+                    ret = -ESPIPE;
+                    goto sxfs_truncate_err;
+                }
+                if(fstat(sxfs_file->write_fd, &st))
+                    sxfs_file->delta = 0;
+                else
+                    sxfs_file_mark_dirty(sxfs_file, MIN(st.st_size, length), MAX(st.st_size, length) - MIN(st.st_size, length));
+                pthread_mutex_unlock(&sxfs_file->mutex);
                 if(ftruncate(sxfs_file->write_fd, length)) {
                     if(errno == ENOSPC)
                         ret = -ENOBUFS;
@@ -1329,6 +1357,12 @@ static int sxfs_truncate (const char *path, off_t length) {
                 }
             }
             if(sxfs_file && sxfs_file->write_fd < 0) {
+                pthread_mutex_lock(&sxfs_file->mutex);
+                if(length && sxfs_file->fdata) { /* the copy was read from fdata */
+                    sxfs_file->delta = 1;
+                    sxfs_file_mark_dirty(sxfs_file, MIN(sxfs_file->fdata->filesize, length), MAX(sxfs_file->fdata->filesize, length) - MIN(sxfs_file->fdata->filesize, length));
+                }
+                pthread_mutex_unlock(&sxfs_file->mutex);
                 sxfs_file->write_fd = fd;
                 sxfs_file->write_path = local_file_path;
                 fd = -1;
@@ -1346,7 +1380,7 @@ static int sxfs_truncate (const char *path, off_t length) {
                     dir->files[index]->st.st_mtime = dir->files[index]->st.st_ctime = mctime;
                 }
 
-                if((ret = sxfs_upload(local_file_path, path, dir->files[index], 0))) {
+                if((ret = sxfs_upload(local_file_path, path, dir->files[index], 0, NULL))) {
                     SXFS_ERROR("Cannot upload file: %s", path);
                     dir->files[index]->st.st_size = size;
                     dir->files[index]->st.st_blocks = (size + 511) / 512;
@@ -1365,7 +1399,7 @@ static int sxfs_truncate (const char *path, off_t length) {
 
     ret = 0;
 sxfs_truncate_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     if(locked & SXFS_FILES_MUTEX)
         pthread_mutex_unlock(&sxfs->files_mutex);
     if(fd >= 0 && close(fd))
@@ -1416,7 +1450,7 @@ static int sxfs_open (const char *path, struct fuse_file_info *file_info) {
         SXFS_ERROR("Cannot get current time: %s", strerror(errno));
         return ret;
     }
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if((ret = sxfs_ls_update(path, &dir))) { /* no creation flag is passed by FUSE */
         SXFS_ERROR("Cannot load file tree: %s", path);
         goto sxfs_open_err;
@@ -1495,6 +1529,15 @@ static int sxfs_open (const char *path, struct fuse_file_info *file_info) {
             SXFS_ERROR("Cannot truncate '%s' file: %s", sxfs_file->write_path, strerror(errno));
             goto sxfs_open_err;
         }
+        if(file_info->flags & O_TRUNC) {
+            pthread_mutex_lock(&sxfs_file->mutex);
+            sxfs_file->delta = 0;
+            if(sxfs_file->write_fd >= 0) { /* uploaded data is gone anyway */
+                sxfs_stream_abort(sxfs_file);
+                sxfs_file->nostream = 0;
+            }
+            pthread_mutex_unlock(&sxfs_file->mutex);
+        }
     }
     pthread_mutex_lock(&sxfs->limits_mutex);
     for(i=0; i<sxfs->fh_limit; i++) {
@@ -1576,7 +1619,7 @@ sxfs_open_err:
     } else if(file_moved) {
         sxfs_upload_del_path(path);
     }
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     if(locked & SXFS_FILES_MUTEX)
         pthread_mutex_unlock(&sxfs->files_mutex);
     if(local_file_path && unlink(local_file_path) && errno != ENOENT)
@@ -1611,14 +1654,24 @@ static int sxfs_read (const char *path, char *buf, size_t size, off_t offset, st
     }
     FH_CHECK(file_info->fh);
     while(size) {
-        retval = sxfs_cache_read(sxfs, sxfs_file, buf+read, size, offset);
-        if(retval < 0) {
-            ret = retval;
-            SXFS_ERROR("Cannot read data from cache");
-            goto sxfs_read_err;
+        if(sxfs->write_behind && (retval = sxfs_stream_read(sxfs, sxfs_file, buf+read, size, offset))) { /* already uploaded */
+            if(retval < 0) {
+                ret = retval;
+                SXFS_ERROR("Cannot read uploaded data");
+                goto sxfs_read_err;
+            }
+        } else {
+            retval = sxfs_cache_read(sxfs, sxfs_file, buf+read, size, offset);
+            if(retval < 0) {
+                ret = retval;
+                SXFS_ERROR("Cannot read data from cache");
+                goto sxfs_read_err;
+            }
+            if(!retval) /* EOF */
+                break;
+            if(sxfs->write_behind && sxfs_stream_uploaded(sxfs_file, offset)) /* released from write_fd while being read */
+                continue;
         }
-        if(!retval) /* EOF */
-            break;
         read += retval;
         size -= retval;
         offset += retval;
@@ -1660,6 +1713,14 @@ static int sxfs_write (const char *path, const char *buf, size_t size, off_t off
         SXFS_ERROR("Cannot download '%s' file", sxfs_file->remote_path);
         return ret;
     }
+    /* marked before writing so that flush never snapshots written but unmarked blocks */
+    pthread_mutex_lock(&sxfs_file->mutex);
+    if((ret = sxfs_stream_check(sxfs, sxfs_file, offset))) {
+        pthread_mutex_unlock(&sxfs_file->mutex);
+        return ret;
+    }
+    sxfs_file_mark_dirty(sxfs_file, offset, size);
+    pthread_mutex_unlock(&sxfs_file->mutex);
     ret = pwrite(sxfs_file->write_fd, buf, size, offset);
     if(ret < 0) {
         if(errno == ENOSPC)
@@ -1668,14 +1729,21 @@ static int sxfs_write (const char *path, const char *buf, size_t size, off_t off
             ret = -errno;
         SXFS_ERROR("Cannot write data to '%s' file: %s", sxfs_file->write_path, strerror(errno));
     } else {
+        int err;
+
         SXFS_VERBOSE("Wrote %d bytes", ret); /* FUSE defines write() to return int */
         pthread_mutex_lock(&sxfs_file->mutex);
         if(!sxfs_file->flush)
             sxfs_file->flush = 1;
+        err = sxfs_stream_write(sxfs, sxfs_file);
         pthread_mutex_unlock(&sxfs_file->mutex);
-        pthread_mutex_lock(&sxfs->ls_mutex);
+        if(err) {
+            SXFS_ERROR("Cannot upload '%s' file", sxfs_file->remote_path);
+            return err;
+        }
+        pthread_rwlock_wrlock(&sxfs->ls_lock);
         if(fstat(sxfs_file->write_fd, &st)) {
-            pthread_mutex_unlock(&sxfs->ls_mutex);
+            pthread_rwlock_unlock(&sxfs->ls_lock);
             ret = -errno;
             SXFS_ERROR("Cannot stat %s file: %s", sxfs_file->write_path, strerror(errno));
             return ret;
@@ -1684,7 +1752,7 @@ static int sxfs_write (const char *path, const char *buf, size_t size, off_t off
         sxfs_file->ls_file->st.st_ctime = st.st_ctime;
         sxfs_file->ls_file->st.st_size = st.st_size;
         sxfs_file->ls_file->st.st_blocks = (st.st_size + 511) / 512;
-        pthread_mutex_unlock(&sxfs->ls_mutex);
+        pthread_rwlock_unlock(&sxfs->ls_lock);
     }
     return ret;
 } /* sxfs_write */
@@ -1781,9 +1849,15 @@ static int sxfs_flush (const char *path, struct fuse_file_info *file_info) {
     }
     SXFS_DEBUG("'%s' (fd: %llu)", path, (unsigned long long int)file_info->fh);
     FH_CHECK(file_info->fh);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     pthread_mutex_lock(&sxfs_file->mutex);
-    if(sxfs_file->flush > 0) {
+    if(sxfs_file->stream) {
+        SXFS_DEBUG("Using file descriptor: %d", sxfs_file->write_fd);
+        if((ret = sxfs_stream_finish(sxfs, sxfs_file))) {
+            SXFS_ERROR("Cannot upload file: %s", sxfs_file->remote_path);
+            goto sxfs_flush_err;
+        }
+    } else if(sxfs_file->flush > 0) {
         SXFS_DEBUG("Using file descriptor: %d", sxfs_file->write_fd);
         file_path = (char*)malloc(strlen(sxfs->tempdir) + 1 + lenof("flush_XXXXXX") + 1);
         if(!file_path) {
@@ -1811,7 +1885,7 @@ static int sxfs_flush (const char *path, struct fuse_file_info *file_info) {
             SXFS_ERROR("Cannot read from '%s' file: %s", sxfs_file->write_path, strerror(errno));
             goto sxfs_flush_err;
         }
-        if((ret = sxfs_upload(file_path, sxfs_file->remote_path, sxfs_file->ls_file, 1))) {
+        if((ret = sxfs_upload(file_path, sxfs_file->remote_path, sxfs_file->ls_file, 1, sxfs_file_delta(sxfs, sxfs_file)))) {
             SXFS_ERROR("Cannot upload file: %s", sxfs_file->remote_path);
             goto sxfs_flush_err;
         }
@@ -1823,7 +1897,7 @@ static int sxfs_flush (const char *path, struct fuse_file_info *file_info) {
     ret = 0;
 sxfs_flush_err:
     pthread_mutex_unlock(&sxfs_file->mutex);
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     if(fd >= 0 && close(fd))
         SXFS_ERROR("Cannot close '%s' file: %s", file_path, strerror(errno));
     if(file_path && unlink(file_path) && errno != ENOENT)
@@ -1862,7 +1936,7 @@ static int sxfs_release (const char *path, struct fuse_file_info *file_info) {
     else
         sxfs->fh_table[file_info->fh] = NULL;
     pthread_mutex_unlock(&sxfs->limits_mutex);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     pthread_mutex_lock(&sxfs->files_mutex);
     if(!sxfs_file && (!path || sxi_ht_get(sxfs->files, path, strlen(path), (void**)&sxfs_file))) { /* try to cleanup data in case of fh_table inconsistency */
         SXFS_ERROR("File not opened: %s", path);
@@ -1874,8 +1948,18 @@ static int sxfs_release (const char *path, struct fuse_file_info *file_info) {
     SXFS_DEBUG("Opened %lu more times", sxfs_file->num_open);
     if(!sxfs_file->num_open) {
         SXFS_DEBUG("Closing the file");
+        if(sxfs_file->stream) { /* flush failed */
+            pthread_mutex_lock(&sxfs_file->mutex);
+            if(sxfs_stream_finish(sxfs, sxfs_file)) {
+                SXFS_ERROR("Cannot upload file: %s", sxfs_file->remote_path);
+                if(sxfs_file->stream_pos)
+                    sxfs_file->flush = 0; /* local copy is not complete */
+                sxfs_stream_abort(sxfs_file);
+            }
+            pthread_mutex_unlock(&sxfs_file->mutex);
+        }
         if(sxfs_file->flush > 0) {
-            if(sxfs_upload(sxfs_file->write_path, sxfs_file->remote_path, sxfs_file->ls_file, 1)) {
+            if(sxfs_upload(sxfs_file->write_path, sxfs_file->remote_path, sxfs_file->ls_file, 1, sxfs_file_delta(sxfs, sxfs_file))) {
                 SXFS_ERROR("Cannot upload file: %s", sxfs_file->remote_path);
                 goto sxfs_release_err;
             }
@@ -1890,7 +1974,7 @@ static int sxfs_release (const char *path, struct fuse_file_info *file_info) {
 
 sxfs_release_err:
     pthread_mutex_unlock(&sxfs->files_mutex);
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     return 0; /* return value of release() is ignored by FUSE */
 } /* sxfs_release */
 
@@ -1913,19 +1997,25 @@ static int sxfs_fsync (const char *path, int datasync, struct fuse_file_info *fi
     }
     SXFS_DEBUG("'%s', datasync: %d (fd: %llu)", path, datasync, (unsigned long long int)file_info->fh);
     FH_CHECK(file_info->fh);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     pthread_mutex_lock(&sxfs_file->mutex);
-    if(sxfs_file->flush > 0) {
-        if((ret = sxfs_upload_force(sxfs_file->write_path, sxfs_file->remote_path, sxfs_file->ls_file))) {
+    if(sxfs_file->stream) {
+        SXFS_DEBUG("'%s': File is being uploaded, the upload finishes when the file is closed", path);
+    } else if(sxfs_file->flush > 0) {
+        sxi_sxfs_delta_t *delta = sxfs_file_delta(sxfs, sxfs_file);
+
+        ret = sxfs_upload_force(sxfs_file->write_path, sxfs_file->remote_path, sxfs_file->ls_file, delta);
+        sxfs_delta_free(delta);
+        if(ret) {
             pthread_mutex_unlock(&sxfs_file->mutex);
-            pthread_mutex_unlock(&sxfs->ls_mutex);
+            pthread_rwlock_unlock(&sxfs->ls_lock);
             SXFS_ERROR("Cannot upload the file");
             return ret;
         }
         sxfs_file->flush = 0;
     }
     pthread_mutex_unlock(&sxfs_file->mutex);
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     return 0;
 } /* sxfs_fsync */
 
@@ -2045,10 +2135,9 @@ static int sxfs_readdir (const char *path, void *buf, fuse_fill_dir_t filler, of
         SXFS_ERROR("Got file descriptor instead of directory");
         return -ENOTDIR;
     }
-    pthread_mutex_lock(&sxfs->ls_mutex);
-    if((ret = sxfs_ls_update(sxfs_file->remote_path, &dir))) {
+    if((ret = sxfs_ls_read(sxfs_file->remote_path, &dir))) {
         SXFS_ERROR("Cannot load file tree: %s", sxfs_file->remote_path);
-        goto sxfs_readdir_err;
+        return ret;
     }
     if(filler(buf, ".", NULL, 0)) {
         SXFS_ERROR("filler failed on current directory");
@@ -2075,7 +2164,7 @@ static int sxfs_readdir (const char *path, void *buf, fuse_fill_dir_t filler, of
 
     ret = 0;
 sxfs_readdir_err:
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     return ret;
 } /* sxfs_readdir */
 
@@ -2258,7 +2347,7 @@ static int sxfs_create (const char *path, mode_t mode, struct fuse_file_info *fi
         free(local_file_path);
         return ret;
     }
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_wrlock(&sxfs->ls_lock);
     if(sxfs->args->use_queues_flag && (ret = sxfs_delete_check_path(path))) {
         SXFS_ERROR("Cannot check deletion queue: %s", path);
         goto sxfs_create_err;
@@ -2361,7 +2450,7 @@ sxfs_create_err:
         sxfs_file_free(sxfs, sxfs_file);
         sxi_ht_del(sxfs->files, path, strlen(path));
     }
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     if(files_locked)
         pthread_mutex_unlock(&sxfs->files_mutex);
     return ret;
@@ -2385,9 +2474,9 @@ static int sxfs_fgetattr (const char *path, struct stat *st, struct fuse_file_in
     }
     SXFS_DEBUG("'%s' (fd: %llu)", path, (unsigned long long int)file_info->fh);
     FH_CHECK(file_info->fh);
-    pthread_mutex_lock(&sxfs->ls_mutex);
+    pthread_rwlock_rdlock(&sxfs->ls_lock);
     memcpy(st, &sxfs_file->ls_file->st, sizeof(struct stat));
-    pthread_mutex_unlock(&sxfs->ls_mutex);
+    pthread_rwlock_unlock(&sxfs->ls_lock);
     st->st_atime = st->st_mtime;
     return 0;
 } /* sxfs_fgetattr */
@@ -3284,6 +3373,22 @@ int main (int argc, char **argv) {
     }
     if(sxfs_cache_init(sx, sxfs, cache_size, cache_dir ? cache_dir : sxfs->tempdir))
         goto main_err;
+    if(args.write_behind_given) {
+        if(sxfs->need_file || sxfs->attribs) {
+            fprintf(stderr, "*** Write-behind does not work with filtered volumes ***\n");
+        } else {
+            sxfs->write_behind = sxi_parse_size(sx, args.write_behind_arg, 1);
+            if(sxfs->write_behind < 0) {
+                fprintf(stderr, "%s\n", sxc_geterrmsg(sx));
+                goto main_err;
+            }
+            if(sxfs->write_behind < SXFS_WRITE_BEHIND_MIN) {
+                fprintf(stderr, "ERROR: Write-behind window must be at least %d bytes\n", SXFS_WRITE_BEHIND_MIN);
+                goto main_err;
+            }
+            print_and_log(sxfs->logfile, "Using write-behind window of %s\n", args.write_behind_arg);
+        }
+    }
     /* directory tree */
     sxfs->root = (sxfs_lsdir_t*)calloc(1, sizeof(sxfs_lsdir_t));
     if(!sxfs->root) {
@@ -3464,8 +3569,8 @@ int main (int argc, char **argv) {
         goto main_err;
     }
     pthread_flag |= SXFS_SX_DATA_MUTEX;
-    if(pthread_mutex_init(&sxfs->ls_mutex, NULL)) {
-        fprintf(stderr, "ERROR: Cannot create ls cache mutex\n");
+    if(pthread_rwlock_init(&sxfs->ls_lock, NULL)) {
+        fprintf(stderr, "ERROR: Cannot create ls cache lock\n");
         goto main_err;
     }
     pthread_flag |= SXFS_LS_MUTEX;
@@ -3634,8 +3739,8 @@ main_err:
         sxi_ht_free(sxfs->files);
         if(pthread_flag & SXFS_SX_DATA_MUTEX && (err = pthread_mutex_destroy(&sxfs->sx_data_mutex)))
             print_and_log(sxfs->logfile, "ERROR: Cannot destroy SX data mutex: %s\n", strerror(err));
-        if(pthread_flag & SXFS_LS_MUTEX && (err = pthread_mutex_destroy(&sxfs->ls_mutex)))
-            print_and_log(sxfs->logfile, "ERROR: Cannot destroy ls cache mutex: %s\n", strerror(err));
+        if(pthread_flag & SXFS_LS_MUTEX && (err = pthread_rwlock_destroy(&sxfs->ls_lock)))
+            print_and_log(sxfs->logfile, "ERROR: Cannot destroy ls cache lock: %s\n", strerror(err));
         if(pthread_flag & SXFS_DELETE_MUTEX && (err = pthread_mutex_destroy(&sxfs->delete_mutex)))
             print_and_log(sxfs->logfile, "ERROR: Cannot destroy deletion mutex: %s\n", strerror(err));
         if(pthread_flag & SXFS_DELETE_THREAD_MUTEX && (err = pthread_mutex_destroy(&sxfs->delete_thread_mutex)))
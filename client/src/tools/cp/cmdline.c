@@ -42,6 +42,7 @@ const char *gengetopt_args_info_full_help[] = {
   "      --exclude=PATTERN        Exclude files matching PATTERN",
   "      --include=PATTERN        Only copy files matching PATTERN",
   "  -b, --bwlimit=RATE           Set bandwidth usage limit in kilobytes per\n                                 second (allows K, M, G suffixes, assume K when\n                                 no suffix given)",
+  "      --parallel-files=N       Upload up to N files at the same time\n                                 (default=`1')",
   "  -q, --no-progress            Don't output progress bar  (default=off)",
   "      --ignore-errors          Keep processing files even when there are errors\n                                 (default=off)",
   "      --replica-wait           Wait for full data replication on the cluster\n                                 (default=off)",
@@ -72,11 +73,12 @@ init_help_array(void)
   gengetopt_args_info_help[10] = gengetopt_args_info_full_help[10];
   gengetopt_args_info_help[11] = gengetopt_args_info_full_help[11];
   gengetopt_args_info_help[12] = gengetopt_args_info_full_help[12];
-  gengetopt_args_info_help[13] = 0; 
+  gengetopt_args_info_help[13] = gengetopt_args_info_full_help[13];
+  gengetopt_args_info_help[14] = 0; 
   
 }
 
-const char *gengetopt_args_info_help[14];
+const char *gengetopt_args_info_help[15];
 
 typedef enum {ARG_NO
   , ARG_FLAG
@@ -110,6 +112,7 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->exclude_given = 0 ;
   args_info->include_given = 0 ;
   args_info->bwlimit_given = 0 ;
+  args_info->parallel_files_given = 0 ;
   args_info->no_progress_given = 0 ;
   args_info->ignore_errors_given = 0 ;
   args_info->replica_wait_given = 0 ;
@@ -135,6 +138,8 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->include_orig = NULL;
   args_info->bwlimit_arg = NULL;
   args_info->bwlimit_orig = NULL;
+  args_info->parallel_files_arg = 1;
+  args_info->parallel_files_orig = NULL;
   args_info->no_progress_flag = 0;
   args_info->ignore_errors_flag = 0;
   args_info->replica_wait_flag = 0;
@@ -172,17 +177,18 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->include_min = 0;
   args_info->include_max = 0;
   args_info->bwlimit_help = gengetopt_args_info_full_help[7] ;
-  args_info->no_progress_help = gengetopt_args_info_full_help[8] ;
-  args_info->ignore_errors_help = gengetopt_args_info_full_help[9] ;
-  args_info->replica_wait_help = gengetopt_args_info_full_help[10] ;
-  args_info->verbose_help = gengetopt_args_info_full_help[11] ;
-  args_info->debug_help = gengetopt_args_info_full_help[12] ;
-  args_info->config_dir_help = gengetopt_args_info_full_help[13] ;
-  args_info->filter_dir_help = gengetopt_args_info_full_help[14] ;
-  args_info->total_conns_limit_help = gengetopt_args_info_full_help[15] ;
-  args_info->host_conns_limit_help = gengetopt_args_info_full_help[16] ;
-  args_info->dot_size_help = gengetopt_args_info_full_help[17] ;
-  args_info->node_preference_help = gengetopt_args_info_full_help[18] ;
+  args_info->parallel_files_help = gengetopt_args_info_full_help[8] ;
+  args_info->no_progress_help = gengetopt_args_info_full_help[9] ;
+  args_info->ignore_errors_help = gengetopt_args_info_full_help[10] ;
+  args_info->replica_wait_help = gengetopt_args_info_full_help[11] ;
+  args_info->verbose_help = gengetopt_args_info_full_help[12] ;
+  args_info->debug_help = gengetopt_args_info_full_help[13] ;
+  args_info->config_dir_help = gengetopt_args_info_full_help[14] ;
+  args_info->filter_dir_help = gengetopt_args_info_full_help[15] ;
+  args_info->total_conns_limit_help = gengetopt_args_info_full_help[16] ;
+  args_info->host_conns_limit_help = gengetopt_args_info_full_help[17] ;
+  args_info->dot_size_help = gengetopt_args_info_full_help[18] ;
+  args_info->node_preference_help = gengetopt_args_info_full_help[19] ;
   
 }
 
@@ -327,6 +333,7 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_multiple_string_field (args_info->include_given, &(args_info->include_arg), &(args_info->include_orig));
   free_string_field (&(args_info->bwlimit_arg));
   free_string_field (&(args_info->bwlimit_orig));
+  free_string_field (&(args_info->parallel_files_orig));
   free_string_field (&(args_info->config_dir_arg));
   free_string_field (&(args_info->config_dir_orig));
   free_string_field (&(args_info->filter_dir_arg));
@@ -394,6 +401,8 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
   write_multiple_into_file(outfile, args_info->include_given, "include", args_info->include_orig, 0);
   if (args_info->bwlimit_given)
     write_into_file(outfile, "bwlimit", args_info->bwlimit_orig, 0);
+  if (args_info->parallel_files_given)
+    write_into_file(outfile, "parallel-files", args_info->parallel_files_orig, 0);
   if (args_info->no_progress_given)
     write_into_file(outfile, "no-progress", 0, 0 );
   if (args_info->ignore_errors_given)
@@ -956,6 +965,7 @@ cmdline_parser_internal (
         { "exclude",	1, NULL, 0 },
         { "include",	1, NULL, 0 },
         { "bwlimit",	1, NULL, 'b' },
+        { "parallel-files",	1, NULL, 0 },
         { "no-progress",	0, NULL, 'q' },
         { "ignore-errors",	0, NULL, 0 },
         { "replica-wait",	0, NULL, 0 },
@@ -1122,6 +1132,20 @@ cmdline_parser_internal (
                 additional_error))
               goto failure;
           
+          }
+          /* Upload up to N files at the same time.  */
+          else if (strcmp (long_options[option_index].name, "parallel-files") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->parallel_files_arg), 
+                 &(args_info->parallel_files_orig), &(args_info->parallel_files_given),
+                &(local_args_info.parallel_files_given), optarg, 0, "1", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "parallel-files", '-',
+                additional_error))
+              goto failure;
+          
           }
           /* Keep processing files even when there are errors.  */
           else if (strcmp (long_options[option_index].name, "ignore-errors") == 0)
@@ -57,6 +57,9 @@ struct gengetopt_args_info
   char * bwlimit_arg;	/**< @brief Set bandwidth usage limit in kilobytes per second (allows K, M, G suffixes, assume K when no suffix given).  */
   char * bwlimit_orig;	/**< @brief Set bandwidth usage limit in kilobytes per second (allows K, M, G suffixes, assume K when no suffix given) original value given at command line.  */
   const char *bwlimit_help; /**< @brief Set bandwidth usage limit in kilobytes per second (allows K, M, G suffixes, assume K when no suffix given) help description.  */
+  int parallel_files_arg;	/**< @brief Upload up to N files at the same time (default='1').  */
+  char * parallel_files_orig;	/**< @brief Upload up to N files at the same time original value given at command line.  */
+  const char *parallel_files_help; /**< @brief Upload up to N files at the same time help description.  */
   int no_progress_flag;	/**< @brief Don't output progress bar (default=off).  */
   const char *no_progress_help; /**< @brief Don't output progress bar help description.  */
   int ignore_errors_flag;	/**< @brief Keep processing files even when there are errors (default=off).  */
@@ -94,6 +97,7 @@ struct gengetopt_args_info
   unsigned int exclude_given ;	/**< @brief Whether exclude was given.  */
   unsigned int include_given ;	/**< @brief Whether include was given.  */
   unsigned int bwlimit_given ;	/**< @brief Whether bwlimit was given.  */
+  unsigned int parallel_files_given ;	/**< @brief Whether parallel-files was given.  */
   unsigned int no_progress_given ;	/**< @brief Whether no-progress was given.  */
   unsigned int ignore_errors_given ;	/**< @brief Whether ignore-errors was given.  */
   unsigned int replica_wait_given ;	/**< @brief Whether replica-wait was given.  */
@@ -471,10 +471,21 @@ static sxc_xfer_callback get_callback_type(void) {
     return progress_callback_type;
 }
 
+/* Bytes of all files transferred so far, for the summary of parallel uploads */
+static int64_t total_bytes = 0;
+
 static int progress_callback(const sxc_xfer_stat_t *xfer_stat) {
+    int parallel;
+
     if(!xfer_stat)
         return SXE_ABORT;
 
+    total_bytes = xfer_stat->total_data_dl + xfer_stat->total_data_ul;
+    /* Files uploaded in parallel share the current transfer stats, only report when they start */
+    parallel = args.parallel_files_arg > 1 && xfer_stat->current_xfer.direction == SXC_XFER_DIRECTION_UPLOAD;
+    if(parallel && xfer_stat->status != SXC_XFER_STATUS_PART_STARTED)
+        return SXE_NOERROR;
+
     /* Called to let callbacks finishing lines */
     if(xfer_stat->status == SXC_XFER_STATUS_PART_FINISHED || xfer_stat->status == SXC_XFER_STATUS_WAITING)
         get_callback_type()(xfer_stat);
@@ -502,6 +513,8 @@ static int progress_callback(const sxc_xfer_stat_t *xfer_stat) {
             free(processed_size);
             free(file_name_esc);
 
+            if(parallel)
+                return SXE_NOERROR;
             return get_callback_type()(xfer_stat);
         } break;
 
@@ -655,6 +668,7 @@ int main(int argc, char **argv) {
     int64_t limit = 0;
     sxc_exclude_t *exclude = NULL;
     sxc_file_list_t *lst = NULL;
+    struct timeval t1, t2;
 
     if(cmdline_parser(argc, argv, &args))
 	exit(1);
@@ -804,6 +818,17 @@ int main(int argc, char **argv) {
         goto main_err;
     }
 
+    if(args.parallel_files_given) {
+        if(args.parallel_files_arg < 1) {
+            fprintf(stderr, "ERROR: Number of parallel files must be positive number\n");
+            goto main_err;
+        }
+        if(sxc_file_list_set_parallel_files(lst, args.parallel_files_arg)) {
+            fprintf(stderr, "ERROR: Failed to set number of parallel files: %s\n", sxc_geterrmsg(sx));
+            goto main_err;
+        }
+    }
+
     source = calloc(args.inputs_num - 1, sizeof(*source));
     if(!source) {
         fprintf(stderr, "ERROR: Out of memory\n");
@@ -862,6 +887,7 @@ int main(int argc, char **argv) {
         }
     }
 
+    gettimeofday(&t1, NULL);
     if(sxc_copy(lst, dst_file, args.recursive_flag, args.one_file_system_flag, exclude, 0)) {
         fprintf(stderr, "ERROR: %s\n", sxc_geterrmsg(sx));
         if(!args.recursive_flag && strstr(sxc_geterrmsg(sx), SXBC_TOOLS_NOTFOUND_ERR) && is_sx(fname) && fname[strlen(fname) - 1] == '/')
@@ -881,6 +907,25 @@ int main(int argc, char **argv) {
         goto main_err;
     }
 
+    if(args.parallel_files_arg > 1 && !args.no_progress_flag) {
+        unsigned int nfiles = sxc_file_list_get_successful(lst);
+        double t;
+        char *processed_number, *processed_speed, *processed_time;
+
+        gettimeofday(&t2, NULL);
+        t = sxi_timediff(&t2, &t1);
+        if(t <= 0)
+            t = 1e-6;
+        processed_number = process_number(total_bytes);
+        processed_speed = process_number(total_bytes / t);
+        processed_time = process_time(t);
+        if(processed_number && processed_speed && processed_time)
+            printf("Transferred %u file(s), %sB in %s (@%.1f files/s, %sB/s)\n", nfiles, processed_number, processed_time, nfiles / t, processed_speed);
+        free(processed_number);
+        free(processed_speed);
+        free(processed_time);
+    }
+
     /* If --node-preference is given, save cluster configuration in order to store nodes speeds */
     if(args.node_preference_given) {
         if(cluster1 && sxc_cluster_save(cluster1, sxc_get_confdir(sx))) {
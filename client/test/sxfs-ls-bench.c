@@ -0,0 +1,769 @@
+/*
+ *  Copyright (C) 2012-2015 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+/* Multithreaded benchmark for the sxfs directory cache.
+ *
+ * A fake SX node is started in-process on 127.0.0.1. It serves a volume of
+ * --dirs directories with --files files each and nothing else, so the
+ * numbers only depend on the client side. The directory cache is then
+ * driven through sxfs_ls_stat() and sxfs_ls_read(), the getattr and readdir
+ * paths, by each --threads N in turn for --seconds. Every thread stats
+ * random files and lists a random directory once in a while. Results are
+ * printed to stdout as a JSON document; logging goes to stderr.
+ *
+ * usage: sxfs-ls-bench [--debug] [--dirs N] [--files N] [--seconds N] [--threads N]...
+ *                      [--readdir PCT] [--latency MSEC] [--churn] [--keep] [scratch-dir]
+ * or from the build tree: make bench BENCHFLAGS="--latency 5"
+ *
+ * The cached listings expire after SXFS_LS_RELOAD seconds, so runs longer
+ * than that include the refreshes. --latency delays every reply of the fake
+ * node to emulate a remote cluster. By default refreshes get 304 Not Modified;
+ * --churn changes the ETag of every listing so that each refresh downloads
+ * and merges the whole directory.
+ */
+
+#include "params.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define GTFO(...) do { fprintf(stderr, "ERROR: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); goto out; } while(0)
+
+#define BENCH_HOST "bench"
+#define BENCH_VOLUME "bench"
+#define BENCH_PROFILE "admin"
+#define BENCH_UUID "5e2a4b10-63c5-4a3c-9b7d-0c8e5f1a2b3c"
+/* Any well formed key works, the fake node does not check signatures */
+#define BENCH_TOKEN "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+#define BENCH_DEFAULT_DIRS 100
+#define BENCH_DEFAULT_FILES 1000
+#define BENCH_DEFAULT_SECONDS 10
+#define BENCH_DEFAULT_READDIR 10
+#define BENCH_MAX_THREADS 64
+/* Latency samples kept per result, later ops only count towards the rate */
+#define BENCH_MAX_SAMPLES (1024 * 1024)
+#define FAKE_REQ_MAX 8192
+
+static const unsigned int bench_threads[] = { 1, 4, 16, 64 };
+
+struct fake_node {
+    int fd;
+    unsigned int port, dirs, files, latency;
+    int churn;
+    pthread_mutex_t mutex;
+    /* guarded by mutex */
+    unsigned long long listings, unchanged, generation;
+};
+
+struct bench_stat {
+    double *lat;
+    double worst; /* also covers the ops past the kept samples */
+    unsigned int n, max;
+    uint64_t ops;
+};
+
+struct bench_ctx {
+    unsigned int dirs, files, readdir_pct;
+    volatile int stop;
+    /* workers wait for go, the run starts when all of them are ready */
+    int go;
+    unsigned int ready;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    sxfs_state_t *sxfs;
+};
+
+static struct fuse_context fuse_ctx;
+static int first_result = 1;
+
+/* sxfs reaches its state through the FUSE context, see SXFS_DATA */
+struct fuse_context *fuse_get_context(void) {
+    return &fuse_ctx;
+}
+
+/* Fake node */
+
+static int fake_send(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while(len) {
+        n = write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int fake_reply(int fd, int status, const char *etag, const char *body, size_t len) {
+    char head[512];
+    int n;
+
+    n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nSX-Cluster: %s (" BENCH_UUID ")\r\nContent-Type: application/json\r\n%s%s%sContent-Length: %u\r\n\r\n",
+                 status, status == 200 ? "OK" : status == 304 ? "Not Modified" : "Not Found", sxc_get_version(),
+                 etag ? "ETag: " : "", etag ? etag : "", etag ? "\r\n" : "", (unsigned int)len);
+    if(n < 0 || n >= (int)sizeof(head) || fake_send(fd, head, n))
+        return -1;
+    return len ? fake_send(fd, body, len) : 0;
+}
+
+static void fake_urldecode(char *s) {
+    char *d = s;
+    unsigned int c;
+
+    while(*s) {
+        if(*s == '%' && s[1] && s[2] && sscanf(s + 1, "%2x", &c) == 1) {
+            *d++ = c;
+            s += 3;
+        } else if(*s == '+') {
+            *d++ = ' ';
+            s++;
+        } else
+            *d++ = *s++;
+    }
+    *d = '\0';
+}
+
+/* Builds the listing of the directory matched by filter, NULL if there is no such directory */
+static char *fake_listing(struct fake_node *node, const char *filter, unsigned int *dir, size_t *len) {
+    size_t size, pos = 0;
+    unsigned int i, d = 0;
+    char *buf, *p;
+    int n;
+
+    if(!strcmp(filter, "/"))
+        *dir = node->dirs;
+    else if(sscanf(filter, "/d%05u/%n", &d, &n) == 1 && !filter[n] && d < node->dirs)
+        *dir = d;
+    else
+        return NULL;
+    size = 64 + (*dir == node->dirs ? node->dirs * 16 : node->files * 256);
+    buf = malloc(size);
+    if(!buf)
+        return NULL;
+    p = buf;
+    pos = sprintf(p, "{\"fileList\":{");
+    if(*dir == node->dirs) {
+        for(i = 0; i < node->dirs; i++)
+            pos += sprintf(p + pos, "%s\"/d%05u/\":{}", i ? "," : "", i);
+    } else {
+        for(i = 0; i < node->files; i++)
+            pos += sprintf(p + pos, "%s\"/d%05u/f%05u\":{\"fileSize\":%u,\"blockSize\":4096,\"createdAt\":1420070400,\"fileRevision\":\"2015-01-01 00:00:00.000:%032u\",\"fileMeta\":{}}",
+                           i ? "," : "", d, i, i * 100, i);
+    }
+    pos += sprintf(p + pos, "}}");
+    *len = pos;
+    return buf;
+}
+
+static int fake_handle(struct fake_node *node, int fd, char *req) {
+    char *uri, *query, *line, *next, *end, *body, etag[64], inm[64] = "";
+    unsigned long long gen;
+    unsigned int dir;
+    size_t len = 0;
+    int ret, match;
+
+    if(strncmp(req, "GET ", 4))
+        return fake_reply(fd, 404, NULL, NULL, 0);
+    uri = req + 4;
+    end = strchr(uri, ' ');
+    if(!end)
+        return -1;
+    *end = '\0';
+    for(line = strstr(end + 1, "\r\n"); line && line[2]; line = next) {
+        line += 2;
+        next = strstr(line, "\r\n");
+        if(next && !strncasecmp(line, "If-None-Match:", lenof("If-None-Match:"))) {
+            const char *v = line + lenof("If-None-Match:");
+            while(*v == ' ')
+                v++;
+            snprintf(inm, sizeof(inm), "%.*s", (int)(next - v), v);
+        }
+    }
+
+    pthread_mutex_lock(&node->mutex);
+    gen = node->generation;
+    if(node->churn)
+        node->generation++;
+    pthread_mutex_unlock(&node->mutex);
+    if(node->latency)
+        usleep(node->latency * 1000);
+
+    if(!strcmp(uri, "/?nodeList")) {
+        static const char nodes[] = "{\"nodeList\":[\"127.0.0.1\"]}";
+        return fake_reply(fd, 200, NULL, nodes, lenof(nodes));
+    }
+    if(strncmp(uri, "/" BENCH_VOLUME "?", lenof("/" BENCH_VOLUME "?"))) {
+        /* Only asked for when the listing comes without the file meta */
+        if(!strncmp(uri, "/" BENCH_VOLUME "/", lenof("/" BENCH_VOLUME "/")) && strstr(uri, "?fileMeta")) {
+            static const char meta[] = "{\"fileMeta\":{}}";
+            return fake_reply(fd, 200, NULL, meta, lenof(meta));
+        }
+        return fake_reply(fd, 404, NULL, NULL, 0);
+    }
+    query = uri + lenof("/" BENCH_VOLUME "?");
+    if(!strncmp(query, "o=locate", lenof("o=locate"))) {
+        static const char locate[] = "{\"nodeList\":[\"127.0.0.1\"],\"blockSize\":4096,\"sizeBytes\":1099511627776,\"replicaCount\":1,"
+                                     "\"owner\":\"" BENCH_PROFILE "\",\"privs\":\"rw\",\"volumeMeta\":{},\"customVolumeMeta\":{}}";
+        return fake_reply(fd, 200, NULL, locate, lenof(locate));
+    }
+    if(strncmp(query, "filter=", lenof("filter=")))
+        return fake_reply(fd, 404, NULL, NULL, 0);
+    query += lenof("filter=");
+    end = strchr(query, '&');
+    if(end)
+        *end = '\0';
+    fake_urldecode(query);
+    body = fake_listing(node, query, &dir, &len);
+    if(!body)
+        return fake_reply(fd, 404, NULL, NULL, 0);
+    snprintf(etag, sizeof(etag), "\"%u-%llu\"", dir, gen);
+    match = !strcmp(inm, etag);
+    pthread_mutex_lock(&node->mutex);
+    node->listings++;
+    if(match)
+        node->unchanged++;
+    pthread_mutex_unlock(&node->mutex);
+    if(match)
+        ret = fake_reply(fd, 304, etag, NULL, 0);
+    else
+        ret = fake_reply(fd, 200, etag, body, len);
+    free(body);
+    return ret;
+}
+
+struct fake_conn_arg {
+    struct fake_node *node;
+    int fd;
+};
+
+/* Serves one keep-alive connection */
+static void *fake_conn(void *arg) {
+    struct fake_conn_arg *conn = arg;
+    char *req = malloc(FAKE_REQ_MAX + 1), *end;
+    size_t have = 0, used;
+    ssize_t n;
+
+    while(req) {
+        n = read(conn->fd, req + have, FAKE_REQ_MAX - have);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        have += n;
+        req[have] = '\0';
+        while((end = strstr(req, "\r\n\r\n"))) {
+            used = end + 4 - req;
+            end[2] = '\0';
+            if(fake_handle(conn->node, conn->fd, req))
+                goto fake_conn_out;
+            have -= used;
+            memmove(req, req + used, have);
+            req[have] = '\0';
+        }
+        if(have == FAKE_REQ_MAX)
+            break;
+    }
+ fake_conn_out:
+    close(conn->fd);
+    free(conn);
+    free(req);
+    return NULL;
+}
+
+static void *fake_accept(void *arg) {
+    struct fake_node *node = arg;
+    struct fake_conn_arg *conn;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd, one = 1;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while((fd = accept(node->fd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED) {
+        if(fd < 0)
+            continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn = malloc(sizeof(*conn));
+        if(conn) {
+            conn->node = node;
+            conn->fd = fd;
+            if(!pthread_create(&thread, &attr, fake_conn, conn))
+                continue;
+            free(conn);
+        }
+        close(fd);
+    }
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
+
+/* Listens on an ephemeral port of 127.0.0.1, the connections are served until exit */
+static int fake_start(struct fake_node *node) {
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    node->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(node->fd < 0)
+        return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(node->fd, (struct sockaddr*)&sin, sizeof(sin)) || listen(node->fd, 128) ||
+       getsockname(node->fd, (struct sockaddr*)&sin, &slen)) {
+        close(node->fd);
+        return -1;
+    }
+    node->port = ntohs(sin.sin_port);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, fake_accept, node);
+    pthread_attr_destroy(&attr);
+    if(ret) {
+        close(node->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void fake_counters(struct fake_node *node, unsigned long long *listings, unsigned long long *unchanged) {
+    pthread_mutex_lock(&node->mutex);
+    *listings = node->listings;
+    *unchanged = node->unchanged;
+    pthread_mutex_unlock(&node->mutex);
+}
+
+/* Timing */
+
+static int timing_init(struct bench_stat *st, unsigned int max) {
+    memset(st, 0, sizeof(*st));
+    st->lat = malloc(max * sizeof(*st->lat));
+    if(!st->lat)
+        return -1;
+    st->max = max;
+    return 0;
+}
+
+/* Cache hits take well under a microsecond, hence the monotonic clock instead of gettimeofday() */
+static double timing_diff(const struct timespec *t1, const struct timespec *t2) {
+    return (t2->tv_sec - t1->tv_sec) + (t2->tv_nsec - t1->tv_nsec) / 1e9;
+}
+
+static void timing_add(struct bench_stat *st, const struct timespec *t1, const struct timespec *t2) {
+    double lat = timing_diff(t1, t2);
+
+    if(st->n < st->max)
+        st->lat[st->n++] = lat;
+    if(lat > st->worst)
+        st->worst = lat;
+    st->ops++;
+}
+
+/* Appends the samples of src, which must fit */
+static void timing_merge(struct bench_stat *dst, const struct bench_stat *src) {
+    memcpy(dst->lat + dst->n, src->lat, src->n * sizeof(*src->lat));
+    dst->n += src->n;
+    dst->ops += src->ops;
+    if(src->worst > dst->worst)
+        dst->worst = src->worst;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static double percentile(const struct bench_stat *st, unsigned int pct) {
+    unsigned int i;
+    if(!st->n)
+        return 0;
+    i = (st->n * pct + 99) / 100;
+    if(i)
+        i--;
+    return st->lat[i];
+}
+
+/* Prints one result object and releases the stat; the rate is per wall clock second of the run */
+static void timing_report(struct bench_stat *st, const char *name, unsigned int threads, double elapsed, unsigned long long listings, unsigned long long unchanged) {
+    if(elapsed <= 0)
+        elapsed = 1e-9;
+    qsort(st->lat, st->n, sizeof(*st->lat), cmp_double);
+    printf("%s\n    {\"name\":\"%s\",\"threads\":%u,\"ops\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.2f,\"p50_usec\":%.2f,\"p99_usec\":%.2f,\"max_usec\":%.2f,\"listings\":%llu,\"not_modified\":%llu}",
+           first_result ? "" : ",", name, threads, (unsigned long long)st->ops, elapsed, st->ops / elapsed,
+           percentile(st, 50) * 1000000, percentile(st, 99) * 1000000, st->worst * 1000000, listings, unchanged);
+    fflush(stdout);
+    first_result = 0;
+    free(st->lat);
+    st->lat = NULL;
+}
+
+/* Workers */
+
+struct bench_worker {
+    pthread_t thread;
+    unsigned int seed;
+    int err;
+    struct bench_ctx *c;
+    struct bench_stat stat, readdir;
+};
+
+static void *bench_work(void *arg) {
+    struct bench_worker *w = arg;
+    struct bench_ctx *c = w->c;
+    sxfs_state_t *sxfs = c->sxfs;
+    sxc_client_t *sx;
+    sxc_cluster_t *cluster;
+    sxfs_lsdir_t *dir;
+    struct timespec t1, t2;
+    struct stat st;
+    char path[64];
+    unsigned int r, d;
+    size_t i, names;
+
+    /* Each thread gets its own cluster handle like the FUSE threads do, keep that out of the timings */
+    w->err = sxfs_get_sx_data(sxfs, &sx, &cluster);
+    pthread_mutex_lock(&c->mutex);
+    c->ready++;
+    pthread_cond_broadcast(&c->cond);
+    while(!c->go)
+        pthread_cond_wait(&c->cond, &c->mutex);
+    pthread_mutex_unlock(&c->mutex);
+    while(!w->err && !c->stop) {
+        r = rand_r(&w->seed);
+        d = r % c->dirs;
+        r /= c->dirs;
+        if(r % 100 < c->readdir_pct) {
+            /* readdir hands over the path with the trailing slash */
+            snprintf(path, sizeof(path), "/d%05u/", d);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if((w->err = sxfs_ls_read(path, &dir)))
+                break;
+            names = 0;
+            for(i=0; i<dir->ndirs; i++)
+                names += dir->dirs[i]->name[0] != '\0';
+            for(i=0; i<dir->nfiles; i++)
+                names += dir->files[i]->name[0] != '\0';
+            pthread_rwlock_unlock(&sxfs->ls_lock);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            if(names != c->files) {
+                fprintf(stderr, "ERROR: Listed %llu entries in %s, expected %u\n", (unsigned long long)names, path, c->files);
+                w->err = -EIO;
+                break;
+            }
+            timing_add(&w->readdir, &t1, &t2);
+        } else {
+            snprintf(path, sizeof(path), "/d%05u/f%05u", d, (r / 100) % c->files);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if((w->err = sxfs_ls_stat(path, &st)) != 1) {
+                fprintf(stderr, "ERROR: Cannot stat %s: %d\n", path, w->err);
+                if(w->err >= 0)
+                    w->err = -EIO;
+                break;
+            }
+            w->err = 0;
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            timing_add(&w->stat, &t1, &t2);
+        }
+    }
+    return NULL;
+}
+
+static int bench_run(struct bench_ctx *c, struct fake_node *node, unsigned int nthreads, unsigned int seconds) {
+    struct bench_worker *w;
+    struct bench_stat stat, readdir;
+    struct timespec t1, t2;
+    unsigned long long listings, unchanged, listings2, unchanged2;
+    unsigned int i, started = 0, samples = BENCH_MAX_SAMPLES / nthreads;
+    int ret = -1;
+
+    memset(&stat, 0, sizeof(stat));
+    memset(&readdir, 0, sizeof(readdir));
+    w = calloc(nthreads, sizeof(*w));
+    if(!w || timing_init(&stat, samples * nthreads) || timing_init(&readdir, samples * nthreads)) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        goto bench_run_err;
+    }
+    for(i=0; i<nthreads; i++) {
+        w[i].c = c;
+        w[i].seed = i + 1;
+        if(timing_init(&w[i].stat, samples) || timing_init(&w[i].readdir, samples)) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            goto bench_run_err;
+        }
+    }
+    c->stop = 0;
+    c->go = 0;
+    c->ready = 0;
+    for(started=0; started<nthreads; started++)
+        if(pthread_create(&w[started].thread, NULL, bench_work, &w[started]))
+            break;
+    pthread_mutex_lock(&c->mutex);
+    while(c->ready < started)
+        pthread_cond_wait(&c->cond, &c->mutex);
+    if(started < nthreads)
+        c->stop = 1;
+    c->go = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+    fake_counters(node, &listings, &unchanged);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(started == nthreads)
+        sleep(seconds);
+    c->stop = 1;
+    for(i=0; i<started; i++)
+        pthread_join(w[i].thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    fake_counters(node, &listings2, &unchanged2);
+    if(started < nthreads) {
+        fprintf(stderr, "ERROR: Cannot start worker thread\n");
+        goto bench_run_err;
+    }
+
+    for(i=0; i<nthreads; i++) {
+        if(w[i].err) {
+            fprintf(stderr, "ERROR: Worker %u failed: %s\n", i, strerror(-w[i].err));
+            goto bench_run_err;
+        }
+        timing_merge(&stat, &w[i].stat);
+        timing_merge(&readdir, &w[i].readdir);
+    }
+    timing_report(&stat, "stat", nthreads, timing_diff(&t1, &t2), listings2 - listings, unchanged2 - unchanged);
+    timing_report(&readdir, "readdir", nthreads, timing_diff(&t1, &t2), listings2 - listings, unchanged2 - unchanged);
+    ret = 0;
+ bench_run_err:
+    if(w)
+        for(i=0; i<nthreads; i++) {
+            free(w[i].stat.lat);
+            free(w[i].readdir.lat);
+        }
+    free(w);
+    free(stat.lat);
+    free(readdir.lat);
+    return ret;
+}
+
+/* Loads the root and every directory once, so that the runs start with a warm cache */
+static int bench_warmup(struct bench_ctx *c) {
+    sxfs_state_t *sxfs = c->sxfs;
+    sxfs_lsdir_t *dir;
+    char path[64];
+    unsigned int i;
+    int ret;
+
+    for(i=0; i<c->dirs; i++) {
+        snprintf(path, sizeof(path), "/d%05u", i);
+        if((ret = sxfs_ls_stat(path, NULL)) != 2) {
+            fprintf(stderr, "ERROR: Cannot stat %s: %d\n", path, ret);
+            return -1;
+        }
+        strcat(path, "/");
+        if((ret = sxfs_ls_read(path, &dir))) {
+            fprintf(stderr, "ERROR: Cannot list %s: %s\n", path, strerror(-ret));
+            return -1;
+        }
+        pthread_rwlock_unlock(&sxfs->ls_lock);
+    }
+    return 0;
+}
+
+static int rmtree_cb(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    struct gengetopt_args_info args;
+    struct fake_node node;
+    struct bench_ctx c;
+    sxfs_state_t state, *sxfs = &state;
+    sxc_logger_t log;
+    sxc_client_t *sx = NULL;
+    sxc_cluster_t *cluster = NULL;
+    char tmpdir[] = "/tmp/sxfs-ls-bench.XXXXXX", *dir = NULL, *confdir = NULL;
+    unsigned int i, nthreads = 0, threads[BENCH_MAX_THREADS], seconds = BENCH_DEFAULT_SECONDS;
+    int keep = 0, json = 0, ret = 1;
+
+    memset(&args, 0, sizeof(args));
+    memset(&node, 0, sizeof(node));
+    memset(&c, 0, sizeof(c));
+    memset(sxfs, 0, sizeof(*sxfs));
+    node.fd = -1;
+    c.dirs = BENCH_DEFAULT_DIRS;
+    c.files = BENCH_DEFAULT_FILES;
+    c.readdir_pct = BENCH_DEFAULT_READDIR;
+    for(i = 1; i < (unsigned int)argc; i++) {
+        if(!strcmp(argv[i], "--debug"))
+            args.debug_flag = 1;
+        else if(!strcmp(argv[i], "--keep"))
+            keep = 1;
+        else if(!strcmp(argv[i], "--churn"))
+            node.churn = 1;
+        else if(!strcmp(argv[i], "--dirs") && i + 1 < (unsigned int)argc)
+            c.dirs = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--files") && i + 1 < (unsigned int)argc)
+            c.files = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--seconds") && i + 1 < (unsigned int)argc)
+            seconds = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--readdir") && i + 1 < (unsigned int)argc)
+            c.readdir_pct = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--latency") && i + 1 < (unsigned int)argc)
+            node.latency = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i + 1 < (unsigned int)argc && nthreads < BENCH_MAX_THREADS) {
+            threads[nthreads] = atoi(argv[++i]);
+            if(!threads[nthreads] || threads[nthreads] > BENCH_MAX_THREADS)
+                GTFO("Invalid --threads %s (1 to %u)", argv[i], BENCH_MAX_THREADS);
+            nthreads++;
+        } else if(argv[i][0] != '-' && !dir)
+            dir = argv[i];
+        else {
+            fprintf(stderr, "usage: %s [--debug] [--dirs N] [--files N] [--seconds N] [--threads N]... [--readdir PCT] [--latency MSEC] [--churn] [--keep] [scratch-dir]\n", argv[0]);
+            goto out;
+        }
+    }
+    if(!c.dirs || c.dirs > 100000 || !c.files || c.files > 100000)
+        GTFO("--dirs and --files must be between 1 and 100000");
+    if(!seconds)
+        GTFO("At least one second is required");
+    if(c.readdir_pct > 100)
+        GTFO("Invalid --readdir percentage");
+    if(!nthreads) {
+        nthreads = sizeof(bench_threads) / sizeof(bench_threads[0]);
+        memcpy(threads, bench_threads, sizeof(bench_threads));
+    }
+    node.dirs = c.dirs;
+    node.files = c.files;
+
+    if(!dir) {
+        if(!mkdtemp(tmpdir))
+            GTFO("Failed to create scratch directory");
+        dir = tmpdir;
+    }
+    confdir = malloc(strlen(dir) + sizeof("/config"));
+    sxfs->tempdir = malloc(strlen(dir) + sizeof("/tmp"));
+    if(!confdir || !sxfs->tempdir)
+        GTFO("Out of memory");
+    sprintf(confdir, "%s/config", dir);
+    sprintf(sxfs->tempdir, "%s/tmp", dir);
+    if(mkdir(sxfs->tempdir, 0700))
+        GTFO("Cannot create %s: %s", sxfs->tempdir, strerror(errno));
+
+    if(pthread_mutex_init(&node.mutex, NULL))
+        GTFO("Cannot initialize mutex");
+    if(fake_start(&node))
+        GTFO("Cannot start the fake node: %s", strerror(errno));
+
+    /* The cluster config sxfs loads, as sxinit --no-ssl would write it */
+    sx = sxc_client_init(sxc_default_logger(&log, argv[0]), sxc_input_fn, NULL);
+    if(!sx)
+        GTFO("Failed to init library");
+    sxc_set_debug(sx, args.debug_flag);
+    if(sxc_set_confdir(sx, confdir))
+        GTFO("Cannot set configuration directory: %s", sxc_geterrmsg(sx));
+    cluster = sxc_cluster_new(sx);
+    if(!cluster || sxc_cluster_set_sslname(cluster, BENCH_HOST) || sxc_cluster_set_dnsname(cluster, NULL) ||
+       sxc_cluster_set_uuid(cluster, BENCH_UUID) || sxc_cluster_add_host(cluster, "127.0.0.1") ||
+       sxc_cluster_set_httpport(cluster, node.port) || sxc_cluster_set_cafile(cluster, NULL) ||
+       sxc_cluster_add_access(cluster, BENCH_PROFILE, BENCH_TOKEN) || sxc_cluster_set_access(cluster, BENCH_PROFILE) ||
+       sxc_cluster_fetchnodes(cluster) || sxc_cluster_save(cluster, confdir))
+        GTFO("Cannot configure the cluster: %s", sxc_geterrmsg(sx));
+
+    /* The parts of sxfs' main() the directory cache depends on */
+    args.config_dir_given = 1;
+    args.config_dir_arg = confdir;
+    if(args.debug_flag)
+        sxfs->logfile = stderr;
+    sxfs->args = &args;
+    sxfs->pname = argv[0];
+    sxfs->uri = sxc_parse_uri(sx, "sx://" BENCH_PROFILE "@" BENCH_HOST "/" BENCH_VOLUME);
+    if(!sxfs->uri)
+        GTFO("Cannot parse the volume URI: %s", sxc_geterrmsg(sx));
+    sxfs->threads_max = SXFS_ALLOC_ENTRIES;
+    sxfs->threads = calloc(sxfs->threads_max, sizeof(int));
+    sxfs->root = calloc(1, sizeof(sxfs_lsdir_t));
+    if(!sxfs->threads || !sxfs->root || !(sxfs->root->name = strdup("/")))
+        GTFO("Out of memory");
+    if(!(sxfs->root->etag = sxfs_hash(sxfs, sxfs->root->name)))
+        GTFO("Cannot compute hash of '%s'", sxfs->root->name);
+    sxfs->root->st.st_nlink = 1;
+    sxfs->root->st.st_mode = SXFS_DIR_ATTR;
+    sxfs->root->st.st_size = SXFS_DIR_SIZE;
+    if(pthread_mutex_init(&sxfs->sx_data_mutex, NULL) || pthread_rwlock_init(&sxfs->ls_lock, NULL) ||
+       pthread_mutex_init(&sxfs->delete_mutex, NULL) || pthread_mutex_init(&sxfs->upload_mutex, NULL) ||
+       pthread_mutex_init(&sxfs->limits_mutex, NULL) ||
+       pthread_key_create(&sxfs->sxkey, sxfs_sx_data_destroy) || pthread_key_create(&sxfs->tid_key, sxfs_thread_id_destroy))
+        GTFO("Cannot initialize sxfs locks");
+    if(pthread_mutex_init(&c.mutex, NULL) || pthread_cond_init(&c.cond, NULL))
+        GTFO("Cannot initialize the worker locks");
+    fuse_ctx.private_data = sxfs;
+    c.sxfs = sxfs;
+
+    if(bench_warmup(&c))
+        goto out;
+    printf("{\"dirs\":%u,\"files\":%u,\"readdir_pct\":%u,\"latency_msec\":%u,\"churn\":%s,\"benchmarks\":[",
+           c.dirs, c.files, c.readdir_pct, node.latency, node.churn ? "true" : "false");
+    json = 1;
+    for(i=0; i<nthreads; i++)
+        if(bench_run(&c, &node, threads[i], seconds))
+            goto out;
+    ret = 0;
+
+ out:
+    if(json)
+        printf("\n]}\n");
+    /* The fake node and the worker cluster handles go away with the process */
+    sxc_cluster_free(cluster);
+    if(sxfs->root)
+        sxfs_lsdir_free(sxfs->root);
+    sxc_free_uri(sxfs->uri);
+    free(sxfs->threads);
+    if(confdir && !keep)
+        nftw(dir, rmtree_cb, 16, FTW_DEPTH | FTW_PHYS);
+    free(sxfs->tempdir);
+    free(confdir);
+    sxc_client_shutdown(sx, 0);
+    return ret;
+}
@@ -337,6 +337,8 @@ int sxc_file_list_add(sxc_file_list_t *lst, sxc_file_t *file, int allow_glob);
 void sxc_file_list_free(sxc_file_list_t *sx);/* frees contained sx_file_t too */
 unsigned sxc_file_list_get_total(const sxc_file_list_t *lst);
 unsigned sxc_file_list_get_successful(const sxc_file_list_t *lst);
+/* Upload up to nfiles local files at the same time (default: 1) */
+int sxc_file_list_set_parallel_files(sxc_file_list_t *lst, unsigned int nfiles);
 
 int sxc_rm(sxc_file_list_t *target, int mass);
 int sxc_remove_sxfile(sxc_file_t *file);
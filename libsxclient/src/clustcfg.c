@@ -863,6 +863,7 @@ struct cb_locate_ctx {
     int64_t used_size;
     int64_t files_size;
     int64_t nfiles;
+    int64_t growable_size;
     char *owner;
     char *privs;
     unsigned int replica_count;
@@ -1018,6 +1019,18 @@ static void cb_locate_fsize(jparse_t *J, void *ctx, int64_t num) {
     yactx->files_size = num;
 }
 
+static void cb_locate_growable(jparse_t *J, void *ctx, int64_t num) {
+    struct cb_locate_ctx *yactx = (struct cb_locate_ctx *)ctx;
+
+    if(num <= 0) {
+        sxi_jparse_cancel(J, "Invalid growable size received");
+        yactx->err = SXE_ECOMM;
+        return;
+    }
+
+    yactx->growable_size = num;
+}
+
 static void cb_locate_nfiles(jparse_t *J, void *ctx, int64_t num) {
     struct cb_locate_ctx *yactx = (struct cb_locate_ctx *)ctx;
 
@@ -1104,7 +1117,8 @@ static int locate_cb(curlev_context_t *cbdata, void *ctx, const void *data, size
     return 0;
 }
 
-int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, char **owner, char **privs, int64_t *size, int64_t *used_size, int64_t *files_size, int64_t *nfiles, unsigned int *replica_count, unsigned int *effective_replica_count, unsigned int *revisions, sxc_meta_t *meta, sxc_meta_t *custom_meta) {
+/* growable_size set means that blocksize is requested for a file of yet unknown size */
+static int volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, int64_t *growable_size, char **owner, char **privs, int64_t *size, int64_t *used_size, int64_t *files_size, int64_t *nfiles, unsigned int *replica_count, unsigned int *effective_replica_count, unsigned int *revisions, sxc_meta_t *meta, sxc_meta_t *custom_meta) {
     const struct jparse_actions acts = {
 	JPACTS_STRING(
 		      JPACT(cb_locate_node, JPKEY("nodeList"), JPANYITM),
@@ -1118,7 +1132,8 @@ int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *node
                      JPACT(cb_locate_size, JPKEY("sizeBytes")),
                      JPACT(cb_locate_usedsize, JPKEY("usedSize")),
                      JPACT(cb_locate_fsize, JPKEY("filesSize")),
-                     JPACT(cb_locate_nfiles, JPKEY("filesCount"))
+                     JPACT(cb_locate_nfiles, JPKEY("filesCount")),
+                     JPACT(cb_locate_growable, JPKEY("growableSize"))
                      ),
         JPACTS_INT32(
                      JPACT(cb_locate_rpl, JPKEY("replicaCount")),
@@ -1152,7 +1167,9 @@ int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *node
 	free(enc_vol);
 	return 1;
     }
-    if(blocksize)
+    if(growable_size)
+	sprintf(url, "%s?o=locate&size=growable", enc_vol);
+    else if(blocksize)
 	sprintf(url, "%s?o=locate&size=%lld", enc_vol, (long long int)*blocksize);
     else
 	sprintf(url, "%s?o=locate", enc_vol);
@@ -1196,6 +1213,17 @@ int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *node
     }
     sxi_jparse_destroy(yctx.J);
 
+    if(growable_size) {
+        if(yctx.growable_size <= 0 || yctx.blocksize <= 0) {
+            sxi_seterr(sx, SXE_ECOMM, "The cluster does not support growing files");
+            sxc_meta_empty(custom_meta);
+            sxc_meta_empty(meta);
+            free(yctx.privs);
+            free(yctx.owner);
+            return -1;
+        }
+        *growable_size = yctx.growable_size;
+    }
     if(blocksize)
 	*blocksize = yctx.blocksize;
     if(size)
@@ -1224,6 +1252,15 @@ int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *node
     return 0;
 }
 
+int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, char **owner, char **privs, int64_t *size, int64_t *used_size, int64_t *files_size, int64_t *nfiles, unsigned int *replica_count, unsigned int *effective_replica_count, unsigned int *revisions, sxc_meta_t *meta, sxc_meta_t *custom_meta) {
+    return volume_info(conns, volume, nodes, blocksize, NULL, owner, privs, size, used_size, files_size, nfiles, replica_count, effective_replica_count, revisions, meta, custom_meta);
+}
+
+int sxi_locate_volume_growable(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, int64_t *growable_size, sxc_meta_t *metadata) {
+    sxi_set_operation(sxi_conns_get_client(conns), "locate volume", volume, NULL, NULL);
+    return volume_info(conns, volume, nodes, blocksize, growable_size, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, metadata, NULL);
+}
+
 int sxi_locate_volume(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *size, sxc_meta_t *metadata, sxc_meta_t *custom_metadata) {
     sxi_set_operation(sxi_conns_get_client(conns), "locate volume", volume, NULL, NULL);
     return sxi_volume_info(conns, volume, nodes, size, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, metadata, custom_metadata);
@@ -4172,6 +4209,10 @@ static void cb_nodest_usrjobs(jparse_t *J, void *ctx, int64_t num) {
     struct node_status_ctx *yactx = (struct node_status_ctx *)ctx;
     yactx->status.usrjobs = num;
 }
+static void cb_nodest_joblag(jparse_t *J, void *ctx, int64_t num) {
+    struct node_status_ctx *yactx = (struct node_status_ctx *)ctx;
+    yactx->status.joblag = num;
+}
 
 static int growbq(jparse_t *J, struct node_status_ctx *yactx) {
     const char *node = sxi_jpath_mapkey(sxi_jpath_down(sxi_jpath_down(sxi_jparse_whereami(J))));
@@ -4191,6 +4232,7 @@ static int growbq(jparse_t *J, struct node_status_ctx *yactx) {
 	yactx->status.bqstat = nubq;
 	strcpy(yactx->status.bqstat[yactx->status.nbq-1].node, node);
 	yactx->status.bqstat[yactx->status.nbq-1].ready = -1;
+	yactx->status.bqstat[yactx->status.nbq-1].lag = -1;
 	yactx->status.bqstat[yactx->status.nbq-1].held = -1;
 	yactx->status.bqstat[yactx->status.nbq-1].unbumps = -1;
     }
@@ -4201,6 +4243,11 @@ static void cb_nodest_bq_ready(jparse_t *J, void *ctx, int64_t num) {
     if(!growbq(J, yactx))
 	yactx->status.bqstat[yactx->status.nbq-1].ready = num;
 }
+static void cb_nodest_bq_lag(jparse_t *J, void *ctx, int64_t num) {
+    struct node_status_ctx *yactx = (struct node_status_ctx *)ctx;
+    if(!growbq(J, yactx))
+	yactx->status.bqstat[yactx->status.nbq-1].lag = num;
+}
 static void cb_nodest_bq_held(jparse_t *J, void *ctx, int64_t num) {
     struct node_status_ctx *yactx = (struct node_status_ctx *)ctx;
     if(!growbq(J, yactx))
@@ -4267,7 +4314,9 @@ int sxi_cluster_status(sxc_cluster_t *cluster, const node_status_cb_t status_cb,
                      JPACT(cb_nodest_swap_free, JPKEY("swapFree")),
 		     JPACT(cb_nodest_sysjobs, JPKEY("queueStatus"), JPKEY("eventQueue"), JPKEY("systemJobs")),
 		     JPACT(cb_nodest_usrjobs, JPKEY("queueStatus"), JPKEY("eventQueue"), JPKEY("userJobs")),
+		     JPACT(cb_nodest_joblag, JPKEY("queueStatus"), JPKEY("eventQueue"), JPKEY("lag")),
 		     JPACT(cb_nodest_bq_ready, JPKEY("queueStatus"), JPKEY("transferQueue"), JPANYKEY, JPKEY("ready")),
+		     JPACT(cb_nodest_bq_lag, JPKEY("queueStatus"), JPKEY("transferQueue"), JPANYKEY, JPKEY("lag")),
 		     JPACT(cb_nodest_bq_held, JPKEY("queueStatus"), JPKEY("transferQueue"), JPANYKEY, JPKEY("held")),
 		     JPACT(cb_nodest_bq_unbumps, JPKEY("queueStatus"), JPKEY("transferQueue"), JPANYKEY, JPKEY("unbumps"))
 		     ),
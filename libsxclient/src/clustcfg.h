@@ -33,6 +33,7 @@ char *sxi_urlencode(sxc_client_t *sx, const char *string, int encode_slash);
 sxi_conns_t *sxi_cluster_get_conns(sxc_cluster_t *cluster);
 #define sxi_cluster_get_name(CLUSTER) sxc_cluster_get_sslname(CLUSTER)
 int sxi_locate_volume(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *size, sxc_meta_t *metadata, sxi_ht *custom_metadata);
+int sxi_locate_volume_growable(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, int64_t *growable_size, sxc_meta_t *metadata);
 int sxi_volume_info(sxi_conns_t *conns, const char *volume, sxi_hostlist_t *nodes, int64_t *blocksize, char **owner, char **privs, int64_t *size, int64_t *used_size, int64_t *files_size, int64_t *nfiles, unsigned int *replica_count, unsigned int *effective_replica_count, unsigned int *revisions, sxc_meta_t *meta, sxc_meta_t *custom_meta);
 const char *sxi_cluster_get_confdir(const sxc_cluster_t *cluster);
 
@@ -189,11 +189,11 @@ typedef struct _node_status_t {
     size_t network_traffic_json_size;
 
     /* Event queue */
-    int64_t sysjobs, usrjobs;
+    int64_t sysjobs, usrjobs, joblag;
     /* Block queue */
     unsigned int nbq;
     struct bqstat_t {
-	int64_t ready, held, unbumps;
+	int64_t ready, lag, held, unbumps;
 	char node[UUID_LEN+1];
     } *bqstat;
 } sxi_node_status_t;
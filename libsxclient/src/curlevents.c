@@ -781,6 +781,8 @@ static int check_ssl_cert(curlev_t *ev)
     return 0;
 }
 
+static void update_host_features(curlev_t *ev, const char *ptr, size_t len);
+
 static size_t headfn(void *ptr, size_t size, size_t nmemb, curlev_t *ev)
 {
     curlev_context_t *ctx = ev ? ev->ctx : NULL;
@@ -798,6 +800,8 @@ static size_t headfn(void *ptr, size_t size, size_t nmemb, curlev_t *ev)
         sxi_cbdata_seterr(ctx, SXE_ECURL, "SSL certificate not verified");
         return 0;
     }
+    if(rctx->reply_status < 400)
+        update_host_features(ev, ptr, size * nmemb);
     if (!ev->head)
         return size * nmemb;
     switch (ev->head(ctx, rctx->reply_status, ptr, size, nmemb)) {
@@ -887,6 +891,7 @@ struct host_info {
     double ul_speed[HOST_STATS_WINDOW_SIZE];
     unsigned int ul_index; /* Current position in ul_speed window */
     unsigned int ul_counter; /* Number of ul measures (max is HOST_STATS_WINDOW_SIZE) */
+    unsigned int features; /* Optional protocol features advertised by the host (SXI_FEATURE_*) */
 };
 
 static struct host_info *host_info_new(const char *host) {
@@ -911,6 +916,7 @@ static struct host_info *host_info_new(const char *host) {
     info->dl_index = 0;
     info->dl_counter = 0;
     info->active = 0;
+    info->features = 0;
     return info;
 }
 
@@ -921,6 +927,32 @@ static void host_info_free(struct host_info* info) {
     free(info);
 }
 
+/* Record the optional features listed in the SX-Features header, e.g.
+ * "SX-Features: hashop-bin"; hosts not sending the header have none */
+static void update_host_features(curlev_t *ev, const char *ptr, size_t len)
+{
+    struct host_info *hi = NULL;
+    unsigned int features = 0;
+    const char *end = ptr + len;
+
+    if(len < lenof("SX-Features:") || strncasecmp(ptr, "SX-Features:", lenof("SX-Features:")))
+        return;
+    if(!ev->hosts || !ev->host || sxi_ht_get(ev->hosts, ev->host, strlen(ev->host), (void **)&hi) || !hi)
+        return;
+    ptr += lenof("SX-Features:");
+    while(ptr < end) {
+        const char *tok;
+        while(ptr < end && strchr(" ,\t\r\n", *ptr))
+            ptr++;
+        tok = ptr;
+        while(ptr < end && !strchr(" ,\t\r\n", *ptr))
+            ptr++;
+        if(ptr - tok == lenof("hashop-bin") && !strncmp(tok, "hashop-bin", lenof("hashop-bin")))
+            features |= SXI_FEATURE_HASHOP_BIN;
+    }
+    hi->features = features;
+}
+
 /* Forward declaration */
 struct ev_queue;
 
@@ -1511,6 +1543,18 @@ int sxi_get_host_speed_stats(sxi_conns_t *conns, const char *host, double *ul, d
     return 0;
 }
 
+int sxi_host_has_feature(sxi_conns_t *conns, const char *host, unsigned int feature) {
+    struct host_info *hi = NULL;
+    curl_events_t *e;
+
+    if(!conns || !host)
+        return 0;
+    e = sxi_conns_get_curlev(conns);
+    if(!e || !e->conn_pool || sxi_ht_get(e->conn_pool->hosts, host, strlen(host), (void**)&hi) || !hi)
+        return 0;
+    return (hi->features & feature) != 0;
+}
+
 /* Nullify context for each curlev_t element from active and inactive cURL events */
 void sxi_curlev_nullify_upload_context(sxi_conns_t *conns, void *ctx) {
     unsigned int i;
@@ -214,5 +214,9 @@ const char *sxi_hostlist_get_optimal_host(sxi_conns_t * conns, const sxi_hostlis
 int sxi_get_host_speed_stats(sxi_conns_t *conns, const char *host, double *ul, double *dl);
 int sxi_set_host_speed_stats(sxi_conns_t *conns, const char *host, double ul, double dl);
 
+/* Optional protocol features advertised by nodes via the SX-Features header */
+#define SXI_FEATURE_HASHOP_BIN 1 /* packed hashes in, presence bitmap out */
+int sxi_host_has_feature(sxi_conns_t *conns, const char *host, unsigned int feature);
+
 int sxi_vcheck(const char *url, size_t (*vcheck_cb)(char *ptr, size_t size, size_t nmemb, void *userdata), void *userdata);
 #endif
@@ -31,6 +31,7 @@
 #include <curl/curl.h>
 #include <fnmatch.h>
 #include <utime.h>
+#include <pthread.h>
 
 #include "sx.h"
 #include "misc.h"
@@ -72,6 +73,9 @@ struct _sxc_file_t {
     uid_t gid;
 
     mode_t mode;
+
+    /* Block hashes of the previous revision, see sxi_file_set_delta() */
+    sxi_sxfs_delta_t *delta;
 };
 
 sxc_xfer_stat_t* sxi_xfer_new(sxc_client_t *sx, sxc_xfer_callback xfer_callback, void *ctx) {
@@ -261,6 +265,8 @@ static int skip_xfer(sxc_cluster_t *cluster, int64_t bytes) {
 /* Download table is at most 5MB and allows for up to 128GB of uniq content */
 #define BLOCKS_PER_TABLE 131072
 #define INITIAL_HASH_ITEMS MIN(BLOCKS_PER_TABLE, 256)
+/* Streamed downloads (filters, pipes) are staged at most this much at a time */
+#define DOWNLOAD_WINDOW_SIZE (64 * 1024 * 1024)
 #define cluster_err(...) sxi_seterr(sxi_cluster_get_client(cluster), __VA_ARGS__)
 #define cluster_syserr(...) sxi_setsyserr(sxi_cluster_get_client(cluster), __VA_ARGS__)
 
@@ -589,6 +595,13 @@ int sxi_file_set_gid(sxc_file_t *file, uid_t gid) {
     return 0;
 }
 
+int sxi_file_set_delta(sxc_file_t *file, sxi_sxfs_delta_t *delta) {
+    if(!file || (delta && is_remote(file)))
+        return 1;
+    file->delta = delta;
+    return 0;
+}
+
 int sxi_file_set_ctime(sxc_file_t *file, time_t c_time) {
     if(!file)
         return 1;
@@ -720,6 +733,7 @@ sxc_file_t *sxi_file_dup(sxc_file_t *file)
             break;
         if(file->meta && !(ret->meta = sxi_meta_dup(sx, file->meta)))
             break;
+        ret->delta = file->delta;
         ret->meta_fetched = file->meta_fetched;
         return ret;
     } while(0);
@@ -890,6 +904,8 @@ struct checksum_offset {
     off_t offset;
     uint32_t checksum;
     uint32_t ref_checksum;
+    /* Set for blocks taken from a delta, which are verified by hash */
+    const char *hash;
 };
 
 struct need_hash {
@@ -937,6 +953,7 @@ struct file_upload_ctx {
     struct timeval t1;
     struct timeval t2;
     struct part_upload_ctx current;
+    struct upload_hasher *hasher;
     char *host;
     unsigned ok;
     unsigned flush_ok;
@@ -947,6 +964,11 @@ struct file_upload_ctx {
     sxc_meta_t *fmeta;
     sxi_query_t *query;
     char *cur_token;
+    sxi_sxfs_delta_t *delta;
+    /* set when the upload runs in an upload pipeline slot: the flush is
+     * then issued by the pipeline once the event loop returns */
+    int pipelined;
+    unsigned finished;
     /* only one part upload active at any on time.
      * This is to keep uploaded blocks sorted properly
      */
@@ -1372,6 +1394,10 @@ static void file_finish(struct file_upload_ctx *yctx)
     if(size != yctx->size || s.st_mtime != yctx->mtime)
         sxi_notice(sx, "WARNING: Source file has changed during upload");
 
+    if (yctx->pipelined) {
+        yctx->finished++;
+        return;
+    }
     yctx->job = flush_file_ev(yctx->cluster, yctx->host, yctx->current.token, yctx->name, yctx->jobs);
     if (!yctx->job) {
         SXDEBUG("fail incremented due to !job");
@@ -1519,7 +1545,7 @@ static void upload_blocks_to_hosts(curlev_context_t *cbdata, struct file_upload_
             /* Reset currently uploaded size */
             u->ul = 0;
             for (;u->i < u->n;) {
-                uint32_t checksum;
+                int mismatch;
                 struct need_hash *need = &u->needed[u->i++];
                 SXDEBUG("adding data %d from pos %lld", u->i, (long long)need->off.offset);
                 ssize_t n = sxi_pread_hard(yctx->fd, u->buf + u->buf_used, yctx->blocksize, need->off.offset);
@@ -1543,8 +1569,22 @@ static void upload_blocks_to_hosts(curlev_context_t *cbdata, struct file_upload_
                     u->buf_used += remaining;
                 }
                 /* Check the checksum for this block and bail out if its incorrect */
-                checksum = sxi_checksum(need->off.ref_checksum, u->buf + u->buf_used - yctx->blocksize, yctx->blocksize);
-                if(checksum != need->off.checksum) {
+                if(need->off.hash) {
+                    const char *uuid = sxi_conns_get_uuid(sxi_cluster_get_conns(yctx->cluster));
+                    unsigned char md[SXI_SHA1_BIN_LEN];
+                    char hexhash[SXI_SHA1_TEXT_LEN + 1];
+
+                    if(!uuid || sxi_sha1_calc(uuid, strlen(uuid), u->buf + u->buf_used - yctx->blocksize, yctx->blocksize, md)) {
+                        SXDEBUG("fail incremented: cannot hash block");
+                        sxi_seterr(sx, SXE_ECRYPT, "Failed to calculate hash");
+                        yctx->fail++;
+                        return;
+                    }
+                    sxi_bin2hex(md, sizeof(md), hexhash);
+                    mismatch = memcmp(hexhash, need->off.hash, SXI_SHA1_TEXT_LEN);
+                } else
+                    mismatch = sxi_checksum(need->off.ref_checksum, u->buf + u->buf_used - yctx->blocksize, yctx->blocksize) != need->off.checksum;
+                if(mismatch) {
                     SXDEBUG("fail incremented: SXI_CHECKSUM mismatch");
                     sxi_seterr(sx, SXE_EREAD, "Copy failed: Source file changed while being read");
                     yctx->fail++;
@@ -1683,75 +1723,272 @@ static void multi_part_upload_blocks(curlev_context_t *ctx, const char *url)
     upload_blocks_to_hosts(ctx, yctx, NULL, status, url);
 }
 
-static int multi_part_compute_hash_ev(struct file_upload_ctx *yctx)
-{
-    sxc_client_t *sx = sxi_cluster_get_client(yctx->cluster);;
+/* Block hashing for uploads
+ *
+ * Each chunk read from the source file is split into blocks which are
+ * hashed by a small pool of worker threads, with the calling thread
+ * joining in once it has read ahead the next chunk. Results are stored
+ * per block and consumed in block order, so the query and the checksums
+ * are the same as when hashing serially. */
+#define HASHER_MAX_THREADS 8
+#define HASHER_MAX_BLOCKS (SX_BS_LARGE / SX_BS_SMALL)
+
+struct upload_hasher {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    pthread_t threads[HASHER_MAX_THREADS];
+    unsigned int nthreads;
+    int quit;
+
+    /* Current chunk, protected by lock */
+    const char *data;
+    unsigned int blocksize;
+    unsigned int nblocks;
+    unsigned int next;
+    unsigned int grab;
+    unsigned int pending;
+    int failed;
+
+    const char *salt;
+    unsigned int salt_len;
+    char *readahead;
+    char hashes[HASHER_MAX_BLOCKS][SXI_SHA1_TEXT_LEN+1];
+    uint32_t checksums[HASHER_MAX_BLOCKS];
+};
+
+/* Hashes blocks of the current chunk until there are none left,
+ * must be called with the lock held */
+static void hasher_run(struct upload_hasher *hs) {
+    while(hs->next < hs->nblocks) {
+        unsigned int i, first = hs->next, last = MIN(first + hs->grab, hs->nblocks);
+        int failed = 0;
+
+        hs->next = last;
+        pthread_mutex_unlock(&hs->lock);
+        for(i=first; i<last; i++) {
+            const char *block = hs->data + (size_t)i * hs->blocksize;
+            unsigned char md[SXI_SHA1_BIN_LEN];
+
+            if(sxi_sha1_calc(hs->salt, hs->salt_len, block, hs->blocksize, md)) {
+                failed = 1;
+                break;
+            }
+            sxi_bin2hex(md, sizeof(md), hs->hashes[i]);
+            hs->hashes[i][SXI_SHA1_TEXT_LEN] = '\0';
+            hs->checksums[i] = sxi_checksum(sxi_checksum(0, NULL, 0), block, hs->blocksize);
+        }
+        pthread_mutex_lock(&hs->lock);
+        if(failed)
+            hs->failed = 1;
+        hs->pending -= last - first;
+        if(!hs->pending)
+            pthread_cond_signal(&hs->done_cond);
+    }
+}
+
+static void *hasher_thread(void *ctx) {
+    struct upload_hasher *hs = ctx;
+
+    pthread_mutex_lock(&hs->lock);
+    while(!hs->quit) {
+        if(hs->next < hs->nblocks)
+            hasher_run(hs);
+        else
+            pthread_cond_wait(&hs->work_cond, &hs->lock);
+    }
+    pthread_mutex_unlock(&hs->lock);
+    return NULL;
+}
+
+static void hasher_free(struct upload_hasher *hs) {
+    unsigned int i;
+
+    if(!hs)
+        return;
+    if(hs->nthreads) {
+        pthread_mutex_lock(&hs->lock);
+        hs->quit = 1;
+        pthread_cond_broadcast(&hs->work_cond);
+        pthread_mutex_unlock(&hs->lock);
+        for(i=0; i<hs->nthreads; i++)
+            pthread_join(hs->threads[i], NULL);
+    }
+    pthread_cond_destroy(&hs->done_cond);
+    pthread_cond_destroy(&hs->work_cond);
+    pthread_mutex_destroy(&hs->lock);
+    free(hs->readahead);
+    free(hs);
+}
+
+/* Falls back to hashing on the calling thread when threads are not available */
+static struct upload_hasher *hasher_new(sxc_client_t *sx, const char *salt, int threaded) {
+    struct upload_hasher *hs = calloc(1, sizeof(*hs));
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int i, want;
+
+    if(!hs) {
+        sxi_seterr(sx, SXE_EMEM, "Out of memory");
+        return NULL;
+    }
+    if(pthread_mutex_init(&hs->lock, NULL)) {
+        free(hs);
+        sxi_seterr(sx, SXE_EMEM, "Cannot initialize hasher lock");
+        return NULL;
+    }
+    if(pthread_cond_init(&hs->work_cond, NULL)) {
+        pthread_mutex_destroy(&hs->lock);
+        free(hs);
+        sxi_seterr(sx, SXE_EMEM, "Cannot initialize hasher condition");
+        return NULL;
+    }
+    if(pthread_cond_init(&hs->done_cond, NULL)) {
+        pthread_cond_destroy(&hs->work_cond);
+        pthread_mutex_destroy(&hs->lock);
+        free(hs);
+        sxi_seterr(sx, SXE_EMEM, "Cannot initialize hasher condition");
+        return NULL;
+    }
+    hs->salt = salt;
+    hs->salt_len = strlen(salt);
+
+    /* The calling thread hashes too */
+    want = threaded && ncpus > 1 ? MIN(ncpus, HASHER_MAX_THREADS) - 1 : 0;
+    if(want && !(hs->readahead = malloc(SX_BS_LARGE)))
+        want = 0;
+    for(i=0; i<want; i++) {
+        if(pthread_create(&hs->threads[i], NULL, hasher_thread, hs))
+            break;
+        hs->nthreads++;
+    }
+    if(!hs->nthreads) {
+        free(hs->readahead);
+        hs->readahead = NULL;
+    }
+    SXDEBUG("Hashing with %u worker threads", hs->nthreads);
+    return hs;
+}
+
+static void hasher_submit(struct upload_hasher *hs, const char *data, unsigned int blocksize, unsigned int nblocks) {
+    pthread_mutex_lock(&hs->lock);
+    hs->data = data;
+    hs->blocksize = blocksize;
+    hs->nblocks = hs->pending = nblocks;
+    hs->next = 0;
+    hs->failed = 0;
+    /* Small grabs balance the load, larger ones keep lock traffic down */
+    hs->grab = MAX(1, nblocks / ((hs->nthreads + 1) * 4));
+    if(hs->nthreads && nblocks > 1)
+        pthread_cond_broadcast(&hs->work_cond);
+    pthread_mutex_unlock(&hs->lock);
+}
+
+static int hasher_wait(struct upload_hasher *hs) {
+    int ret;
+
+    pthread_mutex_lock(&hs->lock);
+    hasher_run(hs);
+    while(hs->pending)
+        pthread_cond_wait(&hs->done_cond, &hs->lock);
+    ret = hs->failed ? -1 : 0;
+    pthread_mutex_unlock(&hs->lock);
+    return ret;
+}
+
+/* Reads the next chunk of the current part, zero padding the last block */
+static int hasher_read(struct file_upload_ctx *yctx, char *buf, ssize_t *nread) {
+    sxc_client_t *sx = sxi_cluster_get_client(yctx->cluster);
+    unsigned remaining;
     ssize_t n;
-    off_t start = yctx->pos;
-    unsigned part_size = yctx->end - yctx->pos;
-    sxc_meta_t *fmeta;
-    yctx->last_pos = yctx->pos;
 
-    if(yctx->pos == 0) {
-	fmeta = yctx->fmeta;
-	yctx->query = sxi_fileadd_proto_begin(sx, yctx->dest->volume, yctx->dest->remote_path, NULL, NULL, yctx->pos, yctx->blocksize, yctx->size);
-        yctx->ref_checksum = sxi_checksum(0, NULL, 0);
-    } else {
-	fmeta = NULL;
-	yctx->query = sxi_fileadd_proto_begin(sx, ".upload", yctx->cur_token, NULL, NULL, yctx->pos, yctx->blocksize, yctx->size);
-        /* extend is only valid on the node that created the file
-         * (same as with flush!) */
-        sxi_hostlist_empty(yctx->volhosts);
-        if (sxi_hostlist_add_host(sx, yctx->volhosts, yctx->host))
-            return -1;
+    SXDEBUG("pos:%lld",(long long)yctx->pos);
+    n = sxi_pread_hard(yctx->fd, buf, SX_BS_LARGE, yctx->pos);
+    if (n < 0) {
+        SXDEBUG("failed to read from source file");
+        sxi_setsyserr(sx, SXE_EREAD, "Block upload failed while reading source file");
+        return -1;
     }
-    if(!yctx->query) {
-        SXDEBUG("failed to allocate query");
+    /* set partial block to zero */
+    remaining = yctx->blocksize - n % yctx->blocksize;
+    if (remaining < yctx->blocksize)
+        memset(buf + n, 0, remaining);
+    yctx->pos += n;
+    if (yctx->pos > yctx->end || (!n && yctx->pos != yctx->end)) {
+        SXDEBUG("source file changed while being read");
+        sxi_seterr(sx, SXE_EREAD, "Copy failed: Source file changed while being read");
         return -1;
     }
+    *nread = n;
+    return 0;
+}
 
-    /* TODO; for last partial block upload all hashes */
-    do {
-        /* hash_chunk -> finish cb -> hash_chunk ... */
-        unsigned i, remaining;
-        SXDEBUG("pos:%lld",(long long)yctx->pos);
-        n = sxi_pread_hard(yctx->fd, yctx->buf, sizeof(yctx->buf), yctx->pos);
-        if (n < 0) {
-            SXDEBUG("failed to read from source file");
-            sxi_setsyserr(sx, SXE_EREAD, "Block upload failed while reading source file");
+static int hasher_compute_hash(struct file_upload_ctx *yctx, off_t start)
+{
+    sxc_client_t *sx = sxi_cluster_get_client(yctx->cluster);
+    struct upload_hasher *hs;
+    char *cur;
+    ssize_t n;
+    off_t cur_pos;
+
+    if(!yctx->hasher) {
+        const char *uuid = sxi_conns_get_uuid(sxi_cluster_get_conns(yctx->cluster));
+        if(!uuid) {
+            SXDEBUG("cluster has got no uuid");
+            sxi_seterr(sx, SXE_EARG, "Cannot compute hash: No cluster uuid is set");
             return -1;
         }
-        /* set partial block to zero */
-        remaining = yctx->blocksize - n % yctx->blocksize;
-        if (remaining < yctx->blocksize)
-            memset(yctx->buf + n, 0, remaining);
-        yctx->pos += n;
-        if (yctx->pos > yctx->end || (!n && yctx->pos != yctx->end)) {
-            SXDEBUG("source file changed while being read");
-            sxi_seterr(sx, SXE_EREAD, "Copy failed: Source file changed while being read");
+        /* Threads only pay off when there is more than a chunk to hash */
+        yctx->hasher = hasher_new(sx, uuid, yctx->size > SX_BS_LARGE);
+        if(!yctx->hasher)
             return -1;
-        }
-        for (i=0;i<n;i += yctx->blocksize) {
-	    char hexhash[SXI_SHA1_TEXT_LEN+1];
-            size_t block;
+    }
+    hs = yctx->hasher;
 
-            if (sxi_cluster_hashcalc(yctx->cluster, yctx->buf + i, yctx->blocksize, hexhash)) {
-                SXDEBUG("failed to compute hash for block");
+    /* TODO; for last partial block upload all hashes */
+    cur = yctx->buf;
+    cur_pos = yctx->pos;
+    if(hasher_read(yctx, cur, &n))
+        return -1;
+    while(1) {
+        unsigned i, nblocks = (n + yctx->blocksize - 1) / yctx->blocksize;
+        int more = n > 0 && yctx->pos < yctx->end;
+        char *next = NULL;
+        off_t next_pos = 0;
+        ssize_t next_n = 0;
+
+        hasher_submit(hs, cur, yctx->blocksize, nblocks);
+        if(more && hs->readahead) {
+            /* Read the next chunk while the current one is being hashed */
+            next = cur == yctx->buf ? hs->readahead : yctx->buf;
+            next_pos = yctx->pos;
+            if(hasher_read(yctx, next, &next_n)) {
+                hasher_wait(hs);
                 return -1;
             }
-	    hexhash[SXI_SHA1_TEXT_LEN] = '\0';
+        }
+        if(hasher_wait(hs)) {
+            SXDEBUG("failed to compute hash for block");
+            sxi_seterr(sx, SXE_ECRYPT, "Failed to calculate hash");
+            return -1;
+        }
+
+        for (i=0;i<nblocks;i++) {
+	    const char *hexhash = hs->hashes[i];
+            off_t pos = cur_pos + (off_t)i * yctx->blocksize;
+            size_t block;
+
 	    yctx->query = sxi_fileadd_proto_addhash(sx, yctx->query, hexhash);
 	    if(!yctx->query) {
 		SXDEBUG("failed to add hash");
 		return -1;
 	    }
 
-            off_t pos = yctx->pos - n + i;
             block = (pos - start) / yctx->blocksize;
             yctx->current.offsets[block].offset = pos;
             /* Calculate checksum for each block and store it for comparison later */
-            yctx->current.offsets[block].checksum = sxi_checksum(yctx->ref_checksum, yctx->buf + i, yctx->blocksize);
+            yctx->current.offsets[block].checksum = sxi_checksum_combine(yctx->ref_checksum, hs->checksums[i], yctx->blocksize);
             yctx->current.offsets[block].ref_checksum = yctx->ref_checksum;
+            yctx->current.offsets[block].hash = NULL;
             yctx->ref_checksum = yctx->current.offsets[block].checksum; /* Save reference checksum for next block */
             SXDEBUG("%p, hash %s: block %ld, %lld, checksum: %lu", (const void*)yctx, hexhash, (long)block, (long long)yctx->current.offsets[block].offset, (unsigned long)yctx->current.offsets[block].checksum);
             if(sxi_ht_add(yctx->current.hashes, hexhash, SXI_SHA1_TEXT_LEN, &yctx->current.offsets[block])) {
@@ -1759,7 +1996,119 @@ static int multi_part_compute_hash_ev(struct file_upload_ctx *yctx)
                 return -1;
             }
         }
-    } while (n > 0 && yctx->pos < yctx->end);
+
+        if(!more)
+            break;
+        if(next) {
+            cur = next;
+            cur_pos = next_pos;
+            n = next_n;
+        } else {
+            cur_pos = yctx->pos;
+            if(hasher_read(yctx, cur, &n))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Like hasher_compute_hash() but only reads and hashes the dirty blocks */
+static int delta_compute_hash(struct file_upload_ctx *yctx, off_t start)
+{
+    sxc_client_t *sx = sxi_cluster_get_client(yctx->cluster);
+    const char *uuid = sxi_conns_get_uuid(sxi_cluster_get_conns(yctx->cluster));
+    sxi_sxfs_delta_t *delta = yctx->delta;
+    uint32_t init = sxi_checksum(0, NULL, 0);
+    unsigned char md[SXI_SHA1_BIN_LEN];
+    unsigned int reused = 0, hashed = 0;
+    off_t pos;
+
+    if(!uuid) {
+        SXDEBUG("cluster has got no uuid");
+        sxi_seterr(sx, SXE_EARG, "Cannot compute hash: No cluster uuid is set");
+        return -1;
+    }
+    for(pos = start; pos < yctx->end; pos += yctx->blocksize) {
+        unsigned int idx = pos / yctx->blocksize;
+        struct checksum_offset *off = &yctx->current.offsets[(pos - start) / yctx->blocksize];
+        char *hexhash = delta->ha[idx];
+
+        off->offset = pos;
+        if(SXI_DELTA_DIRTY(delta, idx)) {
+            ssize_t n = sxi_pread_hard(yctx->fd, yctx->buf, yctx->blocksize, pos);
+            if(n < 0) {
+                SXDEBUG("failed to read from source file");
+                sxi_setsyserr(sx, SXE_EREAD, "Block upload failed while reading source file");
+                return -1;
+            }
+            if(!n || (n < yctx->blocksize && pos + n != yctx->end)) {
+                SXDEBUG("source file changed while being read");
+                sxi_seterr(sx, SXE_EREAD, "Copy failed: Source file changed while being read");
+                return -1;
+            }
+            memset(yctx->buf + n, 0, yctx->blocksize - n);
+            if(sxi_sha1_calc(uuid, strlen(uuid), yctx->buf, yctx->blocksize, md)) {
+                SXDEBUG("failed to compute hash for block");
+                sxi_seterr(sx, SXE_ECRYPT, "Failed to calculate hash");
+                return -1;
+            }
+            sxi_bin2hex(md, sizeof(md), hexhash);
+            hexhash[SXI_SHA1_TEXT_LEN] = '\0';
+            /* Standalone checksum, dirty blocks are not chained */
+            off->checksum = sxi_checksum(init, yctx->buf, yctx->blocksize);
+            off->ref_checksum = init;
+            off->hash = NULL;
+            hashed++;
+        } else {
+            off->checksum = off->ref_checksum = 0;
+            off->hash = hexhash;
+            reused++;
+        }
+
+        yctx->query = sxi_fileadd_proto_addhash(sx, yctx->query, hexhash);
+        if(!yctx->query) {
+            SXDEBUG("failed to add hash");
+            return -1;
+        }
+        if(sxi_ht_add(yctx->current.hashes, hexhash, SXI_SHA1_TEXT_LEN, off)) {
+            SXDEBUG("failed to add hash offset");
+            return -1;
+        }
+    }
+    yctx->pos = yctx->end;
+    SXDEBUG("%u blocks hashed, %u taken from the previous revision", hashed, reused);
+    return 0;
+}
+
+static int multi_part_compute_hash_ev(struct file_upload_ctx *yctx)
+{
+    sxc_client_t *sx = sxi_cluster_get_client(yctx->cluster);;
+    off_t start = yctx->pos;
+    unsigned part_size = yctx->end - yctx->pos;
+    sxc_meta_t *fmeta;
+    yctx->last_pos = yctx->pos;
+
+    if(yctx->pos == 0) {
+	fmeta = yctx->fmeta;
+	yctx->query = sxi_fileadd_proto_begin(sx, yctx->dest->volume, yctx->dest->remote_path, NULL, NULL, yctx->pos, yctx->blocksize, yctx->size);
+        yctx->ref_checksum = sxi_checksum(0, NULL, 0);
+    } else {
+	fmeta = NULL;
+	yctx->query = sxi_fileadd_proto_begin(sx, ".upload", yctx->cur_token, NULL, NULL, yctx->pos, yctx->blocksize, yctx->size);
+        /* extend is only valid on the node that created the file
+         * (same as with flush!) */
+        sxi_hostlist_empty(yctx->volhosts);
+        if (sxi_hostlist_add_host(sx, yctx->volhosts, yctx->host))
+            return -1;
+    }
+    if(!yctx->query) {
+        SXDEBUG("failed to allocate query");
+        return -1;
+    }
+
+    if(yctx->delta ? delta_compute_hash(yctx, start) : hasher_compute_hash(yctx, start))
+        return -1;
 
     yctx->query = sxi_fileadd_proto_end(sx, yctx->query, fmeta);
     if(!yctx->query) {
@@ -1896,6 +2245,8 @@ static sxi_job_t* multi_upload(struct file_upload_ctx *state, long *http_status)
         ret = -1;
     }
     part_free(&state->current);
+    hasher_free(state->hasher);
+    state->hasher = NULL;
     free(state->cur_token);
     sxi_query_free(state->query);
     if (!ret)
@@ -2046,7 +2397,151 @@ static int restore_path(sxc_file_t *dest)
     return 1;
 }
 
-static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, int single_source, int recursive, long *http_status, sxi_jobs_t *jobs) {
+/* Upload pipeline
+ *
+ * When copying many local files to a cluster each upload used to run to
+ * completion (hashing, create, block upload, flush) before the next file
+ * was even opened. The pipeline keeps up to nslots single part uploads in
+ * flight on the cluster event loop instead: a file is hashed and its create
+ * query sent, then the next file is started while the blocks of the
+ * previous ones are being uploaded. Finished uploads are reaped from the
+ * top level, where their flush is submitted and the job handed over to the
+ * jobs context, which polls all of them together. */
+struct upload_slot {
+    struct file_upload_ctx *state;
+    char *path;
+};
+
+struct upload_pipeline {
+    sxc_client_t *sx;
+    sxi_jobs_t *jobs;
+    int *errors;
+    int ignore_errors;
+    long failed;
+    unsigned int nslots;
+    unsigned int nactive;
+    struct upload_slot *slots;
+};
+
+static struct upload_pipeline *upload_pipeline_new(sxc_client_t *sx, unsigned int nslots, sxi_jobs_t *jobs, int *errors, int ignore_errors)
+{
+    struct upload_pipeline *p = calloc(1, sizeof(*p));
+
+    if(!p || !(p->slots = calloc(nslots, sizeof(*p->slots)))) {
+        sxi_seterr(sx, SXE_EMEM, "Cannot allocate upload pipeline: Out of memory");
+        free(p);
+        return NULL;
+    }
+    p->sx = sx;
+    p->jobs = jobs;
+    p->errors = errors;
+    p->ignore_errors = ignore_errors;
+    p->nslots = nslots;
+    return p;
+}
+
+static void upload_pipeline_reap(struct upload_pipeline *p, struct upload_slot *slot, int abandon)
+{
+    struct file_upload_ctx *state = slot->state;
+    sxc_client_t *sx = p->sx;
+    sxc_xfer_stat_t *xfer_stat;
+    sxi_job_t *job = NULL;
+    int rc;
+
+    rc = part_wait_reset(state);
+    if(!rc && !state->fail && state->finished && !abandon)
+        job = flush_file_ev(state->cluster, state->host, state->cur_token, state->name, NULL);
+    if(abandon) {
+        SXDEBUG("abandoning upload of %s", slot->path);
+    } else if(!job) {
+        SXDEBUG("upload of %s failed: fail is %d, rc is %d", slot->path, state->fail, rc);
+        if(sxc_geterrnum(sx) == SXE_NOERROR)
+            sxi_seterr(sx, SXE_ECOMM, "Copy failed: Failed to upload file");
+        sxi_notice(sx, "%s: %s", slot->path, sxc_geterrmsg(sx));
+        (*p->errors)++;
+        p->failed = state->qret > 0 ? state->qret : -1;
+    } else if(sxi_jobs_add(p->jobs, job)) {
+        SXDEBUG("failed to add job to jobs context");
+        sxi_job_free(job);
+        (*p->errors)++;
+        p->failed = -1;
+    }
+
+    xfer_stat = sxi_cluster_get_xfer_stat(state->cluster);
+    if(xfer_stat && xfer_stat->current_xfer.file_name == slot->path)
+        xfer_stat->current_xfer.file_name = "";
+    hasher_free(state->hasher);
+    free(state->cur_token);
+    free(state->name);
+    free(state->host);
+    if(state->fd >= 0)
+        close(state->fd);
+    free(state);
+    free(slot->path);
+    slot->state = NULL;
+    slot->path = NULL;
+    p->nactive--;
+}
+
+/* Reap finished uploads until no more than maxactive are left running */
+static int upload_pipeline_wait(struct upload_pipeline *p, unsigned int maxactive)
+{
+    sxc_client_t *sx = p->sx;
+    sxc_cluster_t *cluster = NULL;
+    unsigned int i;
+
+    while(1) {
+        for(i = 0; i < p->nslots; i++) {
+            struct file_upload_ctx *state = p->slots[i].state;
+            if(!state)
+                continue;
+            if(!state->current.ref)
+                upload_pipeline_reap(p, &p->slots[i], 0);
+            else
+                cluster = state->cluster;
+        }
+        if(p->nactive <= maxactive)
+            return 0;
+        if(sxi_curlev_poll(sxi_conns_get_curlev(sxi_cluster_get_conns(cluster))) < 0) {
+            SXDEBUG("curlev_poll failed");
+            return -1;
+        }
+    }
+}
+
+static int upload_pipeline_drain(struct upload_pipeline *p)
+{
+    if(!p)
+        return 0;
+    return upload_pipeline_wait(p, 0);
+}
+
+static void upload_pipeline_free(struct upload_pipeline *p)
+{
+    unsigned int i;
+
+    if(!p)
+        return;
+    for(i = 0; i < p->nslots; i++) {
+        if(p->slots[i].state)
+            upload_pipeline_reap(p, &p->slots[i], 1);
+    }
+    free(p->slots);
+    free(p);
+}
+
+/* Hand a started upload over to a free slot, see upload_pipeline_wait() */
+static void upload_pipeline_add(struct upload_pipeline *p, struct file_upload_ctx *state, char *path)
+{
+    unsigned int i;
+
+    for(i = 0; p->slots[i].state; i++);
+    p->slots[i].state = state;
+    p->slots[i].path = path;
+    p->nactive++;
+}
+
+static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, int single_source, int recursive, long *http_status, sxi_jobs_t *jobs, struct upload_pipeline *pipeline) {
     unsigned int blocksize;
     char *fname = NULL, *tempfname = NULL;
     struct stat st;
@@ -2062,7 +2557,7 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
     struct filter_handle *fh = NULL;
     long qret = -1;
     sxc_xfer_stat_t *xfer_stat = NULL;
-    char *fdir = NULL;
+    char *fdir = NULL, *slot_path = NULL;
     sxi_job_t *ret = NULL, *job;
 
     sxi_hostlist_init(&volhosts);
@@ -2132,7 +2627,7 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
 	    SXDEBUG("failed to create source file object for temporary input file");
 	else {
             /* We use a temporary file, therefore source is single. */
-	    ret = local_to_remote_begin(tsource, dest, 1, 1, http_status, jobs);
+	    ret = local_to_remote_begin(tsource, dest, 1, 1, http_status, jobs, NULL);
 	    sxc_file_free(tsource);
 	}
 	goto local_to_remote_err; /* cleanup, not necessarily an error */
@@ -2375,6 +2870,23 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
     state->dest = dest;
     state->size = st.st_size;
     state->mtime = st.st_mtime;
+    /* Filters rewrite the data and a different block size voids the hashes */
+    if(source->delta && !(fh && fh->f->data_process) && source->delta->blocksize == blocksize &&
+       source->delta->nhashes == (st.st_size + blocksize - 1) / blocksize)
+        state->delta = source->delta;
+    else if(source->delta)
+        SXDEBUG("Ignoring the delta of %s", source->path);
+
+    /* Only single part uploads of unfiltered files are pipelined */
+    if(pipeline && !fh && state->size <= (off_t)state->max_part_blocks * blocksize) {
+        if(!(slot_path = strdup(source->path))) {
+            sxi_seterr(sx, SXE_EMEM, "Cannot allocate filename: Out of memory");
+            goto local_to_remote_err;
+        }
+        if(upload_pipeline_wait(pipeline, pipeline->nslots - 1))
+            goto local_to_remote_err;
+        state->pipelined = 1;
+    }
 
     xfer_stat = sxi_cluster_get_xfer_stat(dest->cluster);
     if(xfer_stat) {
@@ -2390,6 +2902,35 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
         xfer_stat->status = SXC_XFER_STATUS_RUNNING;
     }
 
+    if(state->pipelined) {
+        state->end = state->size;
+        if(multi_part_upload_ev(state) == -1) {
+            SXDEBUG("failed to start pipelined upload");
+            if (state->current.retry)
+                sxi_retry_done(&state->current.retry);
+            part_free(&state->current);
+            hasher_free(state->hasher);
+            free(state->cur_token);
+            sxi_query_free(state->query);
+            goto local_to_remote_err;
+        }
+        /* The file fits in one part, hashing is over */
+        hasher_free(state->hasher);
+        state->hasher = NULL;
+        state->volhosts = NULL;
+        state->dest = NULL;
+        state->fmeta = NULL;
+        state->delta = NULL;
+        if(xfer_stat)
+            xfer_stat->current_xfer.file_name = slot_path;
+        upload_pipeline_add(pipeline, state, slot_path);
+        slot_path = NULL;
+        state = NULL;
+        s = -1;
+        ret = &JOB_NONE;
+        goto local_to_remote_err; /* cleanup, not an error */
+    }
+
     job = multi_upload(state, http_status);
     if (!job) {
         if (state->qret > 0)
@@ -2436,6 +2977,7 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
 	close(s);
     free(buf);
     free(fdir);
+    free(slot_path);
 
     if(tempfname) {
 	unlink(tempfname);
@@ -2461,7 +3003,7 @@ static sxi_job_t* local_to_remote_begin(sxc_file_t *source, sxc_file_t *dest, in
     return ret;
 }
 
-static int local_to_remote_iterate(sxc_file_t *source, int single_source, int recursive, int depth, int onefs, int ignore_errors, sxc_file_t *dest, const sxc_exclude_t *exclude, sxi_jobs_t *jobs, int *errors)
+static int local_to_remote_iterate(sxc_file_t *source, int single_source, int recursive, int depth, int onefs, int ignore_errors, sxc_file_t *dest, const sxc_exclude_t *exclude, sxi_jobs_t *jobs, int *errors, struct upload_pipeline *pipeline)
 {
     struct dirent *entry;
     sxc_client_t *sx = source->sx;
@@ -2498,7 +3040,7 @@ static int local_to_remote_iterate(sxc_file_t *source, int single_source, int re
             SXDEBUG("Failed to set local file size");
             return -1;
         }
-	job = local_to_remote_begin(source, dest, single_source, recursive, &qret, jobs);
+	job = local_to_remote_begin(source, dest, single_source, recursive, &qret, jobs, pipeline);
         if (!job) {
             SXDEBUG("uploading one file failed");
             (*errors)++;
@@ -2563,7 +3105,7 @@ static int local_to_remote_iterate(sxc_file_t *source, int single_source, int re
                  ends_with(dest->path, '/') ? "" : "/",
                  entry->d_name);
         if (S_ISDIR(sb.st_mode)) {
-            qret = local_to_remote_iterate(src, single_source, 1, depth+1, onefs, ignore_errors, dst, exclude, jobs, errors);
+            qret = local_to_remote_iterate(src, single_source, 1, depth+1, onefs, ignore_errors, dst, exclude, jobs, errors, pipeline);
             if (qret) {
                 SXDEBUG("failure in directory: %s", destpath);
                 if (qret == 403 || qret == 404 || qret == 413) {
@@ -2585,7 +3127,7 @@ static int local_to_remote_iterate(sxc_file_t *source, int single_source, int re
             } else if(r < 0)
                 break;
             SXDEBUG("Starting to upload %s", src->path);
-            if (!(job = local_to_remote_begin(src, dst, single_source, 1, &qret, jobs))) {
+            if (!(job = local_to_remote_begin(src, dst, single_source, 1, &qret, jobs, pipeline))) {
                 sxi_notice(sx, "%s: %s", src->path, sxc_geterrmsg(sx));
                 SXDEBUG("failed to begin upload on %s", src->path);
                 (*errors)++;
@@ -2605,6 +3147,12 @@ static int local_to_remote_iterate(sxc_file_t *source, int single_source, int re
                 break;
             }
             job = NULL;
+            /* A pipelined upload of an earlier file has failed */
+            if (pipeline && pipeline->failed && !ignore_errors) {
+                qret = pipeline->failed;
+                ret = (qret == 403 || qret == 404 || qret == 413) ? qret : -1;
+                break;
+            }
         } else if (S_ISLNK(sb.st_mode)) {
             sxi_notice(sx, "Skipped symlink %s", src->path);
         }
@@ -3722,8 +4270,8 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
     sxc_client_t *sx = source->sx;
     struct stat st;
     int64_t filesize;
-    int ret = 1, rd = -1, d = -1, fail = 0, fret;
-    unsigned int blocksize;
+    int ret = 1, rd = -1, d = -1, fail = 0, fret, streamed = 0;
+    unsigned int blocksize, batchblocks = BLOCKS_PER_TABLE;
     off_t curoff = 0;
     FILE *hf = NULL, *tf;
     const char *dstname;
@@ -3831,20 +4379,52 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
 	goto remote_to_local_err;
     }
     if(strcmp(dest->path, "/dev/stdout") && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) || !strcmp(dest->path, "/dev/null"))) {
-        /* regular files, block devices, and not stdout: write directly */
-	if(strcmp(dest->path, "/dev/null") && ftruncate(d, filesize)) {
+	if(fh && fh->f->data_process) {
+	    /* filtered content is decoded in order, one window at a time; a
+	     * regular file gets it in a temporary file next to it, which only
+	     * replaces it once the download has succeeded */
+	    streamed = 1;
+	    if(S_ISREG(st.st_mode)) {
+		char *destpath = strdup(dest->path);
+		FILE *ff;
+
+		if(!destpath) {
+		    SXDEBUG("OOM strdup(dest->path)");
+		    sxi_setsyserr(sx, SXE_EMEM, "Filter failed: OOM");
+		    goto remote_to_local_err;
+		}
+		tempfilter = sxi_tempfile_track(sx, dirname(destpath), &ff);
+		free(destpath);
+		if(!tempfilter) {
+		    SXDEBUG("Failed to generate filter temporary file");
+		    goto remote_to_local_err;
+		}
+		close(d);
+		d = dup(fileno(ff));
+		fclose(ff);
+		if(d < 0) {
+		    sxi_setsyserr(sx, SXE_EWRITE, "Filter ID %s failed: Can't open temporary file", filter_uuid);
+		    goto remote_to_local_err;
+		}
+		if(fchmod(d, st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO)))
+		    SXDEBUG("failed to set the mode of the filter temporary file");
+	    }
+	} else if(strcmp(dest->path, "/dev/null") && ftruncate(d, filesize)) {
+	    /* regular files, block devices, and not stdout: write directly */
 	    SXDEBUG("failed to set destination file size to %llu", (long long unsigned)filesize);
 	    sxi_setsyserr(sx, SXE_EWRITE, "cannot write to destination file %s", dstname);
 	    goto remote_to_local_err;
 	}
-    } else {
-        /* stdout and other devices: use tempfile */
+    }
+    if(streamed || !strcmp(dest->path, "/dev/stdout") || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) || !strcmp(dest->path, "/dev/null"))) {
+        /* stdout, other devices and filters: use a window sized tempfile */
 	if(!(tempdst = sxi_tempfile_track(dest->sx, NULL, &tf))) {
 	    SXDEBUG("failed to generate intermediate file");
 	    goto remote_to_local_err;
 	}
 	rd = d;
 	d = fileno(tf);
+	batchblocks = MAX(1, MIN(BLOCKS_PER_TABLE, DOWNLOAD_WINDOW_SIZE / blocksize));
     }
 
     if(fh && tempdst && fh->f->data_prepare) {
@@ -3900,7 +4480,7 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
 	char ha[42];
 	unsigned int i;
 	off_t shiftoff = tempdst ? curoff : 0;
-        unsigned nhashes = MIN(BLOCKS_PER_TABLE, (filesize + blocksize - 1)/ blocksize);
+        unsigned nhashes = MIN(batchblocks, (filesize + blocksize - 1)/ blocksize);
         sxc_xfer_stat_t *xfer_stat = NULL;
 
         batch_hashes_free(&bh);
@@ -3916,7 +4496,7 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
             goto remote_to_local_err;
         }
 
-	for(i=0; i<BLOCKS_PER_TABLE; i++) {
+	for(i=0; i<batchblocks; i++) {
 	    if(!fread(ha, 40, 1, hf)) {
 		if(ferror(hf)) {
 		    SXDEBUG("failed to read hash");
@@ -4029,7 +4609,7 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
 		    break;
 		}
 		f_got += got;
-		if(f_got == f_size)
+		if(f_got == f_size && shiftoff + f_got == filesize)
 		    action = SXF_ACTION_DATA_END;
 		while(got) {
 		    if(fh && fh->f->data_process) {
@@ -4085,119 +4665,17 @@ static int remote_to_local(sxc_file_t *source, sxc_file_t *dest, int recursive)
     if(fail)
 	goto remote_to_local_err;
 
-    if(fh && fh->f->data_process && !tempdst) {
-	char inbuff[8192], *destpath;
-	ssize_t bread, bwrite;
-	FILE *tempfile = NULL;
-	ssize_t f_size, f_got = 0;
-        /* FIXME: filter processing should be done once the download has
-         * finished!! */
-
-	destpath = strdup(dest->path);
-	if(!destpath) {
-	    SXDEBUG("OOM strdup(dest->path)");
-	    sxi_setsyserr(sx, SXE_EMEM, "Filter failed: OOM");
-	    goto remote_to_local_err;
-	}
-	if(!(tempfilter = sxi_tempfile_track(sx, dirname(destpath), &tempfile))) {
-	    SXDEBUG("Failed to generate filter temporary file");
-	    free(destpath);
-	    goto remote_to_local_err;
-	}
-	free(destpath);
-	if(fh->f->data_prepare) {
-            unsigned char chksum1[SXI_SHA1_BIN_LEN], chksum2[SXI_SHA1_BIN_LEN];
-
-            if(sxi_meta_checksum(sx, cvmeta, chksum1)) {
-                SXDEBUG("Failed to compute custom volume meta checksum");
-                fclose(tempfile);
-                goto remote_to_local_err;
-            }
-
-	    if(fh->f->data_prepare(fh, &fh->ctx, source->path, filter_cfgdir, cfgval, cfgval_len, cvmeta, SXF_MODE_DOWNLOAD)) {
-		sxi_seterr(sx, SXE_EFILTER, "Filter ID %s failed to initialize itself", filter_uuid);
-		fclose(tempfile);
-		goto remote_to_local_err;
-	    }
-
-            if(sxi_meta_checksum(sx, cvmeta, chksum2)) {
-                SXDEBUG("Failed to compute custom volume meta checksum");
-                fclose(tempfile);
-                goto remote_to_local_err;
-            }
-
-            if(memcmp(chksum1, chksum2, SXI_SHA1_BIN_LEN)) {
-                SXDEBUG("Checksums different, modifying volume %s\n", dest->volume);
-		if(sxc_volume_modify(source->cluster, source->volume, NULL, NULL, -1, -1, cvmeta)) {
-		    if(sxc_geterrnum(source->sx) == SXE_EAUTH)
-			/* ignore error for non-owner */
-			sxc_clearerr(source->sx);
-		    else {
-                        fclose(tempfile);
-			goto remote_to_local_err;
-                    }
-		}
-	    }
-	}
-	f_size = lseek(d, 0, SEEK_END);
-	lseek(d, 0, SEEK_SET);
-	while((bread = read(d, inbuff, sizeof(inbuff))) > 0) {
-	    f_got += bread;
-	    if(f_got == f_size)
-		action = SXF_ACTION_DATA_END;
-
-	    do {
-		bwrite = fh->f->data_process(fh, fh->ctx, inbuff, bread, outbuff, sizeof(outbuff), SXF_MODE_DOWNLOAD, &action);
-		if(bwrite < 0) {
-		    sxi_seterr(sx, SXE_EFILTER, "Filter ID %s failed to process input data", filter_uuid);
-		    fclose(tempfile);
-		    if(fh->f->data_finish)
-			fh->f->data_finish(fh, &fh->ctx, SXF_MODE_DOWNLOAD);
-		    goto remote_to_local_err;
-		}
-		if(fwrite(outbuff, 1, bwrite, tempfile) != (size_t) bwrite) {
-		    sxi_setsyserr(sx, SXE_EWRITE, "Filter ID %s failed: Can't write to temporary file", filter_uuid);
-		    fclose(tempfile);
-		    if(fh->f->data_finish)
-			fh->f->data_finish(fh, &fh->ctx, SXF_MODE_DOWNLOAD);
-		    goto remote_to_local_err;
-		}
-	    } while(action == SXF_ACTION_REPEAT);
-	}
-	if(fclose(tempfile)) {
-	    sxi_seterr(sx, SXE_EWRITE, "Filter ID %s failed: Can't close temporary file", filter_uuid);
-	    goto remote_to_local_err;
-	}
-	if(fh->f->data_finish) {
-	    if(fh->f->data_finish(fh, &fh->ctx, SXF_MODE_DOWNLOAD)) {
-		sxi_seterr(sx, SXE_EFILTER, "Filter ID %s failed to clean up itself", filter_uuid);
-		goto remote_to_local_err;
-	    }
-	}
-
-        if (d != STDOUT_FILENO)
-            close(d);
-	d = -1;
-	if(dstexisted && stat(dest->path, &st) == -1) {
-	    sxi_setsyserr(sx, SXE_EREAD, "failed to stat destination file %s", dest->path);
+    if(tempfilter) {
+	if(rename(tempfilter, dest->path)) {
+	    SXDEBUG("can't rename temporary file");
+	    sxi_setsyserr(sx, SXE_EWRITE, "Filter ID %s failed: Can't rename temporary file", filter_uuid);
 	    goto remote_to_local_err;
 	}
-	if(!dstexisted || S_ISREG(st.st_mode)) {
-	    if(rename(tempfilter, dest->path)) {
-		SXDEBUG("can't rename temporary file");
-		sxi_setsyserr(sx, SXE_EWRITE, "Filter ID %s failed: Can't rename temporary file", filter_uuid);
-		goto remote_to_local_err;
-	    }
-	} else {
-            /* FIXME: this doesn't preserve attributes */
-	    if(file_to_file(sx, tempfilter, dest->path, NULL))
-		goto remote_to_local_err;
-	    unlink(tempfilter);
-	}
 	sxi_tempfile_untrack(sx, tempfilter);
 	tempfilter = NULL;
     }
-    if (created_at >= 0 && !tempdst) {
+
+    if (created_at >= 0 && (!tempdst || streamed)) {
         struct utimbuf tb;
         tb.modtime = created_at;
         tb.actime = time(NULL);
@@ -4637,6 +5115,439 @@ void sxi_sxfs_download_finish(sxi_sxfs_data_t *sxfs) {
     free(sxfs);
 }
 
+struct _sxi_sxfs_stream_t {
+    char *volume, *path;
+    sxi_hostlist_t volhosts;
+    sxi_hostlist_t host; /* the node holding the temporary file */
+    char *token;
+    unsigned int blocksize;
+    int64_t growable_size;
+    int64_t declared_size; /* file size announced to the cluster */
+    int64_t pos; /* amount of data already sent */
+};
+
+sxi_sxfs_stream_t *sxi_sxfs_stream_begin(sxc_file_t *dest) {
+    sxc_client_t *sx;
+    sxi_sxfs_stream_t *stream;
+    sxc_meta_t *vmeta = NULL;
+    int64_t blocksize = 0, growable_size = 0;
+
+    if(!dest)
+        return NULL;
+    sx = dest->sx;
+    if(!is_remote(dest)) {
+        sxi_seterr(sx, SXE_EARG, "Called with local destination file");
+        return NULL;
+    }
+    stream = calloc(1, sizeof(*stream));
+    if(!stream) {
+        sxi_seterr(sx, SXE_EMEM, "Out of memory");
+        return NULL;
+    }
+    sxi_hostlist_init(&stream->volhosts);
+    sxi_hostlist_init(&stream->host);
+    stream->volume = strdup(dest->volume);
+    stream->path = strdup(dest->path);
+    if(!stream->volume || !stream->path) {
+        sxi_seterr(sx, SXE_EMEM, "Out of memory");
+        goto sxi_sxfs_stream_begin_err;
+    }
+    if(!(vmeta = sxc_meta_new(sx)))
+        goto sxi_sxfs_stream_begin_err;
+    if(sxi_locate_volume_growable(sxi_cluster_get_conns(dest->cluster), dest->volume, &stream->volhosts, &blocksize, &growable_size, vmeta)) {
+        SXDEBUG("Cannot locate volume %s", dest->volume);
+        goto sxi_sxfs_stream_begin_err;
+    }
+    if(!sxc_meta_getval(vmeta, "filterActive", NULL, NULL)) {
+        sxi_seterr(sx, SXE_EARG, "Files cannot be streamed to volumes with filters");
+        goto sxi_sxfs_stream_begin_err;
+    }
+    if(blocksize <= 0 || growable_size <= 0) {
+        sxi_seterr(sx, SXE_ECOMM, "Invalid volume information received");
+        goto sxi_sxfs_stream_begin_err;
+    }
+    stream->blocksize = blocksize;
+    stream->growable_size = growable_size;
+    sxc_meta_free(vmeta);
+    return stream;
+
+sxi_sxfs_stream_begin_err:
+    sxc_meta_free(vmeta);
+    sxi_sxfs_stream_free(stream);
+    return NULL;
+}
+
+unsigned int sxi_sxfs_stream_blocksize(const sxi_sxfs_stream_t *stream) {
+    return stream ? stream->blocksize : 0;
+}
+
+int64_t sxi_sxfs_stream_minsize(const sxi_sxfs_stream_t *stream) {
+    if(!stream)
+        return -1;
+    return MAX(stream->declared_size, stream->growable_size);
+}
+
+struct stream_part_ctx {
+    curlev_context_t *cbdata;
+    const struct jparse_actions *acts;
+    jparse_t *J;
+    enum sxc_error_t err;
+    char *host;
+    char *token;
+    const char *hashes;
+    unsigned int nblocks;
+    sxi_hostlist_t *upload_hosts; /* one list per block, empty when the block is not needed */
+    int current;
+};
+
+static void cb_stream_token(jparse_t *J, void *ctx, const char *string, unsigned int length) {
+    struct stream_part_ctx *yctx = (struct stream_part_ctx *)ctx;
+
+    if(yctx->token) {
+        sxi_jparse_cancel(J, "Multiple upload tokens received");
+        yctx->err = SXE_ECOMM;
+        return;
+    }
+    yctx->token = malloc(length + 1);
+    if(!yctx->token) {
+        sxi_jparse_cancel(J, "Out of memory processing upload token");
+        yctx->err = SXE_EMEM;
+        return;
+    }
+    memcpy(yctx->token, string, length);
+    yctx->token[length] = '\0';
+}
+
+static void cb_stream_host(jparse_t *J, void *ctx, const char *string, unsigned int length) {
+    const char *block = sxi_jpath_mapkey(sxi_jpath_down(sxi_jparse_whereami(J)));
+    int listpos = sxi_jpath_arraypos(sxi_jpath_down(sxi_jpath_down(sxi_jparse_whereami(J))));
+    struct stream_part_ctx *yctx = (struct stream_part_ctx *)ctx;
+    sxc_client_t *sx = sxi_conns_get_client(sxi_cbdata_get_conns(yctx->cbdata));
+    char *address;
+    unsigned int i;
+
+    if(listpos < 0) {
+        sxi_jparse_cancel(J, "Internal error: array index %d out of bounds", listpos);
+        yctx->err = SXE_ECOMM;
+        return;
+    }
+    if(!listpos) {
+        yctx->current = -1;
+        if(strlen(block) == SXI_SHA1_TEXT_LEN) {
+            for(i=0; i<yctx->nblocks; i++) {
+                if(!memcmp(yctx->hashes + i * (SXI_SHA1_TEXT_LEN + 1), block, SXI_SHA1_TEXT_LEN)) {
+                    yctx->current = i;
+                    break;
+                }
+            }
+        }
+        if(yctx->current < 0) {
+            sxi_jparse_cancel(J, "Unknown block '%s' requested for upload", block);
+            yctx->err = SXE_ECOMM;
+            return;
+        }
+    }
+    if(!length) {
+        sxi_jparse_cancel(J, "Empty node address revceived for block %s", block);
+        yctx->err = SXE_ECOMM;
+        return;
+    }
+
+    address = malloc(length + 1);
+    if(!address) {
+        sxi_jparse_cancel(J, "Out of memory processing upload nodes");
+        yctx->err = SXE_EMEM;
+        return;
+    }
+    memcpy(address, string, length);
+    address[length] = '\0';
+    if(sxi_hostlist_add_host(sx, &yctx->upload_hosts[yctx->current], address)) {
+        free(address);
+        sxi_jparse_cancel(J, "Out of memory building list of upload nodes");
+        yctx->err = SXE_EMEM;
+        return;
+    }
+    free(address);
+}
+
+static int stream_setup_cb(curlev_context_t *cbdata, void *ctx, const char *host) {
+    struct stream_part_ctx *yctx = (struct stream_part_ctx *)ctx;
+    unsigned int i;
+
+    yctx->cbdata = cbdata;
+    sxi_jparse_destroy(yctx->J);
+    yctx->err = SXE_ECOMM;
+    if(!(yctx->J = sxi_jparse_create(yctx->acts, yctx, 1))) {
+        CBDATADEBUG("OOM allocating JSON parser");
+        sxi_cbdata_seterr(cbdata, SXE_EMEM, "Cannot upload file: Out of memory");
+        return 1;
+    }
+
+    free(yctx->token);
+    yctx->token = NULL;
+    for(i=0; i<yctx->nblocks; i++)
+        sxi_hostlist_empty(&yctx->upload_hosts[i]);
+    free(yctx->host);
+    if(!(yctx->host = strdup(host))) {
+        sxi_cbdata_seterr(cbdata, SXE_EMEM, "Cannot allocate hostname");
+        return 1;
+    }
+    return 0;
+}
+
+static int stream_cb(curlev_context_t *cbdata, void *ctx, const void *data, size_t size) {
+    struct stream_part_ctx *yctx = (struct stream_part_ctx *)ctx;
+
+    if(sxi_jparse_digest(yctx->J, data, size)) {
+        sxi_cbdata_seterr(yctx->cbdata, yctx->err, "%s", sxi_jparse_geterr(yctx->J));
+        return 1;
+    }
+    return 0;
+}
+
+static int stream_same_hosts(const sxi_hostlist_t *a, const sxi_hostlist_t *b) {
+    unsigned int i, n = sxi_hostlist_get_count(a);
+
+    if(n != sxi_hostlist_get_count(b))
+        return 0;
+    for(i=0; i<n; i++)
+        if(strcmp(sxi_hostlist_get_host(a, i), sxi_hostlist_get_host(b, i)))
+            return 0;
+    return 1;
+}
+
+/* Creates or extends the temporary file with nblocks blocks and uploads the
+ * blocks the cluster asks for, those going to the same nodes are sent in one
+ * request of up to UPLOAD_CHUNK_SIZE; size < 0 leaves the declared size alone.
+ * The binary hashes of the blocks are stored in bhashes if given */
+static int stream_part(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const uint8_t *data, unsigned int nblocks, int64_t size, sxc_meta_t *meta, uint8_t *bhashes) {
+    const struct jparse_actions acts = {
+        JPACTS_STRING(
+                      JPACT(cb_stream_token, JPKEY("uploadToken")),
+                      JPACT(cb_stream_host, JPKEY("uploadData"), JPANYKEY, JPANYITM)
+                      )
+    };
+    sxc_client_t *sx = sxi_cluster_get_client(cluster);
+    sxi_conns_t *conns = sxi_cluster_get_conns(cluster);
+    const char *uuid = sxi_conns_get_uuid(conns);
+    struct stream_part_ctx yctx;
+    sxi_query_t *query = NULL;
+    unsigned char md[SXI_SHA1_BIN_LEN];
+    char *hashes = NULL;
+    uint8_t *batch = NULL;
+    unsigned int i, j, batch_max, batch_len;
+    int qret, ret = -1;
+
+    memset(&yctx, 0, sizeof(yctx));
+    if(nblocks) {
+        hashes = malloc(nblocks * (SXI_SHA1_TEXT_LEN + 1));
+        yctx.upload_hosts = malloc(nblocks * sizeof(*yctx.upload_hosts));
+        if(!hashes || !yctx.upload_hosts) {
+            SXDEBUG("OOM allocating block lists");
+            sxi_seterr(sx, SXE_EMEM, "Out of memory");
+            goto stream_part_err;
+        }
+        for(i=0; i<nblocks; i++)
+            sxi_hostlist_init(&yctx.upload_hosts[i]);
+    }
+    yctx.nblocks = nblocks;
+    yctx.hashes = hashes;
+    yctx.acts = &acts;
+
+    if(!stream->token)
+        query = sxi_fileadd_proto_begin(sx, stream->volume, stream->path, NULL, NULL, 0, stream->blocksize, size);
+    else
+        query = sxi_fileadd_proto_grow(sx, stream->token, stream->pos, stream->blocksize, size);
+    for(i=0; query && i<nblocks; i++) {
+        char *hex = hashes + i * (SXI_SHA1_TEXT_LEN + 1);
+        if(!uuid || sxi_sha1_calc(uuid, strlen(uuid), data + (size_t)i * stream->blocksize, stream->blocksize, md)) {
+            SXDEBUG("Cannot compute block hash");
+            sxi_seterr(sx, SXE_ECRYPT, "Cannot compute block hash");
+            goto stream_part_err;
+        }
+        sxi_bin2hex(md, SXI_SHA1_BIN_LEN, hex);
+        if(bhashes)
+            memcpy(bhashes + i * SXI_SHA1_BIN_LEN, md, SXI_SHA1_BIN_LEN);
+        query = sxi_fileadd_proto_addhash(sx, query, hex);
+    }
+    if(query)
+        query = sxi_fileadd_proto_end(sx, query, meta);
+    if(!query) {
+        SXDEBUG("Cannot prepare file upload query");
+        goto stream_part_err;
+    }
+
+    sxi_set_operation(sx, "upload file", stream->volume, stream->path, NULL);
+    qret = sxi_cluster_query(conns, sxi_hostlist_get_count(&stream->host) ? &stream->host : &stream->volhosts, REQ_PUT, query->path, query->content, query->content_len, stream_setup_cb, stream_cb, &yctx);
+    if(qret != 200) {
+        SXDEBUG("File upload query failed");
+        goto stream_part_err;
+    }
+    if(sxi_jparse_done(yctx.J)) {
+        sxi_seterr(sx, yctx.err, "%s", sxi_jparse_geterr(yctx.J));
+        goto stream_part_err;
+    }
+
+    if(!stream->token) {
+        if(!yctx.token || !yctx.host) {
+            sxi_seterr(sx, SXE_ECOMM, "No upload token received");
+            goto stream_part_err;
+        }
+        /* Extends and the flush must go to the node which created the file */
+        if(sxi_hostlist_add_host(sx, &stream->host, yctx.host))
+            goto stream_part_err;
+        stream->token = yctx.token;
+        yctx.token = NULL;
+    }
+    if(size >= 0)
+        stream->declared_size = size;
+
+    batch_max = MAX(UPLOAD_CHUNK_SIZE / stream->blocksize, 1);
+    for(i=0; i<nblocks; i++) {
+        if(!sxi_hostlist_get_count(&yctx.upload_hosts[i]))
+            continue;
+        /* collect the following blocks which go to the same nodes, the list
+         * of each block added to the batch is emptied */
+        batch_len = 1;
+        for(j=i+1; j<nblocks && batch_len<batch_max; j++) {
+            if(!stream_same_hosts(&yctx.upload_hosts[i], &yctx.upload_hosts[j]))
+                continue;
+            if(!batch && !(batch = malloc((size_t)batch_max * stream->blocksize))) {
+                SXDEBUG("OOM allocating upload batch");
+                sxi_seterr(sx, SXE_EMEM, "Out of memory");
+                goto stream_part_err;
+            }
+            if(batch_len == 1)
+                memcpy(batch, data + (size_t)i * stream->blocksize, stream->blocksize);
+            memcpy(batch + (size_t)batch_len * stream->blocksize, data + (size_t)j * stream->blocksize, stream->blocksize);
+            batch_len++;
+            sxi_hostlist_empty(&yctx.upload_hosts[j]);
+        }
+        if(sxi_upload_block_from_buf(conns, &yctx.upload_hosts[i], stream->token, batch_len > 1 ? batch : (uint8_t*)data + (size_t)i * stream->blocksize, stream->blocksize, (int64_t)batch_len * stream->blocksize)) {
+            SXDEBUG("Failed to upload %u block(s) starting at %u", batch_len, i);
+            goto stream_part_err;
+        }
+    }
+    stream->pos += (int64_t)nblocks * stream->blocksize;
+
+    ret = 0;
+stream_part_err:
+    if(yctx.upload_hosts) {
+        for(i=0; i<nblocks; i++)
+            sxi_hostlist_empty(&yctx.upload_hosts[i]);
+        free(yctx.upload_hosts);
+    }
+    sxi_jparse_destroy(yctx.J);
+    free(yctx.token);
+    free(yctx.host);
+    free(hashes);
+    free(batch);
+    sxi_query_free(query);
+    return ret;
+}
+
+int sxi_sxfs_stream_append(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const void *data, unsigned int nblocks, uint8_t *hashes) {
+    int64_t end, size = -1;
+
+    if(!stream || !cluster || (!data && nblocks))
+        return -1;
+    if(!nblocks)
+        return 0;
+    end = stream->pos + (int64_t)nblocks * stream->blocksize;
+    if(!stream->token)
+        size = MAX(end, stream->growable_size);
+    else if(end > stream->declared_size)
+        size = end;
+    return stream_part(stream, cluster, data, nblocks, size, NULL, hashes);
+}
+
+int sxi_sxfs_stream_read(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const uint8_t *hash, void *buf) {
+    sxc_client_t *sx;
+    sxi_conns_t *conns;
+    struct cb_gethash_ctx ctx;
+    char url[sizeof(".data/4294967295/") + SXI_SHA1_TEXT_LEN];
+    int qret;
+
+    if(!stream || !cluster || !hash || !buf)
+        return -1;
+    sx = sxi_cluster_get_client(cluster);
+    conns = sxi_cluster_get_conns(cluster);
+    /* the nodes which do not hold the block answer 404 and the next one is asked */
+    snprintf(url, sizeof(url), ".data/%u/", stream->blocksize);
+    sxi_bin2hex(hash, SXI_SHA1_BIN_LEN, url + strlen(url));
+    ctx.base = buf;
+    ctx.at = 0;
+    ctx.bsize = stream->blocksize;
+    sxi_set_operation(sx, "download file contents", stream->volume, stream->path, NULL);
+    qret = sxi_cluster_query(conns, sxi_conns_get_hostlist(conns), REQ_GET, url, NULL, 0, gethash_setup_cb_old, gethash_cb_old, &ctx);
+    if(qret != 200) {
+        SXDEBUG("Failed to retrieve %s - status: %d", url, qret);
+        return -1;
+    }
+    if(ctx.at != stream->blocksize) {
+        sxi_seterr(sx, SXE_ECOMM, "Incomplete block received");
+        return -1;
+    }
+    return 0;
+}
+
+int sxi_sxfs_stream_finish(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const void *tail, unsigned int tail_len, sxc_meta_t *meta) {
+    sxc_client_t *sx;
+    sxi_query_t *proto = NULL;
+    uint8_t *block = NULL;
+    int64_t size;
+    int ret = -1;
+
+    if(!stream || !cluster || (!tail && tail_len))
+        return -1;
+    sx = sxi_cluster_get_client(cluster);
+    if(tail_len > stream->blocksize) {
+        sxi_seterr(sx, SXE_EARG, "Invalid argument");
+        return -1;
+    }
+    size = stream->pos + tail_len;
+    if(stream->token && size < stream->declared_size) {
+        sxi_seterr(sx, SXE_EARG, "File cannot be smaller than %lld bytes", (long long)stream->declared_size);
+        return -1;
+    }
+    if(tail_len) {
+        /* The last block is padded with zeros */
+        if(!(block = calloc(1, stream->blocksize))) {
+            SXDEBUG("OOM allocating last block");
+            sxi_seterr(sx, SXE_EMEM, "Out of memory");
+            return -1;
+        }
+        memcpy(block, tail, tail_len);
+    }
+    if(stream_part(stream, cluster, block, tail_len ? 1 : 0, (!stream->token || size > stream->declared_size) ? size : -1, meta, NULL))
+        goto sxi_sxfs_stream_finish_err;
+
+    if(!(proto = sxi_flushfile_proto(sx, stream->token)))
+        goto sxi_sxfs_stream_finish_err;
+    sxi_set_operation(sx, "flush file", stream->volume, stream->path, NULL);
+    if(sxi_job_submit_and_poll(sxi_cluster_get_conns(cluster), &stream->host, REQ_PUT, proto->path, proto->content, proto->content_len)) {
+        SXDEBUG("Failed to flush file");
+        goto sxi_sxfs_stream_finish_err;
+    }
+
+    ret = 0;
+sxi_sxfs_stream_finish_err:
+    sxi_query_free(proto);
+    free(block);
+    return ret;
+}
+
+void sxi_sxfs_stream_free(sxi_sxfs_stream_t *stream) {
+    if(!stream)
+        return;
+    free(stream->volume);
+    free(stream->path);
+    sxi_hostlist_empty(&stream->volhosts);
+    sxi_hostlist_empty(&stream->host);
+    free(stream->token);
+    free(stream);
+}
+
 static sxi_job_t* remote_to_remote_fast(sxc_file_t *source, sxc_file_t *dest) {
     char *src_hashfile = NULL, *rcur, ha[42];
     sxi_ht *src_hashes = NULL;
@@ -4784,6 +5695,7 @@ static sxi_job_t* remote_to_remote_fast(sxc_file_t *source, sxc_file_t *dest) {
 	    hoff->offset = ftell(hf);
             hoff->checksum = 0;
             hoff->ref_checksum = 0;
+            hoff->hash = NULL;
 	    if(sxi_ht_add(src_hashes, ha, 40, hoff)) {
 		SXDEBUG("failed to add a new entry to the hash table");
 		free(hoff);
@@ -5085,7 +5997,7 @@ static sxi_job_t* remote_to_remote(sxc_file_t *source, sxc_file_t *dest, int fai
 
     /* remote_to_remote may be called by list iteration (sxi_file_list_foreach()) function,
      * therefore source is a single file (temporary file here). */
-    if(!(ret = local_to_remote_begin(cache, dest, 1, 0, NULL, jobs))) {
+    if(!(ret = local_to_remote_begin(cache, dest, 1, 0, NULL, jobs, NULL))) {
 	SXDEBUG("failed to upload destination file");
 	goto remote_to_remote_err;
     }
@@ -6018,6 +6930,9 @@ struct _sxc_file_list_t {
     int ignore_errors;
     /* Errors counter, accumulates errors which cannot be handled with jobs context (when creating a new job fails for some reason) */
     int errors;
+    /* Number of files uploaded at the same time and their pipeline */
+    unsigned int parallel_files;
+    struct upload_pipeline *uploads;
 };
 
 
@@ -6035,6 +6950,18 @@ unsigned sxc_file_list_get_successful(const sxc_file_list_t *lst)
     return sxi_jobs_successful(lst->jobs, NULL);
 }
 
+int sxc_file_list_set_parallel_files(sxc_file_list_t *lst, unsigned int nfiles)
+{
+    if (!lst)
+        return -1;
+    if (!nfiles || lst->uploads) {
+        sxi_seterr(lst->sx, SXE_EARG, "Invalid number of parallel files");
+        return -1;
+    }
+    lst->parallel_files = nfiles;
+    return 0;
+}
+
 sxc_file_list_t *sxc_file_list_new(sxc_client_t *sx, int recursive, int ignore_errors)
 {
     sxc_file_list_t *lst = calloc(1, sizeof(*lst));
@@ -6099,6 +7026,7 @@ void sxc_file_list_free(sxc_file_list_t *lst)
             sxc_file_free(entry->pattern);
         }
         free(lst->entries);
+        upload_pipeline_free(lst->uploads);
         sxi_jobs_free(lst->jobs);
         free(lst);
 
@@ -6131,6 +7059,8 @@ static int sxi_file_list_foreach_wait(sxc_file_list_t *target)
     int errors;
     sxc_client_t *sx = target->sx;
 
+    if(upload_pipeline_drain(target->uploads))
+        target->errors++;
     SXDEBUG("Waiting for %d jobs", sxi_jobs_total(target->jobs, NULL));
     ret = sxi_jobs_wait(target->jobs, NULL);
     errors = target->errors + sxi_jobs_errors(target->jobs, NULL);
@@ -6624,8 +7554,12 @@ static int sxc_copy_cb(sxc_file_list_t *target, sxc_file_t *pattern, sxi_hostlis
     if(is_remote(it->dest)) { /* Destination file is remote */
         if(is_remote(file)) /* Source file is remote */
             job = remote_copy_cb(target, pattern, hlist, cvmeta, file, ctx, fh, filter_cfgdir);
-        else /* Source file is local */
-            return local_to_remote_iterate(file, it->single_source, target->recursive, 0, it->onefs, target->ignore_errors, it->dest, it->exclude, target->jobs, &target->errors);
+        else { /* Source file is local */
+            if(target->parallel_files > 1 && !target->uploads &&
+               !(target->uploads = upload_pipeline_new(target->sx, target->parallel_files, target->jobs, &target->errors, target->ignore_errors)))
+                return -1;
+            return local_to_remote_iterate(file, it->single_source, target->recursive, 0, it->onefs, target->ignore_errors, it->dest, it->exclude, target->jobs, &target->errors, target->uploads);
+        }
     } else {/* Destination file is local */
         if(is_remote(file)) { /* Source file is remote */
             job = remote_copy_cb(target, pattern, hlist, cvmeta, file, ctx, fh, filter_cfgdir);
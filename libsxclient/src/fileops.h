@@ -71,6 +71,40 @@ sxi_sxfs_data_t *sxi_sxfs_download_init(sxc_file_t *source);
 int sxi_sxfs_download_run(sxi_sxfs_data_t *sxfs, sxc_cluster_t *cluster, sxc_file_t *dest, off_t offset, long int size);
 void sxi_sxfs_download_finish(sxi_sxfs_data_t *sxfs);
 
+/* Hashes of the revision a local file was built from: blocks not marked
+ * in dirty are taken from ha without reading the file, the others are
+ * hashed and their new hashes written back to ha */
+typedef struct _sxi_sxfs_delta_t {
+    unsigned int blocksize, nhashes;
+    char **ha; /* nhashes buffers of SXI_SHA1_TEXT_LEN + 1 */
+    uint8_t *dirty; /* bitmap, one bit per block */
+} sxi_sxfs_delta_t;
+
+#define SXI_DELTA_DIRTY(d, i) ((d)->dirty[(i) / 8] & (1 << ((i) % 8)))
+
+/* The delta is not owned by the file and must outlive the upload */
+int sxi_file_set_delta(sxc_file_t *file, sxi_sxfs_delta_t *delta);
+
+/* Upload of a file while it is still being written: full blocks are sent
+ * with sxi_sxfs_stream_append() as the data comes, the file is created as
+ * growable so its final size is only given to sxi_sxfs_stream_finish().
+ * The stream is not bound to the client which started it, every call uses
+ * the cluster it is given.
+ * Files streamed this way cannot end up smaller than sxi_sxfs_stream_minsize()
+ * and data filters are not applied.
+ * sxi_sxfs_stream_append() stores the binary hashes of the blocks it sent in
+ * hashes (nblocks * SXI_SHA1_BIN_LEN bytes) if given, such a block can be read
+ * back with sxi_sxfs_stream_read() before the file is finished. */
+typedef struct _sxi_sxfs_stream_t sxi_sxfs_stream_t;
+
+sxi_sxfs_stream_t *sxi_sxfs_stream_begin(sxc_file_t *dest);
+unsigned int sxi_sxfs_stream_blocksize(const sxi_sxfs_stream_t *stream);
+int64_t sxi_sxfs_stream_minsize(const sxi_sxfs_stream_t *stream);
+int sxi_sxfs_stream_append(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const void *data, unsigned int nblocks, uint8_t *hashes);
+int sxi_sxfs_stream_read(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const uint8_t *hash, void *buf);
+int sxi_sxfs_stream_finish(sxi_sxfs_stream_t *stream, sxc_cluster_t *cluster, const void *tail, unsigned int tail_len, sxc_meta_t *meta);
+void sxi_sxfs_stream_free(sxi_sxfs_stream_t *stream);
+
 int sxi_file_set_ctime(sxc_file_t *file, time_t creatd_at);
 
 int sxi_filemeta_process(sxc_client_t *sx, struct filter_handle *fh, const char *cfgdir, sxc_file_t *file, sxc_meta_t *custom_volume_meta);
@@ -1979,6 +1979,11 @@ uint32_t sxi_checksum(uint32_t checksum, const void *buf, size_t size)
     return adler32(checksum, buf, size);
 }
 
+uint32_t sxi_checksum_combine(uint32_t checksum, uint32_t next, size_t next_size)
+{
+    return adler32_combine(checksum, next, next_size);
+}
+
 int sxi_derive_key(const char *pass, const char *salt, unsigned salt_size, unsigned int log2_iter, char *out, unsigned int len)
 {
     char settingbuf[30];
@@ -103,6 +103,8 @@ void sxi_free_aliases(alias_list_t *aliases);
 
 /* Compute checksum */
 uint32_t sxi_checksum(uint32_t crc, const void *buf, size_t size);
+/* Extend checksum with next, the checksum of next_size further bytes computed from sxi_checksum(0, NULL, 0) */
+uint32_t sxi_checksum_combine(uint32_t checksum, uint32_t next, size_t next_size);
 
 /* Use blowfish key derivation */
 int sxi_derive_key(const char *pass, const char *salt, unsigned salt_size, unsigned int log2_iter, char *out, unsigned int len);
@@ -20,6 +20,7 @@
 #include "default.h"
 #include <string.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 
 #include "libsxclient-int.h"
 #include "sxproto.h"
@@ -72,6 +73,21 @@ static FMT_PRINTF(4, 5) sxi_query_t* sxi_query_append_fmt(sxc_client_t *sx, sxi_
     return query;
 }
 
+static sxi_query_t* sxi_query_append_raw(sxc_client_t *sx, sxi_query_t *query, const void *data, unsigned n)
+{
+    if (!query) {
+        sxi_seterr(sx, SXE_EARG, "Null argument to sxi_query_append");
+        return NULL;
+    }
+    if (sxi_query_realloc(sx, query, query->content_len + n) == -1) {
+        sxi_query_free(query);
+        return NULL;
+    }
+    memcpy((uint8_t*)query->content + query->content_len, data, n);
+    query->content_len += n;
+    return query;
+}
+
 sxi_query_t *sxi_query_create(sxc_client_t *sx, const char *path, enum sxi_cluster_verb verb)
 {
     sxi_query_t *ret = calloc(1, sizeof(*ret));
@@ -429,7 +445,7 @@ sxi_query_t *sxi_flushfile_proto(sxc_client_t *sx, const char *token) {
     return ret;
 }
 
-static sxi_query_t *fileadd_proto_begin_common(sxc_client_t *sx, const char *vol, const char *path, const char *revision, const char *revision_id, int64_t pos, int64_t blocksize, int64_t size) {
+static sxi_query_t *fileadd_proto_begin_common(sxc_client_t *sx, const char *vol, const char *path, const char *revision, const char *revision_id, int64_t pos, int64_t blocksize, int64_t size, int growing) {
     char *enc_path = NULL, *enc_rev = NULL, *url = NULL;
     sxi_query_t *ret;
     unsigned int len;
@@ -481,7 +497,9 @@ static sxi_query_t *fileadd_proto_begin_common(sxc_client_t *sx, const char *vol
     if (!ret)
         return NULL;
 
-    if (pos > 0)
+    if (pos > 0 && growing)
+        ret = sxi_query_append_fmt(sx, ret, 60, "{\"extendSeq\":%llu,\"fileSize\":%llu,", (unsigned long long)pos / blocksize, (unsigned long long)size);
+    else if (pos > 0)
         ret = sxi_query_append_fmt(sx, ret, 34, "{\"extendSeq\":%llu,", (unsigned long long)pos / blocksize);
     else
         ret = sxi_query_append_fmt(sx, ret, 34, "{\"fileSize\":%llu,", (unsigned long long)size);
@@ -504,11 +522,18 @@ sxi_query_t *sxi_fileadd_proto_begin(sxc_client_t *sx, const char *volname, cons
         sxi_setsyserr(sx, SXE_EMEM, "Failed to encode volume name: Out of memory");
         return NULL;
     }
-    ret = fileadd_proto_begin_common(sx, enc_vol, path, revision, revision_id, pos, blocksize, size);
+    ret = fileadd_proto_begin_common(sx, enc_vol, path, revision, revision_id, pos, blocksize, size, 0);
     free(enc_vol);
     return ret;
 }
 
+/*
+ * Extension of a growable file, the size is only sent when it increases
+ */
+sxi_query_t *sxi_fileadd_proto_grow(sxc_client_t *sx, const char *token, int64_t pos, int64_t blocksize, int64_t size) {
+    return fileadd_proto_begin_common(sx, ".upload", token, NULL, NULL, pos, blocksize, size, size >= 0);
+}
+
 /*
  * New file propagation proto, server side
  */
@@ -517,7 +542,7 @@ sxi_query_t *sxi_fileadd_proto_begin_internal(sxc_client_t *sx, const char *glob
         sxi_setsyserr(sx, SXE_EMEM, "Invalid argument");
         return NULL;
     }
-    return fileadd_proto_begin_common(sx, global_vol_id_hex, path, revision, revision_id, pos, blocksize, size);
+    return fileadd_proto_begin_common(sx, global_vol_id_hex, path, revision, revision_id, pos, blocksize, size, 0);
 }
 
 sxi_query_t *sxi_fileadd_proto_addhash(sxc_client_t *sx, sxi_query_t *query, const char *hexhash)
@@ -652,7 +677,7 @@ sxi_query_t *sxi_massdel_proto(sxc_client_t *sx, const char *volname, const char
     return ret;
 }
 
-static sxi_query_t *sxi_hashop_proto_list(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, enum sxi_cluster_verb verb, const char *op, const char *global_vol_id, const char *reserve_id, const char *revision_id, unsigned replica, uint64_t op_expires_at)
+static sxi_query_t *sxi_hashop_proto_list(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, enum sxi_cluster_verb verb, const char *op, const char *global_vol_id, const char *reserve_id, const char *revision_id, unsigned replica, uint64_t op_expires_at, int bin)
 {
     char url[DOWNLOAD_MAX_BLOCKS * (EXPIRE_TEXT_LEN + SXI_SHA1_TEXT_LEN) + sizeof(".data/1048576/?o=reserve&reserve_id=&revision_id=&global_vol_id=") + 144];
     char expires_str[24];
@@ -663,8 +688,8 @@ static sxi_query_t *sxi_hashop_proto_list(sxc_client_t *sx, unsigned blocksize,
         return NULL;
     snprintf(expires_str, sizeof(expires_str), "%llu", (long long)op_expires_at);
     snprintf(replica_str, sizeof(replica_str), "%u", replica);
-    rc = snprintf(url, sizeof(url), ".data/%u/%.*s?o=%s%s%s%s%s%s%s%s%s%s%s", blocksize, hashes_len, hashes,
-                  op,
+    rc = snprintf(url, sizeof(url), ".data/%u/%.*s?o=%s%s%s%s%s%s%s%s%s%s%s%s", blocksize, hashes_len, hashes,
+                  op, bin ? "&bin" : "",
                   reserve_id ? "&reserve_id=" : "", reserve_id ? reserve_id : "",
                   revision_id ? "&revision_id=" : "", revision_id ? revision_id : "",
                   global_vol_id ? "&global_vol_id=" : "", global_vol_id ? global_vol_id : "",
@@ -679,10 +704,25 @@ static sxi_query_t *sxi_hashop_proto_list(sxc_client_t *sx, unsigned blocksize,
 
 sxi_query_t *sxi_hashop_proto_check(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len)
 {
-    return sxi_hashop_proto_list(sx, blocksize, hashes, hashes_len, REQ_GET, "check", NULL, NULL, NULL, 0, 0);
+    return sxi_hashop_proto_list(sx, blocksize, hashes, hashes_len, REQ_GET, "check", NULL, NULL, NULL, 0, 0, 0);
 }
 
-sxi_query_t *sxi_hashop_proto_reserve(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at)
+/* Binary variant: the hashes are sent packed in the body, the reply is a bitmap */
+sxi_query_t *sxi_hashop_proto_check_bin(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *hashes, unsigned count)
+{
+    sxi_query_t *query;
+
+    if (!hashes || !count || count > HASHOP_BIN_MAX_BLOCKS) {
+        sxi_seterr(sx, SXE_EARG, "Invalid hash batch");
+        return NULL;
+    }
+    query = sxi_hashop_proto_list(sx, blocksize, "", 0, REQ_PUT, "check", NULL, NULL, NULL, 0, 0, 1);
+    if (!query)
+        return NULL;
+    return sxi_query_append_raw(sx, query, hashes, count * sizeof(*hashes));
+}
+
+static sxi_query_t *hashop_proto_reserve(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at, int bin)
 {
     char reserve_idhex[SXI_SHA1_TEXT_LEN + 1];
     char revision_idhex[SXI_SHA1_TEXT_LEN + 1];
@@ -702,7 +742,26 @@ sxi_query_t *sxi_hashop_proto_reserve(sxc_client_t *sx, unsigned blocksize, cons
     sxi_bin2hex(reserve_id->b, sizeof(reserve_id->b), reserve_idhex);
     sxi_bin2hex(revision_id->b, sizeof(revision_id->b), revision_idhex);
     sxi_bin2hex(global_vol_id->b, sizeof(global_vol_id->b), vidhex);
-    return sxi_hashop_proto_list(sx, blocksize, hashes, hashes_len, REQ_PUT, "reserve", vidhex, reserve_idhex, revision_idhex, replica, op_expires_at);
+    return sxi_hashop_proto_list(sx, blocksize, hashes, hashes_len, REQ_PUT, "reserve", vidhex, reserve_idhex, revision_idhex, replica, op_expires_at, bin);
+}
+
+sxi_query_t *sxi_hashop_proto_reserve(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at)
+{
+    return hashop_proto_reserve(sx, blocksize, hashes, hashes_len, global_vol_id, reserve_id, revision_id, replica, op_expires_at, 0);
+}
+
+sxi_query_t *sxi_hashop_proto_reserve_bin(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *hashes, unsigned count, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at)
+{
+    sxi_query_t *query;
+
+    if (!hashes || !count || count > HASHOP_BIN_MAX_BLOCKS) {
+        sxi_seterr(sx, SXE_EARG, "Invalid hash batch");
+        return NULL;
+    }
+    query = hashop_proto_reserve(sx, blocksize, "", 0, global_vol_id, reserve_id, revision_id, replica, op_expires_at, 1);
+    if (!query)
+        return NULL;
+    return sxi_query_append_raw(sx, query, hashes, count * sizeof(*hashes));
 }
 
 sxi_query_t *sxi_hashop_proto_inuse_begin(sxc_client_t *sx)
@@ -758,6 +817,52 @@ sxi_query_t *sxi_hashop_proto_inuse_end(sxc_client_t *sx, sxi_query_t *query)
     return ret;
 }
 
+/* Binary inuse body, for each block:
+ *   hash[20] blocksize[4] count[4]
+ * followed by count entries of:
+ *   revision_id[20] has_vol_id[1] global_vol_id[20] replica[4]
+ * Integers are in network byte order */
+sxi_query_t *sxi_hashop_proto_inuse_bin(sxc_client_t *sx, block_meta_t **blocks, unsigned count)
+{
+    sxi_query_t *query;
+    uint8_t buf[SXI_SHA1_BIN_LEN * 2 + 1 + sizeof(uint32_t) * 2];
+    unsigned i, j;
+    uint32_t u;
+
+    if (!blocks || !count) {
+        sxi_seterr(sx, SXE_EARG, "Invalid block batch");
+        return NULL;
+    }
+    query = sxi_query_create(sx, ".data/?bin", REQ_PUT);
+    for (i=0; query && i<count; i++) {
+        const block_meta_t *m = blocks[i];
+        if (!m || !m->entries) {
+            sxi_seterr(sx, SXE_EARG, "Null/empty blockmeta");
+            sxi_query_free(query);
+            return NULL;
+        }
+        memcpy(buf, m->hash.b, SXI_SHA1_BIN_LEN);
+        u = htonl(m->blocksize);
+        memcpy(buf + SXI_SHA1_BIN_LEN, &u, sizeof(u));
+        u = htonl(m->count);
+        memcpy(buf + SXI_SHA1_BIN_LEN + sizeof(u), &u, sizeof(u));
+        query = sxi_query_append_raw(sx, query, buf, SXI_SHA1_BIN_LEN + sizeof(u) * 2);
+        for (j=0; query && j<m->count; j++) {
+            const block_meta_entry_t *e = &m->entries[j];
+            memcpy(buf, e->revision_id.b, SXI_SHA1_BIN_LEN);
+            buf[SXI_SHA1_BIN_LEN] = e->has_vol_id ? 1 : 0;
+            if (e->has_vol_id)
+                memcpy(buf + SXI_SHA1_BIN_LEN + 1, e->global_vol_id.b, SXI_SHA1_BIN_LEN);
+            else
+                memset(buf + SXI_SHA1_BIN_LEN + 1, 0, SXI_SHA1_BIN_LEN);
+            u = htonl(e->replica);
+            memcpy(buf + SXI_SHA1_BIN_LEN * 2 + 1, &u, sizeof(u));
+            query = sxi_query_append_raw(sx, query, buf, sizeof(buf) - sizeof(u));
+        }
+    }
+    return query;
+}
+
 sxi_query_t *sxi_hashop_proto_revision(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *revision_id, int op)
 {
     char url[sizeof(".data/1048576/?o=revmod&revision_id=") + SXI_SHA1_TEXT_LEN + 1];
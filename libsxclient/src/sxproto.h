@@ -23,6 +23,9 @@
 #include "sx.h"
 #include "default.h"
 #define EXPIRE_TEXT_LEN 18
+/* Max hashes in a binary hashop request (packed SXI_SHA1_BIN_LEN hashes
+ * in the body, presence bitmap in the reply, bit i is (b[i/8] >> (i%8)) & 1) */
+#define HASHOP_BIN_MAX_BLOCKS 1024
 
 enum sxi_cluster_verb { REQ_GET = 0, REQ_PUT, REQ_HEAD, REQ_DELETE };
 typedef struct _sxi_query_t {
@@ -51,6 +54,7 @@ sxi_query_t *sxi_flushfile_proto(sxc_client_t *sx, const char *token);
 sxi_query_t *sxi_fileadd_proto_begin(sxc_client_t *sx, const char *volname, const char *path, const char *revision, const char *revision_id, int64_t pos, int64_t blocksize, int64_t size);
 /* New file propagation, s2s only */
 sxi_query_t *sxi_fileadd_proto_begin_internal(sxc_client_t *sx, const char *global_vol_id_hex, const char *path, const char *revision, const char *revision_id, int64_t pos, int64_t blocksize, int64_t size);
+sxi_query_t *sxi_fileadd_proto_grow(sxc_client_t *sx, const char *token, int64_t pos, int64_t blocksize, int64_t size);
 sxi_query_t *sxi_fileadd_proto_addhash(sxc_client_t *sx, sxi_query_t *query, const char *hexhash);
 sxi_query_t *sxi_fileadd_proto_end(sxc_client_t *sx, sxi_query_t *query, sxc_meta_t *metadata);
 sxi_query_t *sxi_filedel_proto(sxc_client_t *sx, const char *volname, const char *path, const char *revision);
@@ -84,9 +88,12 @@ typedef struct {
 
 sxi_query_t *sxi_hashop_proto_check(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len);
 sxi_query_t *sxi_hashop_proto_reserve(sxc_client_t *sx, unsigned blocksize, const char *hashes, unsigned hashes_len, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at);
+sxi_query_t *sxi_hashop_proto_check_bin(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *hashes, unsigned count);
+sxi_query_t *sxi_hashop_proto_reserve_bin(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *hashes, unsigned count, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned replica, uint64_t op_expires_at);
 sxi_query_t *sxi_hashop_proto_inuse_begin(sxc_client_t *sx);
 sxi_query_t *sxi_hashop_proto_inuse_hash(sxc_client_t *sx, sxi_query_t *query, const block_meta_t *blockmeta);
 sxi_query_t *sxi_hashop_proto_inuse_end(sxc_client_t *sx, sxi_query_t *query);
+sxi_query_t *sxi_hashop_proto_inuse_bin(sxc_client_t *sx, block_meta_t **blocks, unsigned count);
 sxi_query_t *sxi_hashop_proto_revision(sxc_client_t *sx, unsigned blocksize, const sx_hash_t *revision_id, int op);
 
 sxi_query_t *sxi_nodeinit_proto(sxc_client_t *sx, const char *cluster_name, const char *node_uuid, uint16_t http_port, int ssl_flag, const char *ssl_file);
@@ -0,0 +1,497 @@
+/*
+ *  Copyright (C) 2012-2014 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+#include "default.h"
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef HAVE_PWRITEV
+#include <sys/uio.h>
+#include <limits.h>
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define BLOCKIO_IOV_MAX IOV_MAX
+#else
+#define BLOCKIO_IOV_MAX 1024
+#endif
+#endif
+
+#ifdef ENABLE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "blockio.h"
+#include "log.h"
+#include "utils.h"
+
+struct blockio_req {
+    int fd;
+    int write;
+    uint8_t *buf;
+    unsigned int len;
+    uint64_t off;
+    int res;
+    int done; /* res is set */
+};
+
+#ifdef ENABLE_IO_URING
+struct blockio_ring {
+    int fd;
+    unsigned int entries;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+enum ring_state { RING_UNTRIED = 0, RING_OK, RING_UNAVAILABLE };
+#endif
+
+struct _sx_blockio_t {
+    struct blockio_req *reqs;
+    unsigned int nreqs, nalloc;
+    unsigned int depth;
+#ifdef ENABLE_IO_URING
+    struct blockio_ring ring;
+    enum ring_state state;
+    pid_t pid;
+#endif
+};
+
+sx_blockio_t *sx_blockio_new(unsigned int depth) {
+    sx_blockio_t *io = wrap_calloc(1, sizeof(*io));
+    if(!io) {
+	OOM();
+	return NULL;
+    }
+    io->depth = depth ? depth : 1;
+#ifdef ENABLE_IO_URING
+    io->ring.fd = -1;
+#endif
+    return io;
+}
+
+#ifdef ENABLE_IO_URING
+static void ring_free(struct blockio_ring *r) {
+    if(r->sqes && r->sqes != MAP_FAILED)
+	munmap(r->sqes, r->sqes_len);
+    if(r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+	munmap(r->cq_map, r->cq_map_len);
+    if(r->sq_map && r->sq_map != MAP_FAILED)
+	munmap(r->sq_map, r->sq_map_len);
+    if(r->fd >= 0)
+	close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int ring_setup(struct blockio_ring *r, unsigned int entries) {
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(r->fd < 0)
+	return -1;
+    /* IORING_OP_READ and IORING_OP_WRITE came along with this feature (Linux 5.6) */
+    if(!(p.features & IORING_FEAT_RW_CUR_POS)) {
+	ring_free(r);
+	errno = ENOSYS;
+	return -1;
+    }
+
+    r->entries = p.sq_entries;
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+	if(r->cq_map_len > r->sq_map_len)
+	    r->sq_map_len = r->cq_map_len;
+	r->cq_map_len = r->sq_map_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    if(r->sq_map == MAP_FAILED)
+	goto setup_fail;
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+	r->cq_map = r->sq_map;
+    else {
+	r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+	if(r->cq_map == MAP_FAILED)
+	    goto setup_fail;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED)
+	goto setup_fail;
+
+    sq = r->sq_map;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    cq = r->cq_map;
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+ setup_fail:
+    {
+	int err = errno;
+	ring_free(r);
+	errno = err;
+    }
+    return -1;
+}
+
+/* Set up the ring on first use and again in a forked child, which must
+ * not submit to the ring of its parent */
+static int ring_ready(sx_blockio_t *io) {
+    pid_t pid = getpid();
+
+    if(io->state == RING_OK && io->pid != pid) {
+	ring_free(&io->ring);
+	io->state = RING_UNTRIED;
+    }
+    if(io->state == RING_UNTRIED) {
+	if(ring_setup(&io->ring, io->depth)) {
+	    NOTICE("io_uring is not available (%s), falling back to pread/pwrite", strerror(errno));
+	    io->state = RING_UNAVAILABLE;
+	} else {
+	    io->state = RING_OK;
+	    io->pid = pid;
+	}
+    }
+    return io->state == RING_OK;
+}
+#endif
+
+void sx_blockio_free(sx_blockio_t *io) {
+    if(!io)
+	return;
+#ifdef ENABLE_IO_URING
+    /* Never tear down the ring of the parent process from a child */
+    if(io->state == RING_OK && io->pid == getpid())
+	ring_free(&io->ring);
+    else if(io->state == RING_OK) {
+	munmap(io->ring.sqes, io->ring.sqes_len);
+	if(io->ring.cq_map != io->ring.sq_map)
+	    munmap(io->ring.cq_map, io->ring.cq_map_len);
+	munmap(io->ring.sq_map, io->ring.sq_map_len);
+	close(io->ring.fd);
+    }
+#endif
+    free(io->reqs);
+    free(io);
+}
+
+const char *sx_blockio_backend(sx_blockio_t *io) {
+    return sx_blockio_is_async(io) ? "io_uring" : "pread";
+}
+
+int sx_blockio_is_async(sx_blockio_t *io) {
+#ifdef ENABLE_IO_URING
+    return io && ring_ready(io);
+#else
+    return 0;
+#endif
+}
+
+static int blockio_queue(sx_blockio_t *io, int fd, int write, uint8_t *buf, unsigned int len, uint64_t off) {
+    struct blockio_req *r;
+
+    if(!io || fd < 0 || !buf) {
+	errno = EINVAL;
+	return -1;
+    }
+    if(io->nreqs == io->nalloc) {
+	unsigned int nalloc = io->nalloc ? io->nalloc * 2 : io->depth;
+	struct blockio_req *reqs = wrap_realloc(io->reqs, nalloc * sizeof(*reqs));
+	if(!reqs) {
+	    OOM();
+	    errno = ENOMEM;
+	    return -1;
+	}
+	io->reqs = reqs;
+	io->nalloc = nalloc;
+    }
+    r = &io->reqs[io->nreqs++];
+    r->fd = fd;
+    r->write = write;
+    r->buf = buf;
+    r->len = len;
+    r->off = off;
+    r->res = 0;
+    r->done = 0;
+    return 0;
+}
+
+int sx_blockio_read(sx_blockio_t *io, int fd, void *buf, unsigned int len, uint64_t off) {
+    return blockio_queue(io, fd, 0, buf, len, off);
+}
+
+int sx_blockio_write(sx_blockio_t *io, int fd, const void *buf, unsigned int len, uint64_t off) {
+    return blockio_queue(io, fd, 1, (uint8_t *)buf, len, off);
+}
+
+void sx_blockio_reset(sx_blockio_t *io) {
+    if(io)
+	io->nreqs = 0;
+}
+
+static void blockio_dontneed(int fd, uint64_t off, uint64_t len) {
+    /* Large uploads can kick out more useful pages from the cache (such as DB pages).
+       Do not put the uploaded data into cache immediately. */
+#ifdef HAVE_POSIX_FADVISE
+    if(posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED))
+	PWARN("fadvise failed");
+#endif
+}
+
+/* Synchronously transfer len bytes; a read hitting EOF fails with EIO */
+static int blockio_rw(int fd, int write, uint8_t *buf, unsigned int len, uint64_t off) {
+    while(len) {
+	ssize_t l = write ? pwrite(fd, buf, len, off) : pread(fd, buf, len, off);
+	if(l < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	if(!l) {
+	    errno = EIO;
+	    return -1;
+	}
+	len -= l;
+	buf += l;
+	off += l;
+    }
+    return 0;
+}
+
+#ifdef HAVE_PWRITEV
+/* Write the adjacent requests in reqs[0..n) with as few syscalls as possible */
+static int blockio_writev(struct blockio_req *reqs, unsigned int n) {
+    struct iovec iov[BLOCKIO_IOV_MAX];
+    uint64_t off = reqs[0].off;
+    unsigned int i, cur = 0;
+    size_t left = 0;
+
+    for(i = 0; i < n; i++) {
+	iov[i].iov_base = reqs[i].buf;
+	iov[i].iov_len = reqs[i].len;
+	left += reqs[i].len;
+    }
+    while(left) {
+	ssize_t l = pwritev(reqs[0].fd, &iov[cur], n - cur, off);
+	if(l < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	left -= l;
+	off += l;
+	/* Skip over what was written on a short write */
+	while(cur < n && (size_t)l >= iov[cur].iov_len) {
+	    l -= iov[cur].iov_len;
+	    cur++;
+	}
+	if(l) {
+	    iov[cur].iov_base = (uint8_t *)iov[cur].iov_base + l;
+	    iov[cur].iov_len -= l;
+	}
+    }
+    return 0;
+}
+#endif
+
+static int blockio_run_portable(struct blockio_req *reqs, unsigned int n) {
+    unsigned int i = 0;
+
+    while(i < n) {
+	struct blockio_req *r = &reqs[i];
+	unsigned int cnt = 1;
+	uint64_t len = r->len;
+
+	if(!r->write) {
+	    if(blockio_rw(r->fd, 0, r->buf, r->len, r->off))
+		return -1;
+	    i++;
+	    continue;
+	}
+#ifdef HAVE_PWRITEV
+	while(i + cnt < n && cnt < BLOCKIO_IOV_MAX && r[cnt].write && r[cnt].fd == r->fd && r[cnt].off == r->off + len) {
+	    len += r[cnt].len;
+	    cnt++;
+	}
+	if(cnt > 1 ? blockio_writev(r, cnt) : blockio_rw(r->fd, 1, r->buf, r->len, r->off))
+	    return -1;
+#else
+	if(blockio_rw(r->fd, 1, r->buf, r->len, r->off))
+	    return -1;
+#endif
+	blockio_dontneed(r->fd, r->off, len);
+	i += cnt;
+    }
+    return 0;
+}
+
+#ifdef ENABLE_IO_URING
+/* Collect the completions posted so far, returns how many */
+static unsigned int ring_reap(struct blockio_ring *ring, struct blockio_req *reqs) {
+    unsigned int head = *ring->cq_head, n = 0;
+
+    while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+	struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+	reqs[cqe->user_data].res = cqe->res;
+	reqs[cqe->user_data].done = 1;
+	head++;
+	n++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Give up on the ring after io_uring_enter failed: the kernel may still be
+ * working on the requests it picked up, into our buffers, so wait for those
+ * before tearing it down. The others are never going to be submitted */
+static void ring_abandon(sx_blockio_t *io, struct blockio_req *reqs, unsigned int sq_head, unsigned int done) {
+    struct blockio_ring *ring = &io->ring;
+    unsigned int submitted = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) - sq_head;
+
+    while(done < submitted) {
+	/* Completions are posted whether or not we get to wait for them */
+	if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+	    usleep(1000);
+	done += ring_reap(ring, reqs);
+    }
+    ring_free(ring);
+    io->state = RING_UNAVAILABLE;
+}
+
+/* Submit reqs[0..n), n not exceeding the ring size, and wait for all of them.
+ * If the ring fails, what it did not complete is done with pread/pwrite */
+static int blockio_run_ring(sx_blockio_t *io, struct blockio_req *reqs, unsigned int n) {
+    struct blockio_ring *ring = &io->ring;
+    unsigned int i, tail = *ring->sq_tail, sq_head = *ring->sq_head, tosubmit = n, done = 0;
+    int ret = 0;
+
+    for(i = 0; i < n; i++) {
+	unsigned int idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = reqs[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = reqs[i].fd;
+	sqe->addr = (uintptr_t)reqs[i].buf;
+	sqe->len = reqs[i].len;
+	sqe->off = reqs[i].off;
+	sqe->user_data = i;
+	ring->sq_array[idx] = idx;
+	tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while(done < n) {
+	int r = syscall(__NR_io_uring_enter, ring->fd, tosubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	if(r < 0) {
+	    if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+		continue;
+	    /* The ring is in an unknown state: stop using it */
+	    PWARN("io_uring_enter failed, falling back to pread/pwrite");
+	    ring_abandon(io, reqs, sq_head, done + ring_reap(ring, reqs));
+	    break;
+	}
+	tosubmit -= r < (int)tosubmit ? r : tosubmit;
+	done += ring_reap(ring, reqs);
+    }
+
+    for(i = 0; i < n; i++) {
+	struct blockio_req *r = &reqs[i];
+	if(!r->done) {
+	    r->res = 0;
+	    r->done = 1;
+	}
+	if(r->res < 0) {
+	    if(!ret)
+		errno = -r->res;
+	    ret = -1;
+	    continue;
+	}
+	/* Short transfers, and those the ring never got to, are completed synchronously */
+	if((unsigned int)r->res < r->len &&
+	   blockio_rw(r->fd, r->write, r->buf + r->res, r->len - r->res, r->off + r->res)) {
+	    ret = -1;
+	    continue;
+	}
+	if(r->write)
+	    blockio_dontneed(r->fd, r->off, r->len);
+    }
+    return ret;
+}
+#endif
+
+int sx_blockio_submit(sx_blockio_t *io) {
+    int ret;
+
+    if(!io) {
+	errno = EINVAL;
+	return -1;
+    }
+    if(!io->nreqs)
+	return 0;
+#ifdef ENABLE_IO_URING
+    if(ring_ready(io)) {
+	unsigned int i, n;
+	ret = 0;
+	for(i = 0; i < io->nreqs && !ret; i += n) {
+	    /* The ring may have been given up on by the previous batch */
+	    if(io->state != RING_OK) {
+		ret = blockio_run_portable(&io->reqs[i], io->nreqs - i);
+		break;
+	    }
+	    n = io->nreqs - i;
+	    if(n > io->ring.entries)
+		n = io->ring.entries;
+	    ret = blockio_run_ring(io, &io->reqs[i], n);
+	}
+	io->nreqs = 0;
+	return ret;
+    }
+#endif
+    ret = blockio_run_portable(io->reqs, io->nreqs);
+    io->nreqs = 0;
+    return ret;
+}
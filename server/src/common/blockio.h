@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2012-2014 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+#ifndef BLOCKIO_H
+#define BLOCKIO_H
+
+#include <stdint.h>
+
+/* Block data file I/O
+ *
+ * Reads and writes are queued with sx_blockio_read() and sx_blockio_write()
+ * and only performed by sx_blockio_submit().
+ * The portable backend runs the queue with pread/pwrite, coalescing adjacent
+ * writes into vectored writes where available.
+ * When built with --enable-io-uring the whole queue is handed to the kernel
+ * in a single io_uring submission; if the kernel refuses to set up a ring
+ * the portable backend is used instead.
+ *
+ * Writes are followed by POSIX_FADV_DONTNEED as they are never re-read soon.
+ * A handle must not be shared across processes: after a fork() the child
+ * transparently sets up its own ring on the next submission.
+ */
+typedef struct _sx_blockio_t sx_blockio_t;
+
+sx_blockio_t *sx_blockio_new(unsigned int depth);
+void sx_blockio_free(sx_blockio_t *io);
+
+/* Returns the name of the backend in use ("pread" or "io_uring") */
+const char *sx_blockio_backend(sx_blockio_t *io);
+/* Returns non zero if the queued requests are performed concurrently */
+int sx_blockio_is_async(sx_blockio_t *io);
+
+/* Queue a request: buf must stay valid until sx_blockio_submit() returns */
+int sx_blockio_read(sx_blockio_t *io, int fd, void *buf, unsigned int len, uint64_t off);
+int sx_blockio_write(sx_blockio_t *io, int fd, const void *buf, unsigned int len, uint64_t off);
+
+/* Perform all the queued requests and empty the queue
+ * Returns 0 if every request was fully completed, -1 with errno set otherwise */
+int sx_blockio_submit(sx_blockio_t *io);
+/* Drop the queued requests without performing them */
+void sx_blockio_reset(sx_blockio_t *io);
+
+#endif
@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <fnmatch.h>
 #include <ctype.h>
 
@@ -60,6 +61,15 @@
 #define fdatasync fsync
 #endif
 
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/statvfs.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/falloc.h>
+#endif
+
 #define HASHDBS 16
 #define METADBS 16
 #define GCDBS 1
@@ -259,6 +269,272 @@ static int read_block(int fd, uint8_t *dt, uint64_t off, unsigned int buf_len) {
     return 0;
 }
 
+/* Per data file generation counters, shared by all the processes using the storage.
+ * A counter is bumped every time the online compactor relocates blocks within the
+ * data file, so that readers holding a block position can tell it may be stale */
+#define DATAGEN_SIZE (sizeof(uint64_t) * SIZES * HASHDBS)
+
+/* Cluster state generation, shared by all the processes using the storage.
+ * It is bumped after every commit touching the hashfs table of hashfs.db, where
+ * the cluster mode and the distribution models live, so that the per request
+ * mode and distribution checks only query the database when it moves */
+#define CSTATE_SIZE sizeof(uint64_t)
+
+/* Per data file block I/O counters, shared by all the processes using the storage
+ * and cumulative over restarts; they are summed up per data directory on request */
+struct datafile_iostat {
+    uint64_t reads, read_bytes;
+    uint64_t writes, write_bytes;
+};
+#define IOSTAT_SIZE (sizeof(struct datafile_iostat) * SIZES * HASHDBS)
+/* Cached values are verified against the database at least this often (in
+ * seconds) anyway, for the writers which don't bump the generation (e.g. the
+ * offline upgrade) */
+#define CSTATE_RECHECK 5
+
+/* Node wide cache of the user and volume privilege lookups done by every
+ * authenticated request, shared by all the processes using the storage.
+ * Entries are tagged with the auth generation current when their lookup
+ * started; the generation is bumped after every commit touching users or privs,
+ * adding or removing volumes or changing their owner or enabled state */
+#define AUTHCACHE_USERS 4096
+#define AUTHCACHE_PRIVS 16384
+/* Entries expire after this many seconds anyway, for the writers which don't
+ * bump the generation (e.g. the offline upgrade) */
+#define AUTHCACHE_TTL 60
+
+/* Entries are written under a sequence lock: seq is odd while an entry is
+ * being written and readers retry as a miss if it moved under them.
+ * Writers claim an entry by storing their pid in owner, and only then stamp it
+ * and make seq odd. The claim of a writer which died before releasing it is
+ * taken over; a writer which finds its claim taken over anyway invalidates the
+ * entry rather than publishing it */
+struct authcache_user {
+    uint32_t seq;
+    uint32_t owner;
+    uint32_t priv;
+    uint64_t gen;
+    int64_t stamp;
+    int64_t uid;
+    int64_t quota;
+    uint8_t user[AUTH_UID_LEN];
+    uint8_t key[AUTH_KEY_LEN];
+};
+
+struct authcache_priv {
+    uint32_t seq;
+    uint32_t owner;
+    uint32_t priv;
+    uint64_t gen;
+    int64_t stamp;
+    int64_t vid;
+    uint8_t user[AUTH_UID_LEN];
+};
+
+struct authcache {
+    uint64_t gen;
+    uint64_t user_hits, user_misses, priv_hits, priv_misses;
+    struct authcache_user users[AUTHCACHE_USERS];
+    struct authcache_priv privs[AUTHCACHE_PRIVS];
+};
+
+static uint64_t *shared_map(const char *path, size_t size) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if(fd < 0) {
+	WARN("Failed to open %s: %s", path, strerror(errno));
+	return NULL;
+    }
+    if(fstat(fd, &st) || (st.st_size < size && ftruncate(fd, size))) {
+	WARN("Failed to size %s: %s", path, strerror(errno));
+	close(fd);
+	return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+	WARN("Failed to map %s: %s", path, strerror(errno));
+	return NULL;
+    }
+    return map;
+}
+
+/* Block membership filters
+ *
+ * A blocked bloom filter per (size, hashdb) lets the lookups of blocks which are
+ * not stored skip the blocks table. The filters live in a file shared by all the
+ * processes using the storage: the bits of a block are set, with the write lock
+ * on its hashdb held, before its row is committed. A process which cannot map
+ * the bitmaps marks the filter not ready instead. Deletions are not reflected
+ * and the GC rebuilds a filter from the blocks table once enough of its entries
+ * are stale or it gets too full.
+ * Each filter has two bitmaps: the rebuild clears and fills the inactive one,
+ * while the inserters update both, and then makes it active. The bitmaps are
+ * sized from the number of blocks when they are rebuilt, the file is sparse.
+ * The bits are only on disk once the file is synced: every user holds a shared
+ * flock on it, the last one to leave syncs it and flags it clean, and the first
+ * one to come finds out whether the filters survived or must be rebuilt */
+#define BFILTER_MAGIC 0x3253464b4c425853ULL /* SXBLKFS2 */
+#define BFILTER_HDRSIZE 4096
+#define BFILTER_BITMAP_MIN (1024 * 1024)
+#define BFILTER_BITMAP_MAX (32 * 1024 * 1024)
+#define BFILTER_LINE_WORDS 8 /* 512 bit lines: one cache line per lookup */
+#define BFILTER_LINE_SIZE (BFILTER_LINE_WORDS * sizeof(uint64_t))
+#define BFILTER_PROBES 7
+/* Bitmaps are sized for this many bits per block, and rebuilt once they are down to half that */
+#define BFILTER_BITS_PER_BLOCK 20
+#define BFILTER_SIZE (BFILTER_HDRSIZE + (off_t)SIZES * HASHDBS * 2 * BFILTER_BITMAP_MAX)
+
+struct bfilter_slot {
+    uint32_t ready; /* the active bitmap covers all the blocks */
+    uint32_t active; /* bitmap used for lookups */
+    uint32_t shadow; /* 1 + bitmap being rebuilt, 0 if none */
+    uint32_t seq; /* bumped before a bitmap is cleared */
+    uint32_t stale; /* bumped by the writers which could not set the bits */
+    uint32_t lines[2]; /* size of each bitmap, a power of two */
+    uint64_t entries; /* blocks added to the active bitmap */
+    uint64_t deleted; /* blocks deleted since the last rebuild */
+    uint64_t dataino; /* inode of the data file the filter was built for */
+};
+
+struct bfilter_hdr {
+    uint64_t magic;
+    uint64_t bitmap_max;
+    uint64_t clean; /* all the bits are on disk */
+    struct bfilter_slot slot[SIZES][HASHDBS];
+};
+
+/* Maps the filters into *full, or their header only into *hdr if the bitmaps
+ * don't fit; returns the locked file descriptor, -1 on error */
+static int bfilter_map(const char *path, struct bfilter_hdr **full, struct bfilter_hdr **hdr) {
+    struct bfilter_hdr *f;
+    unsigned int i, j;
+    struct stat st;
+    uint64_t head[2];
+    void *map;
+    int fd, first;
+
+    *full = *hdr = NULL;
+    fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if(fd < 0) {
+	WARN("Failed to open %s: %s", path, strerror(errno));
+	return -1;
+    }
+    /* Nobody else is using the filters: a different layout can be dropped */
+    first = !flock(fd, LOCK_EX | LOCK_NB);
+    if(first && pread(fd, head, sizeof(head), 0) == sizeof(head) &&
+       (head[0] != BFILTER_MAGIC || head[1] != BFILTER_BITMAP_MAX) && ftruncate(fd, 0)) {
+	WARN("Failed to reset %s: %s", path, strerror(errno));
+	goto bfilter_map_err;
+    }
+    if(fstat(fd, &st) || (st.st_size < BFILTER_SIZE && ftruncate(fd, BFILTER_SIZE))) {
+	WARN("Failed to size %s: %s", path, strerror(errno));
+	goto bfilter_map_err;
+    }
+    map = mmap(NULL, BFILTER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+	WARN("Failed to map %s, block lookups will not be filtered: %s", path, strerror(errno));
+	map = mmap(NULL, BFILTER_HDRSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+	    WARN("Failed to map the header of %s: %s", path, strerror(errno));
+	    goto bfilter_map_err;
+	}
+	*hdr = map;
+    } else
+	*full = map;
+    f = map;
+
+    /* A new file is all zeroes: concurrent initializers store the same values */
+    if(!__atomic_load_n(&f->magic, __ATOMIC_SEQ_CST)) {
+	for(i = 0; i < SIZES; i++)
+	    for(j = 0; j < HASHDBS; j++)
+		f->slot[i][j].lines[0] = f->slot[i][j].lines[1] = BFILTER_BITMAP_MIN / BFILTER_LINE_SIZE;
+	__atomic_store_n(&f->bitmap_max, BFILTER_BITMAP_MAX, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&f->clean, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&f->magic, BFILTER_MAGIC, __ATOMIC_SEQ_CST);
+    }
+    if(f->magic != BFILTER_MAGIC || f->bitmap_max != BFILTER_BITMAP_MAX) {
+	WARN("Bad block filter file %s", path);
+	goto bfilter_map_err;
+    }
+    if(first) {
+	/* The last run didn't get to sync the bits: they may be missing some blocks */
+	if(!__atomic_load_n(&f->clean, __ATOMIC_SEQ_CST)) {
+	    INFO("Block filters were not shut down cleanly, they will be rebuilt");
+	    for(i = 0; i < SIZES; i++)
+		for(j = 0; j < HASHDBS; j++)
+		    __atomic_store_n(&f->slot[i][j].ready, 0, __ATOMIC_SEQ_CST);
+	}
+	__atomic_store_n(&f->clean, 0, __ATOMIC_SEQ_CST);
+	if(msync(f, BFILTER_HDRSIZE, MS_SYNC)) {
+	    WARN("Failed to sync %s: %s", path, strerror(errno));
+	    goto bfilter_map_err;
+	}
+    }
+    if(flock(fd, LOCK_SH)) {
+	WARN("Failed to lock %s: %s", path, strerror(errno));
+	goto bfilter_map_err;
+    }
+    return fd;
+
+ bfilter_map_err:
+    if(*full)
+	munmap(*full, BFILTER_SIZE);
+    if(*hdr)
+	munmap(*hdr, BFILTER_HDRSIZE);
+    *full = *hdr = NULL;
+    close(fd);
+    return -1;
+}
+
+/* Number of lines for a bitmap holding the given number of blocks */
+static uint32_t bfilter_lines_for(uint64_t blocks) {
+    uint64_t lines = BFILTER_BITMAP_MIN / BFILTER_LINE_SIZE;
+
+    while(lines < BFILTER_BITMAP_MAX / BFILTER_LINE_SIZE && lines * BFILTER_LINE_SIZE * 8 < blocks * BFILTER_BITS_PER_BLOCK)
+	lines *= 2;
+    return lines;
+}
+
+static uint64_t *bfilter_bitmap(struct bfilter_hdr *f, unsigned int hs, unsigned int ndb, unsigned int map) {
+    return (uint64_t *)((uint8_t *)f + BFILTER_HDRSIZE + ((hs * HASHDBS + ndb) * 2 + map) * (size_t)BFILTER_BITMAP_MAX);
+}
+
+static uint64_t *bfilter_line(struct bfilter_hdr *f, unsigned int hs, unsigned int ndb, unsigned int map, const sx_hash_t *hash) {
+    uint32_t lines = __atomic_load_n(&f->slot[hs][ndb].lines[map], __ATOMIC_SEQ_CST);
+    uint64_t w;
+
+    /* Hashes are uniformly distributed already: use their bits as they are */
+    memcpy(&w, hash->b, sizeof(w));
+    return bfilter_bitmap(f, hs, ndb, map) + (w & (lines - 1)) * BFILTER_LINE_WORDS;
+}
+
+static uint64_t bfilter_probes(const sx_hash_t *hash) {
+    uint64_t w;
+
+    memcpy(&w, hash->b + sizeof(w), sizeof(w));
+    return w;
+}
+
+static void bfilter_set(uint64_t *line, uint64_t probes) {
+    unsigned int i;
+
+    for(i = 0; i < BFILTER_PROBES; i++, probes >>= 9)
+	__atomic_fetch_or(&line[(probes & 511) >> 6], 1ULL << (probes & 63), __ATOMIC_RELAXED);
+}
+
+static int bfilter_test(const uint64_t *line, uint64_t probes) {
+    unsigned int i;
+
+    for(i = 0; i < BFILTER_PROBES; i++, probes >>= 9)
+	if(!(__atomic_load_n(&line[(probes & 511) >> 6], __ATOMIC_RELAXED) & (1ULL << (probes & 63))))
+	    return 0;
+    return 1;
+}
+
 int sx_hashfs_hash_buf(const void *salt, unsigned int salt_len, const void *buf, unsigned int buf_len, sx_hash_t *hash) {
     return sxi_sha1_calc(salt, salt_len, buf, buf_len, hash->b);
 }
@@ -328,8 +604,29 @@ static sxi_db_t *create_db(const char *path, const char *dbtype, const sx_uuid_t
 
 static int qlog_set = 0;
 
-static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size) {
-    unsigned int dirlen, i, j;
+/* The data files and their hash dbs are spread round robin over the data
+ * directories, so that every directory gets a share of every block size */
+static const char *datadir_of(const char **datadirs, unsigned int ndatadirs, unsigned int hs, unsigned int ndb) {
+    return ndatadirs ? datadirs[(hs * HASHDBS + ndb) % ndatadirs] : NULL;
+}
+
+static void datadirs_cleanup(const char **datadirs, unsigned int ndatadirs, char *path) {
+    unsigned int i, j;
+    for(j = 0; j < SIZES; j++) {
+	for(i = 0; i < HASHDBS; i++) {
+	    const char *ddir = datadir_of(datadirs, ndatadirs, j, i);
+	    if(!ddir)
+		return;
+	    sprintf(path, "%s/h%c%08x.db", ddir, sizedirs[j], i);
+	    unlink(path);
+	    sprintf(path, "%s/h%c%08x.bin", ddir, sizedirs[j], i);
+	    unlink(path);
+	}
+    }
+}
+
+static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size, const char **datadirs, unsigned int ndatadirs) {
+    unsigned int dirlen, i, j, placed = 0;
     sxi_db_t *db = NULL;
     sqlite3_stmt *q = NULL;
     char *path, dbitem[64];
@@ -341,6 +638,20 @@ static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t
 	return EINVAL;
     }
 
+    for(i = 0; i < ndatadirs; i++) {
+	unsigned int len = datadirs[i] ? strlen(datadirs[i]) : 0;
+	if(!len || datadirs[i][0] != '/') {
+	    CRIT("Data directories must be absolute paths");
+	    return EINVAL;
+	}
+	if(len > dirlen)
+	    dirlen = len;
+	if(access(datadirs[i], R_OK | W_OK | X_OK)) {
+	    PCRIT("Cannot access data directory %s", datadirs[i]);
+	    return FAIL_EINIT;
+	}
+    }
+
     if(ssl_version_check())
 	return FAIL_EINIT;
 
@@ -352,6 +663,24 @@ static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t
     if(!(path = wrap_malloc(dirlen + bsz[SIZES-1])))
 	goto create_hashfs_fail;
 
+    /* Never clobber the files of another storage sharing a data directory */
+    for(j = 0; j < SIZES && ndatadirs; j++) {
+	for(i = 0; i < HASHDBS; i++) {
+	    const char *ddir = datadir_of(datadirs, ndatadirs, j, i);
+	    sprintf(path, "%s/h%c%08x.db", ddir, sizedirs[j], i);
+	    if(!access(path, F_OK)) {
+		CRIT("Data directory %s already contains a storage", ddir);
+		goto create_hashfs_fail;
+	    }
+	    sprintf(path, "%s/h%c%08x.bin", ddir, sizedirs[j], i);
+	    if(!access(path, F_OK)) {
+		CRIT("Data directory %s already contains a storage", ddir);
+		goto create_hashfs_fail;
+	    }
+	}
+    }
+    placed = ndatadirs;
+
     /* --- HASHFS db --- */
     sqlite3_config(SQLITE_CONFIG_LOG, qlog, NULL);
     qlog_set = 1;
@@ -374,17 +703,24 @@ static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t
 	    goto create_hashfs_fail;
     }
 
-    /* Set the path to the block dbs */
+    /* Set the path to the block dbs: relative to the storage unless placed in a data directory */
     for(j = 0; j < SIZES; j++) {
 	for(i=0; i<HASHDBS; i++) {
+	    const char *ddir = datadir_of(datadirs, ndatadirs, j, i);
 	    sprintf(dbitem, "hashdb_%c_%08x", sizedirs[j], i);
-	    sprintf(path, "h%c%08x.db", sizedirs[j], i);
+	    if(ddir)
+		sprintf(path, "%s/h%c%08x.db", ddir, sizedirs[j], i);
+	    else
+		sprintf(path, "h%c%08x.db", sizedirs[j], i);
 	    sqlite3_reset(q);
 	    if(qbind_text(q, ":k", dbitem) || qbind_text(q, ":v", path) || qstep_noret(q))
 		goto create_hashfs_fail;
 
 	    sprintf(dbitem, "datafile_%c_%08x", sizedirs[j], i);
-	    sprintf(path, "h%c%08x.bin", sizedirs[j], i);
+	    if(ddir)
+		sprintf(path, "%s/h%c%08x.bin", ddir, sizedirs[j], i);
+	    else
+		sprintf(path, "h%c%08x.bin", sizedirs[j], i);
 	    sqlite3_reset(q);
 	    if(qbind_text(q, ":k", dbitem) || qbind_text(q, ":v", path) || qstep_noret(q))
 		goto create_hashfs_fail;
@@ -481,9 +817,10 @@ static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t
     /* --- HASH dbs --- */
     for(j = 0; j < SIZES; j++) {
 	for(i=0; i<HASHDBS; i++) {
+	    const char *ddir = datadir_of(datadirs, ndatadirs, j, i);
 	    int fd;
 
-	    sprintf(path, "%s/h%c%08x.db", dir, sizedirs[j], i);
+	    sprintf(path, "%s/h%c%08x.db", ddir ? ddir : dir, sizedirs[j], i);
 	    sprintf(dbitem, "hashdb_%c_%08x", sizedirs[j], i);
 	    if(!(db = create_db(path, dbitem, cluster, HASHFS_VERSION_INITIAL, &q)))
 		goto create_hashfs_fail;
@@ -515,7 +852,7 @@ static rc_ty create_initial_storage(const char *dir, sx_uuid_t *cluster, uint8_t
 	    qclose(&db);
 
 	    /* Create DATA files */
-	    sprintf(path, "%s/h%c%08x.bin", dir, sizedirs[j], i);
+	    sprintf(path, "%s/h%c%08x.bin", ddir ? ddir : dir, sizedirs[j], i);
 	    fd = creat(path, 0666);
 	    if(fd < 0) {
 		PCRIT("Cannot create data file %s", path);
@@ -601,6 +938,8 @@ create_hashfs_fail:
     sqlite3_finalize(q);
     if(db)
         qclose(&db);
+    if(ret && placed)
+	datadirs_cleanup(datadirs, placed, path);
     free(path);
     sxc_free_uri(uri);
     if(ret)
@@ -608,8 +947,8 @@ create_hashfs_fail:
     return ret;
 }
 
-rc_ty sx_storage_create(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size) {
-    rc_ty ret = create_initial_storage(dir, cluster, key, key_size);
+rc_ty sx_storage_create(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size, const char **datadirs, unsigned int ndatadirs) {
+    rc_ty ret = create_initial_storage(dir, cluster, key, key_size, datadirs, ndatadirs);
     if (ret == OK)
         ret = sx_storage_upgrade(dir);
     if (ret == OK)
@@ -742,8 +1081,15 @@ typedef struct {
     sx_hash_t revision_id;
 } list_entry_t;
 
+/* Maximum number of rows fetched from a meta database per listing query */
+#define LIST_PREFETCH 32
+
+/* Ring size of the block data file I/O queue */
+#define BLOCKIO_DEPTH 128
+
 struct _sx_hashfs_t {
     uint8_t *blockbuf;
+    sx_blockio_t *blockio;
 
     sxi_db_t *db;
     sqlite3_stmt *q_getval;
@@ -878,6 +1224,10 @@ struct _sx_hashfs_t {
     sqlite3_stmt *qb_get_meta[SIZES][HASHDBS];
     sqlite3_stmt *qb_gc_find_unused_revision[SIZES][HASHDBS];
     sqlite3_stmt *qb_gc_find_unused_block[SIZES][HASHDBS];
+    sqlite3_stmt *qb_gc_candidate[SIZES][HASHDBS];
+    sqlite3_stmt *qb_gc_candidate_del[SIZES][HASHDBS];
+    sqlite3_stmt *qb_gc_candidate_requeue[SIZES][HASHDBS];
+    sqlite3_stmt *qb_isavail[SIZES][HASHDBS];
     sqlite3_stmt *qb_gc_check_revop_expiration[SIZES][HASHDBS];
     sqlite3_stmt *qb_gc_prep_revops_expiration[SIZES][HASHDBS];
     sqlite3_stmt *qb_gc_del_revops_expiration[SIZES][HASHDBS];
@@ -951,7 +1301,12 @@ struct _sx_hashfs_t {
     int list_recurse;
     int64_t list_volid;
     char list_pattern[2*SXLIMIT_MAX_FILENAME_LEN+3];
-    list_entry_t list_cache[METADBS];
+    list_entry_t list_cache[METADBS][LIST_PREFETCH];
+    unsigned int list_cache_pos[METADBS]; /* Current row in list_cache */
+    unsigned int list_cache_len[METADBS]; /* Number of rows in list_cache */
+    int list_cache_eof[METADBS]; /* 1 if the last batch was short */
+    unsigned int list_heap[METADBS]; /* Min-heap of meta databases ordered by their current row */
+    unsigned int list_heap_len;
     unsigned int list_pattern_slashes; /* Number of slashes in pattern */
     int list_pattern_end_with_slash; /* 1 if pattern ends with slash */
 
@@ -986,6 +1341,7 @@ struct _sx_hashfs_t {
     sx_hash_t put_global_vol_id;
     unsigned int *put_nidxs;
     unsigned int *put_hashnos;
+    unsigned int *put_hashnidx;
     unsigned int put_nblocks;
     char put_token[TOKEN_TEXT_LEN + 1];
     struct {
@@ -1028,8 +1384,360 @@ struct _sx_hashfs_t {
 
     int readonly;
     int lockfd;
+    uint64_t *datagen;
+    struct bfilter_hdr *bfilter;
+    struct bfilter_hdr *bfilter_hdr; /* when only the header could be mapped */
+    int bfilter_fd;
+    struct datafile_iostat *iostat;
+    char *devpath[SIZES * HASHDBS]; /* Data directories, as found in the data file paths */
+    unsigned int ndevs;
+    unsigned int datadev[SIZES][HASHDBS];
+
+    uint64_t *cstate;
+    int cstate_dirty; /* The hashfs table was modified by the current transaction */
+    struct authcache *authcache;
+    int authgen_dirty; /* Users, privs or volume ownership were modified by the current transaction */
+    uint64_t mode_gen, hdrev_gen; /* Generation at which mode and hd_rev were last verified */
+    time_t mode_checked, hdrev_checked;
+    int mode;
+
+    sx_hashfs_gc_stats_t *gc_stats;
+    unsigned int gc_worker, gc_nworkers; /* Only hash dbs with (hs * HASHDBS + ndb) % gc_nworkers == gc_worker are GCed */
+    struct gc_punch_list {
+	int64_t *blocks;
+	unsigned int n, size;
+    } gc_punch[SIZES][HASHDBS]; /* Slots freed by the GC, to be given back to the filesystem */
+    int gc_punch_off;
 };
 
+static uint64_t datagen_get(sx_hashfs_t *h, unsigned int hs, unsigned int ndb) {
+    return h->datagen ? __atomic_load_n(&h->datagen[hs * HASHDBS + ndb], __ATOMIC_ACQUIRE) : 0;
+}
+
+static void datagen_bump(sx_hashfs_t *h, unsigned int hs, unsigned int ndb) {
+    if(h->datagen)
+	__atomic_add_fetch(&h->datagen[hs * HASHDBS + ndb], 1, __ATOMIC_RELEASE);
+}
+
+static void iostat_add(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, int write, uint64_t nblocks) {
+    struct datafile_iostat *st;
+    if(!h->iostat || !nblocks)
+	return;
+    st = &h->iostat[hs * HASHDBS + ndb];
+    if(write) {
+	__atomic_add_fetch(&st->writes, nblocks, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->write_bytes, nblocks * bsz[hs], __ATOMIC_RELAXED);
+    } else {
+	__atomic_add_fetch(&st->reads, nblocks, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->read_bytes, nblocks * bsz[hs], __ATOMIC_RELAXED);
+    }
+}
+
+/* Records the data directory of a data file */
+static int datadev_add(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const char *path) {
+    const char *slash = strrchr(path, '/');
+    unsigned int i, len = slash ? slash - path : 0;
+
+    for(i = 0; i < h->ndevs; i++)
+	if(strlen(h->devpath[i]) == len && !memcmp(h->devpath[i], path, len))
+	    break;
+    if(i == h->ndevs) {
+	if(!(h->devpath[i] = wrap_malloc(len + 1))) {
+	    OOM();
+	    return -1;
+	}
+	memcpy(h->devpath[i], path, len);
+	h->devpath[i][len] = '\0';
+	h->ndevs++;
+    }
+    h->datadev[hs][ndb] = i;
+    return 0;
+}
+
+static uint64_t cstate_get(sx_hashfs_t *h) {
+    return h->cstate ? __atomic_load_n(h->cstate, __ATOMIC_ACQUIRE) : 0;
+}
+
+/* Returns 1 if a value verified at generation gen and time checked needs no new lookup */
+static int cstate_current(sx_hashfs_t *h, uint64_t gen, time_t checked, time_t now) {
+    return h->cstate && checked && gen == cstate_get(h) && now >= checked && now - checked < CSTATE_RECHECK;
+}
+
+static void cstate_update_hook(void *ctx, int op, const char *dbname, const char *table, sqlite3_int64 rowid) {
+    sx_hashfs_t *h = ctx;
+    if(!strcmp(table, "hashfs"))
+	h->cstate_dirty = 1;
+    /* Volume updates are mostly size accounting: the ones which matter
+     * to the auth cache are flagged by the authcache_volume trigger */
+    else if(!strcmp(table, "users") || !strcmp(table, "privs") || (!strcmp(table, "volumes") && op != SQLITE_UPDATE))
+	h->authgen_dirty = 1;
+}
+
+static void cstate_rollback_hook(void *ctx) {
+    sx_hashfs_t *h = ctx;
+    h->cstate_dirty = 0;
+    h->authgen_dirty = 0;
+}
+
+/* Runs once the transaction is committed, so a reader can't cache the old state with the new generation */
+static void cstate_commit_cb(void *ctx) {
+    sx_hashfs_t *h = ctx;
+    if(h->cstate_dirty) {
+	h->cstate_dirty = 0;
+	if(h->cstate)
+	    __atomic_add_fetch(h->cstate, 1, __ATOMIC_RELEASE);
+    }
+    if(h->authgen_dirty) {
+	h->authgen_dirty = 0;
+	if(h->authcache)
+	    __atomic_add_fetch(&h->authcache->gen, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void authcache_touch(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    sx_hashfs_t *h = sqlite3_user_data(ctx);
+    h->authgen_dirty = 1;
+    sqlite3_result_null(ctx);
+}
+
+/* Returns the generation to tag the result of a lookup starting now with,
+ * 0 if it must not be cached */
+static uint64_t authcache_gen(sx_hashfs_t *h) {
+    /* Whatever the current transaction reads of its own changes may be rolled back */
+    if(!h->authcache || h->authgen_dirty)
+	return 0;
+    return __atomic_load_n(&h->authcache->gen, __ATOMIC_ACQUIRE) + 1;
+}
+
+static int authcache_valid(sx_hashfs_t *h, uint64_t gen, int64_t stamp) {
+    int64_t now = time(NULL);
+    return gen == authcache_gen(h) && now >= stamp && now - stamp < AUTHCACHE_TTL;
+}
+
+/* Claims an entry for writing, on success *claim receives the (odd) sequence to release */
+static int authcache_lock(uint32_t *seq, uint32_t *owner, int64_t *stamp, uint32_t *claim) {
+    uint32_t me = getpid(), cur = __atomic_load_n(owner, __ATOMIC_ACQUIRE), s;
+
+    /* The cache outlives the workers: the claim of a writer which was killed
+     * would hold the entry forever. A live one is left alone, however slow */
+    if(cur && (kill(cur, 0) == 0 || errno != ESRCH))
+	return 0;
+    if(!__atomic_compare_exchange_n(owner, &cur, me, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	return 0; /* Someone else is filling it, let them */
+    __atomic_store_n(stamp, time(NULL), __ATOMIC_RELAXED);
+    /* A dead writer may have left seq odd: move it anyway so that readers
+     * which copied a torn entry don't take it for good */
+    s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    s += (s & 1) ? 2 : 1;
+    __atomic_store_n(seq, s, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *claim = s;
+    return 1;
+}
+
+/* Publishes the entry, unless the claim was lost: then it is left to the new
+ * owner, stripped of the generation so that it can't be valid before that */
+static void authcache_unlock(uint32_t *seq, uint32_t *owner, uint64_t *gen, uint32_t claim) {
+    uint32_t me = getpid();
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if(__atomic_load_n(owner, __ATOMIC_ACQUIRE) != me ||
+       !__atomic_compare_exchange_n(seq, &claim, claim + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	__atomic_store_n(gen, 0, __ATOMIC_RELEASE);
+	return;
+    }
+    __atomic_compare_exchange_n(owner, &me, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* FNV-1a: clones share all but the last bytes of their uid */
+static uint32_t authcache_hash(const uint8_t *user, int64_t vid) {
+    uint32_t hash = 2166136261u;
+    unsigned int i;
+
+    for(i = 0; i < AUTH_UID_LEN; i++)
+	hash = (hash ^ user[i]) * 16777619u;
+    for(i = 0; i < sizeof(vid); i++)
+	hash = (hash ^ ((uint64_t)vid >> (i * 8) & 0xff)) * 16777619u;
+    return hash;
+}
+
+static struct authcache_user *authcache_user_slot(sx_hashfs_t *h, const uint8_t *user) {
+    return &h->authcache->users[authcache_hash(user, 0) % AUTHCACHE_USERS];
+}
+
+static struct authcache_priv *authcache_priv_slot(sx_hashfs_t *h, const uint8_t *user, int64_t vid) {
+    return &h->authcache->privs[authcache_hash(user, vid) % AUTHCACHE_PRIVS];
+}
+
+static int authcache_user_get(sx_hashfs_t *h, const uint8_t *user, struct authcache_user *out) {
+    struct authcache_user *e;
+    uint32_t seq;
+
+    if(!authcache_gen(h))
+	return 0;
+    e = authcache_user_slot(h, user);
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if(!(seq & 1)) {
+	memcpy(out, e, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(seq == __atomic_load_n(&e->seq, __ATOMIC_RELAXED) &&
+	   !memcmp(out->user, user, AUTH_UID_LEN) && authcache_valid(h, out->gen, out->stamp)) {
+	    __atomic_add_fetch(&h->authcache->user_hits, 1, __ATOMIC_RELAXED);
+	    return 1;
+	}
+    }
+    __atomic_add_fetch(&h->authcache->user_misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void authcache_user_put(sx_hashfs_t *h, uint64_t gen, const uint8_t *user, sx_uid_t uid, const uint8_t *key, sx_priv_t priv, int64_t quota) {
+    struct authcache_user *e;
+    uint32_t seq;
+
+    if(!gen || !h->authcache)
+	return;
+    e = authcache_user_slot(h, user);
+    if(!authcache_lock(&e->seq, &e->owner, &e->stamp, &seq))
+	return;
+    e->gen = gen;
+    e->uid = uid;
+    e->priv = priv;
+    e->quota = quota;
+    memcpy(e->user, user, AUTH_UID_LEN);
+    memcpy(e->key, key, AUTH_KEY_LEN);
+    authcache_unlock(&e->seq, &e->owner, &e->gen, seq);
+}
+
+static int authcache_priv_get(sx_hashfs_t *h, const uint8_t *user, int64_t vid, sx_priv_t *access) {
+    struct authcache_priv *e, copy;
+    uint32_t seq;
+
+    if(!authcache_gen(h))
+	return 0;
+    e = authcache_priv_slot(h, user, vid);
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if(!(seq & 1)) {
+	memcpy(&copy, e, sizeof(copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(seq == __atomic_load_n(&e->seq, __ATOMIC_RELAXED) && copy.vid == vid &&
+	   !memcmp(copy.user, user, AUTH_UID_LEN) && authcache_valid(h, copy.gen, copy.stamp)) {
+	    __atomic_add_fetch(&h->authcache->priv_hits, 1, __ATOMIC_RELAXED);
+	    *access = copy.priv;
+	    return 1;
+	}
+    }
+    __atomic_add_fetch(&h->authcache->priv_misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void authcache_priv_put(sx_hashfs_t *h, uint64_t gen, const uint8_t *user, int64_t vid, sx_priv_t access) {
+    struct authcache_priv *e;
+    uint32_t seq;
+
+    if(!gen || !h->authcache)
+	return;
+    e = authcache_priv_slot(h, user, vid);
+    if(!authcache_lock(&e->seq, &e->owner, &e->stamp, &seq))
+	return;
+    e->gen = gen;
+    e->vid = vid;
+    e->priv = access;
+    memcpy(e->user, user, AUTH_UID_LEN);
+    authcache_unlock(&e->seq, &e->owner, &e->gen, seq);
+}
+
+rc_ty sx_hashfs_stats_authcache(sx_hashfs_t *h, int64_t *user_hits, int64_t *user_misses, int64_t *priv_hits, int64_t *priv_misses) {
+    if(!h || !user_hits || !user_misses || !priv_hits || !priv_misses) {
+	NULLARG();
+	return EINVAL;
+    }
+    if(!h->authcache) {
+	msg_set_reason("The auth cache is not available");
+	return ENOENT;
+    }
+    *user_hits = __atomic_load_n(&h->authcache->user_hits, __ATOMIC_RELAXED);
+    *user_misses = __atomic_load_n(&h->authcache->user_misses, __ATOMIC_RELAXED);
+    *priv_hits = __atomic_load_n(&h->authcache->priv_hits, __ATOMIC_RELAXED);
+    *priv_misses = __atomic_load_n(&h->authcache->priv_misses, __ATOMIC_RELAXED);
+    return OK;
+}
+
+static void bfilter_unmap(sx_hashfs_t *h) {
+    if(h->bfilter) {
+	/* The last user leaves filters which the next one can trust */
+	if(!flock(h->bfilter_fd, LOCK_EX | LOCK_NB) && !msync(h->bfilter, BFILTER_SIZE, MS_SYNC)) {
+	    __atomic_store_n(&h->bfilter->clean, 1, __ATOMIC_SEQ_CST);
+	    msync(h->bfilter, BFILTER_HDRSIZE, MS_SYNC);
+	}
+	munmap(h->bfilter, BFILTER_SIZE);
+	h->bfilter = NULL;
+    }
+    if(h->bfilter_hdr) {
+	munmap(h->bfilter_hdr, BFILTER_HDRSIZE);
+	h->bfilter_hdr = NULL;
+    }
+    if(h->bfilter_fd >= 0) {
+	close(h->bfilter_fd);
+	h->bfilter_fd = -1;
+    }
+}
+
+/* Returns 0 if the block is certainly not stored, 1 if it may be */
+static int bfilter_maybe(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const sx_hash_t *hash) {
+    struct bfilter_slot *s;
+    uint32_t seq;
+
+    if(!h->bfilter)
+	return 1;
+    s = &h->bfilter->slot[hs][ndb];
+    if(!__atomic_load_n(&s->ready, __ATOMIC_SEQ_CST))
+	return 1;
+    seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST);
+    if(bfilter_test(bfilter_line(h->bfilter, hs, ndb, __atomic_load_n(&s->active, __ATOMIC_SEQ_CST), hash), bfilter_probes(hash)))
+	return 1;
+    /* A negative from a bitmap which was being cleared cannot be trusted */
+    return __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST) != seq;
+}
+
+/* Must be called with the write lock on the hashdb held
+ * Returns non zero if the filter could be neither updated nor invalidated */
+static int bfilter_add(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const sx_hash_t *hash) {
+    struct bfilter_slot *s;
+    uint32_t shadow;
+
+    if(!h->bfilter) {
+	if(!h->bfilter_hdr) {
+	    WARN("Block filters are not available, refusing to store blocks");
+	    return -1;
+	}
+	/* Not ready until the GC has rebuilt it, including any rebuild running now */
+	s = &h->bfilter_hdr->slot[hs][ndb];
+	__atomic_add_fetch(&s->stale, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->ready, 0, __ATOMIC_SEQ_CST);
+	return 0;
+    }
+    /* Our bits may not reach the disk anymore before the last user leaves */
+    if(__atomic_load_n(&h->bfilter->clean, __ATOMIC_SEQ_CST)) {
+	__atomic_store_n(&h->bfilter->clean, 0, __ATOMIC_SEQ_CST);
+	if(msync(h->bfilter, BFILTER_HDRSIZE, MS_SYNC)) {
+	    PWARN("Failed to sync the block filters");
+	    return -1;
+	}
+    }
+    s = &h->bfilter->slot[hs][ndb];
+    shadow = __atomic_load_n(&s->shadow, __ATOMIC_SEQ_CST);
+    bfilter_set(bfilter_line(h->bfilter, hs, ndb, __atomic_load_n(&s->active, __ATOMIC_SEQ_CST), hash), bfilter_probes(hash));
+    if(shadow)
+	bfilter_set(bfilter_line(h->bfilter, hs, ndb, shadow - 1, hash), bfilter_probes(hash));
+    __atomic_add_fetch(&s->entries, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void bfilter_del(sx_hashfs_t *h, unsigned int hs, unsigned int ndb) {
+    if(h->bfilter)
+	__atomic_add_fetch(&h->bfilter->slot[hs][ndb].deleted, 1, __ATOMIC_RELAXED);
+}
+
 static void close_all_dbs(sx_hashfs_t *h) {
     unsigned int i, j;
 
@@ -1088,6 +1796,12 @@ static void close_all_dbs(sx_hashfs_t *h) {
             sqlite3_finalize(h->qb_get_meta[j][i]);
             sqlite3_finalize(h->qb_gc_find_unused_revision[j][i]);
             sqlite3_finalize(h->qb_gc_find_unused_block[j][i]);
+            sqlite3_finalize(h->qb_gc_candidate[j][i]);
+            sqlite3_finalize(h->qb_gc_candidate_del[j][i]);
+            sqlite3_finalize(h->qb_gc_candidate_requeue[j][i]);
+            sqlite3_finalize(h->qb_isavail[j][i]);
+            free(h->gc_punch[j][i].blocks);
+            h->gc_punch[j][i].blocks = NULL;
             sqlite3_finalize(h->qb_gc_find_block[j][i]);
             sqlite3_finalize(h->qb_gc_check_revop_expiration[j][i]);
             sqlite3_finalize(h->qb_gc_prep_revops_expiration[j][i]);
@@ -1266,6 +1980,62 @@ static sxi_db_t *open_db(const char *basedir, const char *dbname, const sx_uuid_
 }
 
 
+/* Tables of the online compaction and the incremental GC, created on the first
+ * open rather than by an upgrade step. The blocks already left unreferenced are
+ * not queued here: the GC sweeps each datadb in full once anyway */
+static int datadb_gc_schema(sxi_db_t *db) {
+    sqlite3_stmt *q = NULL;
+    int ret = -1;
+
+    if(qprep(db, &q, "SELECT 1 FROM sqlite_master WHERE type = 'trigger' AND name = 'gc_candidate_new'"))
+	return -1;
+    switch(qstep(q)) {
+    case SQLITE_ROW:
+	qnullify(q);
+	return 0;
+    case SQLITE_DONE:
+	break;
+    default:
+	qnullify(q);
+	return -1;
+    }
+    qnullify(q);
+
+    if(qbegin(db))
+	return -1;
+    do {
+        /* Online compaction: locate the tail blocks and park the slots they leave behind */
+        if(qprep(db, &q, "CREATE INDEX IF NOT EXISTS blocks_blockno ON blocks(blockno)") || qstep_noret(q))
+            break;
+        qnullify(q);
+        if(qprep(db, &q, "CREATE TABLE IF NOT EXISTS compact_pending (blocknumber INTEGER NOT NULL PRIMARY KEY ASC, released_at INTEGER NOT NULL)") || qstep_noret(q))
+            break;
+        qnullify(q);
+
+        /* Incremental GC: blocks which are left without any revision_blocks entry get queued here */
+        if(qprep(db, &q, "CREATE TABLE IF NOT EXISTS gc_candidates (hash BLOB("STRIFY(SXI_SHA1_BIN_LEN)") NOT NULL PRIMARY KEY, queued_at INTEGER NOT NULL)") || qstep_noret(q))
+            break;
+        qnullify(q);
+        if(qprep(db, &q, "CREATE INDEX IF NOT EXISTS gc_candidates_queued ON gc_candidates(queued_at)") || qstep_noret(q))
+            break;
+        qnullify(q);
+        if(qprep(db, &q, "CREATE TRIGGER IF NOT EXISTS gc_candidate_unref AFTER DELETE ON revision_blocks WHEN NOT EXISTS (SELECT 1 FROM revision_blocks WHERE blocks_hash = OLD.blocks_hash) AND EXISTS (SELECT 1 FROM blocks WHERE hash = OLD.blocks_hash) BEGIN INSERT OR IGNORE INTO gc_candidates(hash, queued_at) VALUES(OLD.blocks_hash, CAST(strftime('%s', 'now') AS INTEGER)); END") || qstep_noret(q))
+            break;
+        qnullify(q);
+        if(qprep(db, &q, "CREATE TRIGGER IF NOT EXISTS gc_candidate_new AFTER INSERT ON blocks WHEN NOT EXISTS (SELECT 1 FROM revision_blocks WHERE blocks_hash = NEW.hash) BEGIN INSERT OR IGNORE INTO gc_candidates(hash, queued_at) VALUES(NEW.hash, CAST(strftime('%s', 'now') AS INTEGER)); END") || qstep_noret(q))
+            break;
+        qnullify(q);
+
+        if(qcommit(db))
+            break;
+        ret = 0;
+    } while(0);
+    qnullify(q);
+    if(ret)
+	qrollback(db);
+    return ret;
+}
+
 void sx_hashfs_checkpoint_idle(sx_hashfs_t *h)
 {
     unsigned i, j;
@@ -1635,6 +2405,7 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
     const char *str;
     sx_hashfs_t *h;
     struct flock fl;
+    struct stat st;
 
     if(!dir || !(dirlen = strlen(dir))) {
 	CRIT("Bad path");
@@ -1650,6 +2421,7 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 	return NULL;
     memset(h->datafd, -1, sizeof(h->datafd));
     h->lockfd = -1;
+    h->bfilter_fd = -1;
     h->sx = NULL;
     h->job_trigger = h->xfer_trigger = h->gc_trigger = h->gc_expire_trigger = h->hbeat_trigger = -1;
     /* TODO: read from hashfs kv store */
@@ -1682,6 +2454,27 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
         goto open_hashfs_fail;
     }
 
+    /* Not fatal: without it the online compaction is simply disabled */
+    sprintf(path, "%s/hashfs.gen", dir);
+    h->datagen = shared_map(path, DATAGEN_SIZE);
+
+    /* Not fatal either: the mode and distribution are then looked up on every check */
+    sprintf(path, "%s/hashfs.state", dir);
+    h->cstate = shared_map(path, CSTATE_SIZE);
+
+    /* Not fatal: the per directory I/O statistics are then not reported */
+    sprintf(path, "%s/hashfs.iostat", dir);
+    h->iostat = (struct datafile_iostat *)shared_map(path, IOSTAT_SIZE);
+
+    /* Not fatal: users and privileges are then looked up on every request */
+    sprintf(path, "%s/hashfs.authcache", dir);
+    h->authcache = (struct authcache *)shared_map(path, sizeof(struct authcache));
+
+    /* Not fatal: every lookup then goes to the database, blocks can still
+     * be stored as long as the filters can be invalidated */
+    sprintf(path, "%s/hashfs.filter", dir);
+    h->bfilter_fd = bfilter_map(path, &h->bfilter, &h->bfilter_hdr);
+
     if (!qlog_set) {
 	sqlite3_config(SQLITE_CONFIG_LOG, qlog, NULL);
 	qlog_set = 1;
@@ -1711,6 +2504,20 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
     if(qprep(h->db, &q, "PRAGMA foreign_keys = ON") || qstep_noret(q))
 	goto open_hashfs_fail;
     qnullify(q);
+    sqlite3_update_hook(h->db->handle, cstate_update_hook, h);
+    sqlite3_rollback_hook(h->db->handle, cstate_rollback_hook, h);
+    h->db->commit_cb = cstate_commit_cb;
+    h->db->commit_ctx = h;
+    if(h->authcache) {
+	if(sqlite3_create_function(h->db->handle, "authcache_touch", 0, SQLITE_UTF8, h, authcache_touch, NULL, NULL) ||
+	   qprep(h->db, &q, "CREATE TEMP TRIGGER authcache_volume AFTER UPDATE OF owner_id, enabled ON main.volumes BEGIN SELECT authcache_touch(); END") ||
+	   qstep_noret(q)) {
+	    WARN("Failed to set up the auth cache invalidation, disabling the cache");
+	    munmap(h->authcache, sizeof(struct authcache));
+	    h->authcache = NULL;
+	}
+	qnullify(q);
+    }
     if(qprep(h->db, &h->q_getval, "SELECT value FROM hashfs WHERE key = :k"))
 	goto open_hashfs_fail;
     if(qprep(h->db, &h->q_setval, "INSERT OR REPLACE INTO hashfs (key,value) VALUES (:k, :v)"))
@@ -1927,6 +2734,8 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 
     if(!(h->blockbuf = wrap_malloc(bsz[SIZES-1])))
 	goto open_hashfs_fail;
+    if(!(h->blockio = sx_blockio_new(BLOCKIO_DEPTH)))
+	goto open_hashfs_fail;
 
     for(j=0; j<SIZES; j++) {
 	char hexsz[9];
@@ -1936,6 +2745,10 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 	    sprintf(dbitem, "hashdb_%c_%08x", sizedirs[j], i);
 	    if(!(h->datadb[j][i] = open_db(dir, dbitem, &h->cluster_uuid, &curver, h->q_getval)))
 		goto open_hashfs_fail;
+	    if(datadb_gc_schema(h->datadb[j][i])) {
+		WARN("Failed to set up the GC tables of %s", dbitem);
+		goto open_hashfs_fail;
+	    }
 	    if(qprep(h->datadb[j][i], &h->qb_nextavail[j][i], "SELECT blocknumber FROM avail ORDER BY blocknumber ASC LIMIT 1"))
 		goto open_hashfs_fail;
 	    if(qprep(h->datadb[j][i], &h->qb_nextalloc[j][i], "SELECT value FROM hashfs WHERE key = 'next_blockno'"))
@@ -1973,6 +2786,14 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 		goto open_hashfs_fail;
 	    if(qprep(h->datadb[j][i], &h->qb_gc_find_unused_block[j][i], "SELECT id, blockno, hash, revision_id FROM blocks LEFT JOIN revision_blocks ON blocks.hash=blocks_hash WHERE id  > :last ORDER BY id LIMIT " STRIFY(GC_MAX_ROWS)))
 		goto open_hashfs_fail;
+	    if(qprep(h->datadb[j][i], &h->qb_gc_candidate[j][i], "SELECT c.hash, b.id, b.blockno, EXISTS (SELECT 1 FROM revision_blocks WHERE blocks_hash = c.hash) FROM gc_candidates AS c LEFT JOIN blocks AS b ON b.hash = c.hash WHERE c.queued_at < :before ORDER BY c.queued_at LIMIT 1"))
+		goto open_hashfs_fail;
+	    if(qprep(h->datadb[j][i], &h->qb_gc_candidate_del[j][i], "DELETE FROM gc_candidates WHERE hash = :hash"))
+		goto open_hashfs_fail;
+	    if(qprep(h->datadb[j][i], &h->qb_gc_candidate_requeue[j][i], "UPDATE gc_candidates SET queued_at = :now WHERE hash = :hash"))
+		goto open_hashfs_fail;
+	    if(qprep(h->datadb[j][i], &h->qb_isavail[j][i], "SELECT 1 FROM avail WHERE blocknumber = :blockno"))
+		goto open_hashfs_fail;
             if(qprep(h->datadb[j][i], &h->qb_gc_check_revop_expiration[j][i], "SELECT expiry_time < datetime('now') FROM revision_ops_expiration WHERE revision_id = :revision_id LIMIT 1"))
                 goto open_hashfs_fail;
             if(qprep(h->datadb[j][i], &h->qb_gc_prep_revops_expiration[j][i], "INSERT INTO revision_ops_expiration (revision_id, expiry_time) VALUES(:revision_id, datetime(:expiry + strftime('%s', datetime('now')), 'unixepoch'))"))
@@ -2043,6 +2864,8 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 		perror("open");
 		goto open_hashfs_fail;
 	    }
+	    if(datadev_add(h, j, i, str))
+		goto open_hashfs_fail;
 	    if(read_block(h->datafd[j][i], h->blockbuf, 0, bsz[j]))
 		goto open_hashfs_fail;
 	    if(sx_hashfs_version_parse(&binver, h->blockbuf, 16)) {
@@ -2056,6 +2879,15 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
 		CRIT("Bad header in datafile %s (version %s)", str, binver.fullstr);
 		goto open_hashfs_fail;
 	    }
+	    /* A filter built for another copy of the data cannot be trusted */
+	    if(!h->bfilter)
+		continue;
+	    if(fstat(h->datafd[j][i], &st)) {
+		PCRIT("Failed to stat datafile %s", str);
+		goto open_hashfs_fail;
+	    }
+	    if(__atomic_load_n(&h->bfilter->slot[j][i].dataino, __ATOMIC_SEQ_CST) != (uint64_t)st.st_ino)
+		__atomic_store_n(&h->bfilter->slot[j][i].ready, 0, __ATOMIC_SEQ_CST);
 	}
     }
 
@@ -2070,9 +2902,9 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
             goto open_hashfs_fail;
 	if(qprep(h->metadb[i], &h->qm_ins[i], "INSERT INTO files (volume_id, name, size, content, rev, revision_id, age) VALUES (:volume, :name, :size, :hashes, :revision, :revision_id, :age)"))
 	    goto open_hashfs_fail;
-        if(qprep(h->metadb[i], &h->qm_list[i], "SELECT name, size, rev, revision_id FROM files WHERE volume_id = :volume AND name > :previous AND (:limit is NULL OR name < :limit) AND pmatch(name, :pattern, :pattern_slashes, :slash_ending) > 0 AND age >= 0 GROUP BY name HAVING rev = MAX(rev) ORDER BY name ASC LIMIT 1"))
+        if(qprep(h->metadb[i], &h->qm_list[i], "SELECT name, size, rev, revision_id FROM files WHERE volume_id = :volume AND name > :previous AND (:limit is NULL OR name < :limit) AND pmatch(name, :pattern, :pattern_slashes, :slash_ending) > 0 AND age >= 0 GROUP BY name HAVING rev = MAX(rev) ORDER BY name ASC LIMIT :batch"))
             goto open_hashfs_fail;
-        if(qprep(h->metadb[i], &h->qm_list_eq[i], "SELECT name, size, rev, revision_id FROM files WHERE volume_id = :volume AND name >= :previous AND (:limit is NULL OR name < :limit) AND pmatch(name, :pattern, :pattern_slashes, :slash_ending) > 0 AND age >= 0 GROUP BY name HAVING rev = MAX(rev) ORDER BY name ASC LIMIT 2"))
+        if(qprep(h->metadb[i], &h->qm_list_eq[i], "SELECT name, size, rev, revision_id FROM files WHERE volume_id = :volume AND name >= :previous AND (:limit is NULL OR name < :limit) AND pmatch(name, :pattern, :pattern_slashes, :slash_ending) > 0 AND age >= 0 GROUP BY name HAVING rev = MAX(rev) ORDER BY name ASC LIMIT :batch"))
             goto open_hashfs_fail;
 	if(qprep(h->metadb[i], &h->qm_listrevs[i], "SELECT size, rev, revision_id FROM files WHERE volume_id = :volume AND name = :name AND rev > :previous AND age >= 0 ORDER BY rev ASC LIMIT 1"))
 	    goto open_hashfs_fail;
@@ -2178,7 +3010,7 @@ sx_hashfs_t *sx_hashfs_open(const char *dir, sxc_client_t *sx) {
         goto open_hashfs_fail;
     if(qprep(h->eventdb, &h->qe_parent, "SELECT j1.parent, j2.type, j2.data FROM jobs AS j1 LEFT JOIN jobs AS j2 ON j1.parent = j2.job WHERE j1.job = :id"))
         goto open_hashfs_fail;
-    if(qprep(h->eventdb, &h->qe_jstats, "SELECT COUNT(user), COUNT(*) FROM jobs WHERE complete = 0 AND sched_time <= strftime('%Y-%m-%d %H:%M:%f')"))
+    if(qprep(h->eventdb, &h->qe_jstats, "SELECT COUNT(user), COUNT(*), strftime('%s') - strftime('%s', MIN(sched_time)) FROM jobs WHERE complete = 0 AND sched_time <= strftime('%Y-%m-%d %H:%M:%f')"))
         goto open_hashfs_fail;
 
     if(qprep(h->eventdb, &h->rit.q_add, "INSERT OR IGNORE INTO hash_retry(hash, blocksize, id) VALUES(:hash, :blocksize, :hash)"))
@@ -2235,6 +3067,18 @@ open_hashfs_fail:
     sqlite3_shutdown();
     free(h->dir);
     free(h->blockbuf);
+    sx_blockio_free(h->blockio);
+    if(h->datagen)
+	munmap(h->datagen, DATAGEN_SIZE);
+    if(h->cstate)
+	munmap(h->cstate, CSTATE_SIZE);
+    if(h->iostat)
+	munmap(h->iostat, IOSTAT_SIZE);
+    for(i = 0; i < h->ndevs; i++)
+	free(h->devpath[i]);
+    if(h->authcache)
+	munmap(h->authcache, sizeof(struct authcache));
+    bfilter_unmap(h);
     if(h->lockfd >= 0)
         close(h->lockfd);
     free(h);
@@ -2242,11 +3086,18 @@ open_hashfs_fail:
 }
 
 int sx_hashfs_distcheck(sx_hashfs_t *h) {
-    int ret = 0;
+    int ret = 0, checked = 1;
+    uint64_t gen;
+    time_t now;
 
     if(!h)
 	return 0;
 
+    now = time(NULL);
+    if(cstate_current(h, h->hdrev_gen, h->hdrev_checked, now))
+	return 0;
+    gen = cstate_get(h);
+
     sqlite3_reset(h->q_gethdrev);
     switch(qstep(h->q_gethdrev)) {
     case SQLITE_DONE:
@@ -2257,12 +3108,19 @@ int sx_hashfs_distcheck(sx_hashfs_t *h) {
 	break;
     default:
 	WARN("Failed to check distribution version, assuming unchanged");
+	checked = 0;
     }
     sqlite3_reset(h->q_gethdrev);
 
     if(ret && load_config(h, h->sx))
 	ret = -1;
 
+    if(checked && ret >= 0) {
+	h->hdrev_gen = gen;
+	h->hdrev_checked = now;
+    } else
+	h->hdrev_checked = 0;
+
     return ret; /* return 0 = no change, 1 = hdist-change, -1 = error */
 }
 
@@ -2302,6 +3160,20 @@ static int set_nonblock(int fd)
     return 0;
 }
 
+const char *sx_hashfs_dir(sx_hashfs_t *h) {
+    return h ? h->dir : NULL;
+}
+
+void sx_hashfs_get_triggers(sx_hashfs_t *h, int *job_trigger, int *xfer_trigger, int *gc_trigger, int *gc_expire_trigger, int *hbeat_trigger) {
+    if(!h)
+	return;
+    *job_trigger = h->job_trigger;
+    *xfer_trigger = h->xfer_trigger;
+    *gc_trigger = h->gc_trigger;
+    *gc_expire_trigger = h->gc_expire_trigger;
+    *hbeat_trigger = h->hbeat_trigger;
+}
+
 void sx_hashfs_set_triggers(sx_hashfs_t *h, int job_trigger, int xfer_trigger, int gc_trigger, int gc_expire_trigger, int hbeat_trigger) {
     if(!h)
 	return;
@@ -2319,6 +3191,8 @@ void sx_hashfs_set_triggers(sx_hashfs_t *h, int job_trigger, int xfer_trigger, i
 }
 
 void sx_hashfs_close(sx_hashfs_t *h) {
+    unsigned int i;
+
     if(!h)
 	return;
     if(h->have_hd)
@@ -2337,6 +3211,7 @@ void sx_hashfs_close(sx_hashfs_t *h) {
     close_all_dbs(h);
 
     free(h->blockbuf);
+    sx_blockio_free(h->blockio);
 /*    if(h->sx)
 	sx_shutdown(h->sx, 0);
     do not free sx here: it is not owned by hashfs.c!
@@ -2350,6 +3225,17 @@ void sx_hashfs_close(sx_hashfs_t *h) {
     free(h->cluster_name);
     free(h->dir);
 
+    if(h->datagen)
+	munmap(h->datagen, DATAGEN_SIZE);
+    if(h->cstate)
+	munmap(h->cstate, CSTATE_SIZE);
+    if(h->iostat)
+	munmap(h->iostat, IOSTAT_SIZE);
+    for(i = 0; i < h->ndevs; i++)
+	free(h->devpath[i]);
+    if(h->authcache)
+	munmap(h->authcache, sizeof(struct authcache));
+    bfilter_unmap(h);
     if(h->lockfd >= 0)
         close(h->lockfd);
     free(h);
@@ -3977,12 +4863,114 @@ static int check_blocks_revmaps(sx_hashfs_t *h, int debug, unsigned int hs, unsi
             goto check_blocks_revmaps_err;
         }
 
-        sqlite3_reset(qvol);
+        sqlite3_reset(qvol);
+    }
+
+check_blocks_revmaps_err:
+    sqlite3_finalize(q);
+    sqlite3_finalize(qvol);
+    return ret;
+}
+
+/* Identifies the distribution and volume replica state a full sweep of the blocks was made for */
+static int gc_sweep_token(sx_hashfs_t *h, char *token, size_t len) {
+    long long gen = 0;
+
+    sqlite3_reset(h->q_getval);
+    if(qbind_text(h->q_getval, ":k", "gc_sweep_gen"))
+        return -1;
+    switch(qstep(h->q_getval)) {
+    case SQLITE_ROW:
+        gen = sqlite3_column_int64(h->q_getval, 0);
+        break;
+    case SQLITE_DONE:
+        break;
+    default:
+        sqlite3_reset(h->q_getval);
+        return -1;
+    }
+    sqlite3_reset(h->q_getval);
+    snprintf(token, len, "%u:%lld", (unsigned int)sxi_hdist_version(h->hd), gen);
+    return 0;
+}
+
+/* Returns 1 if the datadb was swept in full for the given token, 0 if not, -1 on error */
+static int gc_sweep_done(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const char *token) {
+    sqlite3_stmt *q = NULL;
+    int ret = -1;
+
+    if(qprep(h->datadb[hs][ndb], &q, "SELECT value = :token FROM hashfs WHERE key = 'gc_last_sweep'") ||
+       qbind_text(q, ":token", token))
+        goto gc_sweep_done_err;
+    switch(qstep(q)) {
+    case SQLITE_ROW:
+        ret = sqlite3_column_int(q, 0) != 0;
+        break;
+    case SQLITE_DONE:
+        ret = 0;
+        break;
+    }
+ gc_sweep_done_err:
+    qnullify(q);
+    return ret;
+}
+
+static int gc_sweep_set(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const char *token) {
+    sqlite3_stmt *q = NULL;
+    int ret = -1;
+
+    if(!qprep(h->datadb[hs][ndb], &q, "INSERT OR REPLACE INTO hashfs (key, value) VALUES ('gc_last_sweep', :token)") &&
+       !qbind_text(q, ":token", token) && !qstep_noret(q))
+        ret = 0;
+    qnullify(q);
+    return ret;
+}
+
+/* Every block without a revision_blocks entry must be queued in gc_candidates,
+ * unless the GC is still due to sweep the whole datadb */
+static int check_blocks_unreferenced(sx_hashfs_t *h, int debug, unsigned int hs, unsigned int ndb) {
+    int ret = 0, r;
+    sqlite3_stmt *q = NULL;
+    sxi_db_t *db;
+    char token[64];
+
+    if(hs >= SIZES || ndb >= HASHDBS) {
+        ret = -1;
+        goto check_blocks_unreferenced_err;
+    }
+
+    db = h->datadb[hs][ndb];
+
+    if(gc_sweep_token(h, token, sizeof(token)) || (r = gc_sweep_done(h, hs, ndb, token)) < 0) {
+        ret = -1;
+        goto check_blocks_unreferenced_err;
+    }
+    if(!r) {
+        if(debug)
+            CHECK_INFO("Skipping the unreferenced blocks check in %s hash database %u / %u: a full GC sweep is pending", sizelongnames[hs], ndb+1, HASHDBS);
+        goto check_blocks_unreferenced_err;
+    }
+
+    if(debug) {
+        CHECK_INFO("Checking for unreferenced blocks within %lld blocks and %lld GC candidates in %s hash database %u / %u...",
+            (long long int)get_count(db, "blocks"), (long long int)get_count(db, "gc_candidates"), sizelongnames[hs], ndb+1, HASHDBS);
+    }
+
+    if(qprep(db, &q, "SELECT lower(hex(hash)) FROM blocks WHERE NOT EXISTS (SELECT 1 FROM revision_blocks WHERE blocks_hash = blocks.hash) AND NOT EXISTS (SELECT 1 FROM gc_candidates WHERE gc_candidates.hash = blocks.hash)")) { /* SLOWQ */
+        ret = -1;
+        goto check_blocks_unreferenced_err;
+    }
+
+    while((r = qstep(q)) == SQLITE_ROW) {
+        CHECK_PGRS;
+        CHECK_ERROR("Block %s is not referenced by any revision and is not queued for GC", sqlite3_column_text(q, 0));
     }
 
-check_blocks_revmaps_err:
+    if(r != SQLITE_DONE)
+        ret = -1;
+
+check_blocks_unreferenced_err:
     sqlite3_finalize(q);
-    sqlite3_finalize(qvol);
     return ret;
 }
 
@@ -4033,6 +5021,14 @@ static int check_blocks(sx_hashfs_t *h, int debug) {
             }
             ret += r;
 
+            /* Look for unused blocks the GC doesn't know about */
+            r = check_blocks_unreferenced(h, debug, j, i);
+            if(r == -1) {
+                ret = -1;
+                goto check_blocks_itererr;
+            }
+            ret += r;
+
             r = qstep(avail);
             if(r != SQLITE_DONE) {
                 while(r == SQLITE_ROW) {
@@ -7110,16 +8106,20 @@ const sx_nodelist_t *sx_hashfs_faulty_nodes(sx_hashfs_t *h) {
     return h ? h->faulty_nodes : NULL;
 }
 
-/* always builds the table with required_replica nodes
- * ignored nodes are placed at the end of the array
- * returns the number of non ignored nodes in the array */
-static int hash_nidx_tobuf(sx_hashfs_t *h, const sx_hash_t *hash, unsigned int required_replica, unsigned int max_volume_replica, unsigned int *nidx) {
+/* always builds the tables with required_replica nodes
+ * for each of the nids hashes[ids[i]] the node indexes are stored
+ * at nidxs[ids[i] * required_replica]
+ * ignored nodes are placed at the end of each table
+ * returns the lowest number of non ignored nodes in any table */
+#define NIDX_BATCH 1024
+static int hash_nidx_tobuf(sx_hashfs_t *h, const sx_hash_t *hashes, const unsigned int *ids, unsigned int nids, unsigned int required_replica, unsigned int max_volume_replica, unsigned int *nidxs) {
+    uint64_t mh[NIDX_BATCH];
+    unsigned int loc[NIDX_BATCH];
     const sx_nodelist_t *nodes;
-    sx_nodelist_t *belongsto;
-    unsigned int i, start;
-    int ret;
+    unsigned int i, j, k, chunk, start, nnodes;
+    int has_ignored, ret = required_replica;
 
-    if(!h || !hash) {
+    if(!h || (nids && (!hashes || !ids || !nidxs))) {
 	NULLARG();
 	return -1;
     }
@@ -7130,6 +8130,12 @@ static int hash_nidx_tobuf(sx_hashfs_t *h, const sx_hash_t *hash, unsigned int r
     }
 
     nodes = sx_hashfs_all_nodes(h, NL_NEXT); /* this matches the set used in are_blocks_available */
+    nnodes = sx_nodelist_count(nodes);
+    /* next_dist is a copy of the build 0 nodelist: hdist indexes are valid here */
+    if(nnodes != sx_nodelist_count(sxi_hdist_nodelist(h->hd, 0))) {
+	CRIT("Node list and hdist model are out of sync");
+	return -1;
+    }
 
     if(max_volume_replica < 1 || max_volume_replica > h->next_maxreplica ||
        required_replica < 1 || required_replica > max_volume_replica) {
@@ -7137,46 +8143,40 @@ static int hash_nidx_tobuf(sx_hashfs_t *h, const sx_hash_t *hash, unsigned int r
 	return -1;
     }
 
-    belongsto = sxi_hdist_locate(h->hd, MurmurHash64(hash, sizeof(*hash), HDIST_SEED), max_volume_replica, 0);
-    if(!belongsto) {
-	WARN("Cannot get nodes for volume");
-	return -1;
-    }
-
-    start = 0;
-    for(i=0; i<max_volume_replica && start < required_replica; i++) {
-	const sx_node_t *node = sx_nodelist_get(belongsto, i);
-	const sx_uuid_t *uuid = sx_node_uuid(node);
-	unsigned int nodeidx;
+    has_ignored = sx_nodelist_count(h->ignored_nodes) != 0;
+    chunk = NIDX_BATCH / max_volume_replica;
+    for(i=0; i<nids; i+=chunk) {
+	unsigned int n = MIN(chunk, nids - i);
 
-	if(!sx_nodelist_lookup_index(nodes, uuid, &nodeidx)) {
-	    CRIT("node id %s from hdist is unknown to us", uuid->string);
-	    sx_nodelist_delete(belongsto);
+	for(j=0; j<n; j++)
+	    mh[j] = MurmurHash64(&hashes[ids[i+j]], sizeof(hashes[0]), HDIST_SEED);
+	if(sxi_hdist_locate_many(h->hd, mh, n, max_volume_replica, 0, loc)) {
+	    WARN("Cannot get nodes for volume");
 	    return -1;
 	}
 
-	if(!sx_nodelist_lookup(h->ignored_nodes, uuid))
-	    nidx[start++] = nodeidx;
-    }
-    ret = start;
+	for(j=0; j<n; j++) {
+	    const unsigned int *belongsto = &loc[j * max_volume_replica];
+	    unsigned int *nidx = &nidxs[ids[i+j] * required_replica];
 
-    for(i=0; i<max_volume_replica && start < required_replica; i++) {
-	const sx_node_t *node = sx_nodelist_get(belongsto, i);
-	const sx_uuid_t *uuid = sx_node_uuid(node);
-	unsigned int nodeidx;
+	    if(!has_ignored) {
+		memcpy(nidx, belongsto, required_replica * sizeof(*nidx));
+		continue;
+	    }
 
-	if(!sx_nodelist_lookup_index(nodes, uuid, &nodeidx)) {
-	    CRIT("node id %s from hdist is unknown to us", uuid->string);
-	    sx_nodelist_delete(belongsto);
-	    return -1;
-	}
+	    start = 0;
+	    for(k=0; k<max_volume_replica && start < required_replica; k++)
+		if(!sx_nodelist_lookup(h->ignored_nodes, sx_node_uuid(sx_nodelist_get(nodes, belongsto[k]))))
+		    nidx[start++] = belongsto[k];
+	    if((int)start < ret)
+		ret = start;
 
-	if(sx_nodelist_lookup(h->ignored_nodes, uuid))
-	    nidx[start++] = nodeidx;
+	    for(k=0; k<max_volume_replica && start < required_replica; k++)
+		if(sx_nodelist_lookup(h->ignored_nodes, sx_node_uuid(sx_nodelist_get(nodes, belongsto[k]))))
+		    nidx[start++] = belongsto[k];
+	}
     }
 
-    sx_nodelist_delete(belongsto);
-
     return ret;
 }
 
@@ -7435,112 +8435,193 @@ static int pcmp(sx_hashfs_t *h, const char *p1, const char *p2, unsigned int max
     return r;
 }
 
-static rc_ty lookup_file_name(sx_hashfs_t *h, int db_idx, int update_cache) {
+#define LIST_HEAD(h, db_idx) (&(h)->list_cache[db_idx][(h)->list_cache_pos[db_idx]])
+
+/*
+ * Fetch the next batch of up to LIST_PREFETCH file names from a meta database.
+ * The batch starts at the lower limit when first is set, otherwise right after
+ * the last cached row.
+ */
+static rc_ty lookup_file_names(sx_hashfs_t *h, unsigned int db_idx, int first) {
     int r;
     rc_ty ret = FAIL_EINTERNAL;
     const char *n, *revision;
     sqlite3_stmt *stmt;
-    list_entry_t *e = &h->list_cache[db_idx];
+    list_entry_t *e;
+    char previous[sizeof(e->name)];
     const char *q = NULL;
     const void *revid;
+    unsigned int count = 0, batch = LIST_PREFETCH;
 
-    if(!h->list_recurse && (q = ith_slash(e->name, h->list_pattern_slashes + 1))) {
-        /* We are not searching recursively and next slash was found in pervious name,
-         * we can skip all files that are prefixed by that dir. To achieve that we can simply move
-         * starting name to the next one, but we will have to also be careful and use >= for name matching
-         */
-        e->name[q - e->name]++;
-        e->name[q - e->name + 1] = '\0';
+    if(first) {
+        sxi_strlcpy(previous, h->list_lower_limit, sizeof(previous));
+    } else {
+        sxi_strlcpy(previous, h->list_cache[db_idx][h->list_cache_len[db_idx]-1].name, sizeof(previous));
+        if(!h->list_recurse && (q = ith_slash(previous, h->list_pattern_slashes + 1))) {
+            /* We are not searching recursively and next slash was found in pervious name,
+             * we can skip all files that are prefixed by that dir. To achieve that we can simply move
+             * starting name to the next one, but we will have to also be careful and use >= for name matching
+             */
+            previous[q - previous]++;
+            previous[q - previous + 1] = '\0';
+            /* Rows following a fake dir most likely belong to it and would be skipped anyway */
+            batch = 1;
+        }
     }
 
     /* Use statement with > or >= regarding to previous q assignment (or if using h->list_lower_limit) */
-    if(q || !update_cache)
+    if(q || first)
         stmt = h->qm_list_eq[db_idx];
     else
         stmt = h->qm_list[db_idx];
+
+    /* The cache is overwritten below, make sure a failure leaves this db exhausted */
+    h->list_cache_pos[db_idx] = 0;
+    h->list_cache_len[db_idx] = 0;
+    h->list_cache_eof[db_idx] = 1;
+
     sqlite3_reset(stmt);
     if(qbind_int64(stmt, ":volume", h->list_volid) ||
-       qbind_text(stmt, ":previous", update_cache ? e->name : h->list_lower_limit) ||
+       qbind_text(stmt, ":previous", previous) ||
        qbind_text(stmt, ":pattern", h->list_pattern) ||
        qbind_int(stmt, ":pattern_slashes", h->list_pattern_slashes) ||
-       qbind_int(stmt, ":slash_ending", h->list_pattern_end_with_slash)) {
+       qbind_int(stmt, ":slash_ending", h->list_pattern_end_with_slash) ||
+       qbind_int(stmt, ":batch", batch)) {
         WARN("Failed to bind list query values");
-        goto lookup_file_name_err;
+        goto lookup_file_names_err;
     }
 
     if(h->list_limit_len) {
         if(qbind_text(stmt, ":limit", h->list_upper_limit)) {
             WARN("Failed to bind upper limit");
-            goto lookup_file_name_err;
+            goto lookup_file_names_err;
         }
     } else {
         if(qbind_null(stmt, ":limit")) {
             WARN("Failed to bind upper limit (null)");
-            goto lookup_file_name_err;
+            goto lookup_file_names_err;
         }
     }
 
-    r = qstep(stmt);
     h->qm_list_queries++;
-    if(r == SQLITE_DONE) {
-        e->name[0] = '\0';
-        /* Done for this db, no more reading needed */
-        ret = OK;
-        goto lookup_file_name_err;
-    }
+    while((r = qstep(stmt)) == SQLITE_ROW) {
+        if(count >= batch) {
+            WARN("Too many rows returned by list query on meta database %u", db_idx);
+            goto lookup_file_names_err;
+        }
+        e = &h->list_cache[db_idx][count];
 
-    if(r != SQLITE_ROW)
-        goto lookup_file_name_err;
+        n = (const char *)sqlite3_column_text(stmt, 0);
+        if(!n) {
+            WARN("Cannot list NULL filename on meta database %u", db_idx);
+            goto lookup_file_names_err;
+        }
 
-    n = (const char *)sqlite3_column_text(stmt, 0);
-    if(!n) {
-        WARN("Cannot list NULL filename on meta database %u", db_idx);
-        goto lookup_file_name_err;
-    }
+        e->file_size = sqlite3_column_int64(stmt, 1);
+        e->nblocks = size_to_blocks(e->file_size, NULL, &e->block_size);
 
-    e->file_size = sqlite3_column_int64(stmt, 1);
-    e->nblocks = size_to_blocks(e->file_size, NULL, &e->block_size);
+        revision = (const char *)sqlite3_column_text(stmt, 2);
+        if(!revision || parse_revision(revision, &e->created_at)) {
+            WARN("Bad revision found on file %s, volid %lld", n, (long long)h->list_volid);
+            goto lookup_file_names_err;
+        } else {
+            strncpy(e->revision, revision, sizeof(e->revision));
+            e->revision[sizeof(e->revision)-1] = '\0';
+        }
 
-    revision = (const char *)sqlite3_column_text(stmt, 2);
-    if(!revision || parse_revision(revision, &e->created_at)) {
-        WARN("Bad revision found on file %s, volid %lld", h->list_file.name, (long long)h->list_volid);
-        goto lookup_file_name_err;
-    } else {
-        strncpy(e->revision, revision, sizeof(e->revision));
-        e->revision[sizeof(e->revision)-1] = '\0';
-    }
+        strncpy(e->name, n, sizeof(e->name));
+        e->name[sizeof(e->name)-1] = '\0';
 
-    strncpy(e->name, n, sizeof(e->name));
-    e->name[sizeof(e->name)-1] = '\0';
+        revid = sqlite3_column_blob(stmt, 3);
+        if(!revid || sqlite3_column_bytes(stmt, 3) != SXI_SHA1_BIN_LEN) {
+            WARN("Invalid revision ID");
+            goto lookup_file_names_err;
+        }
+        memcpy(e->revision_id.b, revid, SXI_SHA1_BIN_LEN);
 
-    revid = sqlite3_column_blob(stmt, 3);
-    if(!revid || sqlite3_column_bytes(stmt, 3) != SXI_SHA1_BIN_LEN) {
-        WARN("Invalid revision ID");
-        goto lookup_file_name_err;
-    }
-    memcpy(e->revision_id.b, revid, SXI_SHA1_BIN_LEN);
+        #ifdef DEBUG_REVISION_ID
+            sx_hash_t revid_ref;
+            if(sx_unique_fileid(h->sx, e->revision, &revid_ref)) {
+                WARN("Failed to check revision ID for %s", e->revision);
+                goto lookup_file_names_err;
+            }
 
-    #ifdef DEBUG_REVISION_ID
-        sx_hash_t revid_ref;
-        if(sx_unique_fileid(h->sx, e->revision, &revid_ref)) {
-            WARN("Failed to check revision ID for %s", h->list_file.revision);
-            goto lookup_file_name_err;
-        }
+            if(memcmp(revid_ref.b, e->revision_id.b, sizeof(revid_ref.b))) {
+                WARN("Revision ID mismatch for %s", e->revision);
+                goto lookup_file_names_err;
+            }
+        #endif
 
-        if(memcmp(revid_ref.b, e->revision_id.b, sizeof(revid_ref.b))) {
-            WARN("Revision ID mismatch for %s", h->list_file.revision);
-            goto lookup_file_name_err;
-        }
-    #endif
+        count++;
+    }
+
+    if(r != SQLITE_DONE)
+        goto lookup_file_names_err;
 
+    h->list_cache_len[db_idx] = count;
+    /* A short batch means there is nothing more to read from this db */
+    h->list_cache_eof[db_idx] = count < batch;
     ret = OK;
-    lookup_file_name_err:
+    lookup_file_names_err:
     /* Always reset statement to avoid locking server */
     sqlite3_reset(stmt);
 
     return ret;
 }
 
+/* Move a meta database to its next cached row that is not equal (modulo directory name) to skip */
+static rc_ty list_advance(sx_hashfs_t *h, unsigned int db_idx, const char *skip) {
+    h->list_cache_pos[db_idx]++;
+    while(1) {
+        if(h->list_cache_pos[db_idx] >= h->list_cache_len[db_idx]) {
+            if(h->list_cache_eof[db_idx])
+                return ITER_NO_MORE;
+            if(lookup_file_names(h, db_idx, 0) != OK)
+                return FAIL_EINTERNAL;
+            if(!h->list_cache_len[db_idx])
+                return ITER_NO_MORE;
+        }
+        if(!skip || pcmp(h, LIST_HEAD(h, db_idx)->name, skip, sizeof(LIST_HEAD(h, db_idx)->name)))
+            return OK;
+        h->list_cache_pos[db_idx]++;
+    }
+}
+
+static int list_heap_less(sx_hashfs_t *h, unsigned int a, unsigned int b) {
+    int r = pcmp(h, LIST_HEAD(h, a)->name, LIST_HEAD(h, b)->name, sizeof(LIST_HEAD(h, a)->name));
+    return r < 0 || (!r && a < b);
+}
+
+static void list_heap_down(sx_hashfs_t *h, unsigned int pos) {
+    unsigned int *heap = h->list_heap;
+
+    while(1) {
+        unsigned int l = 2 * pos + 1, r = l + 1, min = pos, t;
+        if(l < h->list_heap_len && list_heap_less(h, heap[l], heap[min]))
+            min = l;
+        if(r < h->list_heap_len && list_heap_less(h, heap[r], heap[min]))
+            min = r;
+        if(min == pos)
+            break;
+        t = heap[pos];
+        heap[pos] = heap[min];
+        heap[min] = t;
+        pos = min;
+    }
+}
+
+/* Advance the meta database on top of the heap and restore the heap order */
+static rc_ty list_heap_advance(sx_hashfs_t *h, const char *skip) {
+    rc_ty s = list_advance(h, h->list_heap[0], skip);
+
+    if(s == ITER_NO_MORE) /* Drop the exhausted db from the heap */
+        h->list_heap[0] = h->list_heap[--h->list_heap_len];
+    else if(s != OK)
+        return s;
+    list_heap_down(h, 0);
+    return OK;
+}
+
 static int parse_pattern(sx_hashfs_t *h, const char *pattern, int escape) {
     unsigned int plen, l, r;
 
@@ -7651,6 +8732,9 @@ rc_ty sx_hashfs_list_first(sx_hashfs_t *h, const sx_hashfs_volume_t *volume, con
         return EINVAL;
     }
 
+    /* Forget about any previous listing */
+    h->list_heap_len = 0;
+
     if(!sx_hashfs_is_or_was_my_volume(h, volume, 0)) {
         /* TODO: got, expected: */
         msg_set_reason("Wrong node for volume '%s': ...", volume->name);
@@ -7688,70 +8772,49 @@ rc_ty sx_hashfs_list_first(sx_hashfs_t *h, const sx_hashfs_volume_t *volume, con
     /* For debugging */
     h->qm_list_queries = 0;
 
-    /* Store first file names in cache */
+    /* Store first file names in cache, dbs without matching names never enter the heap */
+    h->list_heap_len = 0;
     for(l = 0; l < METADBS; l++) {
-        h->list_cache[l].name[0] = '\0';
-        if(lookup_file_name(h, l, 0) != OK) {
+        if(lookup_file_names(h, l, 1) != OK) {
             WARN("Failed fetching file name from db %d", l);
             return FAIL_EINTERNAL;
         }
+        if(h->list_cache_len[l])
+            h->list_heap[h->list_heap_len++] = l;
     }
+    for(l = h->list_heap_len / 2; l-- > 0; )
+        list_heap_down(h, l);
 
     return sx_hashfs_list_next(h);
 }
 
 rc_ty sx_hashfs_list_next(sx_hashfs_t *h) {
-    int i, min_idx = -1;
+    const list_entry_t *e;
     const char *q = NULL;
 
     if(!h || !*h->list_pattern)
         return EINVAL;
 
-    for(i=0; i < METADBS; i++) {
-        int comp;
-        if(h->list_cache[i].name[0] == '\0')
-            continue; /* No more file names found in that db */
-
-        if(min_idx == -1)
-            min_idx = i;
-        else {
-            /* In case this db has stored file name that is equal (modulo directory name) to current name, lookup next one */
-            if(!(comp = pcmp(h, h->list_cache[i].name, h->list_cache[min_idx].name, sizeof(h->list_cache[i].name)))) {
-                if(lookup_file_name(h, i, 1)) {
-                    WARN("Could not lookup file name");
-                    return FAIL_EINTERNAL;
-                }
-                /* No more in that db */
-                if(h->list_cache[i].name[0] == '\0')
-                    continue;
-
-                comp = pcmp(h, h->list_cache[i].name, h->list_cache[min_idx].name, sizeof(h->list_cache[i].name));
-            }
-
-            if(comp < 0) /* Found smaller file name */
-                min_idx = i;
-        }
-    }
-
-    if(min_idx < 0) {
+    if(!h->list_heap_len) {
         DEBUG("Queried %lld times", (long long)h->qm_list_queries);
         return ITER_NO_MORE;
     }
 
-    h->list_file.file_size = h->list_cache[min_idx].file_size;
-    h->list_file.nblocks = h->list_cache[min_idx].nblocks;
-    h->list_file.block_size = h->list_cache[min_idx].block_size;
+    e = LIST_HEAD(h, h->list_heap[0]);
+    h->list_file.file_size = e->file_size;
+    h->list_file.nblocks = e->nblocks;
+    h->list_file.block_size = e->block_size;
 
-    strncpy(h->list_file.revision, h->list_cache[min_idx].revision, sizeof(h->list_file.revision));
+    strncpy(h->list_file.revision, e->revision, sizeof(h->list_file.revision));
     h->list_file.revision[sizeof(h->list_file.revision)-1] = '\0';
-    h->list_file.created_at = h->list_cache[min_idx].created_at;
+    h->list_file.created_at = e->created_at;
 
     h->list_file.name[0] = '/';
     /* Truncate dir file name */
-    if(!h->list_recurse && (q = ith_slash(h->list_cache[min_idx].name, h->list_pattern_slashes + 1))) {
+    if(!h->list_recurse && (q = ith_slash(e->name, h->list_pattern_slashes + 1))) {
         /* Truncate file name */
-        strncpy(h->list_file.name + 1, h->list_cache[min_idx].name, q - h->list_cache[min_idx].name + 1);
-        h->list_file.name[q - h->list_cache[min_idx].name + 2] = '\0';
+        strncpy(h->list_file.name + 1, e->name, q - e->name + 1);
+        h->list_file.name[q - e->name + 2] = '\0';
         /* This is a fake dir, all unrelated items are zeroed */
         h->list_file.file_size = 0;
         h->list_file.block_size = 0;
@@ -7768,25 +8831,19 @@ rc_ty sx_hashfs_list_next(sx_hashfs_t *h) {
           This value is only used internally to adjust the Last-Modified header.
         */
     } else {
-        strncpy(h->list_file.name + 1, h->list_cache[min_idx].name, sizeof(h->list_file.name)-1);
+        strncpy(h->list_file.name + 1, e->name, sizeof(h->list_file.name)-1);
         h->list_file.name[sizeof(h->list_file.name)-1] = '\0';
-        memcpy(h->list_file.revision_id.b, h->list_cache[min_idx].revision_id.b, sizeof(h->list_file.revision_id.b));
+        memcpy(h->list_file.revision_id.b, e->revision_id.b, sizeof(h->list_file.revision_id.b));
     }
 
-    /* Lookup next file name for this database */
-    if(lookup_file_name(h, min_idx, 1) != OK) {
-        WARN("Could not lookup next file name");
-        return FAIL_EINTERNAL;
-    }
-
-    /* If path comparison returned same string, query again, applicable only when not listing recursively */
-    if(h->list_cache[min_idx].name[0] != '\0' && !h->list_recurse &&
-       !pcmp(h, h->list_cache[min_idx].name, h->list_file.name + 1, sizeof(h->list_cache[min_idx].name))) {
-        if(lookup_file_name(h, min_idx, 1)) {
-            WARN("Could not lookup file name");
+    /* Move past the returned name (or fake dir) in every db holding it */
+    do {
+        if(list_heap_advance(h, h->list_file.name + 1) != OK) {
+            WARN("Could not lookup next file name");
             return FAIL_EINTERNAL;
         }
-    }
+    } while(h->list_heap_len &&
+            !pcmp(h, LIST_HEAD(h, h->list_heap[0])->name, h->list_file.name + 1, sizeof(e->name)));
 
     return OK;
 }
@@ -7896,8 +8953,30 @@ sx_nodelist_t *sx_hashfs_effective_hashnodes(sx_hashfs_t *h, sx_hashfs_nl_t whic
     return effnodes;
 }
 
-sx_nodelist_t *sx_hashfs_putfile_hashnodes(sx_hashfs_t *h, const sx_hash_t *hash) {
-    return sx_hashfs_effective_hashnodes(h, NL_NEXT, hash, h->put_replica);
+int sx_hashfs_putfile_hashnidx(sx_hashfs_t *h, const sx_hash_t *hash, const unsigned int **nidx) {
+    unsigned int id = 0;
+
+    if(!h || !hash || !nidx) {
+	NULLARG();
+	return -1;
+    }
+    if(is_subreplica(h, h->put_replica)) {
+	msg_set_reason("The replica value %u cannot be satisfied with the current replica loss of %u",
+		       h->put_replica,
+		       (h->next_maxreplica - h->effective_maxreplica));
+	return -1;
+    }
+    if(!h->put_hashnidx) {
+	h->put_hashnidx = wrap_malloc(h->put_replica * sizeof(*h->put_hashnidx));
+	if(!h->put_hashnidx) {
+	    OOM();
+	    return -1;
+	}
+    }
+
+    *nidx = h->put_hashnidx;
+    /* Ignored nodes are sorted last and not counted */
+    return hash_nidx_tobuf(h, hash, &id, 1, h->put_replica, h->put_replica, h->put_hashnidx);
 }
 
 static rc_ty get_volnodes_common(sx_hashfs_t *h, sx_hashfs_nl_t which, const sx_hashfs_volume_t *volume, int64_t size, sx_nodelist_t **nodes, unsigned int *block_size, int effective_only, int write_op) {
@@ -9739,19 +10818,33 @@ void sx_hashfs_getfile_end(sx_hashfs_t *h) {
     h->get_ndb = METADBS;
 }
 
-rc_ty sx_hashfs_block_get(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, const uint8_t **block) {
-    unsigned int ndb = gethashdb(hash), hs;
-    uint64_t dboff;
-    int r;
+static int blocksize_to_hs(unsigned int bs) {
+    unsigned int hs;
 
     for(hs = 0; hs < SIZES; hs++)
 	if(bsz[hs] == bs)
-	    break;
-    if(hs == SIZES) {
+	    return hs;
+    return -1;
+}
+
+/* Resolve a block to its data file and offset without reading it
+ * gen (optional) receives the data file generation the position is valid for */
+rc_ty sx_hashfs_block_locate(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, int *fd, uint64_t *offset, uint64_t *gen) {
+    unsigned int ndb = gethashdb(hash);
+    int hs, r;
+
+    hs = blocksize_to_hs(bs);
+    if(hs < 0) {
 	WARN("bad blocksize: %d", bs);
 	return FAIL_BADBLOCKSIZE;
     }
 
+    if(gen)
+	*gen = datagen_get(h, hs, ndb);
+    if(!bfilter_maybe(h, hs, ndb, hash)) {
+	DEBUG("Hash not in filter");
+	return ENOENT;
+    }
     sqlite3_reset(h->qb_get[hs][ndb]);
     if(qbind_blob(h->qb_get[hs][ndb], ":hash", hash, sizeof(*hash)))
 	return FAIL_EINTERNAL;
@@ -9770,15 +10863,61 @@ rc_ty sx_hashfs_block_get(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash
 	sqlite3_reset(h->qb_get[hs][ndb]);
 	return FAIL_EINTERNAL;
     }
-    if(!block) {
-	sqlite3_reset(h->qb_get[hs][ndb]);
-	return OK;
+    if(offset)
+	*offset = sqlite3_column_int64(h->qb_get[hs][ndb], 0) * bs;
+    if(fd) {
+	/* The caller is about to read the block */
+	*fd = h->datafd[hs][ndb];
+	iostat_add(h, hs, ndb, 0, 1);
     }
-    dboff = sqlite3_column_int64(h->qb_get[hs][ndb], 0);
     sqlite3_reset(h->qb_get[hs][ndb]);
-    dboff *= bs;
+    return OK;
+}
+
+/* Tells whether a position returned by sx_hashfs_block_locate may no longer be valid
+ * Once the data file generation changes the block is looked up again: if it is
+ * still at offset, gen is refreshed and the position is good */
+int sx_hashfs_block_moved(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, uint64_t offset, uint64_t *gen) {
+    uint64_t newoffset, newgen;
+    int hs = blocksize_to_hs(bs);
+
+    if(hs < 0 || datagen_get(h, hs, gethashdb(hash)) == *gen)
+	return 0;
+    if(sx_hashfs_block_locate(h, bs, hash, NULL, &newoffset, &newgen) != OK || newoffset != offset)
+	return 1;
+    *gen = newgen;
+    return 0;
+}
+
+sx_blockio_t *sx_hashfs_blockio(sx_hashfs_t *h) {
+    return h ? h->blockio : NULL;
+}
+
+#define BLOCK_GET_TRIES 3
+rc_ty sx_hashfs_block_get(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, const uint8_t **block) {
+    uint64_t dboff, gen;
+    unsigned int tries;
+    rc_ty ret;
+    int fd, r;
+
+    if(!block)
+	return sx_hashfs_block_locate(h, bs, hash, NULL, NULL, NULL);
+
+    /* Retry if the block was relocated while we were reading it */
+    for(tries = 1; ; tries++) {
+	ret = sx_hashfs_block_locate(h, bs, hash, &fd, &dboff, &gen);
+	if(ret != OK)
+	    return ret;
 
-    if(read_block(h->datafd[hs][ndb], h->blockbuf, dboff, bs))
+	r = read_block(fd, h->blockbuf, dboff, bs);
+	if(!sx_hashfs_block_moved(h, bs, hash, dboff, &gen))
+	    break;
+	if(tries == BLOCK_GET_TRIES) {
+	    WARN("Block keeps being relocated, giving up");
+	    return FAIL_EINTERNAL;
+	}
+    }
+    if(r)
 	return FAIL_EINTERNAL;
 
     *block = h->blockbuf;
@@ -9875,6 +11014,8 @@ static rc_ty hashop_check_presence(sx_hashfs_t *h, unsigned hs, const sx_hash_t
     rc_ty ret;
     unsigned ndb;
     ndb = gethashdb(hash);
+    if(!bfilter_maybe(h, hs, ndb, hash))
+        return ENOENT;
     sqlite3_reset(h->qb_get[hs][ndb]);
     if(qbind_blob(h->qb_get[hs][ndb], ":hash", hash, sizeof(*hash)))
         return FAIL_EINTERNAL;
@@ -10101,26 +11242,249 @@ rc_ty sx_hashfs_hashop_use_revmap(sx_hashfs_t *h, const sx_hash_t *hash, const s
     for(hs = 0; hs < SIZES; hs++)
 	if(bsz[hs] == bs)
 	    break;
-    if(hs == SIZES) {
-	WARN("bad blocksize: %d", bs);
-	return FAIL_BADBLOCKSIZE;
+    if(hs == SIZES) {
+	WARN("bad blocksize: %d", bs);
+	return FAIL_BADBLOCKSIZE;
+    }
+
+    /* This call accesses all the hash databases matching the block size */
+    rc = sx_hashfs_revision_op(h, bs, revision_id, 1);
+    if(rc != OK) {
+        WARN("Failed to mark revision as used");
+        return rc;
+    }
+
+    rc = hashop_create_revmap(h, global_vol_id, revision_id, hs, hash, replica);
+    if (rc == OK)
+        rc = hashop_check_presence(h, hs, hash);
+    return rc;
+}
+
+/* Take the first free slot out of the avail list or bump the datafile size.
+ * Must be called within a transaction on datadb[hs][ndb] */
+static rc_ty block_reserve_slot(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, int64_t *next) {
+    int r;
+
+    sqlite3_reset(h->qb_nextavail[hs][ndb]);
+    sqlite3_reset(h->qb_nextalloc[hs][ndb]);
+    sqlite3_reset(h->qb_bumpavail[hs][ndb]);
+    sqlite3_reset(h->qb_bumpalloc[hs][ndb]);
+
+    r = qstep(h->qb_nextavail[hs][ndb]);
+    if(r == SQLITE_ROW) {
+	*next = sqlite3_column_int64(h->qb_nextavail[hs][ndb], 0);
+	sqlite3_reset(h->qb_nextavail[hs][ndb]);
+
+	if(qbind_int64(h->qb_bumpavail[hs][ndb], ":next", *next) || qstep_noret(h->qb_bumpavail[hs][ndb])) {
+	    WARN("bumpavail failed");
+	    return FAIL_EINTERNAL;
+	}
+	return OK;
+    } else if(r == SQLITE_DONE) {
+	r = qstep(h->qb_nextalloc[hs][ndb]);
+	if(r == SQLITE_ROW) {
+	    *next = sqlite3_column_int64(h->qb_nextalloc[hs][ndb], 0);
+	    sqlite3_reset(h->qb_nextalloc[hs][ndb]);
+
+	    if(qstep_noret(h->qb_bumpalloc[hs][ndb])) {
+		WARN("bumpalloc failed");
+		return FAIL_EINTERNAL;
+	    }
+	    return OK;
+	}
+    }
+
+    WARN("nextavail failed");
+    return FAIL_EINTERNAL;
+}
+
+struct block_put_item {
+    sx_hash_t hash;
+    const uint8_t *data;
+    int64_t slot; /* -1 if the block is already stored */
+    unsigned int ndb;
+};
+
+static int sort_by_hashdb_then_hash_func(const void *thunk, const void *a, const void *b) {
+    const struct block_put_item *ia = (const struct block_put_item *)a;
+    const struct block_put_item *ib = (const struct block_put_item *)b;
+    if(ia->ndb != ib->ndb)
+	return ia->ndb < ib->ndb ? -1 : 1;
+    return cmphash(&ia->hash, &ib->hash);
+}
+
+static int sort_by_slot_func(const void *thunk, const void *a, const void *b) {
+    const struct block_put_item *ia = (const struct block_put_item *)a;
+    const struct block_put_item *ib = (const struct block_put_item *)b;
+    if(ia->slot == ib->slot)
+	return 0;
+    return ia->slot < ib->slot ? -1 : 1;
+}
+
+/* Queue the writes of the blocks in items[0..n), sorted by slot: the I/O
+ * layer coalesces the contiguous slots */
+static int queue_block_writes(sx_hashfs_t *h, int fd, const struct block_put_item *items, unsigned int n, unsigned int bs) {
+    unsigned int i;
+    for(i = 0; i < n; i++) {
+	if(sx_blockio_write(h->blockio, fd, items[i].data, bs, (uint64_t)items[i].slot * bs)) {
+	    msg_set_errno_reason("Failed to queue block write");
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* Best effort: give back the slots of blocks which were not stored */
+static void block_release_slots(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const struct block_put_item *items, unsigned int n) {
+    sqlite3_stmt *q = h->qb_setfree[hs][ndb];
+    unsigned int i;
+
+    if(qbegin(h->datadb[hs][ndb]))
+	return;
+    for(i = 0; i < n; i++) {
+	if(items[i].slot < 0)
+	    continue;
+	sqlite3_reset(q);
+	if(qbind_int64(q, ":blockno", items[i].slot) || qstep_noret(q)) {
+	    sqlite3_reset(q);
+	    qrollback(h->datadb[hs][ndb]);
+	    return;
+	}
+    }
+    sqlite3_reset(q);
+    if(qcommit(h->datadb[hs][ndb]))
+	qrollback(h->datadb[hs][ndb]);
+}
+
+/* Reserve the slots for the blocks of a single hash database which are not
+ * stored yet: items must be sorted by hash and free of duplicates.
+ * On success the *nmissing blocks to write are moved to the front of items
+ * and sorted by slot */
+static rc_ty block_put_reserve(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, struct block_put_item *items, unsigned int n, unsigned int *nmissing) {
+    sxi_db_t *db = h->datadb[hs][ndb];
+    unsigned int i, nmiss = 0;
+    int r;
+
+    *nmissing = 0;
+    /* Presence check first, no need to lock anything for that */
+    for(i = 0; i < n; i++) {
+	if(bfilter_maybe(h, hs, ndb, &items[i].hash)) {
+	    sqlite3_reset(h->qb_get[hs][ndb]);
+	    if(qbind_blob(h->qb_get[hs][ndb], ":hash", &items[i].hash, sizeof(items[i].hash))) {
+		WARN("binding hash failed");
+		return FAIL_EINTERNAL;
+	    }
+	    r = qstep(h->qb_get[hs][ndb]);
+	    sqlite3_reset(h->qb_get[hs][ndb]);
+	    if(r == SQLITE_ROW)
+		continue;
+	    if(r != SQLITE_DONE)
+		return FAIL_EINTERNAL;
+	}
+	/* Move the missing blocks to the front */
+	if(nmiss != i) {
+	    struct block_put_item tmp = items[nmiss];
+	    items[nmiss] = items[i];
+	    items[i] = tmp;
+	}
+	nmiss++;
+    }
+    if(!nmiss)
+	return OK;
+
+    /* Reserve the slots for all the missing blocks at once */
+    if(qbegin(db)) {
+	WARN("begin failed");
+	return FAIL_EINTERNAL;
+    }
+    for(i = 0; i < nmiss; i++) {
+	if(block_reserve_slot(h, hs, ndb, &items[i].slot) != OK) {
+	    qrollback(db);
+	    for(i = 0; i < nmiss; i++)
+		items[i].slot = -1;
+	    return FAIL_EINTERNAL;
+	}
+    }
+    if(qcommit(db)) {
+	qrollback(db);
+	for(i = 0; i < nmiss; i++)
+	    items[i].slot = -1;
+	WARN("nextavail failed");
+	return FAIL_EINTERNAL;
+    }
+
+    sx_qsort(items, nmiss, sizeof(*items), NULL, sort_by_slot_func);
+    DEBUG("%u blocks stored @%d/%d/%lld", nmiss, hs, ndb, (long long)items[0].slot * bsz[hs]);
+    *nmissing = nmiss;
+    return OK;
+}
+
+/* Add the index rows of the blocks written in the reserved slots, in one go */
+static rc_ty block_put_index(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, const struct block_put_item *items, unsigned int n) {
+    sxi_db_t *db = h->datadb[hs][ndb];
+    int64_t now = time(NULL);
+    unsigned int i;
+    int r;
+
+    if(qbegin(db)) {
+	WARN("begin failed");
+	return FAIL_EINTERNAL;
+    }
+    for(i = 0; i < n; i++) {
+	sqlite3_reset(h->qb_add[hs][ndb]);
+	if(qbind_blob(h->qb_add[hs][ndb], ":hash", &items[i].hash, sizeof(items[i].hash)) ||
+	   qbind_int64(h->qb_add[hs][ndb], ":now", now) ||
+	   qbind_int64(h->qb_add[hs][ndb], ":next", items[i].slot)) {
+	    WARN("add failed");
+	    break;
+	}
+	r = qstep(h->qb_add[hs][ndb]);
+	sqlite3_reset(h->qb_add[hs][ndb]);
+	if(r != SQLITE_DONE)
+	    break;
+	if(!sqlite3_changes(db->handle)) {
+	    /* race condition: someone else stored the same block meanwhile */
+	    DEBUGHASH("Race in block_store, releasing slot", &items[i].hash);
+	    sqlite3_reset(h->qb_setfree[hs][ndb]);
+	    if(qbind_int64(h->qb_setfree[hs][ndb], ":blockno", items[i].slot) ||
+	       qstep_noret(h->qb_setfree[hs][ndb])) {
+		sqlite3_reset(h->qb_setfree[hs][ndb]);
+		break;
+	    }
+	    sqlite3_reset(h->qb_setfree[hs][ndb]);
+	}
+	/* Even if it was the other writer's: it may not have had the filter */
+	if(bfilter_add(h, hs, ndb, &items[i].hash))
+	    break;
     }
-
-    /* This call accesses all the hash databases matching the block size */
-    rc = sx_hashfs_revision_op(h, bs, revision_id, 1);
-    if(rc != OK) {
-        WARN("Failed to mark revision as used");
-        return rc;
+    if(i < n || qcommit(db)) {
+	qrollback(db);
+	return FAIL_EINTERNAL;
     }
 
-    rc = hashop_create_revmap(h, global_vol_id, revision_id, hs, hash, replica);
-    if (rc == OK)
-        rc = hashop_check_presence(h, hs, hash);
-    return rc;
+    return OK;
+}
+
+struct block_put_group {
+    unsigned int ndb;
+    unsigned int first;
+    unsigned int nmissing;
+};
+
+static void block_put_release(sx_hashfs_t *h, unsigned int hs, const struct block_put_item *items, const struct block_put_group *groups, unsigned int ngroups) {
+    unsigned int g;
+    for(g = 0; g < ngroups; g++)
+	if(groups[g].nmissing)
+	    block_release_slots(h, hs, groups[g].ndb, &items[groups[g].first], groups[g].nmissing);
 }
 
 /*
- * Saves the block in hashfs reusing an existing "hole" or appending to the datafile
+ * Saves the blocks in hashfs reusing existing "holes" or appending to the datafiles
+ *
+ * data points to nblocks consecutive blocks of size bs.
+ * The blocks are grouped by hash database: for each group the free slots are reserved
+ * in a single transaction, the data of all the groups is then handed to the block I/O
+ * layer as one submission and finally the index rows of each group are committed at once.
  *
  * replica_count:
  * for client uploads, the value is retieved from the upload token in fcgi_save_blocks
@@ -10129,12 +11493,11 @@ rc_ty sx_hashfs_hashop_use_revmap(sx_hashfs_t *h, const sx_hash_t *hash, const s
  * if replica_count is 0, then it means that the block was sent from another node (so we just take it
  * and don't propagate it further)
  */
-rc_ty sx_hashfs_block_put(sx_hashfs_t *h, const uint8_t *data, unsigned int bs, unsigned int replica_count, sx_uid_t uid) {
-    sx_nodelist_t *belongsto;
-    unsigned int ndb, hs;
-    sx_hash_t hash;
-    rc_ty ret = FAIL_EINTERNAL;
-    int r;
+rc_ty sx_hashfs_block_put_many(sx_hashfs_t *h, const uint8_t *data, unsigned int nblocks, unsigned int bs, unsigned int replica_count, sx_uid_t uid) {
+    struct block_put_group groups[HASHDBS];
+    struct block_put_item *items;
+    unsigned int i, j, g, hs, ngroups;
+    rc_ty ret = OK;
 
     if(!h->have_hd) {
 	WARN("Called before initialization");
@@ -10147,120 +11510,109 @@ rc_ty sx_hashfs_block_put(sx_hashfs_t *h, const uint8_t *data, unsigned int bs,
     if(hs == SIZES)
 	return FAIL_BADBLOCKSIZE;
 
-    if(hash_buf(h->cluster_uuid.string, strlen(h->cluster_uuid.string), data, bs, &hash)) {
-	WARN("hashing failed");
-	return FAIL_EINTERNAL;
-    }
-
-    DEBUGHASH("Block uploaded by user", &hash);
-
-    /* MODHDIST: lookup is strictly on bidx 0 */
-    belongsto = sx_hashfs_all_hashnodes(h, NL_NEXT, &hash, replica_count ? replica_count : h->next_maxreplica);
-    r = sx_nodelist_lookup(belongsto, &h->node_uuid) == NULL;
-    sx_nodelist_delete(belongsto);
-    if(r) {
-	DEBUGHASH("Block doesn't belong to this node", &hash);
-	return ENOENT;
-    }
-
-    ndb = gethashdb(&hash);
+    if(!nblocks)
+	return OK;
 
-    sqlite3_reset(h->qb_get[hs][ndb]);
-    if(qbind_blob(h->qb_get[hs][ndb], ":hash", &hash, sizeof(hash))) {
-	WARN("binding hash failed");
+    items = wrap_malloc(nblocks * sizeof(*items));
+    if(!items) {
+	OOM();
 	return FAIL_EINTERNAL;
     }
 
-    r = qstep(h->qb_get[hs][ndb]);
-    sqlite3_reset(h->qb_get[hs][ndb]);
-    if(r == SQLITE_DONE) {
-	int64_t dsto, next;
+    for(i = 0; i < nblocks; i++) {
+	sx_nodelist_t *belongsto;
+	int r;
 
-	if(qbegin(h->datadb[hs][ndb])) {
-	    WARN("begin failed");
+	items[i].data = data + (uint64_t)i * bs;
+	items[i].slot = -1;
+	if(hash_buf(h->cluster_uuid.string, strlen(h->cluster_uuid.string), items[i].data, bs, &items[i].hash)) {
+	    WARN("hashing failed");
+	    free(items);
 	    return FAIL_EINTERNAL;
 	}
 
-	sqlite3_reset(h->qb_nextavail[hs][ndb]);
-	sqlite3_reset(h->qb_nextalloc[hs][ndb]);
-	sqlite3_reset(h->qb_bumpavail[hs][ndb]);
-	sqlite3_reset(h->qb_bumpalloc[hs][ndb]);
-	sqlite3_reset(h->qb_add[hs][ndb]);
-
-	r = qstep(h->qb_nextavail[hs][ndb]);
-	if(r == SQLITE_ROW) {
-	    next = sqlite3_column_int64(h->qb_nextavail[hs][ndb], 0);
-	    sqlite3_reset(h->qb_nextavail[hs][ndb]);
-
-	    if(qbind_int64(h->qb_bumpavail[hs][ndb], ":next", next) || qstep_noret(h->qb_bumpavail[hs][ndb])) {
-		qrollback(h->datadb[hs][ndb]);
-		WARN("bumpavail failed");
-		return FAIL_EINTERNAL;
-	    }
-	} else if(r == SQLITE_DONE) {
-	    r = qstep(h->qb_nextalloc[hs][ndb]);
-	    if(r == SQLITE_ROW) {
-		next = sqlite3_column_int64(h->qb_nextalloc[hs][ndb], 0);
-		sqlite3_reset(h->qb_nextalloc[hs][ndb]);
+	DEBUGHASH("Block uploaded by user", &items[i].hash);
 
-		if(qstep_noret(h->qb_bumpalloc[hs][ndb])) {
-		    qrollback(h->datadb[hs][ndb]);
-		    WARN("bumpalloc failed");
-		    return FAIL_EINTERNAL;
-		}
-	    }
+	/* MODHDIST: lookup is strictly on bidx 0 */
+	belongsto = sx_hashfs_all_hashnodes(h, NL_NEXT, &items[i].hash, replica_count ? replica_count : h->next_maxreplica);
+	r = sx_nodelist_lookup(belongsto, &h->node_uuid) == NULL;
+	sx_nodelist_delete(belongsto);
+	if(r) {
+	    DEBUGHASH("Block doesn't belong to this node", &items[i].hash);
+	    free(items);
+	    return ENOENT;
 	}
+	items[i].ndb = gethashdb(&items[i].hash);
+    }
 
-	if(r != SQLITE_ROW || qcommit(h->datadb[hs][ndb])) {
-	    qrollback(h->datadb[hs][ndb]);
-	    WARN("nextavail failed");
-	    return FAIL_EINTERNAL;
+    /* Group by hash database and drop the duplicates within the batch */
+    sx_qsort(items, nblocks, sizeof(*items), NULL, sort_by_hashdb_then_hash_func);
+    for(i = 0, j = 1; j < nblocks; j++) {
+	if(items[i].ndb != items[j].ndb || cmphash(&items[i].hash, &items[j].hash)) {
+	    i++;
+	    if(i != j)
+		items[i] = items[j];
 	}
+    }
+    nblocks = i + 1;
 
-	dsto = next * bs;
-	DEBUG("Block stored @%d/%d/%ld", hs, ndb, dsto);
-
-	if(write_block(h->datafd[hs][ndb], data, dsto, bs)) {
-	    WARN("write failed");
-	    return FAIL_EINTERNAL;
+    /* Reserve the slots in every hash database first... */
+    for(i = 0, ngroups = 0; i < nblocks; i = j, ngroups++) {
+	for(j = i + 1; j < nblocks && items[j].ndb == items[i].ndb; j++);
+	groups[ngroups].ndb = items[i].ndb;
+	groups[ngroups].first = i;
+	ret = block_put_reserve(h, hs, items[i].ndb, &items[i], j - i, &groups[ngroups].nmissing);
+	if(ret != OK) {
+	    block_put_release(h, hs, items, groups, ngroups);
+	    free(items);
+	    return ret;
 	}
+    }
 
-	/* insert it now */
-	if(qbind_blob(h->qb_add[hs][ndb], ":hash", &hash, sizeof(hash)) ||
-           qbind_int64(h->qb_add[hs][ndb], ":now", time(NULL)) ||
-	   qbind_int64(h->qb_add[hs][ndb], ":next", next)) {
-	    WARN("add failed");
-	    return FAIL_EINTERNAL;
+    /* ...then write all the data with a single submission... */
+    for(g = 0; g < ngroups; g++) {
+	if(queue_block_writes(h, h->datafd[hs][groups[g].ndb], &items[groups[g].first], groups[g].nmissing, bs)) {
+	    sx_blockio_reset(h->blockio);
+	    break;
 	}
-	r = qstep(h->qb_add[hs][ndb]);
-        DEBUG("r: %d, changes: %d", r, sqlite3_changes(h->datadb[hs][ndb]->handle));
-        if (r == SQLITE_DONE && !sqlite3_changes(h->datadb[hs][ndb]->handle)) {
-            DEBUG("checking for race condition");
-            /* race condition */
-            r = qstep(h->qb_get[hs][ndb]);
-            sqlite3_reset(h->qb_get[hs][ndb]);
-            if (r == SQLITE_ROW) {
-		DEBUG("Race in block_store, falling back");
-                ret = EAGAIN;
-            } else if (r == SQLITE_DONE) {
-                WARNHASH("Impossible: hash cannot be added but is not present either", &hash);
-                ret = FAIL_EINTERNAL;
-            } else
-                ret = FAIL_EINTERNAL;
-        } else
-            ret = OK;
-    } else if(r == SQLITE_ROW)
-        ret = EAGAIN;
-    if(ret != OK && ret != EAGAIN)
+    }
+    if(g < ngroups || sx_blockio_submit(h->blockio)) {
+	if(g == ngroups)
+	    msg_set_errno_reason("Failed to write block");
+	WARN("write failed");
+	block_put_release(h, hs, items, groups, ngroups);
+	free(items);
 	return FAIL_EINTERNAL;
+    }
+
+    /* ...and finally index the stored blocks */
+    for(g = 0; g < ngroups; g++) {
+	if(!groups[g].nmissing)
+	    continue;
+	iostat_add(h, hs, groups[g].ndb, 1, groups[g].nmissing);
+	ret = block_put_index(h, hs, groups[g].ndb, &items[groups[g].first], groups[g].nmissing);
+	if(ret != OK) {
+	    block_put_release(h, hs, items, &groups[g], ngroups - g);
+	    free(items);
+	    return ret;
+	}
+    }
 
     if(replica_count > 1) {
-	sx_nodelist_t *targets = sx_hashfs_effective_hashnodes(h, NL_NEXT, &hash, replica_count);
-	rc_ty ret = sx_hashfs_xfer_tonodes(h, &hash, bs, targets, uid);
-	sx_nodelist_delete(targets);
-	return ret;
+	for(i = 0; i < nblocks; i++) {
+	    sx_nodelist_t *targets = sx_hashfs_effective_hashnodes(h, NL_NEXT, &items[i].hash, replica_count);
+	    ret = sx_hashfs_xfer_tonodes(h, &items[i].hash, bs, targets, uid);
+	    sx_nodelist_delete(targets);
+	    if(ret != OK)
+		break;
+	}
     }
-    return OK;
+    free(items);
+    return ret;
+}
+
+rc_ty sx_hashfs_block_put(sx_hashfs_t *h, const uint8_t *data, unsigned int bs, unsigned int replica_count, sx_uid_t uid) {
+    return sx_hashfs_block_put_many(h, data, 1, bs, replica_count, uid);
 }
 
 static void putfile_reinit(sx_hashfs_t *h) {
@@ -10277,6 +11629,7 @@ static void putfile_reinit(sx_hashfs_t *h) {
     h->put_token[0] = '\0';
     h->put_blocks = NULL;
     h->put_nidxs = NULL;
+    h->put_hashnidx = NULL;
     h->put_nblocks = 0;
     h->put_extendsize = -1LL;
     h->put_extendfrom = 0;
@@ -11034,12 +12387,9 @@ rc_ty sx_hashfs_putfile_gettoken(sx_hashfs_t *h, const uint8_t *user, int64_t si
 	h->put_hashnos = &h->put_nidxs[h->put_putblock];
         build_uniq_hash_index(h->put_blocks, h->put_hashnos, &h->put_putblock);
 
-	/* Lookup first node */
-	for(i=0; i<h->put_putblock; i++) {
-	    /* Fills in the index of the target node for the current block on the NL_NEXT dist */
-	    if(hash_nidx_tobuf(h, &h->put_blocks[h->put_hashnos[i]], 1, h->put_replica, &h->put_nidxs[h->put_hashnos[i]]) < 1)
-		goto gettoken_err;
-	}
+	/* Lookup first node: fills in the index of the target node for each block on the NL_NEXT dist */
+	if(hash_nidx_tobuf(h, h->put_blocks, h->put_hashnos, h->put_putblock, 1, h->put_replica, h->put_nidxs) < 1)
+	    goto gettoken_err;
 	if(h->put_putblock > 1) {
 	    /* Group by node, then by original position
 	     * so that we second the readahead instead of fighting it */
@@ -11577,18 +12927,10 @@ static rc_ty reserve_replicas(sx_hashfs_t *h, uint64_t op_expires_at)
     if (!node_indexes)
         return ENOMEM;
 
-    for(i=0; i<uniq_count; i++) {
-	/* MODHDIST: pick from _next, bidx=0 */
-	if(hash_nidx_tobuf(
-			   h,
-			   &all_hashes[uniq_hash_indexes[i]],
-			   effective_replica,
-			   h->put_replica,
-			   &node_indexes[uniq_hash_indexes[i]*effective_replica]
-			   ) < effective_replica) {
-	    WARN("hash_nidx_tobuf failed");
-            ret = FAIL_EINTERNAL;
-	}
+    /* MODHDIST: pick from _next, bidx=0 */
+    if(hash_nidx_tobuf(h, all_hashes, uniq_hash_indexes, uniq_count, effective_replica, h->put_replica, node_indexes) < (int)effective_replica) {
+	WARN("hash_nidx_tobuf failed");
+	ret = FAIL_EINTERNAL;
     }
     DEBUG("reserve_replicas begin");
     for(i=2; ret == OK && i<=effective_replica; i++) {
@@ -11679,6 +13021,7 @@ void sx_hashfs_putfile_end(sx_hashfs_t *h) {
 
     free(h->put_blocks);
     free(h->put_nidxs);
+    free(h->put_hashnidx);
 
     if(!h->put_success && h->put_id)
 	sx_hashfs_tmp_delete(h, h->put_id);
@@ -12117,12 +13460,10 @@ rc_ty sx_hashfs_tmp_getinfo(sx_hashfs_t *h, int64_t tmpfile_id, sx_hashfs_tmpinf
     if(nuniqs)
         memcpy(tbd->uniq_ids, uniqs, nuniqs * sizeof(tbd->uniq_ids[0]));
     memset(tbd->nidxs, -1, nblocks * sizeof(tbd->nidxs[0]) * volume->max_replica);
-    for(i=0; i<nuniqs; i++) {
-	/* MODHDIST: pick from _next, bidx=0 */
-	if(hash_nidx_tobuf(h, &tbd->all_blocks[tbd->uniq_ids[i]], volume->max_replica, volume->max_replica, &tbd->nidxs[tbd->uniq_ids[i]*volume->max_replica]) < 0) {
-	    WARN("hash_nidx_tobuf failed");
-	    goto getmissing_err;
-	}
+    /* MODHDIST: pick from _next, bidx=0 */
+    if(hash_nidx_tobuf(h, tbd->all_blocks, tbd->uniq_ids, nuniqs, volume->max_replica, volume->max_replica, tbd->nidxs) < 0) {
+	WARN("hash_nidx_tobuf failed");
+	goto getmissing_err;
     }
 
     /* Remap the blocks availability array to fit into the recent volume replica, it might have changed during the upload */
@@ -14644,9 +15985,11 @@ rc_ty sx_hashfs_cluster_settings_get_string(sx_hashfs_t *h, const char *key, cha
 }
 
 rc_ty sx_hashfs_get_user_info(sx_hashfs_t *h, const uint8_t *user, sx_uid_t *uid, uint8_t *key, sx_priv_t *basepriv, char **desc, int64_t *quota) {
+    struct authcache_user cached;
     const uint8_t *kcol;
     rc_ty ret = FAIL_EINTERNAL;
     sx_priv_t userpriv;
+    uint64_t gen;
     int r;
 
     if(!h || !user)
@@ -14654,6 +15997,20 @@ rc_ty sx_hashfs_get_user_info(sx_hashfs_t *h, const uint8_t *user, sx_uid_t *uid
     if (desc)
         *desc = NULL;
 
+    /* The description is not cached */
+    if(!desc && authcache_user_get(h, user, &cached)) {
+	if(basepriv)
+	    *basepriv = cached.priv;
+	if(key)
+	    memcpy(key, cached.key, AUTH_KEY_LEN);
+	if(uid)
+	    *uid = cached.uid;
+	if(quota)
+	    *quota = cached.quota;
+	return OK;
+    }
+    gen = authcache_gen(h);
+
     sqlite3_reset(h->q_getuser);
     if(qbind_blob(h->q_getuser, ":user", user, AUTH_UID_LEN))
 	goto get_user_info_err;
@@ -14702,6 +16059,7 @@ rc_ty sx_hashfs_get_user_info(sx_hashfs_t *h, const uint8_t *user, sx_uid_t *uid
     }
     if(quota)
         *quota = sqlite3_column_int64(h->q_getuser, 4);
+    authcache_user_put(h, gen, user, sqlite3_column_int64(h->q_getuser, 0), kcol, userpriv, sqlite3_column_int64(h->q_getuser, 4));
     ret = OK;
 
 get_user_info_err:
@@ -14798,6 +16156,7 @@ rc_ty sx_hashfs_get_access(sx_hashfs_t *h, const uint8_t *user, const char *volu
     int r;
     int64_t owner_id;
     uint8_t owner_uid[AUTH_UID_LEN];
+    uint64_t gen;
 
     if(!h || !user || !volume || !access)
 	return EINVAL;
@@ -14806,6 +16165,10 @@ rc_ty sx_hashfs_get_access(sx_hashfs_t *h, const uint8_t *user, const char *volu
     if(ret)
 	return ret;
 
+    if(authcache_priv_get(h, user, vol->id, access))
+	return OK;
+    gen = authcache_gen(h);
+
     sqlite3_reset(h->q_getaccess);
     if(qbind_int64(h->q_getaccess, ":volume", vol->id) ||
        qbind_blob(h->q_getaccess, ":user_first", firstcid(user, cid), sizeof(cid)) ||
@@ -14815,6 +16178,7 @@ rc_ty sx_hashfs_get_access(sx_hashfs_t *h, const uint8_t *user, const char *volu
     r = qstep(h->q_getaccess);
     if(r == SQLITE_DONE) {
 	*access = PRIV_NONE;
+	authcache_priv_put(h, gen, user, vol->id, *access);
 	return OK;
     }
     if(r != SQLITE_ROW)
@@ -14842,6 +16206,8 @@ rc_ty sx_hashfs_get_access(sx_hashfs_t *h, const uint8_t *user, const char *volu
         *access |= PRIV_MANAGER | PRIV_OWNER;
 
     sqlite3_reset(h->q_getaccess);
+    if(ret == OK)
+	authcache_priv_put(h, gen, user, vol->id, *access);
     return ret;
 }
 
@@ -14852,6 +16218,7 @@ rc_ty sx_hashfs_get_access_by_global_id(sx_hashfs_t *h, const uint8_t *user, con
     int r;
     int64_t owner_id;
     uint8_t owner_uid[AUTH_UID_LEN];
+    uint64_t gen;
 
     if(!h || !user || !global_vol_id || !access)
         return EINVAL;
@@ -14860,6 +16227,10 @@ rc_ty sx_hashfs_get_access_by_global_id(sx_hashfs_t *h, const uint8_t *user, con
     if(ret)
         return ret;
 
+    if(authcache_priv_get(h, user, vol->id, access))
+        return OK;
+    gen = authcache_gen(h);
+
     sqlite3_reset(h->q_getaccess);
     if(qbind_int64(h->q_getaccess, ":volume", vol->id) ||
        qbind_blob(h->q_getaccess, ":user_first", firstcid(user, cid), sizeof(cid)) ||
@@ -14869,6 +16240,7 @@ rc_ty sx_hashfs_get_access_by_global_id(sx_hashfs_t *h, const uint8_t *user, con
     r = qstep(h->q_getaccess);
     if(r == SQLITE_DONE) {
         *access = PRIV_NONE;
+        authcache_priv_put(h, gen, user, vol->id, *access);
         return OK;
     }
     if(r != SQLITE_ROW)
@@ -14896,6 +16268,8 @@ rc_ty sx_hashfs_get_access_by_global_id(sx_hashfs_t *h, const uint8_t *user, con
         *access |= PRIV_MANAGER | PRIV_OWNER;
 
     sqlite3_reset(h->q_getaccess);
+    if(ret == OK)
+        authcache_priv_put(h, gen, user, vol->id, *access);
     return ret;
 }
 
@@ -15530,6 +16904,122 @@ rc_ty sx_hashfs_unbump_wait(sx_hashfs_t *h)
     return ret;
 }
 
+void sx_hashfs_gc_set_worker(sx_hashfs_t *h, sx_hashfs_gc_stats_t *stats, unsigned int worker, unsigned int nworkers) {
+    unsigned int hs, ndb;
+
+    if(!h)
+	return;
+    if(!nworkers)
+	nworkers = 1;
+    h->gc_stats = stats;
+    h->gc_worker = worker % nworkers;
+    h->gc_nworkers = nworkers;
+    if(stats) {
+	stats->pid = getpid();
+	stats->hashdbs = 0;
+	for(hs = 0; hs < SIZES; hs++)
+	    for(ndb = 0; ndb < HASHDBS; ndb++)
+		if((hs * HASHDBS + ndb) % nworkers == h->gc_worker)
+		    stats->hashdbs++;
+    }
+}
+
+/* Returns 1 if the hash db belongs to this GC worker */
+static int gc_owns(sx_hashfs_t *h, unsigned int hs, unsigned int ndb) {
+    return h->gc_nworkers <= 1 || (hs * HASHDBS + ndb) % h->gc_nworkers == h->gc_worker;
+}
+
+static void gc_punch_add(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, int64_t blockno) {
+    struct gc_punch_list *l = &h->gc_punch[hs][ndb];
+
+    if(h->gc_punch_off)
+	return;
+    if(l->n == l->size) {
+	unsigned int newsize = l->size ? l->size * 2 : 256;
+	int64_t *nb = wrap_realloc(l->blocks, newsize * sizeof(*nb));
+	if(!nb)
+	    return; /* Just not released, the slot stays in avail */
+	l->blocks = nb;
+	l->size = newsize;
+    }
+    l->blocks[l->n++] = blockno;
+}
+
+static int punch_hole(int fd, off_t offset, off_t len) {
+#if defined(__linux__) && defined(SYS_fallocate)
+    return syscall(SYS_fallocate, fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+static int cmp_blockno(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Deallocates the data of the slots freed on datadb[hs][ndb] so the space goes
+ * back to the filesystem right away.
+ * The slots are only punched if they are still in avail: a writer takes the slot
+ * out of avail under this same lock before it stores anything in it, and slots
+ * freed by a transaction which was rolled back never made it there */
+static void gc_punch_holes(sx_hashfs_t *h, unsigned int hs, unsigned int ndb) {
+    struct gc_punch_list *l = &h->gc_punch[hs][ndb];
+    sqlite3_stmt *q = h->qb_isavail[hs][ndb];
+    int64_t first = -1, last = -1, released = 0;
+    unsigned int i;
+    int r = SQLITE_DONE;
+
+    if(!l->n)
+	return;
+    if(h->gc_punch_off || qbegin(h->datadb[hs][ndb])) {
+	l->n = 0;
+	return;
+    }
+    qsort(l->blocks, l->n, sizeof(*l->blocks), cmp_blockno);
+    for(i = 0; i <= l->n; i++) {
+	if(i < l->n) {
+	    if(l->blocks[i] == last)
+		continue;
+	    sqlite3_reset(q);
+	    if(qbind_int64(q, ":blockno", l->blocks[i]))
+		break;
+	    r = qstep(q);
+	    sqlite3_reset(q);
+	    if(r != SQLITE_ROW && r != SQLITE_DONE)
+		break;
+	    if(r == SQLITE_ROW && first >= 0 && l->blocks[i] == last + 1) {
+		last++;
+		continue;
+	    }
+	}
+	/* Punch the run collected so far */
+	if(first >= 0) {
+	    if(punch_hole(h->datafd[hs][ndb], first * bsz[hs], (last - first + 1) * bsz[hs])) {
+		if(errno == EOPNOTSUPP || errno == ENOSYS) {
+		    NOTICE("The filesystem does not support hole punching, freed blocks will only be reclaimed by the compaction");
+		    h->gc_punch_off = 1;
+		    break;
+		}
+		WARN("Failed to release blocks %lld-%lld on %s datafile #%u: %s", (long long)first, (long long)last, sizelongnames[hs], ndb, strerror(errno));
+	    } else
+		released += (last - first + 1) * bsz[hs];
+	    first = last = -1;
+	}
+	if(i < l->n && r == SQLITE_ROW)
+	    first = last = l->blocks[i];
+    }
+    if(qcommit(h->datadb[hs][ndb]))
+	qrollback(h->datadb[hs][ndb]);
+    l->n = 0;
+    if(released) {
+	DEBUG("Released %lld bytes on %s datafile #%u", (long long)released, sizelongnames[hs], ndb);
+	if(h->gc_stats)
+	    h->gc_stats->released += released;
+    }
+}
+
 /* Delete a hash */
 static rc_ty gc_block(sx_hashfs_t *h, unsigned int hs, unsigned int hdb, const sx_hash_t *hash, int64_t id, int64_t blockno)
 {
@@ -15564,6 +17054,12 @@ static rc_ty gc_block(sx_hashfs_t *h, unsigned int hs, unsigned int hdb, const s
         gc_log(hash, "gc_block", 0, "Failed to set delete block");
         return FAIL_EINTERNAL;
     }
+    bfilter_del(h, hs, hdb);
+    /* The slot can be reused or punched as soon as we commit */
+    datagen_bump(h, hs, hdb);
+    gc_punch_add(h, hs, hdb, blockno);
+    if(h->gc_stats)
+	h->gc_stats->blocks++;
 
     gc_log(hash, "gc_block", 1, NULL);
 
@@ -16251,6 +17747,8 @@ static rc_ty gc_iterate(sx_hashfs_t *h, int *terminate, revisions_iterate_cb_t c
             rc_ty r;
             sx_hash_t last;
 
+            if(!gc_owns(h, j, i))
+                continue;
             memset(last.b, 0, sizeof(last.b));
 
             do {
@@ -16290,6 +17788,7 @@ static rc_ty gc_iterate(sx_hashfs_t *h, int *terminate, revisions_iterate_cb_t c
                     }
                 } else
                     qrollback(h->datadb[j][i]);
+                gc_punch_holes(h, j, i);
 
                 /* Check the return code of the callback and stop if failed. */
                 if(r != OK && r != ITER_NO_MORE)
@@ -16525,72 +18024,202 @@ static rc_ty unused_blocks_iterate(sx_hashfs_t *h, int *terminate, unsigned int
         rows++;
         *last = id;
 
-        /* Check if we did not reach the timeout */
-        if (qelapsed(h->datadb[sizedb][hashdb]) > gc_max_batch_time) {
-            DEBUG("Throttling the GC slow check, elapsed: %.2lf, time limit: %.2lf", qelapsed(h->datadb[sizedb][hashdb]), gc_max_batch_time);
-            break;
-        }
+        /* Check if we did not reach the timeout */
+        if (qelapsed(h->datadb[sizedb][hashdb]) > gc_max_batch_time) {
+            DEBUG("Throttling the GC slow check, elapsed: %.2lf, time limit: %.2lf", qelapsed(h->datadb[sizedb][hashdb]), gc_max_batch_time);
+            break;
+        }
+
+        /* Rebind the query in order to go inside the loop again */
+        if(qbind_int64(q, ":last", *last)) {
+            WARN("Failed to bind 'last' parameter");
+            goto unused_blocks_iterate_err;
+        }
+    }
+
+    /* When termination is requested we don't want the run to be treated as a failure,
+     * therefore we return OK here. */
+    if(*terminate || rows >= GC_MAX_ROWS)
+        ret = OK;
+    else
+        ret = ITER_NO_MORE;
+unused_blocks_iterate_err:
+    DEBUG("[%d/%d] %s: %llu/%llu", sizedb, hashdb, ret == OK ? "throttled" : (ret == ITER_NO_MORE ? "done" : "failure"),
+        (unsigned long long)*gced, (unsigned long long)rows);
+    sqlite3_reset(q);
+    return ret;
+}
+
+/* Drops the queued gc_candidates which are still not referenced by any revision.
+ * Returns OK if it did not drain the queue (it throttled itself or got terminated),
+ * ITER_NO_MORE if no candidate older than before is left or another code on error.
+ *
+ * === This function must be called inside a transaction. ===
+ */
+static rc_ty gc_candidates_iterate(sx_hashfs_t *h, int *terminate, unsigned int hs, unsigned int hdb, int64_t before, uint64_t *gced, uint64_t *visited) {
+    sqlite3_stmt *q = h->qb_gc_candidate[hs][hdb];
+    sqlite3_stmt *qdel = h->qb_gc_candidate_del[hs][hdb];
+    sqlite3_stmt *qrequeue = h->qb_gc_candidate_requeue[hs][hdb];
+    rc_ty ret = FAIL_EINTERNAL;
+    int r;
+
+    while(!*terminate) {
+        const uint8_t *ptr;
+        sx_hash_t hash;
+        int64_t id, blockno;
+        int has_block, referenced;
+
+        sqlite3_reset(q);
+        if(qbind_int64(q, ":before", before)) {
+            WARN("Failed to bind 'before' parameter");
+            goto gc_candidates_iterate_err;
+        }
+        r = qstep(q);
+        if(r == SQLITE_DONE) {
+            ret = ITER_NO_MORE;
+            break;
+        }
+        if(r != SQLITE_ROW)
+            goto gc_candidates_iterate_err;
+
+        ptr = sqlite3_column_blob(q, 0);
+        if(!ptr || sqlite3_column_bytes(q, 0) != sizeof(hash.b)) {
+            WARN("Invalid hash found");
+            goto gc_candidates_iterate_err;
+        }
+        memcpy(hash.b, ptr, sizeof(hash.b));
+        has_block = sqlite3_column_type(q, 1) != SQLITE_NULL;
+        id = sqlite3_column_int64(q, 1);
+        blockno = sqlite3_column_int64(q, 2);
+        referenced = sqlite3_column_int(q, 3);
+        sqlite3_reset(q);
+
+        (*visited)++;
+        if(has_block && !referenced) {
+            r = gc_block(h, hs, hdb, &hash, id, blockno);
+            if(r == EAGAIN) {
+                /* Locked by the rebalance, look at it again later */
+                sqlite3_reset(qrequeue);
+                if(qbind_int64(qrequeue, ":now", time(NULL)) ||
+                   qbind_blob(qrequeue, ":hash", hash.b, sizeof(hash.b)) ||
+                   qstep_noret(qrequeue))
+                    goto gc_candidates_iterate_err;
+                continue;
+            }
+            if(r != OK)
+                goto gc_candidates_iterate_err;
+            (*gced)++;
+        }
+
+        /* Gone, referenced again or just collected */
+        sqlite3_reset(qdel);
+        if(qbind_blob(qdel, ":hash", hash.b, sizeof(hash.b)) || qstep_noret(qdel))
+            goto gc_candidates_iterate_err;
+
+        if(qelapsed(h->datadb[hs][hdb]) > gc_max_batch_time) {
+            DEBUG("Throttling the GC candidates check, elapsed: %.2lf, time limit: %.2lf", qelapsed(h->datadb[hs][hdb]), gc_max_batch_time);
+            ret = OK;
+            break;
+        }
+    }
+    if(*terminate)
+        ret = OK;
+
+gc_candidates_iterate_err:
+    sqlite3_reset(q);
+    sqlite3_reset(qdel);
+    sqlite3_reset(qrequeue);
+    return ret;
+}
+
+rc_ty sx_hashfs_gc_candidates(sx_hashfs_t *h, int *terminate)
+{
+    unsigned int i, j;
+    uint64_t gced = 0, visited = 0;
+    int64_t before = time(NULL) - GC_CANDIDATE_DELAY;
+    int ret = 0;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    for(j = 0; j < SIZES && !ret && !*terminate; j++) {
+        for(i = 0; i < HASHDBS && !ret && !*terminate; i++) {
+            rc_ty r;
+
+            if(!gc_owns(h, j, i))
+                continue;
+            do {
+                uint64_t visited_now = 0;
+
+                if(qbegin(h->datadb[j][i])) {
+                    ret = -1;
+                    break;
+                }
+
+                r = gc_candidates_iterate(h, terminate, j, i, before, &gced, &visited_now);
+                visited += visited_now;
+
+                if(visited_now && (r == OK || r == ITER_NO_MORE) && !*terminate) {
+                    if(qcommit(h->datadb[j][i])) {
+                        ret = -1;
+                        break;
+                    }
+                } else
+                    qrollback(h->datadb[j][i]);
+                gc_punch_holes(h, j, i);
+
+                if(r != OK && r != ITER_NO_MORE) {
+                    ret = -1;
+                    break;
+                }
 
-        /* Rebind the query in order to go inside the loop again */
-        if(qbind_int64(q, ":last", *last)) {
-            WARN("Failed to bind 'last' parameter");
-            goto unused_blocks_iterate_err;
+                if(r == OK && !*terminate)
+                    usleep(100000);
+            } while(r == OK && !*terminate);
         }
     }
-
-    /* When termination is requested we don't want the run to be treated as a failure,
-     * therefore we return OK here. */
-    if(*terminate || rows >= GC_MAX_ROWS)
-        ret = OK;
-    else
-        ret = ITER_NO_MORE;
-unused_blocks_iterate_err:
-    DEBUG("[%d/%d] %s: %llu/%llu", sizedb, hashdb, ret == OK ? "throttled" : (ret == ITER_NO_MORE ? "done" : "failure"),
-        (unsigned long long)*gced, (unsigned long long)rows);
-    sqlite3_reset(q);
-    return ret;
+    gettimeofday(&end, NULL);
+    INFO("GCed %llu unused hashes out of %llu candidates in %.2lfs", (unsigned long long)gced, (unsigned long long)visited, sxi_timediff(&end, &start));
+    return ret ? FAIL_EINTERNAL : OK;
 }
 
+/* The full blocks table scan. The gc_candidates queue covers the blocks left
+ * unused by the revisions, the scan is still needed:
+ *  - when it is explicitly enabled
+ *  - during a rebalance
+ *  - once per datadb after a rebalance
+ *  - once per datadb after a volume replica change (or its undo)
+ *  - once per datadb which predates the queue, for the blocks it missed */
 rc_ty sx_hashfs_gc_slow(sx_hashfs_t *h, int *terminate)
 {
     unsigned i, j;
     uint64_t gc_blocks = 0;
-    int ret = 0;
+    int ret = 0, running = 0;
     struct timeval start, end;
+    char token[64];
 
-    sqlite3_reset(h->q_getval);
-    if(qbind_text(h->q_getval, ":k", "gc_last_hdist"))
-        return FAIL_EINTERNAL;
-    int last_hdist;
-    switch(qstep(h->q_getval)) {
-    case SQLITE_ROW:
-        last_hdist = sqlite3_column_int(h->q_getval, 0);
-        break;
-    case SQLITE_DONE:
-        last_hdist = -1;
-        break;
-    default:
-        sqlite3_reset(h->q_getval);
+    if(gc_sweep_token(h, token, sizeof(token)))
         return FAIL_EINTERNAL;
-    }
-    int current_hdist = sxi_hdist_version(h->hd);
-    sqlite3_reset(h->q_getval);
-    /* must run slow check either if:
-        - it is explicitly enabled
-        - during a rebalance
-        - after a rebalance (once)
-        - during and after volume replica change process */
-    if (!(gc_slow_check ||
-          sx_hashfs_is_rebalancing(h) ||
-          last_hdist != current_hdist))
-        return ret;
-    INFO("Running slow check");
     gettimeofday(&start, NULL);
     for (j=0;j<SIZES && !ret && !*terminate ;j++) {
         for (i=0;i<HASHDBS && !ret && !*terminate;i++) {
             int64_t last = 0;
             rc_ty r; /* stores the result of unused_blocks_iterate() */
 
+            if(!gc_owns(h, j, i))
+                continue;
+            if(!gc_slow_check && !sx_hashfs_is_rebalancing(h)) {
+                int done = gc_sweep_done(h, j, i, token);
+                if(done < 0) {
+                    ret = -1;
+                    break;
+                }
+                if(done)
+                    continue;
+            }
+            if(!running) {
+                INFO("Running slow check");
+                running = 1;
+            }
             do {
                 uint64_t gced_now = 0;
 
@@ -16614,6 +18243,7 @@ rc_ty sx_hashfs_gc_slow(sx_hashfs_t *h, int *terminate)
                     }
                 } else
                     qrollback(h->datadb[j][i]);
+                gc_punch_holes(h, j, i);
 
                 /* Check the return code of the unused_blocks_iterate() and stop if failed. */
                 if(r != OK && r != ITER_NO_MORE) {
@@ -16626,22 +18256,41 @@ rc_ty sx_hashfs_gc_slow(sx_hashfs_t *h, int *terminate)
                 if(r == OK && !*terminate)
                     usleep(100000);
             } while (r == OK && !*terminate);
+            if(!ret && !*terminate && !sx_hashfs_is_rebalancing(h) && gc_sweep_set(h, j, i, token))
+                ret = -1;
         }
     }
-    if (!ret && !*terminate) {
-        sqlite3_reset(h->q_setval);
-        if(qbind_text(h->q_setval, ":k", "gc_last_hdist") ||
-           qbind_int(h->q_setval, ":v", current_hdist) ||
-           qstep_noret(h->q_setval))
-            return FAIL_EINTERNAL;
-    }
+    if(!running)
+        return ret ? FAIL_EINTERNAL : OK;
     gettimeofday(&end, NULL);
     INFO("GCed %lld unused hashes in %.2lfs", (long long)gc_blocks, sxi_timediff(&end, &start));
     return ret ? FAIL_EINTERNAL : OK;
 }
 
-rc_ty sx_hashfs_gc_info(sx_hashfs_t *h, int *terminate)
+rc_ty sx_hashfs_gc_info(sx_hashfs_t *h, const sx_hashfs_gc_stats_t *stats, unsigned int nworkers)
 {
+    struct timeval now;
+    unsigned int i;
+
+    if(!h || !stats) {
+	NULLARG();
+	return EINVAL;
+    }
+    gettimeofday(&now, NULL);
+    for(i = 0; i < nworkers; i++) {
+	const sx_hashfs_gc_stats_t *s = &stats[i];
+	double elapsed;
+
+	if(!s->start.tv_sec)
+	    continue;
+	elapsed = sxi_timediff(s->end.tv_sec ? &s->end : &now, &s->start);
+	if(elapsed <= 0)
+	    elapsed = 0.001;
+	INFO("GC worker %u (pid %d, %u hash dbs): %s, step %u/%u, %llu blocks freed (%.0f/s), %.2f MB released (%.2f MB/s) in %.2lfs",
+	     i, (int)s->pid, s->hashdbs, s->end.tv_sec ? (s->rc == OK ? "completed" : rc2str(s->rc)) : "running",
+	     s->steps_done, s->steps, (unsigned long long)s->blocks, s->blocks / elapsed,
+	     s->released / 1048576.0, s->released / 1048576.0 / elapsed, elapsed);
+    }
     return OK;
 }
 
@@ -17946,6 +19595,57 @@ void sx_storage_usage(sx_hashfs_t *h, int64_t *allocated, int64_t *committed) {
     sqlite3_reset(h->q_getval);
 }
 
+unsigned int sx_hashfs_device_count(sx_hashfs_t *h) {
+    return h ? h->ndevs : 0;
+}
+
+rc_ty sx_hashfs_device_info(sx_hashfs_t *h, unsigned int devidx, sx_hashfs_device_t *dev) {
+    struct statvfs vfs;
+    unsigned int hs, ndb;
+
+    if(!h || !dev) {
+	NULLARG();
+	return EFAULT;
+    }
+    if(devidx >= h->ndevs)
+	return ENOENT;
+
+    memset(dev, 0, sizeof(*dev));
+    dev->path = h->devpath[devidx];
+    if(statvfs(dev->path, &vfs)) {
+	PWARN("Cannot stat filesystem of %s", dev->path);
+	dev->fs_size = dev->fs_avail = -1;
+    } else {
+	dev->fs_size = (int64_t)vfs.f_blocks * vfs.f_frsize;
+	dev->fs_avail = (int64_t)vfs.f_bavail * vfs.f_frsize;
+    }
+
+    for(hs = 0; hs < SIZES; hs++) {
+	for(ndb = 0; ndb < HASHDBS; ndb++) {
+	    const char *dbfile;
+	    struct stat st;
+
+	    if(h->datadev[hs][ndb] != devidx)
+		continue;
+	    dev->datafiles++;
+	    /* Allocated rather than apparent size: the data files have holes */
+	    if(!fstat(h->datafd[hs][ndb], &st))
+		dev->data_size += (int64_t)st.st_blocks * 512;
+	    dbfile = sqlite3_db_filename(h->datadb[hs][ndb]->handle, "main");
+	    if(dbfile && !stat(dbfile, &st))
+		dev->data_size += st.st_size;
+	    if(h->iostat) {
+		const struct datafile_iostat *io = &h->iostat[hs * HASHDBS + ndb];
+		dev->reads += __atomic_load_n(&io->reads, __ATOMIC_RELAXED);
+		dev->read_bytes += __atomic_load_n(&io->read_bytes, __ATOMIC_RELAXED);
+		dev->writes += __atomic_load_n(&io->writes, __ATOMIC_RELAXED);
+		dev->write_bytes += __atomic_load_n(&io->write_bytes, __ATOMIC_RELAXED);
+	    }
+	}
+    }
+    return OK;
+}
+
 const sx_uuid_t *sx_hashfs_distinfo(sx_hashfs_t *h, unsigned int *version, uint64_t *checksum) {
     const sx_uuid_t *ret;
     if(!h || !h->have_hd)
@@ -20667,8 +22367,8 @@ rc_ty sx_hashfs_node_status(sx_hashfs_t *h, sxi_node_status_t *status) {
     return OK;
 }
 
-rc_ty sx_hashfs_stats_jobq(sx_hashfs_t *h, int64_t *sysjobs, int64_t *userjobs) {
-    int64_t scnt = 0, ucnt = 0;
+rc_ty sx_hashfs_stats_jobq(sx_hashfs_t *h, int64_t *sysjobs, int64_t *userjobs, int64_t *lag) {
+    int64_t scnt = 0, ucnt = 0, age = 0;
 
     if(!h) {
 	NULLARG();
@@ -20682,17 +22382,21 @@ rc_ty sx_hashfs_stats_jobq(sx_hashfs_t *h, int64_t *sysjobs, int64_t *userjobs)
 
     ucnt = sqlite3_column_int64(h->qe_jstats, 0);
     scnt = sqlite3_column_int64(h->qe_jstats, 1) - ucnt;
+    /* lag is the age in seconds of the oldest runnable job, i.e. how long jobs wait before being picked up */
+    age = sqlite3_column_int64(h->qe_jstats, 2);
     sqlite3_reset(h->qe_jstats);
 
     if(sysjobs)
 	*sysjobs = scnt;
     if(userjobs)
 	*userjobs = ucnt;
+    if(lag)
+	*lag = age;
 
     return OK;
 }
 
-rc_ty sx_hashfs_stats_blockq(sx_hashfs_t *h, const sx_uuid_t *dest, int64_t *ready, int64_t *held, int64_t *unbumps) {
+rc_ty sx_hashfs_stats_blockq(sx_hashfs_t *h, const sx_uuid_t *dest, int64_t *ready, int64_t *lag, int64_t *held, int64_t *unbumps) {
     sqlite3_stmt *q = NULL;
     rc_ty ret = FAIL_EINTERNAL;
 
@@ -20701,12 +22405,16 @@ rc_ty sx_hashfs_stats_blockq(sx_hashfs_t *h, const sx_uuid_t *dest, int64_t *rea
         return EINVAL;
     }
 
-    if(ready) {
-	if(qprep(h->xferdb, &q, "SELECT COUNT(*) FROM topush WHERE node = :node AND sched_time <= strftime('%Y-%m-%d %H:%M:%f')") ||
+    if(ready || lag) {
+	/* lag is the age in seconds of the oldest ready transfer, i.e. how far behind we are with this node */
+	if(qprep(h->xferdb, &q, "SELECT COUNT(*), strftime('%s') - strftime('%s', MIN(sched_time)) FROM topush WHERE node = :node AND sched_time <= strftime('%Y-%m-%d %H:%M:%f')") ||
 	   qbind_blob(q, ":node", dest->binary, sizeof(dest->binary)) ||
 	   qstep_ret(q))
 	    goto stats_blockq_err;
-	*ready = sqlite3_column_int64(q, 0);
+	if(ready)
+	    *ready = sqlite3_column_int64(q, 0);
+	if(lag)
+	    *lag = sqlite3_column_int64(q, 1);
 	qnullify(q);
     }
     if(held) {
@@ -20882,12 +22590,21 @@ rc_ty sx_hashfs_cluster_get_mode(sx_hashfs_t *h, int *mode) {
     const char *mode_str;
     int r;
     rc_ty ret = FAIL_EINTERNAL;
+    uint64_t gen;
+    time_t now;
 
     if(!h || !mode) {
         NULLARG();
         return EINVAL;
     }
 
+    now = time(NULL);
+    if(cstate_current(h, h->mode_gen, h->mode_checked, now)) {
+        *mode = h->mode;
+        return OK;
+    }
+    gen = cstate_get(h);
+
     sqlite3_reset(h->q_getval);
     if(qbind_text(h->q_getval, ":k", "mode")) {
         WARN("Failed to get cluster operating mode");
@@ -20921,10 +22638,15 @@ rc_ty sx_hashfs_cluster_get_mode(sx_hashfs_t *h, int *mode) {
 
     ret = OK;
 sx_hashfs_cluster_get_mode_err:
-    if(ret == OK)
+    if(ret == OK) {
         h->readonly = *mode;
-    else
+        h->mode = *mode;
+        h->mode_gen = gen;
+        h->mode_checked = now;
+    } else {
         h->readonly = 0;
+        h->mode_checked = 0;
+    }
     sqlite3_reset(h->q_getval);
     return ret;
 }
@@ -21175,8 +22897,380 @@ rc_ty sx_hashfs_syncglobs_end(sx_hashfs_t *h) {
 }
 
 
+/*
+ * Online compaction
+ *
+ * Live blocks are moved from the tail of a data file into the lowest free
+ * slots, a batch per transaction. The slots left behind are parked in the
+ * compact_pending table rather than freed: readers which resolved a block
+ * position before the move can still read the old copy, and the data file
+ * generation is bumped so that they can tell. Parked slots older than
+ * COMPACT_RELEASE_DELAY are freed by the next run, the trailing hole is cut
+ * off and the data file is truncated; the generation is bumped again so that
+ * slower readers notice their slot may have been reused.
+ */
+#define COMPACT_BATCH 64
+#define COMPACT_RELEASE_DELAY 30
+
+struct compact_ctx {
+    sqlite3_stmt *qfree, *qtail, *qmove, *qpark, *qrelease, *qunpark, *qhole, *qdelavail, *qsetnext;
+};
+
+static void compact_ctx_free(struct compact_ctx *c) {
+    qnullify(c->qfree);
+    qnullify(c->qtail);
+    qnullify(c->qmove);
+    qnullify(c->qpark);
+    qnullify(c->qrelease);
+    qnullify(c->qunpark);
+    qnullify(c->qhole);
+    qnullify(c->qdelavail);
+    qnullify(c->qsetnext);
+}
+
+static int compact_ctx_prep(sxi_db_t *db, struct compact_ctx *c) {
+    memset(c, 0, sizeof(*c));
+    if(qprep(db, &c->qfree, "SELECT blocknumber FROM avail ORDER BY blocknumber ASC LIMIT "STRIFY(COMPACT_BATCH)) ||
+       qprep(db, &c->qtail, "SELECT blockno FROM blocks ORDER BY blockno DESC LIMIT "STRIFY(COMPACT_BATCH)) ||
+       qprep(db, &c->qmove, "UPDATE blocks SET blockno = :to WHERE blockno = :from") ||
+       qprep(db, &c->qpark, "INSERT OR REPLACE INTO compact_pending(blocknumber, released_at) VALUES(:blockno, :now)") ||
+       qprep(db, &c->qrelease, "INSERT OR IGNORE INTO avail SELECT blocknumber FROM compact_pending WHERE released_at <= :cutoff") ||
+       qprep(db, &c->qunpark, "DELETE FROM compact_pending WHERE released_at <= :cutoff") ||
+       qprep(db, &c->qhole, "SELECT blocknumber FROM avail WHERE blocknumber < :next ORDER BY blocknumber DESC") ||
+       qprep(db, &c->qdelavail, "DELETE FROM avail WHERE blocknumber >= :next") ||
+       qprep(db, &c->qsetnext, "UPDATE hashfs SET value = :next WHERE key = 'next_blockno'")) {
+	compact_ctx_free(c);
+	return -1;
+    }
+    return 0;
+}
+
+/* Moves one batch of tail blocks, returns the number of blocks moved or -1 on error */
+static int compact_move(sx_hashfs_t *h, struct compact_ctx *c, unsigned int hs, unsigned int ndb) {
+    int64_t freeslot[COMPACT_BATCH], tailslot[COMPACT_BATCH], now = time(NULL);
+    sxi_db_t *db = h->datadb[hs][ndb];
+    int nfree = 0, ntail = 0, nmove, i, r;
+
+    if(qbegin(db))
+	return -1;
+
+    sqlite3_reset(c->qfree);
+    while((r = qstep(c->qfree)) == SQLITE_ROW)
+	freeslot[nfree++] = sqlite3_column_int64(c->qfree, 0);
+    sqlite3_reset(c->qfree);
+    if(r != SQLITE_DONE)
+	goto compact_move_err;
+
+    sqlite3_reset(c->qtail);
+    while((r = qstep(c->qtail)) == SQLITE_ROW)
+	tailslot[ntail++] = sqlite3_column_int64(c->qtail, 0);
+    sqlite3_reset(c->qtail);
+    if(r != SQLITE_DONE)
+	goto compact_move_err;
+
+    /* Free slots go up, tail slots go down: pair them while it's worth it */
+    for(nmove = 0; nmove < nfree && nmove < ntail && freeslot[nmove] < tailslot[nmove]; nmove++);
+    if(!nmove) {
+	qrollback(db);
+	return 0;
+    }
+
+    for(i = 0; i < nmove; i++) {
+	if(read_block(h->datafd[hs][ndb], h->blockbuf, tailslot[i] * bsz[hs], bsz[hs]) ||
+	   write_block(h->datafd[hs][ndb], h->blockbuf, freeslot[i] * bsz[hs], bsz[hs])) {
+	    WARN("Failed to relocate block %lld to %lld on %s datafile #%u", (long long)tailslot[i], (long long)freeslot[i], sizelongnames[hs], ndb);
+	    goto compact_move_err;
+	}
+    }
+    iostat_add(h, hs, ndb, 0, nmove);
+    iostat_add(h, hs, ndb, 1, nmove);
+    /* The new copies must be durable before the index points at them */
+    if(fdatasync(h->datafd[hs][ndb])) {
+	WARN("Failed to flush %s datafile #%u to disk", sizelongnames[hs], ndb);
+	msg_set_errno_reason("Failed to flush datafile to disk");
+	goto compact_move_err;
+    }
+
+    for(i = 0; i < nmove; i++) {
+	sqlite3_reset(h->qb_bumpavail[hs][ndb]);
+	if(qbind_int64(c->qmove, ":to", freeslot[i]) ||
+	   qbind_int64(c->qmove, ":from", tailslot[i]) ||
+	   qstep_noret(c->qmove) ||
+	   qbind_int64(h->qb_bumpavail[hs][ndb], ":next", freeslot[i]) ||
+	   qstep_noret(h->qb_bumpavail[hs][ndb]) ||
+	   qbind_int64(c->qpark, ":blockno", tailslot[i]) ||
+	   qbind_int64(c->qpark, ":now", now) ||
+	   qstep_noret(c->qpark)) {
+	    sqlite3_reset(h->qb_bumpavail[hs][ndb]);
+	    WARN("Failed to update block positions on %s db #%u", sizelongnames[hs], ndb);
+	    goto compact_move_err;
+	}
+    }
+    sqlite3_reset(h->qb_bumpavail[hs][ndb]);
+
+    if(qcommit(db))
+	goto compact_move_err;
+    datagen_bump(h, hs, ndb);
+    return nmove;
+
+ compact_move_err:
+    qrollback(db);
+    return -1;
+}
+
+/* Frees the slots parked before cutoff and cuts off the trailing hole */
+static rc_ty compact_release(sx_hashfs_t *h, struct compact_ctx *c, unsigned int hs, unsigned int ndb, int64_t cutoff, int64_t *freed) {
+    sxi_db_t *db = h->datadb[hs][ndb];
+    int64_t next, newnext;
+    struct stat st;
+    int r, released;
+
+    if(qbegin(db))
+	return FAIL_EINTERNAL;
+
+    if(qbind_int64(c->qrelease, ":cutoff", cutoff) || qstep_noret(c->qrelease))
+	goto compact_release_err;
+    released = sqlite3_changes(db->handle);
+    if(qbind_int64(c->qunpark, ":cutoff", cutoff) || qstep_noret(c->qunpark))
+	goto compact_release_err;
+
+    sqlite3_reset(h->qb_nextalloc[hs][ndb]);
+    if(qstep_ret(h->qb_nextalloc[hs][ndb]))
+	goto compact_release_err;
+    next = sqlite3_column_int64(h->qb_nextalloc[hs][ndb], 0);
+    sqlite3_reset(h->qb_nextalloc[hs][ndb]);
+
+    /* Walk down the contiguous free slots at the end of the file */
+    newnext = next;
+    if(qbind_int64(c->qhole, ":next", next))
+	goto compact_release_err;
+    while((r = qstep(c->qhole)) == SQLITE_ROW && sqlite3_column_int64(c->qhole, 0) == newnext - 1)
+	newnext--;
+    sqlite3_reset(c->qhole);
+    if(r != SQLITE_ROW && r != SQLITE_DONE)
+	goto compact_release_err;
+
+    if(newnext < next) {
+	if(qbind_int64(c->qdelavail, ":next", newnext) || qstep_noret(c->qdelavail) ||
+	   qbind_int64(c->qsetnext, ":next", newnext) || qstep_noret(c->qsetnext))
+	    goto compact_release_err;
+    }
+
+    /* Nobody can allocate past next while we hold the lock */
+    if(fstat(h->datafd[hs][ndb], &st)) {
+	msg_set_errno_reason("Failed to stat datafile");
+	goto compact_release_err;
+    }
+    if(st.st_size > newnext * bsz[hs]) {
+	if(ftruncate(h->datafd[hs][ndb], newnext * bsz[hs])) {
+	    WARN("Cannot truncate %s datafile #%u", sizelongnames[hs], ndb);
+	    msg_set_errno_reason("Failed to truncate datafile");
+	    goto compact_release_err;
+	}
+	*freed += st.st_size - newnext * bsz[hs];
+    }
+
+    if(qcommit(db))
+	goto compact_release_err;
+    if(released || newnext < next)
+	datagen_bump(h, hs, ndb);
+    return OK;
+
+ compact_release_err:
+    qrollback(db);
+    return FAIL_EINTERNAL;
+}
+
+rc_ty sx_hashfs_gc_compact(sx_hashfs_t *h, int *terminate)
+{
+    int64_t budget = (int64_t)gc_compact_budget * 1024 * 1024, moved = 0, freed = 0;
+    struct timeval start, end;
+    unsigned int hs, ndb;
+    struct compact_ctx c;
+    rc_ty ret = OK;
+
+    if(!h || !terminate) {
+	NULLARG();
+	return EINVAL;
+    }
+    if(!budget)
+	return OK;
+    /* The budget is per node, the workers split it */
+    if(h->gc_nworkers > 1)
+	budget = budget / h->gc_nworkers + 1;
+    if(!h->datagen) {
+	WARN("Online compaction is not available");
+	return OK;
+    }
+
+    gettimeofday(&start, NULL);
+    for(hs = 0; hs < SIZES && ret == OK && !*terminate; hs++) {
+	for(ndb = 0; ndb < HASHDBS && ret == OK && !*terminate; ndb++) {
+	    int64_t nmoved = 0;
+	    int n;
+
+	    if(!gc_owns(h, hs, ndb))
+		continue;
+	    if(compact_ctx_prep(h->datadb[hs][ndb], &c)) {
+		WARN("Cannot prepare compaction queries on %s db #%u", sizelongnames[hs], ndb);
+		ret = FAIL_EINTERNAL;
+		break;
+	    }
+
+	    /* Slots parked by an earlier run, the ones parked now are left to the next */
+	    if(compact_release(h, &c, hs, ndb, time(NULL) - COMPACT_RELEASE_DELAY, &freed) != OK) {
+		WARN("Failed to release compacted slots on %s db #%u", sizelongnames[hs], ndb);
+		ret = FAIL_EINTERNAL;
+	    }
+
+	    while(ret == OK && !*terminate && moved < budget) {
+		n = compact_move(h, &c, hs, ndb);
+		if(n < 0)
+		    ret = FAIL_EINTERNAL;
+		if(n <= 0)
+		    break;
+		moved += (int64_t)n * bsz[hs];
+		nmoved += n;
+		usleep(gc_yield_time * 1000000);
+	    }
+	    compact_ctx_free(&c);
+	    if(nmoved)
+		INFO("Relocated %lld blocks on %s datafile #%u", (long long)nmoved, sizelongnames[hs], ndb);
+	}
+    }
+
+    gettimeofday(&end, NULL);
+    INFO("Compaction relocated %lld bytes and freed %lld bytes in %.2lfs", (long long)moved, (long long)freed, sxi_timediff(&end, &start));
+    return ret;
+}
+
+/* A filter is rebuilt once at least this many and a quarter of its entries are stale */
+#define BFILTER_STALE_MIN 1024
+
+static rc_ty bfilter_rebuild(sx_hashfs_t *h, unsigned int hs, unsigned int ndb, int *terminate, uint64_t *nentries) {
+    struct bfilter_slot *s = &h->bfilter->slot[hs][ndb];
+    sxi_db_t *db = h->datadb[hs][ndb];
+    uint32_t map = !__atomic_load_n(&s->active, __ATOMIC_SEQ_CST);
+    uint32_t stale = __atomic_load_n(&s->stale, __ATOMIC_SEQ_CST), lines, oldlines;
+    uint64_t entries = 0;
+    sqlite3_stmt *q = NULL;
+    struct stat st;
+    rc_ty ret = FAIL_EINTERNAL;
+    int r;
+
+    if(fstat(h->datafd[hs][ndb], &st)) {
+	PWARN("Failed to stat %s datafile #%u", sizelongnames[hs], ndb);
+	return FAIL_EINTERNAL;
+    }
+
+    /* Size the bitmap for the blocks stored now */
+    if(qprep(db, &q, "SELECT COUNT(*) FROM blocks") || qstep_ret(q)) /* SLOWQ */
+	goto bfilter_rebuild_err;
+    lines = bfilter_lines_for(sqlite3_column_int64(q, 0));
+    qnullify(q);
+
+    /* Lookups still running on the inactive bitmap will fall back to the db */
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    oldlines = __atomic_load_n(&s->lines[map], __ATOMIC_SEQ_CST);
+#ifdef MADV_REMOVE
+    /* Give the space back rather than writing out zeroes */
+    if(madvise(bfilter_bitmap(h->bfilter, hs, ndb, map), BFILTER_BITMAP_MAX, MADV_REMOVE))
+#endif
+	memset(bfilter_bitmap(h->bfilter, hs, ndb, map), 0, (lines > oldlines ? lines : oldlines) * BFILTER_LINE_SIZE);
+    __atomic_store_n(&s->lines[map], lines, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&s->shadow, map + 1, __ATOMIC_SEQ_CST);
+
+    /* Wait for the writers which may have missed the shadow bitmap: the blocks
+     * they add are visible to the scan below, all the later ones are set by
+     * bfilter_add() */
+    if(qbegin(db)) {
+	WARN("Failed to lock %s db #%u", sizelongnames[hs], ndb);
+	goto bfilter_rebuild_err;
+    }
+    qrollback(db);
+
+    if(qprep(db, &q, "SELECT hash FROM blocks")) /* SLOWQ */
+	goto bfilter_rebuild_err;
+    while((r = qstep(q)) == SQLITE_ROW) {
+	const sx_hash_t *hash = sqlite3_column_blob(q, 0);
+
+	if(!hash || sqlite3_column_bytes(q, 0) != sizeof(*hash)) {
+	    WARN("Invalid hash in %s db #%u", sizelongnames[hs], ndb);
+	    goto bfilter_rebuild_err;
+	}
+	bfilter_set(bfilter_line(h->bfilter, hs, ndb, map, hash), bfilter_probes(hash));
+	entries++;
+	if(!(entries % 4096) && *terminate)
+	    goto bfilter_rebuild_err;
+    }
+    if(r != SQLITE_DONE)
+	goto bfilter_rebuild_err;
+
+    __atomic_store_n(&s->entries, entries, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->deleted, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->dataino, (uint64_t)st.st_ino, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&s->active, map, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&s->shadow, 0, __ATOMIC_SEQ_CST);
+    /* A writer without the bitmaps stored a block meanwhile: try again next time */
+    if(__atomic_load_n(&s->stale, __ATOMIC_SEQ_CST) == stale)
+	__atomic_store_n(&s->ready, 1, __ATOMIC_SEQ_CST);
+    *nentries += entries;
+    ret = OK;
+
+bfilter_rebuild_err:
+    if(ret != OK)
+	__atomic_store_n(&s->shadow, 0, __ATOMIC_SEQ_CST);
+    qnullify(q);
+    return ret;
+}
+
+/* Rebuild the block filters which are not yet populated, hold too many deleted blocks or got too full */
+rc_ty sx_hashfs_gc_filter(sx_hashfs_t *h, int *terminate)
+{
+    uint64_t entries = 0;
+    unsigned int hs, ndb, rebuilt = 0;
+    struct timeval start, end;
+    rc_ty ret = OK;
+
+    if(!h || !terminate) {
+	NULLARG();
+	return EINVAL;
+    }
+    if(!h->bfilter)
+	return OK;
+
+    gettimeofday(&start, NULL);
+    for(hs = 0; hs < SIZES && !*terminate; hs++) {
+	for(ndb = 0; ndb < HASHDBS && !*terminate; ndb++) {
+	    struct bfilter_slot *s = &h->bfilter->slot[hs][ndb];
+	    uint64_t deleted = __atomic_load_n(&s->deleted, __ATOMIC_RELAXED);
+	    uint64_t added = __atomic_load_n(&s->entries, __ATOMIC_RELAXED);
+	    uint32_t lines = __atomic_load_n(&s->lines[__atomic_load_n(&s->active, __ATOMIC_SEQ_CST)], __ATOMIC_SEQ_CST);
+
+	    if(__atomic_load_n(&s->ready, __ATOMIC_SEQ_CST) &&
+	       (deleted < BFILTER_STALE_MIN || deleted < added / 4) &&
+	       (lines >= bfilter_lines_for(added / 2) || lines >= BFILTER_BITMAP_MAX / BFILTER_LINE_SIZE))
+		continue;
+	    if(bfilter_rebuild(h, hs, ndb, terminate, &entries) != OK) {
+		if(!*terminate) {
+		    WARN("Failed to rebuild the block filter of %s db #%u", sizelongnames[hs], ndb);
+		    ret = FAIL_EINTERNAL;
+		}
+		continue;
+	    }
+	    rebuilt++;
+	}
+    }
+
+    if(rebuilt) {
+	gettimeofday(&end, NULL);
+	INFO("Rebuilt %u block filters with %llu blocks in %.2lfs", rebuilt, (unsigned long long)entries, sxi_timediff(&end, &start));
+    }
+    return ret;
+}
+
 rc_ty sx_hashfs_compact(sx_hashfs_t *h, int64_t *bytes_freed) {
-    sqlite3_stmt *qsyn = NULL, *qnys = NULL, *qget = NULL, *qdel = NULL, *qupa = NULL, *qupb = NULL, *qset = NULL, *qvac = NULL;
+    sqlite3_stmt *qsyn = NULL, *qnys = NULL, *qget = NULL, *qdel = NULL, *qupa = NULL, *qupb = NULL, *qset = NULL, *qvac = NULL, *qpark = NULL, *qunpark = NULL;
     unsigned int ndb, hs, rollback = 0;
     int64_t freed = 0;
     rc_ty ret = FAIL_EINTERNAL;
@@ -21216,6 +23310,22 @@ rc_ty sx_hashfs_compact(sx_hashfs_t *h, int64_t *bytes_freed) {
 		goto defrag_err;
 	    }
 
+	    /* Nobody is reading: the slots parked by the online compaction can be freed right away */
+	    if(qprep(h->datadb[hs][ndb], &qpark, "INSERT OR IGNORE INTO avail SELECT blocknumber FROM compact_pending") ||
+	       qprep(h->datadb[hs][ndb], &qunpark, "DELETE FROM compact_pending") ||
+	       qbegin(h->datadb[hs][ndb])) {
+		WARN("Cannot release parked blocks on %s db #%u", sizelongnames[hs], ndb);
+		goto defrag_err;
+	    }
+	    rollback = 1;
+	    if(qstep_noret(qpark) || qstep_noret(qunpark) || qcommit(h->datadb[hs][ndb])) {
+		WARN("Cannot release parked blocks on %s db #%u", sizelongnames[hs], ndb);
+		goto defrag_err;
+	    }
+	    rollback = 0;
+	    qnullify(qpark);
+	    qnullify(qunpark);
+
 	    while(1) { /* Foreach block in freelist */
 		int64_t empty, next_empty, full, nextblq;
 		if(qbegin(h->datadb[hs][ndb])) {
@@ -21413,6 +23523,8 @@ rc_ty sx_hashfs_compact(sx_hashfs_t *h, int64_t *bytes_freed) {
     sqlite3_finalize(qupb);
     sqlite3_finalize(qset);
     sqlite3_finalize(qvac);
+    sqlite3_finalize(qpark);
+    sqlite3_finalize(qunpark);
     if(rollback)
 	qrollback(h->datadb[hs][ndb]);
 
@@ -21969,7 +24081,7 @@ static rc_ty volrep_release_index(sx_hashfs_t *h) {
 }
 
 rc_ty sx_hashfs_modify_volume_replica(sx_hashfs_t *h, const sx_hashfs_volume_t *vol, unsigned int prev_replica, unsigned int next_replica) {
-    sqlite3_stmt *q, *qdel;
+    sqlite3_stmt *q, *qgen = NULL;
     rc_ty s, ret = FAIL_EINTERNAL;
 
     if(!vol) {
@@ -22030,9 +24142,7 @@ rc_ty sx_hashfs_modify_volume_replica(sx_hashfs_t *h, const sx_hashfs_volume_t *
     }
 
     q = h->q_modreplica;
-    qdel = h->q_delval;
     sqlite3_reset(q);
-    sqlite3_reset(qdel);
 
     if(qbind_int64(q, ":volume_id", vol->id) || qbind_int(q, ":next_replica", next_replica) ||
        qbind_int(q, ":replica", prev_replica) || qbind_int64(q, ":now", time(NULL)) || qstep_noret(q)) {
@@ -22044,10 +24154,10 @@ rc_ty sx_hashfs_modify_volume_replica(sx_hashfs_t *h, const sx_hashfs_volume_t *
      * The GC should be notified the volume replica has been changed in order to be able to run the slow check.
      * It would be sufficient to perform a slow check only when the replica value decreases, but we may
      * face an undo phase and therefore we should run the slow check in both cases.
-     * When gc_last_hdist entry is not present GC will perform a slow check and save the current hdist
-     * after its finished, therefore we delete this entry here.
+     * The GC sweeps every datadb which was not swept since gc_sweep_gen was last bumped.
      */
-    if((qbind_text(qdel, ":k", "gc_last_hdist") || qstep_noret(qdel))) {
+    if(qprep(h->db, &qgen, "INSERT OR REPLACE INTO hashfs (key, value) VALUES ('gc_sweep_gen', COALESCE((SELECT value FROM hashfs WHERE key = 'gc_sweep_gen'), 0) + 1)") ||
+       qstep_noret(qgen)) {
         msg_set_reason("Failed to notify garbage collector");
         goto sx_hashfs_modify_volume_replica_err;
     }
@@ -22067,7 +24177,7 @@ sx_hashfs_modify_volume_replica_err:
     if(ret != OK)
         qrollback(h->db);
     sqlite3_reset(q);
-    sqlite3_reset(qdel);
+    qnullify(qgen);
     return OK;
 }
 
@@ -22182,17 +24292,77 @@ void sx_hashfs_getmaxreplica(sx_hashfs_t *h, unsigned int *maxreplica, unsigned
 	*effective_maxreplica = effr;
 }
 
+/* Copies a data file, leaving out the unused (all zero) ranges as holes */
+static rc_ty copy_datafile(sx_hashfs_t *h, int srcfd, const char *destination) {
+    unsigned int chunk = bsz[SIZES-1];
+    struct stat st;
+    off_t off;
+    int dstfd;
+
+    if(fstat(srcfd, &st)) {
+	msg_set_errno_reason("Failed to stat data file");
+	return FAIL_EINTERNAL;
+    }
+    dstfd = open(destination, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if(dstfd < 0) {
+	msg_set_errno_reason("Failed to create destination data file");
+	return EINVAL;
+    }
+    for(off = 0; off < st.st_size; off += chunk) {
+	unsigned int len = MIN(chunk, st.st_size - off), i;
+	if(read_block(srcfd, h->blockbuf, off, len))
+	    goto copy_datafile_err;
+	for(i = 0; i < len && !h->blockbuf[i]; i++);
+	if(i < len && write_block(dstfd, h->blockbuf, off, len))
+	    goto copy_datafile_err;
+    }
+    if(ftruncate(dstfd, st.st_size) || fsync(dstfd)) {
+	msg_set_errno_reason("Failed to flush destination data file");
+	goto copy_datafile_err;
+    }
+    if(close(dstfd)) {
+	dstfd = -1;
+	msg_set_errno_reason("Failed to close destination data file");
+	goto copy_datafile_err;
+    }
+    return OK;
+
+ copy_datafile_err:
+    if(dstfd >= 0)
+	close(dstfd);
+    unlink(destination);
+    return FAIL_EINTERNAL;
+}
+
 rc_ty sx_hashfs_movedb(sx_hashfs_t *h, const char *dbname, const char *destdir) {
     const char *s, *bname;
     char *source = NULL, *destination = NULL;
     struct flock fl;
     unsigned int i, locked = 0;
-    sxi_db_t *src_db;
+    sxi_db_t *src_db = NULL;
     sqlite3 *dst_dbh = NULL;
+    int r, datafd = -1;
     rc_ty ret;
-    int r;
 
-    if(!strncmp("hashdb_", dbname, lenof("hashdb_"))) {
+    if(!strncmp("datafile_", dbname, lenof("datafile_"))) {
+	/* Block data files: moved along the hashdbs to rebalance the data directories */
+	unsigned int sz, part;
+	for(sz=0; sz<SIZES; sz++)
+	    if(dbname[lenof("datafile_")] == sizedirs[sz])
+		break;
+	if(sz == SIZES ||
+	   dbname[lenof("datafile_") + 1] != '_' ||
+	   dbname[lenof("datafile_") + 2] == '\0') {
+	    msg_set_reason("No such data file: %s", dbname);
+	    return EINVAL;
+	}
+	part = strtol(&dbname[lenof("datafile_") + 2], (char **)&s, 16);
+	if(*s != '\0' || part >= HASHDBS) {
+	    msg_set_reason("No such data file: %s", dbname);
+	    return EINVAL;
+	}
+	datafd = h->datafd[sz][part];
+    } else if(!strncmp("hashdb_", dbname, lenof("hashdb_"))) {
 	/* Blocks */
 	unsigned int sz, part;
 	for(sz=0; sz<SIZES; sz++)
@@ -22290,13 +24460,42 @@ rc_ty sx_hashfs_movedb(sx_hashfs_t *h, const char *dbname, const char *destdir)
     }
     sqlite3_reset(h->q_getval);
     bname = strrchr(source, '/');
-    destination = malloc(strlen(destdir) + 1 + strlen(bname) + 1);
+    i = strlen(destdir);
+    while(i > 1 && destdir[i-1] == '/')
+	i--;
+    destination = malloc(i + strlen(bname) + 1);
     if(!destination) {
 	msg_set_reason("Out of memory");
 	ret = ENOMEM;
 	goto movedb_err;
     }
-    sprintf(destination, "%s/%s", destdir, bname);
+    sprintf(destination, "%.*s%s", (int)i, destdir, bname);
+
+    if(datafd >= 0) {
+	if(!strcmp(source, destination)) {
+	    msg_set_reason("The data file is already in %s", destdir);
+	    ret = EINVAL;
+	    goto movedb_err;
+	}
+	ret = copy_datafile(h, datafd, destination);
+	if(ret != OK)
+	    goto movedb_err;
+	sqlite3_reset(h->q_setval);
+	if(qbind_text(h->q_setval, ":k", dbname) ||
+	   qbind_text(h->q_setval, ":v", destination) ||
+	   qstep_noret(h->q_setval)) {
+	    msg_set_reason("Failed to update the data file location");
+	    unlink(destination);
+	    ret = FAIL_EINTERNAL;
+	    goto movedb_err;
+	}
+	/* Unlike the dbs, the old copy is dropped: freeing its space is the point */
+	if(unlink(source))
+	    PWARN("Failed to remove %s", source);
+	INFO("%s -> %s", source, destination);
+	ret = OK;
+	goto movedb_err;
+    }
 
     r = sqlite3_wal_checkpoint_v2(src_db->handle, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
     if(r != SQLITE_OK) {
@@ -36,6 +36,7 @@
 #include "../libsxclient/src/cluster.h"
 #include "sxdbi.h"
 #include "hashop.h"
+#include "blockio.h"
 #include "sxlimits.h"
 
 #define TOKEN_RAND_BYTES 16
@@ -59,6 +60,10 @@
 /* Defines a maximum number of blocks to process while performing a slow check */
 #define GC_MAX_ROWS 1000
 #define GC_UNBUMPED_REVOPS_EXPIRY 3600 /* 1 hour */
+/* Minimum time a block spends unreferenced in the gc_candidates queue before it's dropped */
+#define GC_CANDIDATE_DELAY 3600 /* 1 hour */
+/* One hash database per GC worker at most */
+#define GC_MAX_WORKERS 48
 
 
 #define QUOTA_UNDEFINED -1LL
@@ -82,7 +87,8 @@ typedef enum {
 typedef int64_t sx_uid_t;
 
 /* HashFS main actions */
-rc_ty sx_storage_create(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size);
+/* datadirs: absolute paths the block data files and their dbs are spread over (NULL/0: dir) */
+rc_ty sx_storage_create(const char *dir, sx_uuid_t *cluster, uint8_t *key, int key_size, const char **datadirs, unsigned int ndatadirs);
 rc_ty sx_storage_upgrade(const char *dir);
 typedef struct _sx_hashfs_t sx_hashfs_t;
 int sx_hashfs_is_upgrading(sx_hashfs_t *h);
@@ -100,11 +106,25 @@ const char *sx_hashfs_cluster_name(sx_hashfs_t *h);
 uint16_t sx_hashfs_http_port(sx_hashfs_t *h);
 const char *sx_hashfs_ca_file(sx_hashfs_t *h);
 void sx_storage_usage(sx_hashfs_t *h, int64_t *allocated, int64_t *committed);
+
+/* Data directories (devices) the block data files are placed on */
+typedef struct _sx_hashfs_device_t {
+    const char *path;
+    unsigned int datafiles; /* Data files placed in the directory */
+    int64_t data_size; /* Space taken by the data files and their dbs */
+    int64_t fs_size, fs_avail; /* Size and space available of the filesystem, -1 if unknown */
+    uint64_t reads, read_bytes; /* Block I/O since the storage was opened by the first process */
+    uint64_t writes, write_bytes;
+} sx_hashfs_device_t;
+unsigned int sx_hashfs_device_count(sx_hashfs_t *h);
+rc_ty sx_hashfs_device_info(sx_hashfs_t *h, unsigned int devidx, sx_hashfs_device_t *dev);
 const sx_uuid_t *sx_hashfs_distinfo(sx_hashfs_t *h, unsigned int *version, uint64_t *checksum);
 rc_ty sx_storage_activate(sx_hashfs_t *h, const char *name, const sx_node_t *firstnode, uint8_t *admin_uid, unsigned int uid_size, uint8_t *admin_key, int key_size, uint16_t port, const char *ssl_ca_file);
 rc_ty sx_hashfs_setnodedata(sx_hashfs_t *h, const char *name, const sx_uuid_t *node_uuid, uint16_t port, int use_ssl, const char *ssl_ca_crt);
 int sx_hashfs_uses_secure_proto(sx_hashfs_t *h);
 void sx_hashfs_set_triggers(sx_hashfs_t *h, int job_trigger, int xfer_trigger, int gc_trigger, int gc_expire_trigger, int hbeat_trigger);
+void sx_hashfs_get_triggers(sx_hashfs_t *h, int *job_trigger, int *xfer_trigger, int *gc_trigger, int *gc_expire_trigger, int *hbeat_trigger);
+const char *sx_hashfs_dir(sx_hashfs_t *h);
 void sx_hashfs_close(sx_hashfs_t *h);
 int sx_hashfs_check(sx_hashfs_t *h, int debug, int show_progress);
 int sx_hashfs_extract(sx_hashfs_t *h, const char *destpath);
@@ -112,7 +132,9 @@ void sx_hashfs_stats(sx_hashfs_t *h);
 int sx_hashfs_analyze(sx_hashfs_t *h, int verbose);
 sx_nodelist_t *sx_hashfs_all_hashnodes(sx_hashfs_t *h, sx_hashfs_nl_t which, const sx_hash_t *hash, unsigned int replica_count);
 sx_nodelist_t *sx_hashfs_effective_hashnodes(sx_hashfs_t *h, sx_hashfs_nl_t which, const sx_hash_t *hash, unsigned int replica_count);
-sx_nodelist_t *sx_hashfs_putfile_hashnodes(sx_hashfs_t *h, const sx_hash_t *hash);
+/* Returns the number of effective target nodes for hash and sets *nidx to their
+ * indexes in sx_hashfs_all_nodes(h, NL_NEXT); the buffer is owned by h */
+int sx_hashfs_putfile_hashnidx(sx_hashfs_t *h, const sx_hash_t *hash, const unsigned int **nidx);
 rc_ty sx_hashfs_check_blocksize(unsigned int bs);
 int64_t sx_hashfs_growable_filesize(void);
 int sx_hashfs_distcheck(sx_hashfs_t *h);
@@ -339,7 +361,12 @@ rc_ty sx_hashfs_getfilemeta_next(sx_hashfs_t *h, const char **key, const void **
 
 /* Block xfer */
 rc_ty sx_hashfs_block_get(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, const uint8_t **block);
+rc_ty sx_hashfs_block_locate(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, int *fd, uint64_t *offset, uint64_t *gen);
+int sx_hashfs_block_moved(sx_hashfs_t *h, unsigned int bs, const sx_hash_t *hash, uint64_t offset, uint64_t *gen);
+/* The I/O queue of the data files, for batched reads of located blocks */
+sx_blockio_t *sx_hashfs_blockio(sx_hashfs_t *h);
 rc_ty sx_hashfs_block_put(sx_hashfs_t *h, const uint8_t *data, unsigned int bs, unsigned int replica_count, sx_uid_t uid);
+rc_ty sx_hashfs_block_put_many(sx_hashfs_t *h, const uint8_t *data, unsigned int nblocks, unsigned int bs, unsigned int replica_count, sx_uid_t uid);
 
 /* hash batch ops for GC */
 rc_ty sx_hashfs_hashop_perform(sx_hashfs_t *h, unsigned int block_size, unsigned replica_count, enum sxi_hashop_kind kind, const sx_hash_t *hash, const sx_hash_t *global_vol_id, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, uint64_t op_expires_at, int *present);
@@ -351,8 +378,23 @@ void sx_hashfs_revision_op_rollback(sx_hashfs_t *h);
 rc_ty sx_hashfs_reserve_revision_id(sx_hashfs_t *h, const sx_hash_t *reserve_id, const sx_hash_t *revision_id, unsigned int blocksize, uint64_t op_expires_at);
 rc_ty sx_hashfs_unbump_wait(sx_hashfs_t *h);
 rc_ty sx_hashfs_gc_periodic(sx_hashfs_t *h, int *terminate, int grace_period);
+rc_ty sx_hashfs_gc_candidates(sx_hashfs_t *h, int *terminate);
 rc_ty sx_hashfs_gc_slow(sx_hashfs_t *h, int *terminate);
-rc_ty sx_hashfs_gc_info(sx_hashfs_t *h, int *terminate);
+rc_ty sx_hashfs_gc_compact(sx_hashfs_t *h, int *terminate);
+rc_ty sx_hashfs_gc_filter(sx_hashfs_t *h, int *terminate);
+
+/* Progress of a GC worker, lives in memory shared with the GC process */
+typedef struct _sx_hashfs_gc_stats_t {
+    pid_t pid;
+    unsigned int hashdbs; /* Hash databases owned by the worker */
+    unsigned int steps, steps_done;
+    uint64_t blocks; /* Blocks freed */
+    uint64_t released; /* Bytes given back to the filesystem */
+    struct timeval start, end;
+    rc_ty rc;
+} sx_hashfs_gc_stats_t;
+void sx_hashfs_gc_set_worker(sx_hashfs_t *h, sx_hashfs_gc_stats_t *stats, unsigned int worker, unsigned int nworkers);
+rc_ty sx_hashfs_gc_info(sx_hashfs_t *h, const sx_hashfs_gc_stats_t *stats, unsigned int nworkers);
 rc_ty sx_hashfs_gc_expire_all_reservations(sx_hashfs_t *h);
 rc_ty sx_hashfs_gc_unused_revisions(sx_hashfs_t *h, int *terminate);
 rc_ty sx_hashfs_gc_unbumped_revisions(sx_hashfs_t *h, int *terminate);
@@ -733,8 +775,9 @@ void sx_hashfs_raft_state_empty(sx_hashfs_t *h, sx_raft_state_t *state);
 
 int sx_hashfs_vacuum(sx_hashfs_t *h);
 
-rc_ty sx_hashfs_stats_jobq(sx_hashfs_t *h, int64_t *sysjobs, int64_t *userjobs);
-rc_ty sx_hashfs_stats_blockq(sx_hashfs_t *h, const sx_uuid_t *dest, int64_t *ready, int64_t *held, int64_t *unbumps);
+rc_ty sx_hashfs_stats_jobq(sx_hashfs_t *h, int64_t *sysjobs, int64_t *userjobs, int64_t *lag);
+rc_ty sx_hashfs_stats_blockq(sx_hashfs_t *h, const sx_uuid_t *dest, int64_t *ready, int64_t *lag, int64_t *held, int64_t *unbumps);
+rc_ty sx_hashfs_stats_authcache(sx_hashfs_t *h, int64_t *user_hits, int64_t *user_misses, int64_t *priv_hits, int64_t *priv_misses);
 
 int sx_hashfs_update_storage_usage(sx_hashfs_t *h);
 rc_ty sx_hashfs_movedb(sx_hashfs_t *h, const char *dbname, const char *destdir);
@@ -81,15 +81,20 @@ void sxi_hashop_begin(sxi_hashop_t *hashop, sxi_conns_t *conns, hash_presence_cb
 struct hashop_ctx {
     jparse_t *J;
     char *hexhashes;
+    sx_hash_t *binhashes;
+    unsigned int nhashes;
+    uint8_t bitmap[HASHOP_BIN_MAX_BLOCKS / 8];
+    unsigned int bitmap_len;
     sxi_query_t *query;
     unsigned int idx;
-    int idxs[DOWNLOAD_MAX_BLOCKS];
+    int idxs[HASHOP_BIN_MAX_BLOCKS];
     sxi_hashop_t *hashop;
     curlev_context_t *cbdata;
 };
 
 /* 
 {"presence":[true, false, ...]}
+or, for binary requests, a bitmap with one bit per hash
 */
 
 static void cb_presence(jparse_t *J, void *ctx, int boolean) {
@@ -139,6 +144,9 @@ static int presence_setup_cb(curlev_context_t *cbdata, const char *host) {
 	return 1;
 
     yactx->cbdata = cbdata;
+    yactx->bitmap_len = 0;
+    if(yactx->binhashes)
+	return 0;
 
     sxi_jparse_destroy(yactx->J);
     if(!(yactx->J = sxi_jparse_create(&presence_acts, yactx, 1))) {
@@ -151,6 +159,26 @@ static int presence_setup_cb(curlev_context_t *cbdata, const char *host) {
     return 0;
 }
 
+static int batch_report(struct hashop_ctx *yactx, unsigned int i, int code)
+{
+    sxi_hashop_t *hashop = yactx->hashop;
+    char hexhash[SXI_SHA1_TEXT_LEN + 1];
+    const char *q;
+    int mapped_idx = yactx->idxs[i];
+
+    if (mapped_idx < 0) {
+        WARN("uninitialized mapped_idx");
+        return 0;
+    }
+    if (yactx->binhashes) {
+        bin2hex(yactx->binhashes[i].b, SXI_SHA1_BIN_LEN, hexhash, sizeof(hexhash));
+        q = hexhash;
+    } else
+        q = yactx->hexhashes + i * SXI_SHA1_TEXT_LEN;
+    DEBUG("Hash index %d (%d) status: %d", mapped_idx, i, code);
+    return hashop->cb ? hashop->cb(q, mapped_idx, code, hashop->context) : 0;
+}
+
 static void batch_finish(curlev_context_t *ctx, const char *url)
 {
     struct hashop_ctx *yactx = sxi_cbdata_get_hashop_ctx(ctx);
@@ -167,18 +195,34 @@ static void batch_finish(curlev_context_t *ctx, const char *url)
         WARN("NULL hashop");
         return;
     }
+    hashop->inflight--;
 
-    char *q;
-    q = yactx->hexhashes;
-    if (!q) {
+    if (!yactx->hexhashes && !yactx->binhashes) {
         WARN("NULL hexhashes");
         return;
     }
     sxc_client_t *sx = sxi_conns_get_client(sxi_cbdata_get_conns(ctx));
     jparse_t *J = yactx->J;
+    unsigned i, n = yactx->nhashes;
 
-    SXDEBUG("batch_finish for %s (%p) : %ld", yactx->hexhashes, yactx->hexhashes, status);
-    if (rc != -1 && status == 200) {
+    SXDEBUG("batch_finish for %u hashes: %ld", n, status);
+    if (rc != -1 && status == 200 && yactx->binhashes) {
+        if (yactx->bitmap_len != (n + 7) / 8) {
+            sxi_cbdata_seterr(ctx, SXE_ECOMM, "hashop failed: bad presence bitmap size %u for %u hashes", yactx->bitmap_len, n);
+            hashop->cb_fail++;
+        } else {
+            for (i=0;i<n;i++) {
+                int present = (yactx->bitmap[i / 8] >> (i % 8)) & 1;
+                if (batch_report(yactx, i, present ? 200 : 404) == -1)
+                    hashop->cb_fail++;
+                if (present)
+                    hashop->ok++;
+                else
+                    hashop->enoent++;
+                hashop->finished++;
+            }
+        }
+    } else if (rc != -1 && status == 200) {
         /* some hashes (maybe all) are present,
          * the server reports us the presence ones */
         if (!J) {
@@ -189,24 +233,15 @@ static void batch_finish(curlev_context_t *ctx, const char *url)
             hashop->cb_fail++;
         }
     } else {
-        unsigned i, n = strlen(q) / SXI_SHA1_TEXT_LEN;
-        DEBUG("hexhashes missing all: %s (%p)", q, q);
+        DEBUG("hashes missing all: %u", n);
         /* error: report all hashes as missing */
-        if (hashop->cb) {
-            for (i=0;i<n;i++) {
-                int mapped_idx = yactx->idxs[i];
-                if (mapped_idx < 0 ) {
-                    WARN("uninitialized mapped_idx");
-                    continue;
-                }
-                DEBUG("Hash index %d (%d) status: missing", mapped_idx, i);
-                hashop->cb(q + i * SXI_SHA1_TEXT_LEN, mapped_idx, 404, hashop->context);
-            }
-        }
+        for (i=0;i<n;i++)
+            batch_report(yactx, i, 404);
     }
 
     sxi_jparse_destroy(J);
     free(yactx->hexhashes);
+    free(yactx->binhashes);
     free(yactx);
 }
 
@@ -217,6 +252,16 @@ static int presence_cb(curlev_context_t *ctx, const unsigned char *data, size_t
         return 1;
     }
 
+    if(yactx->binhashes) {
+	if(size > sizeof(yactx->bitmap) - yactx->bitmap_len) {
+	    sxi_cbdata_seterr(yactx->cbdata, SXE_ECOMM, "Presence bitmap too long");
+	    return 1;
+	}
+	memcpy(yactx->bitmap + yactx->bitmap_len, data, size);
+	yactx->bitmap_len += size;
+	return 0;
+    }
+
     if(sxi_jparse_digest(yactx->J, data, size)) {
 	sxi_cbdata_seterr(yactx->cbdata, SXE_ECOMM, "%s", sxi_jparse_geterr(yactx->J));
 	return 1;
@@ -229,6 +274,7 @@ static int sxi_hashop_batch(sxi_hashop_t *hashop)
     const char *host, *hexhashes;
     unsigned int blocksize;
     sxi_query_t *query;
+    sxc_client_t *sx;
     int rc;
     if (!hashop || !hashop->conns)
 	return -1;
@@ -237,11 +283,12 @@ static int sxi_hashop_batch(sxi_hashop_t *hashop)
     if (!host || !hexhashes)
         return -1;
     blocksize = hashop->current_blocksize;
-    hashop->hashes[hashop->hashes_pos] = '\0';
-    hashop->hexhashes[hashop->hashes_count*SXI_SHA1_TEXT_LEN] = '\0';
-    sxc_client_t *sx;
-
     sx = sxi_conns_get_client(hashop->conns);
+    if (!hashop->bin) {
+        hashop->hashes[hashop->hashes_pos] = '\0';
+        hashop->hexhashes[hashop->hashes_count*SXI_SHA1_TEXT_LEN] = '\0';
+    }
+
     if (hashop->finished > hashop->ok + hashop->enoent) {
 	sxi_seterr(sx, SXE_ECOMM, "%d failed HEAD requests",
 		   hashop->finished - hashop->ok - hashop->enoent);
@@ -259,25 +306,36 @@ static int sxi_hashop_batch(sxi_hashop_t *hashop)
         free(pp);
 	return -1;
     }
-    pp->hexhashes = strdup(hexhashes);
-    if (!pp->hexhashes) {
+    if (hashop->bin) {
+        pp->binhashes = malloc(hashop->hashes_count * sizeof(*pp->binhashes));
+        if (pp->binhashes)
+            memcpy(pp->binhashes, hashop->binhashes, hashop->hashes_count * sizeof(*pp->binhashes));
+    } else
+        pp->hexhashes = strdup(hexhashes);
+    if (!pp->hexhashes && !pp->binhashes) {
 	sxi_seterr(sx, SXE_EMEM, "failed to allocate hashbatch");
         free(pp);
 	free(cbdata);
 	return -1;
     }
+    pp->nhashes = hashop->hashes_count;
     pp->hashop = hashop;
     SXDEBUG("a->queries: %d", hashop->queries);
-    hashop->queries += strlen(hexhashes) / 40;
+    hashop->queries += hashop->hashes_count;
 
-    SXDEBUG("hashop %d, on %s, hexhashes: %s (%p)", hashop->hashes_count, hashop->hashes, hashop->hexhashes,
-            hashop->hexhashes);
+    SXDEBUG("hashop %d (%s)", hashop->hashes_count, hashop->bin ? "binary" : hashop->hashes);
     switch (hashop->kind) {
         case HASHOP_CHECK:
-            query = sxi_hashop_proto_check(sxi_conns_get_client(hashop->conns), blocksize, hashop->hashes, hashop->hashes_pos);
+            if (hashop->bin)
+                query = sxi_hashop_proto_check_bin(sx, blocksize, hashop->binhashes, hashop->hashes_count);
+            else
+                query = sxi_hashop_proto_check(sx, blocksize, hashop->hashes, hashop->hashes_pos);
             break;
         case HASHOP_RESERVE:
-            query = sxi_hashop_proto_reserve(sxi_conns_get_client(hashop->conns), blocksize, hashop->hashes, hashop->hashes_pos, &hashop->global_vol_id, &hashop->reserve_id, &hashop->revision_id, hashop->replica, hashop->op_expires_at);
+            if (hashop->bin)
+                query = sxi_hashop_proto_reserve_bin(sx, blocksize, hashop->binhashes, hashop->hashes_count, &hashop->global_vol_id, &hashop->reserve_id, &hashop->revision_id, hashop->replica, hashop->op_expires_at);
+            else
+                query = sxi_hashop_proto_reserve(sx, blocksize, hashop->hashes, hashop->hashes_pos, &hashop->global_vol_id, &hashop->reserve_id, &hashop->revision_id, hashop->replica, hashop->op_expires_at);
             break;
         default:
             query = NULL;
@@ -286,9 +344,13 @@ static int sxi_hashop_batch(sxi_hashop_t *hashop)
     pp->query = query;
     if (query) {
         DEBUG("Sending query to %s", query->path);
+        hashop->inflight++;
         rc = sxi_cluster_query_ev(cbdata, hashop->conns, host, query->verb, query->path, query->content, query->content_len, presence_setup_cb, presence_cb);
+        if (rc && !sxi_cbdata_is_finished(cbdata))
+            hashop->inflight--; /* batch_finish() won't be called */
     } else {
         free(pp->hexhashes);
+        free(pp->binhashes);
         sxi_query_free(pp->query);
         free(pp);
         rc = -1;
@@ -321,11 +383,21 @@ int sxi_hashop_batch_add(sxi_hashop_t *hashop, const char *host, unsigned idx, c
         sxi_seterr(sx, SXE_EARG, "Null arg to hashop_batch_add");
         return -1;
     }
-    if ((hashop->current_host && strcmp(host, hashop->current_host)) || blocksize != hashop->current_blocksize || hashop->hashes_count >= DOWNLOAD_MAX_BLOCKS) {
+    if ((hashop->current_host && strcmp(host, hashop->current_host)) || blocksize != hashop->current_blocksize ||
+        hashop->hashes_count >= (hashop->bin ? HASHOP_BIN_MAX_BLOCKS : DOWNLOAD_MAX_BLOCKS)) {
         rc = sxi_hashop_batch_flush(hashop);
     }
+    /* Nodes advertising it get packed hashes, older ones the hex URL */
+    if (!hashop->hashes_count)
+        hashop->bin = sxi_host_has_feature(hashop->conns, host, SXI_FEATURE_HASHOP_BIN);
     hashop->current_host = host;
     hashop->current_blocksize = blocksize;
+    if (hashop->bin) {
+        memcpy(hashop->binhashes[hashop->hashes_count].b, binhash, SXI_SHA1_BIN_LEN);
+        hashop->idxs_tmp[hashop->hashes_count] = idx;
+        hashop->hashes_count++;
+        return rc;
+    }
     hidx = hashop->hashes_count * SXI_SHA1_TEXT_LEN;
     if (hashop->hashes_pos + SXI_SHA1_TEXT_LEN + 1 >= sizeof(hashop->hashes) ||
         hidx + SXI_SHA1_TEXT_LEN >= sizeof(hashop->hexhashes)) {
@@ -351,7 +423,7 @@ int sxi_hashop_end(sxi_hashop_t *hashop)
     if (!hashop || !hashop->conns)
 	return -1;
     rc = sxi_hashop_batch_flush(hashop);
-    while (hashop->finished != hashop->queries && !sxi_curlev_poll(sxi_conns_get_curlev(hashop->conns))) {
+    while (hashop->finished != hashop->queries && hashop->inflight && !sxi_curlev_poll(sxi_conns_get_curlev(hashop->conns))) {
 /*        syslog(LOG_INFO,"finished: %d, queries: %d", hashop->finished,
  *        hashop->queries);*/
     }
@@ -35,6 +35,7 @@ struct sxi_hashop {
   sxi_conns_t *conns;
   int queries;
   int finished;
+  int inflight;
   int ok;
   int enoent;
   int cb_fail;
@@ -46,7 +47,9 @@ struct sxi_hashop {
   unsigned int current_blocksize;
   char hexhashes[DOWNLOAD_MAX_BLOCKS * SXI_SHA1_TEXT_LEN + 1];
   char hashes[DOWNLOAD_MAX_BLOCKS * (SXI_SHA1_TEXT_LEN + EXPIRE_TEXT_LEN) + 1];
-  int idxs_tmp[DOWNLOAD_MAX_BLOCKS];
+  sx_hash_t binhashes[HASHOP_BIN_MAX_BLOCKS];
+  int idxs_tmp[HASHOP_BIN_MAX_BLOCKS];
+  int bin;
   unsigned hashes_count;
   unsigned hashes_pos;
   unsigned replica;
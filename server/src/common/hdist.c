@@ -79,6 +79,18 @@ struct hdist_node {
     uint64_t capacity;
 };
 
+/* Lookup-only copy of a built circle: the point values are laid out
+ * contiguously for the binary search and each point is already resolved to
+ * the index of its owner in sxnl[bidx] */
+struct hdist_ring {
+    uint64_t *points;
+    unsigned int *owner;
+    unsigned int *zone;
+    unsigned int npoints;
+    unsigned int nnodes;
+    unsigned int maxreplica;
+};
+
 struct _sxi_hdist_t {
     unsigned int state, builds, builds_alloced, version;
     unsigned int max_builds;
@@ -100,6 +112,7 @@ struct _sxi_hdist_t {
     char **zone_cfg;
     struct hdist_point **circle;
     unsigned int *circle_points;
+    struct hdist_ring **ring;
 };
 
 sxi_hdist_t *sxi_hdist_new(unsigned int seed, unsigned int max_builds, sx_uuid_t *uuid)
@@ -174,6 +187,12 @@ sxi_hdist_t *sxi_hdist_new(unsigned int seed, unsigned int max_builds, sx_uuid_t
 	goto hdist_new_err;
     }
 
+    model->ring = (struct hdist_ring **) wrap_calloc(sizeof(struct hdist_ring *), max_builds);
+    if(!model->ring) {
+	critmsg("Out of memory allocating new distribution model (ring)");
+	goto hdist_new_err;
+    }
+
     memcpy(&model->uuid, uuid, sizeof(*uuid));
 
     model->cfg = (char *) wrap_malloc(sizeof(char) * CFG_PREALLOC);
@@ -201,6 +220,7 @@ hdist_new_err:
     free(model->capacity_total);
     free(model->circle);
     free(model->circle_points);
+    free(model->ring);
     free(model);
     return NULL;
 }
@@ -506,16 +526,6 @@ const char *sxi_hdist_get_node_zone(const sxi_hdist_t *model, unsigned int bidx,
     return NULL;
 }
 
-static int get_node_idx(const sxi_hdist_t *model, unsigned int bidx, unsigned int node_id)
-{
-	unsigned int i;
-
-    for(i = 0; i < model->node_count[bidx]; i++)
-	if(model->node_list[bidx][i].id == node_id)
-	    return i;
-    return -1;
-}
-
 static rc_ty hdist_addnode(sxi_hdist_t *model, unsigned int id, uint64_t capacity, sx_node_t *sxn, unsigned int hashes_stored, unsigned int replicas_stored, uint64_t *hashes, uint8_t *replica_cnt, const sx_uuid_t *prev_uuid)
 {
 	struct hdist_node *node_list_new;
@@ -673,6 +683,7 @@ rc_ty sxi_hdist_newbuild(sxi_hdist_t *model)
 	model->capacity_total[i] = model->capacity_total[i - 1];
 	model->circle[i] = model->circle[i - 1];
 	model->circle_points[i] = model->circle_points[i - 1];
+	model->ring[i] = model->ring[i - 1];
     }
 
     model->node_list[0] = NULL;
@@ -683,6 +694,7 @@ rc_ty sxi_hdist_newbuild(sxi_hdist_t *model)
     model->capacity_total[0] = 0;
     model->circle[0] = NULL;
     model->circle_points[0] = 0;
+    model->ring[0] = NULL;
     model->state = 0xcafe;
     model->builds_alloced++;
     return OK;
@@ -796,6 +808,8 @@ rc_ty sxi_hdist_rebalanced(sxi_hdist_t *model)
 	model->sxnl[i] = NULL;
 	free(model->circle[i]);
 	model->circle[i] = NULL;
+	free(model->ring[i]);
+	model->ring[i] = NULL;
 	free(model->zone_cfg[i]);
 	model->zone_cfg[i] = NULL;
     }
@@ -964,6 +978,68 @@ rc_ty sxi_hdist_check_zones(const char *zones)
     return set_zones(NULL, zones);
 }
 
+static rc_ty hdist_ring_build(sxi_hdist_t *model)
+{
+	struct hdist_ring *ring;
+	unsigned int i, idx, max_id = 0, *id2idx;
+	unsigned int npoints = model->circle_points[0], nnodes = model->node_count[0];
+
+    if(!npoints || nnodes != sx_nodelist_count(model->sxnl[0])) {
+	critmsg("Internal error: inconsistent distribution model");
+	return FAIL_EINTERNAL;
+    }
+
+    for(i = 0; i < nnodes; i++)
+	if(model->node_list[0][i].id > max_id)
+	    max_id = model->node_list[0][i].id;
+
+    ring = (struct hdist_ring *) wrap_malloc(sizeof(*ring) + npoints * (sizeof(uint64_t) + sizeof(unsigned int)) + nnodes * sizeof(unsigned int));
+    id2idx = (unsigned int *) wrap_malloc((max_id + 1) * sizeof(unsigned int));
+    if(!ring || !id2idx) {
+	critmsg("Out of memory building distribution model (ring)");
+	free(ring);
+	free(id2idx);
+	return ENOMEM;
+    }
+    ring->points = (uint64_t *) (ring + 1);
+    ring->owner = (unsigned int *) &ring->points[npoints];
+    ring->zone = &ring->owner[npoints];
+    ring->npoints = npoints;
+    ring->nnodes = nnodes;
+
+    /* Map internal node IDs to their position in the public node list */
+    memset(id2idx, 0xff, (max_id + 1) * sizeof(unsigned int));
+    for(i = 0; i < nnodes; i++) {
+	const sx_node_t *sxn = model->node_list[0][i].sxn;
+	if(!sxn || !sx_nodelist_lookup_index(model->sxnl[0], sx_node_uuid(sxn), &idx)) {
+	    critmsg("Internal error: node with ID %u not found in distribution model", model->node_list[0][i].id);
+	    free(ring);
+	    free(id2idx);
+	    return FAIL_EINTERNAL;
+	}
+	id2idx[model->node_list[0][i].id] = idx;
+	ring->zone[idx] = model->node_list[0][i].zone_id;
+    }
+
+    for(i = 0; i < npoints; i++) {
+	unsigned int id = model->circle[0][i].node_id;
+	if(id > max_id || id2idx[id] == UINT_MAX) {
+	    critmsg("Internal error: node with ID %u not found in distribution model", id);
+	    free(ring);
+	    free(id2idx);
+	    return FAIL_EINTERNAL;
+	}
+	ring->points[i] = model->circle[0][i].point;
+	ring->owner[i] = id2idx[id];
+    }
+    free(id2idx);
+
+    free(model->ring[0]);
+    model->ring[0] = ring;
+    ring->maxreplica = sxi_hdist_maxreplica(model, 0, NULL);
+    return OK;
+}
+
 rc_ty sxi_hdist_build(sxi_hdist_t *model, const char *zones)
 {
 	unsigned int i, j, p, cfg_size;
@@ -1091,6 +1167,8 @@ rc_ty sxi_hdist_build(sxi_hdist_t *model, const char *zones)
     model->state = 0xbabe;
     model->builds++;
     model->version++;
+    if((ret = hdist_ring_build(model)))
+	return ret;
     if(hchecksum(model)) {
 	critmsg("Cannot build distribution: failed to compute checksum");
         return ENOMEM;
@@ -1145,6 +1223,7 @@ void sxi_hdist_free(sxi_hdist_t *model)
 	free(model->zone_cfg[i]);
 	sx_nodelist_delete(model->sxnl[i]);
 	free(model->circle[i]);
+	free(model->ring[i]);
     }
     free(model->node_count);
     free(model->node_list);
@@ -1152,6 +1231,7 @@ void sxi_hdist_free(sxi_hdist_t *model)
     free(model->zone_count);
     free(model->zone_cfg);
     free(model->circle);
+    free(model->ring);
     free(model->cfg);
     free(model->cfg_blob);
     free(model);
@@ -1159,167 +1239,126 @@ void sxi_hdist_free(sxi_hdist_t *model)
 
 /*
  * replica_count: number (>= 1) of copies to be stored on different nodes
- * dest_nodes: array of size replica_count that will be filled with node IDs
+ * dest: array of size replica_count that will be filled with node indexes
  */
-static rc_ty hdist_hash(const sxi_hdist_t *model, uint64_t hash, unsigned int replica_count, unsigned int *dest_nodes, unsigned int *dest_zones, unsigned int bidx, int store)
+static rc_ty hdist_ring_locate(const struct hdist_ring *ring, uint64_t hash, unsigned int replica_count, unsigned int *dest)
 {
-	unsigned int i, j, l = 0, h, m, rdiv;
-	int node_idx;
+	const uint64_t *points = ring->points;
+	unsigned int i, j, k = 0, l, m, n, base = 0, owner = 0, zone;
+
+    if(ring->npoints > 1) {
+	/* Find the last point <= hash among all but the last one (or the
+	 * first point if there is none) without branching on the data;
+	 * the closest of that and the next point is the primary */
+	n = ring->npoints - 1;
+	while(n > 1) {
+		unsigned int half = n / 2;
+	    base += (points[base + half] <= hash) ? half : 0;
+	    n -= half;
+	}
+	m = base + (hash - points[base] > points[base + 1] - hash);
+    } else
+	m = 0;
 
-    if(!model || model->state != 0xbabe) {
-	critmsg("Failed to locate object: invalid distribution model");
-	return EINVAL;
+    dest[0] = ring->owner[m];
+
+    /* Replicas go to the next points on the circle which belong to
+     * different nodes and, for zoned nodes, to different zones */
+    for(i = 1; i < replica_count; i++) {
+	for(j = 1; j < ring->npoints; j++) {
+	    k = m + j;
+	    if(k >= ring->npoints)
+		k -= ring->npoints;
+	    owner = ring->owner[k];
+	    zone = ring->zone[owner];
+	    for(l = 0; l < i; l++)
+		if(dest[l] == owner || (zone && ring->zone[dest[l]] == zone))
+		    break;
+	    if(l == i)
+		break;
+	}
+	if(j == ring->npoints) {
+	    critmsg("Failed to locate object: can't replicate data");
+	    return FAIL_EINTERNAL;
+	}
+	dest[i] = owner;
+	m = k;
     }
 
-    if(!dest_nodes) {
-	critmsg("Failed to locate object: invalid argument (dest_nodes == NULL)");
-	return EINVAL;
+    return OK;
+}
+
+static const struct hdist_ring *hdist_get_ring(const sxi_hdist_t *model, unsigned int replica_count, unsigned int bidx)
+{
+    if(!model || model->state != 0xbabe) {
+	critmsg("Failed to locate object: invalid distribution model");
+	return NULL;
     }
 
-    if(bidx >= model->builds) {
+    if(bidx >= model->builds || !model->ring[bidx]) {
 	critmsg("Failed to locate object: invalid build index (%u >= %u)", bidx, model->builds);
-	return EINVAL;
+	return NULL;
     }
 
-    if(replica_count > sxi_hdist_maxreplica(model, bidx, NULL)) {
+    if(!replica_count || replica_count > model->ring[bidx]->maxreplica) {
 	critmsg("Failed to locate object: replica_count > max_replica");
-	return EINVAL;
+	return NULL;
     }
 
-    h = model->circle_points[bidx] - 1;
-    while(l + 1 < h) {
-	m = (l + h) / 2;
-	if(hash == model->circle[bidx][m].point) {
-	    l = h = m;
-	    break;
-	}
-	if(hash < model->circle[bidx][m].point)
-	    h = m;
-	else
-	    l = m;
-    }
-    if(hash - model->circle[bidx][l].point > model->circle[bidx][h].point - hash)
-	m = h;
-    else
-	m = l;
-
-    node_idx = get_node_idx(model, bidx, model->circle[bidx][m].node_id);
-    if(node_idx < 0) {
-	critmsg("Failed to locate object: node with ID %d not found", model->circle[bidx][m].node_id);
-	return FAIL_EINTERNAL;
+    return model->ring[bidx];
+}
+
+rc_ty sxi_hdist_locate_many(const sxi_hdist_t *model, const uint64_t *hashes, unsigned int nhashes, unsigned int replica_count, unsigned int bidx, unsigned int *nidx)
+{
+	const struct hdist_ring *ring;
+	unsigned int i;
+	rc_ty ret;
+
+    if(!hashes || !nidx) {
+	critmsg("Failed to locate objects: invalid argument");
+	return EINVAL;
     }
 
-    dest_nodes[0] = model->circle[bidx][m].node_id;
-    dest_zones[0] = model->circle[bidx][m].zone_id;
+    if(!(ring = hdist_get_ring(model, replica_count, bidx)))
+	return EINVAL;
 
-    rdiv = MAX_RDIV;
-    for(i = 1; i < replica_count; i++) {
-	node_idx = -1;
-	for(j = 0; j < 2; j++) {
-	    for(h = m + 1; h < model->circle_points[bidx]; h++) {
-		    struct hdist_point *p = &model->circle[bidx][h];
-		if(!node_in_set(dest_nodes, dest_zones, NULL, i, p->node_id, p->zone_id)) {
-		    /*
-		    if(!j && p->num > (p->node_points / rdiv)) {
-			node_idx = -1;
-			continue;
-		    }
-		    */
-		    node_idx = get_node_idx(model, bidx, p->node_id);
-		    m = h;
-		    break;
-		}
-	    }
-	    if(h == model->circle_points[bidx] && m != h) {
-		for(h = 0; h < m; h++) {
-		    struct hdist_point *p = &model->circle[bidx][h];
-		    if(!node_in_set(dest_nodes, dest_zones, NULL, i, p->node_id, p->zone_id)) {
-			/*
-			if(!j && p->num > (p->node_points / rdiv)) {
-			    node_idx = -1;
-			    continue;
-			}
-			*/
-			node_idx = get_node_idx(model, bidx, p->node_id);
-			m = h;
-			break;
-		    }
-		}
-	    }
-	    if(node_idx != -1)
-		break;
-	}
-	if(node_idx == -1) {
-	    critmsg("Failed to locate object: can't replicate data");
-	    return FAIL_EINTERNAL;
-	}
-	dest_nodes[i] = model->circle[bidx][h].node_id;
-	dest_zones[i] = model->circle[bidx][h].zone_id;
-	if(rdiv >= 2)
-	    rdiv--;
+    for(i = 0; i < nhashes; i++) {
+	if((ret = hdist_ring_locate(ring, hashes[i], replica_count, &nidx[i * replica_count])))
+	    return ret;
     }
 
-    return 0;
+    return OK;
 }
 
 sx_nodelist_t *sxi_hdist_locate(const sxi_hdist_t *model, uint64_t hash, unsigned int replica_count, unsigned int bidx)
 {
-	unsigned int *dest_nodes, *dest_zones, i, j;
-	rc_ty ret;
+	unsigned int dest_buf[16], *dest_nodes = dest_buf, i;
+	const struct hdist_ring *ring;
 	sx_nodelist_t *nodelist = NULL;
-	const sx_node_t *node;
 
-    if(!model)
-	return NULL;
-
-    dest_nodes = (unsigned int *) malloc(sizeof(unsigned int) * replica_count);
-    if(!dest_nodes) {
-	critmsg("Out of memory locating object (nodes)");
+    if(!(ring = hdist_get_ring(model, replica_count, bidx)))
 	return NULL;
-    }
 
-    dest_zones = (unsigned int *) malloc(sizeof(unsigned int) * replica_count);
-    if(!dest_zones) {
-	critmsg("Out of memory locating object (zones)");
-	free(dest_nodes);
-	return NULL;
+    if(replica_count > sizeof(dest_buf) / sizeof(dest_buf[0])) {
+	dest_nodes = (unsigned int *) malloc(sizeof(unsigned int) * replica_count);
+	if(!dest_nodes) {
+	    critmsg("Out of memory locating object (nodes)");
+	    return NULL;
+	}
     }
 
-
-    ret = hdist_hash(model, hash, replica_count, dest_nodes, dest_zones, bidx, 0);
-    if(!ret) {
+    if(!hdist_ring_locate(ring, hash, replica_count, dest_nodes)) {
 	nodelist = sx_nodelist_new();
-	if(!nodelist) {
-	    free(dest_nodes);
-	    free(dest_zones);
-	    return NULL;
-	}
-	for(i = 0; i < replica_count; i++) {
-	    node = NULL;
-	    for(j = 0; j < model->node_count[bidx]; j++) {
-		if(model->node_list[bidx][j].id == dest_nodes[i]) {
-		    node = model->node_list[bidx][j].sxn;
-		    break;
-		}
-	    }
-	    if(!node) {
-		critmsg("Failed to locate object: cannot map internal node id -> sx_node_t");
-		free(dest_nodes);
-		free(dest_zones);
-		sx_nodelist_delete(nodelist);
-		return NULL;
-	    }
-	    if(sx_nodelist_add(nodelist, sx_node_dup(node))) {
-		free(dest_nodes);
-		free(dest_zones);
+	for(i = 0; nodelist && i < replica_count; i++) {
+	    if(sx_nodelist_add(nodelist, sx_node_dup(sx_nodelist_get(model->sxnl[bidx], dest_nodes[i])))) {
 		sx_nodelist_delete(nodelist);
-		return NULL;
+		nodelist = NULL;
 	    }
 	}
     }
 
-    free(dest_nodes);
-    free(dest_zones);
+    if(dest_nodes != dest_buf)
+	free(dest_nodes);
     return nodelist;
 }
 
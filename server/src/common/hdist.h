@@ -61,6 +61,9 @@ rc_ty sxi_hdist_rebalanced(sxi_hdist_t *model);
 
 sx_nodelist_t *sxi_hdist_locate(const sxi_hdist_t *model, uint64_t hash, unsigned int replica_count, unsigned int bidx);
 
+/* Fills nidx with replica_count indexes into sxi_hdist_nodelist(bidx) for each of the nhashes hashes */
+rc_ty sxi_hdist_locate_many(const sxi_hdist_t *model, const uint64_t *hashes, unsigned int nhashes, unsigned int replica_count, unsigned int bidx, unsigned int *nidx);
+
 const sx_nodelist_t *sxi_hdist_nodelist(const sxi_hdist_t *model, unsigned int bidx);
 
 unsigned int sxi_hdist_buildcnt(const sxi_hdist_t *model);
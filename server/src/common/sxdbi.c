@@ -73,6 +73,8 @@ static int qwal_hook(void *ctx, sqlite3 *handle, const char *name, int pages)
         if (!db->wal_pages)
             gettimeofday(&db->tv_last, NULL);
         db->wal_pages = pages;
+        if (db->commit_cb)
+            db->commit_cb(db->commit_ctx);
     }
     if (pages >= db_max_passive_wal_pages) {
         qcheckpoint(db);
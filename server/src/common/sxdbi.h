@@ -38,6 +38,9 @@ typedef struct {
     struct timeval tv_last;
     struct timeval tv_begin;
     int has_begin_time;
+    /* Invoked after each write transaction is committed */
+    void (*commit_cb)(void *ctx);
+    void *commit_ctx;
 } sxi_db_t;
 
 sxi_db_t* qnew(sqlite3 *handle);
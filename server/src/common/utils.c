@@ -639,7 +639,11 @@ int gc_interval;
 double gc_max_batch_time;
 double gc_yield_time;
 int gc_slow_check=1;
+int gc_compact_budget = 1024;
+int gc_workers = 1;
 float blockmgr_delay;
+int blockmgr_pipelines = 4;
+int jobmgr_concurrency = 8;
 int max_pending_user_jobs = 128;
 /* used outside of fcgi */
 int db_min_passive_wal_pages=5000;
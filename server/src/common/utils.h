@@ -128,7 +128,11 @@ extern int gc_interval;
 extern double gc_max_batch_time;
 extern double gc_yield_time;
 extern int gc_slow_check;
+extern int gc_compact_budget;
+extern int gc_workers;
 extern float blockmgr_delay;
+extern int blockmgr_pipelines;
+extern int jobmgr_concurrency;
 extern int db_min_passive_wal_pages;
 extern int db_max_passive_wal_pages;
 extern int db_max_restart_wal_pages;
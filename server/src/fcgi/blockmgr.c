@@ -35,6 +35,7 @@
 
 #include "log.h"
 #include "blockmgr.h"
+#include "../libsxclient/src/curlevents.h"
 
 static int terminate = 0;
 
@@ -43,7 +44,6 @@ static void sighandler(int signum) {
 }
 
 #define UPLOAD_MAX_BLOCKS (UPLOAD_CHUNK_SIZE / SX_BS_SMALL)
-/* WARNING: stack alloc'd ~30KB */
 struct blockmgr_hlist_t {
     int64_t ids[UPLOAD_MAX_BLOCKS];
     sx_hash_t binhs[UPLOAD_MAX_BLOCKS];
@@ -69,15 +69,31 @@ static int hcb(const char *hash, unsigned int index, int code, void *context) {
     return 0;
 }
 
-struct blockmgr_data_t {
+/* A batch of blocks of the same size, all headed to the same node.
+ * Up to blockmgr_pipelines of these are in flight at any time, each going
+ * through the presence check and the upload on the shared curlev handle */
+enum blockmgr_xfer_state { XFER_IDLE = 0, XFER_CHECK, XFER_UPLOAD };
+struct blockmgr_xfer_t {
     struct blockmgr_hlist_t hashlist;
+    sxi_hashop_t hc;
+    curlev_context_t *cbdata;
+    enum blockmgr_xfer_state state;
+    sx_uuid_t target;
+    char *host;
+    char *url;
+    unsigned int blocksize;
+    int failed;
+    uint8_t upbuffer[UPLOAD_CHUNK_SIZE];
+};
+
+struct blockmgr_data_t {
+    struct blockmgr_xfer_t *xfers;
+    unsigned int nxfers;
     sx_hashfs_t *hashfs;
     sqlite3_stmt *qprune, *qdel, *qbump;
     sqlite3_stmt *qget_first_hi, *qget_first_lo, *qget_next_lo, *qget_next_hi;
     sqlite3_stmt *qwipesched, *qaddsched;
-    const sx_node_t *target;
     int64_t last_flowid; /* this may be uninitialized and that's ok */
-    unsigned int blocksize;
 };
 
 static int blockmgr_rb_release(struct blockmgr_data_t *q, int64_t xfer_id) {
@@ -133,8 +149,10 @@ static void blockmgr_reschedule_xfer(struct blockmgr_data_t *q, int64_t xfer_id)
     sqlite3_reset(q->qbump);
 }
 
-static int schedule_blocks_sfq(struct blockmgr_data_t *q) {
-    sx_uuid_t target_uuid;
+/* Fills x with a new batch; the master block is picked among the nodes
+ * which don't already have a batch in flight */
+static int schedule_blocks_sfq(struct blockmgr_data_t *q, struct blockmgr_xfer_t *x) {
+    const sx_node_t *target;
     sqlite3_stmt *qget;
     int ret = 0, r;
     unsigned int maxblocks = 0;
@@ -174,37 +192,44 @@ static int schedule_blocks_sfq(struct blockmgr_data_t *q) {
 
 	if(!ret) {
 	    /* First block is the "master" and dictates blocksize and target node */
-	    q->blocksize = sqlite3_column_int(qget, 3);
-	    if(sx_hashfs_check_blocksize(q->blocksize)) {
-		WARN("Removing block with invalid blocksize %u", q->blocksize);
+	    x->blocksize = sqlite3_column_int(qget, 3);
+	    if(sx_hashfs_check_blocksize(x->blocksize)) {
+		WARN("Removing block with invalid blocksize %u", x->blocksize);
 		sqlite3_reset(qget);
 		blockmgr_del_xfer(q, push_id);
-		return schedule_blocks_sfq(q);
+		return schedule_blocks_sfq(q, x);
 	    }
-	    maxblocks = UPLOAD_CHUNK_SIZE / q->blocksize;
+	    maxblocks = UPLOAD_CHUNK_SIZE / x->blocksize;
 
 	    p = sqlite3_column_blob(qget, 4);
-	    if(sqlite3_column_bytes(qget, 4) != sizeof(target_uuid.binary)) {
+	    if(sqlite3_column_bytes(qget, 4) != sizeof(x->target.binary)) {
 		WARN("Removing block with invalid target node UUID");
 		sqlite3_reset(qget);
 		blockmgr_del_xfer(q, push_id);
-		return schedule_blocks_sfq(q);
+		return schedule_blocks_sfq(q, x);
 	    }
-	    uuid_from_binary(&target_uuid, p);
-	    if(!(q->target = sx_nodelist_lookup(sx_hashfs_effective_nodes(q->hashfs, NL_NEXT), &target_uuid))) {
-		DEBUG("Removing transfer to non existing (possibly ignored) node %s", target_uuid.string);
+	    uuid_from_binary(&x->target, p);
+	    if(!(target = sx_nodelist_lookup(sx_hashfs_effective_nodes(q->hashfs, NL_NEXT), &x->target))) {
+		DEBUG("Removing transfer to non existing (possibly ignored) node %s", x->target.string);
 		sqlite3_reset(qget);
 		blockmgr_del_xfer(q, push_id);
-		return schedule_blocks_sfq(q);
+		return schedule_blocks_sfq(q, x);
 	    }
-	    if(!sx_node_cmp(q->target, sx_hashfs_self(q->hashfs))) {
+	    if(!sx_node_cmp(target, sx_hashfs_self(q->hashfs))) {
 		WARN("Removing transfer to self");
 		sqlite3_reset(qget);
 		blockmgr_del_xfer(q, push_id);
-		return schedule_blocks_sfq(q);
+		return schedule_blocks_sfq(q, x);
+	    }
+	    /* The node list may be reloaded while the batch is in flight */
+	    free(x->host);
+	    if(!(x->host = wrap_strdup(sx_node_internal_addr(target)))) {
+		WARN("Cannot allocate target address");
+		sqlite3_reset(qget);
+		return -1;
 	    }
 
-	    DEBUG("Selected master block for transfer bs: %u, node: %s", q->blocksize, target_uuid.string);
+	    DEBUG("Selected master block for transfer bs: %u, node: %s", x->blocksize, x->target.string);
 	}
 
 	p = sqlite3_column_blob(qget, 2);
@@ -214,31 +239,27 @@ static int schedule_blocks_sfq(struct blockmgr_data_t *q) {
 		WARN("Removing block with invalid hash");
 		sqlite3_reset(qget);
 		blockmgr_del_xfer(q, push_id);
-		return schedule_blocks_sfq(q);
+		return schedule_blocks_sfq(q, x);
 	    } else /* Or silently skip slaves (they'll be pruned in the subsequent loops) */
 		continue;
 	}
 
-	q->hashlist.ids[ret] = push_id;
-	q->hashlist.havehs[ret] = 0;
-	memcpy(&q->hashlist.binhs[ret], p, SXI_SHA1_BIN_LEN);
+	x->hashlist.ids[ret] = push_id;
+	x->hashlist.havehs[ret] = 0;
+	memcpy(&x->hashlist.binhs[ret], p, SXI_SHA1_BIN_LEN);
 	sqlite3_reset(qget);
 
-	if(!ret && qstep_noret(q->qwipesched)) {
-	    sqlite3_reset(qget);
-	    WARN("Failed to wipe schedule");
-	    return -1;
-	}
 	if(qbind_int64(q->qaddsched, ":pushid", push_id) ||
+	   qbind_blob(q->qaddsched, ":node", x->target.binary, sizeof(x->target.binary)) ||
 	   qstep_noret(q->qaddsched)) {
 	    WARN("Failed to schedule block transfer");
-	    return -1;
+	    break;
 	}
 
 	/*
 	do {
 	    char hexh[SXI_SHA1_BIN_LEN * 2 + 1];
-	    sxi_bin2hex(&q->hashlist.binhs[ret], SXI_SHA1_BIN_LEN, hexh);
+	    sxi_bin2hex(&x->hashlist.binhs[ret], SXI_SHA1_BIN_LEN, hexh);
 	    INFO("Block %s scheduled for transfer", hexh);
 	} while(0);
 	*/
@@ -251,8 +272,8 @@ static int schedule_blocks_sfq(struct blockmgr_data_t *q) {
 	    /* Failure is not severe here: we just ship what we have scheduled so far and call it a day */
 	    qget = (i == 0) ? q->qget_next_hi : q->qget_next_lo;
 	    if(qbind_int64(qget, ":flow", q->last_flowid) ||
-	       qbind_int(qget, ":size", q->blocksize) ||
-	       qbind_blob(qget, ":node", target_uuid.binary, sizeof(target_uuid.binary))) {
+	       qbind_int(qget, ":size", x->blocksize) ||
+	       qbind_blob(qget, ":node", x->target.binary, sizeof(x->target.binary))) {
 		WARN("Error retrieving next slave block from queue");
 		r = SQLITE_DONE;
 		break;
@@ -267,139 +288,252 @@ static int schedule_blocks_sfq(struct blockmgr_data_t *q) {
 	}
     } while(r == SQLITE_ROW);
 
-    q->hashlist.nblocks = ret;
-    DEBUG("Successfully scheduled %d blocks for transfer", ret);
+    x->hashlist.nblocks = ret;
+    DEBUG("Successfully scheduled %d blocks for transfer to %s", ret, x->target.string);
     return ret;
 }
 
+static void blockmgr_xfer_fail(struct blockmgr_xfer_t *x) {
+    unsigned int i;
+    for(i=0; i<x->hashlist.nblocks; i++)
+	x->hashlist.havehs[i] = 2; /* Reschedule */
+    x->failed = 1;
+}
 
-static uint8_t upbuffer[UPLOAD_CHUNK_SIZE];
-static int blockmgr_process_queue(struct blockmgr_data_t *q) {
+/* Phase 2 - presence check blocks */
+static void blockmgr_xfer_check(struct blockmgr_data_t *q, struct blockmgr_xfer_t *x) {
     sxc_client_t *sx = sx_hashfs_client(q->hashfs);
-    sxi_conns_t *clust = sx_hashfs_conns(q->hashfs);
-    sxi_hostlist_t uploadto;
-    int ret = -1;
+    const char *token = NULL;
+    unsigned int i;
 
-    sxi_hostlist_init(&uploadto);
-
-    while(!terminate) {
-	unsigned int i, j, lastup = 0, trigger_jobmgr = 0;
-        const char *host, *token = NULL;
-	sxi_hashop_t hc;
-	uint8_t *curb;
-	int r;
+    /* Until the hashop is started the batch stays idle, so that a failure
+     * here goes straight to the cleanup without ending a stale x->hc */
+    x->failed = 0;
 
-	/* Phase 1 - schedule blocks */
-	r = schedule_blocks_sfq(q);
-	if(r <= 0) {
-	    /* no blocks(0) or error (<1) */
-	    if(ret <= 0)
-		ret = r;
-	    break;
+    if(sx_hashfs_make_token(q->hashfs, CLUSTER_USER, NULL, 0, time(NULL) + JOB_FILE_MAX_TIME, &token)) {
+	WARN("Cannot create upload token");
+	blockmgr_xfer_fail(x);
+	return;
+    }
+    free(x->url);
+    if(!(x->url = wrap_malloc(sizeof(".data/") + 32 + strlen(token)))) {
+	WARN("Cannot allocate upload url");
+	blockmgr_xfer_fail(x);
+	return;
+    }
+    sprintf(x->url, ".data/%u/%s", x->blocksize, token);
+
+    /* just check for presence, reservation was already done by the failed INUSE;
+     * the queries are sent out as they fill up and completed in blockmgr_xfer_step() */
+    x->state = XFER_CHECK;
+    sxi_hashop_begin(&x->hc, sx_hashfs_conns(q->hashfs), hcb, HASHOP_CHECK, 0, NULL, NULL, NULL, &x->hashlist, 0);
+    for(i=0; i<x->hashlist.nblocks; i++) {
+	if(sxi_hashop_batch_add(&x->hc, x->host, i, x->hashlist.binhs[i].b, x->blocksize) != 0) {
+	    WARN("Cannot verify block presence: %s", sxc_geterrmsg(sx));
+	    x->failed = 1;
+	    return;
 	}
+    }
+    if(sxi_hashop_batch_flush(&x->hc)) {
+	WARN("Cannot verify block presence: %s", sxc_geterrmsg(sx));
+	x->failed = 1;
+    }
+}
 
-	/* Phase 2 - presence check blocks */
-	sxi_hostlist_empty(&uploadto);
-        host = sx_node_internal_addr(q->target);
-	if(sxi_hostlist_add_host(sx, &uploadto, host)) {
-	    WARN("Cannot generate hostlist");
-	    break;
+/* Phase 3 - upload blocks */
+static void blockmgr_xfer_upload(struct blockmgr_data_t *q, struct blockmgr_xfer_t *x) {
+    sxi_conns_t *clust = sx_hashfs_conns(q->hashfs);
+    sxc_client_t *sx = sx_hashfs_client(q->hashfs);
+    uint8_t *curb = x->upbuffer;
+    unsigned int i;
+
+    /* The batch was sized by schedule_blocks_sfq() so that it fits a single upload chunk */
+    for(i=0; i<x->hashlist.nblocks; i++) {
+	const uint8_t *b;
+	if(x->hashlist.havehs[i]) {
+	    /* TODO: print actual hash */
+	    DEBUG("Block %d was found remotely", i);
+	    x->hashlist.havehs[i] = 1; /* Dequeue */
+	} else if(sx_hashfs_block_get(q->hashfs, x->blocksize, &x->hashlist.binhs[i], &b)) {
+	    INFO("Block %ld was not found locally", x->hashlist.ids[i]);
+	    x->hashlist.havehs[i] = 2; /* Reschedule */
+	    if (sx_hashfs_is_rebalancing(q->hashfs)) {
+		/* avoid bb#1964 infloop */
+		blockmgr_rb_release(q, x->hashlist.ids[i]);
+	    }
+	} else {
+	    memcpy(curb, b, x->blocksize);
+	    curb += x->blocksize;
 	}
+    }
+    if(curb == x->upbuffer) {
+	/* Nothing to upload */
+	x->state = XFER_IDLE;
+	return;
+    }
 
-        if(sx_hashfs_make_token(q->hashfs, CLUSTER_USER, NULL, 0, time(NULL) + JOB_FILE_MAX_TIME, &token)) {
-            WARN("Cannot create upload token");
-            break;
-        }
-
-        /* just check for presence, reservation was already done by the failed INUSE */
-	sxi_hashop_begin(&hc, clust, hcb, HASHOP_CHECK, 0, NULL, NULL, NULL, &q->hashlist, 0);
-	r = 0;
-	for(i=0; i<q->hashlist.nblocks; i++) {
-            if(sxi_hashop_batch_add(&hc, host, i, q->hashlist.binhs[i].b, q->blocksize) != 0) {
-                WARN("Cannot verify block presence: %s", sxc_geterrmsg(sx));
-		r = 1;
-		break;
-            }
+    x->state = XFER_UPLOAD;
+    x->cbdata = sxi_cbdata_create_generic(clust, NULL, NULL);
+    if(!x->cbdata) {
+	WARN("Cannot allocate upload context");
+	x->failed = 1;
+	return;
+    }
+    sxi_set_operation(sx, "upload file contents", NULL, NULL, NULL);
+    if(sxi_cluster_query_ev(x->cbdata, clust, x->host, REQ_PUT, x->url, x->upbuffer, curb - x->upbuffer, NULL, NULL)) {
+	WARN("Block transfer to %s (%s) failed: %s", x->target.string, x->host, sxi_cbdata_geterrmsg(x->cbdata));
+	x->failed = 1;
+    }
+}
+
+/* Advances x through the check and upload phases without blocking;
+ * returns non zero once x has reached the cleanup phase */
+static int blockmgr_xfer_step(struct blockmgr_data_t *q, struct blockmgr_xfer_t *x) {
+    sxc_client_t *sx = sx_hashfs_client(q->hashfs);
+    unsigned int i;
+
+    if(x->state == XFER_CHECK) {
+	if(x->hc.inflight)
+	    return 0;
+	if(sxi_hashop_end(&x->hc) == -1) {
+	    if(!x->failed)
+		WARN("Cannot verify block presence on node %s (%s): %s", x->target.string, x->host, sxc_geterrmsg(sx));
+	    x->failed = 1;
 	}
-	if(sxi_hashop_end(&hc) == -1) {
-	    WARN("Cannot verify block presence on node %s (%s): %s", sx_node_uuid_str(q->target), host, sxc_geterrmsg(sx));
-	    r = 1;
+	if(x->failed) {
+	    blockmgr_xfer_fail(x);
+	    x->state = XFER_IDLE;
+	    return 1;
 	}
+	blockmgr_xfer_upload(q, x);
+    }
 
-	if(r) {
-	    for(i=0; i<q->hashlist.nblocks; i++)
-		q->hashlist.havehs[i] = 2; /* Reschedule */
-	} else {
-	    /* Phase 3 - upload blocks */
-	    curb = upbuffer;
-	    for(i=0; i<q->hashlist.nblocks; i++) {
-		const uint8_t *b;
-		if(q->hashlist.havehs[i]) {
-		    /* TODO: print actual hash */
-		    DEBUG("Block %d was found remotely", i);
-		    q->hashlist.havehs[i] = 1; /* Dequeue */
-		} else if(sx_hashfs_block_get(q->hashfs, q->blocksize, &q->hashlist.binhs[i], &b)) {
-		    INFO("Block %ld was not found locally", q->hashlist.ids[i]);
-                    q->hashlist.havehs[i] = 2; /* Reschedule */
-                    if (sx_hashfs_is_rebalancing(q->hashfs)) {
-                        /* avoid bb#1964 infloop */
-                        blockmgr_rb_release(q, q->hashlist.ids[i]);
-                    }
-		} else {
-		    memcpy(curb, b, q->blocksize);
-		    curb += q->blocksize;
-		}
-		if(sizeof(upbuffer) - (curb - upbuffer) < q->blocksize || i == q->hashlist.nblocks - 1) {
-		    /* upload chunk */
-		    r = sxi_upload_block_from_buf(clust, &uploadto, token, upbuffer, q->blocksize, curb-upbuffer);
-		    if(r) {
-			for(j=lastup; j<=q->hashlist.nblocks; j++)
-			    if(!q->hashlist.havehs[j])
-				q->hashlist.havehs[j] = 2 /* Reschedule */;
-			WARN("Block transfer failed");
-			break;
-		    } else {
-			for(j=lastup; j<=i; j++) {
-			    if(q->hashlist.havehs[j])
-				continue;
-			    if (UNLIKELY(sxi_log_is_debug(&logger))) {
-				char debughash[sizeof(sx_hash_t)*2+1];
-				const sx_hash_t *hash = &q->hashlist.binhs[j];
-				bin2hex(hash->b, sizeof(hash->b), debughash, sizeof(debughash));
-				DEBUG("Block %ld #%s# was transferred successfully", q->hashlist.ids[j], debughash);
-			    }
-			    q->hashlist.havehs[j] = 1 /* Dequeue */;
-			    trigger_jobmgr = 1;
-			}
-			lastup = j;
-			curb = upbuffer;
-		    }
-		}
+    if(x->state == XFER_UPLOAD) {
+	long http_status = 0;
+	if(!x->failed && !sxi_cbdata_is_finished(x->cbdata))
+	    return 0;
+	if(!x->failed &&
+	   (sxi_cbdata_wait(x->cbdata, sxi_conns_get_curlev(sx_hashfs_conns(q->hashfs)), &http_status) || http_status != 200)) {
+	    WARN("Block transfer to %s (%s) failed with %ld: %s", x->target.string, x->host, http_status, sxi_cbdata_geterrmsg(x->cbdata));
+	    x->failed = 1;
+	}
+	sxi_cbdata_unref(&x->cbdata);
+	for(i=0; i<x->hashlist.nblocks; i++) {
+	    if(x->hashlist.havehs[i])
+		continue;
+	    if(x->failed) {
+		x->hashlist.havehs[i] = 2 /* Reschedule */;
+		continue;
+	    }
+	    if (UNLIKELY(sxi_log_is_debug(&logger))) {
+		char debughash[sizeof(sx_hash_t)*2+1];
+		const sx_hash_t *hash = &x->hashlist.binhs[i];
+		bin2hex(hash->b, sizeof(hash->b), debughash, sizeof(debughash));
+		DEBUG("Block %ld #%s# was transferred successfully to %s", x->hashlist.ids[i], debughash, x->target.string);
 	    }
+	    x->hashlist.havehs[i] = 1 /* Dequeue */;
 	}
+	x->state = XFER_IDLE;
+    }
+
+    return 1;
+}
+
+/* Phase 4 - Cleanup (prune uploaded blocks, reschedule failed / missing) */
+static int blockmgr_xfer_cleanup(struct blockmgr_data_t *q, struct blockmgr_xfer_t *x) {
+    sxi_db_t *xferdb = sx_hashfs_xferdb(q->hashfs);
+    unsigned int i;
+    int ret = 0;
+
+    if(!qbegin(xferdb)) {
+	for(i=0; i<x->hashlist.nblocks; i++) {
+	    if(x->hashlist.havehs[i] == 1) {
+		blockmgr_del_xfer(q, x->hashlist.ids[i]);
+		ret = 1;
+	    } else if(x->hashlist.havehs[i] == 2)
+		blockmgr_reschedule_xfer(q, x->hashlist.ids[i]);
+	    else
+		WARN("Invalid block state %u", x->hashlist.havehs[i]);
+	}
+	if(qcommit(xferdb))
+	    WARN("Failed to commit cleanup");
+    } else
+	WARN("Failed to perform block cleanup and reschedule");
+
+    sqlite3_reset(q->qwipesched);
+    if(qbind_blob(q->qwipesched, ":node", x->target.binary, sizeof(x->target.binary)) ||
+       qstep_noret(q->qwipesched))
+	WARN("Failed to wipe schedule");
+
+    x->hashlist.nblocks = 0;
+    return ret;
+}
 
-	/* Phase 4 - Cleanup (prune uploaded blocks, reschedule failed / missing) */
-	if(!qbegin(sx_hashfs_xferdb(q->hashfs))) {
-	    for(i=0; i<q->hashlist.nblocks; i++) {
-		if(q->hashlist.havehs[i] == 1) {
-		    blockmgr_del_xfer(q, q->hashlist.ids[i]);
+/* Keeps up to q->nxfers batches in flight, each to a different node, and
+ * returns as soon as at least one of them is complete.
+ * Batches still in flight are picked up again on the next call, so the
+ * presence check of one batch overlaps the upload of another.
+ * Returns 1 if some work was done or is still pending, 0 if the queue is
+ * empty, -1 on error or if all the completed batches failed */
+static int blockmgr_process_queue(struct blockmgr_data_t *q, int drain) {
+    curl_events_t *curlev = sxi_conns_get_curlev(sx_hashfs_conns(q->hashfs));
+    unsigned int i, inflight, done = 0, trigger_jobmgr = 0;
+    int r, ret = -1, sched = !drain;
+
+    while(1) {
+	/* Phase 1 - schedule blocks */
+	inflight = 0;
+	for(i=0; i<q->nxfers; i++) {
+	    struct blockmgr_xfer_t *x = &q->xfers[i];
+	    if(x->state == XFER_IDLE && !x->hashlist.nblocks && sched && !terminate) {
+		r = schedule_blocks_sfq(q, x);
+		if(r <= 0) {
+		    /* no blocks(0) or error (<1) */
+		    if(!done && ret <= 0)
+			ret = r;
+		    sched = 0;
+		} else
+		    blockmgr_xfer_check(q, x);
+	    }
+	    if(x->state != XFER_IDLE && !blockmgr_xfer_step(q, x)) {
+		inflight++;
+		continue;
+	    }
+	    if(x->hashlist.nblocks) {
+		if(blockmgr_xfer_cleanup(q, x)) {
 		    ret = 1;
-		} else if(q->hashlist.havehs[i] == 2)
-		    blockmgr_reschedule_xfer(q, q->hashlist.ids[i]);
-		else
-		    WARN("Invalid block state %u", q->hashlist.havehs[i]);
+		    trigger_jobmgr = 1;
+		}
+		done++;
 	    }
-	    if(qcommit(sx_hashfs_xferdb(q->hashfs)))
-		WARN("Failed to commit cleanup");
-	} else
-	    WARN("Failed to perform block cleanup and reschedule");
+	}
 
-	if(trigger_jobmgr)
-	    sx_hashfs_job_trigger(q->hashfs);
+	if(!inflight || (done && !drain))
+	    break;
 
-	break;
+	r = sxi_curlev_poll(curlev);
+	if(r == -2) {
+	    /* Nothing is running anymore: whatever is still marked in flight is lost */
+	    WARN("No running queries with %u batches in flight", inflight);
+	    for(i=0; i<q->nxfers; i++) {
+		if(q->xfers[i].state == XFER_IDLE)
+		    continue;
+		q->xfers[i].hc.inflight = 0;
+		q->xfers[i].failed = 1;
+	    }
+	} else if(r) {
+	    /* Batches are kept in flight and resumed on the next call */
+	    WARN("Failed to poll for block transfers: %s", sxc_geterrmsg(sx_hashfs_client(q->hashfs)));
+	    break;
+	}
     }
-    sxi_hostlist_empty(&uploadto);
+
+    if(trigger_jobmgr)
+	sx_hashfs_job_trigger(q->hashfs);
+
+    if(inflight)
+	ret = 1;
+    DEBUG("Block queue: %u batches completed, %u still in flight", done, inflight);
     return ret;
 }
 
@@ -607,9 +741,15 @@ int blockmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
     memset(&unb, 0, sizeof(unb));
 
     q.hashfs = hashfs;
+    q.nxfers = blockmgr_pipelines;
+    q.xfers = wrap_calloc(q.nxfers, sizeof(*q.xfers));
+    if(!q.xfers) {
+	CRIT("Cannot allocate block transfer pipelines");
+	goto blockmgr_err;
+    }
 
     xferdb = sx_hashfs_xferdb(q.hashfs);
-    if(qprep(xferdb, &qsched, "CREATE TEMPORARY TABLE scheduled (push_id INTEGER NOT NULL PRIMARY KEY)") || qstep_noret(qsched)) {
+    if(qprep(xferdb, &qsched, "CREATE TEMPORARY TABLE scheduled (push_id INTEGER NOT NULL PRIMARY KEY, node BLOB NOT NULL)") || qstep_noret(qsched)) {
 	qnullify(qsched);
 	goto blockmgr_err;
     }
@@ -623,9 +763,10 @@ int blockmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
     if(qprep(xferdb, &q.qbump, "UPDATE topush SET sched_time = strftime('%Y-%m-%d %H:%M:%f', sched_time, '"STRIFY(BLOCKMGR_RESCHEDULE)" seconds') WHERE id = :id"))
 	goto blockmgr_err;
 
-    if(qprep(xferdb, &q.qget_first_hi, "SELECT id, flow, block, size, node FROM topush WHERE strftime('%Y-%m-%d %H:%M:%f') >= sched_time AND flow > :flow ORDER BY flow ASC, sched_time ASC LIMIT 1"))
+    /* Nodes with a batch in flight are skipped: there's at most one pipeline per target */
+    if(qprep(xferdb, &q.qget_first_hi, "SELECT id, flow, block, size, node FROM topush WHERE strftime('%Y-%m-%d %H:%M:%f') >= sched_time AND flow > :flow AND node NOT IN (SELECT node FROM scheduled) ORDER BY flow ASC, sched_time ASC LIMIT 1"))
 	goto blockmgr_err;
-    if(qprep(xferdb, &q.qget_first_lo, "SELECT id, flow, block, size, node FROM topush WHERE strftime('%Y-%m-%d %H:%M:%f') >= sched_time AND flow <= :flow ORDER BY flow ASC, sched_time ASC LIMIT 1"))
+    if(qprep(xferdb, &q.qget_first_lo, "SELECT id, flow, block, size, node FROM topush WHERE strftime('%Y-%m-%d %H:%M:%f') >= sched_time AND flow <= :flow AND node NOT IN (SELECT node FROM scheduled) ORDER BY flow ASC, sched_time ASC LIMIT 1"))
 	goto blockmgr_err;
     /* Using index on 'node' is explicitly disabled here because despite being more efficient in the WHERE clause,
      * it adds extremely higher extra costs in the for of a temp b-tree used for the ORDER BY clause */
@@ -633,9 +774,9 @@ int blockmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
 	goto blockmgr_err;
     if(qprep(xferdb, &q.qget_next_lo, "SELECT id, flow, block FROM topush WHERE id NOT IN (SELECT push_id FROM scheduled) AND strftime('%Y-%m-%d %H:%M:%f') >= sched_time AND flow <= :flow AND +node = :node AND size = :size ORDER BY flow ASC, sched_time ASC LIMIT 1"))
 	goto blockmgr_err;
-    if(qprep(xferdb, &q.qwipesched, "DELETE FROM scheduled"))
+    if(qprep(xferdb, &q.qwipesched, "DELETE FROM scheduled WHERE node = :node"))
 	goto blockmgr_err;
-    if(qprep(xferdb, &q.qaddsched, "INSERT INTO scheduled (push_id) VALUES (:pushid)"))
+    if(qprep(xferdb, &q.qaddsched, "INSERT INTO scheduled (push_id, node) VALUES (:pushid, :node)"))
 	goto blockmgr_err;
 
     unb.hashfs = q.hashfs;
@@ -667,7 +808,7 @@ int blockmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
 	    }
 
 	    DEBUG("Start processing block queue");
-	    p1 = blockmgr_process_queue(&q);
+	    p1 = blockmgr_process_queue(&q, 0);
 	    DEBUG("Done processing block queue");
 
 	    DEBUG("Start processing unbump queue");
@@ -689,6 +830,18 @@ int blockmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
     }
 
  blockmgr_err:
+    if(q.xfers) {
+	unsigned int i;
+	/* Let the batches in flight complete and requeue whatever failed */
+	if(q.qwipesched)
+	    blockmgr_process_queue(&q, 1);
+	for(i=0; i<q.nxfers; i++) {
+	    free(q.xfers[i].host);
+	    free(q.xfers[i].url);
+	}
+	free(q.xfers);
+    }
+
     sqlite3_finalize(unb.quget_lo);
     sqlite3_finalize(unb.quget_hi);
     sqlite3_finalize(unb.qudel);
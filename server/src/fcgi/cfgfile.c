@@ -68,6 +68,10 @@ const char *gengetopt_args_info_full_help[] = {
   "      --verbose-rebalance       Generate HUGE rebalance logs  (default=off)",
   "      --verbose-gc              Generate HUGE garbage collector logs\n                                  (default=off)",
   "      --max-pending-user-jobs=N Maximum number of concurrent jobs a single user\n                                  can start  (default=`128')",
+  "      --blockmgr-pipelines=N    Maximum number of block transfer batches in\n                                  flight  (default=`4')",
+  "      --gc-compact-budget=MB    Maximum amount of data relocated per GC run by\n                                  the online compaction (0 disables it) \n                                  (default=`1024')",
+  "      --jobmgr-concurrency=N    Maximum number of jobs in flight  (default=`8')",
+  "      --gc-workers=N            Number of GC processes sharing out the hash\n                                  databases  (default=`1')",
     0
 };
 
@@ -178,6 +182,10 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->verbose_rebalance_given = 0 ;
   args_info->verbose_gc_given = 0 ;
   args_info->max_pending_user_jobs_given = 0 ;
+  args_info->blockmgr_pipelines_given = 0 ;
+  args_info->gc_compact_budget_given = 0 ;
+  args_info->jobmgr_concurrency_given = 0 ;
+  args_info->gc_workers_given = 0 ;
 }
 
 static
@@ -238,6 +246,14 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->verbose_gc_flag = 0;
   args_info->max_pending_user_jobs_arg = 128;
   args_info->max_pending_user_jobs_orig = NULL;
+  args_info->blockmgr_pipelines_arg = 4;
+  args_info->blockmgr_pipelines_orig = NULL;
+  args_info->gc_compact_budget_arg = 1024;
+  args_info->gc_compact_budget_orig = NULL;
+  args_info->jobmgr_concurrency_arg = 8;
+  args_info->jobmgr_concurrency_orig = NULL;
+  args_info->gc_workers_arg = 1;
+  args_info->gc_workers_orig = NULL;
   
 }
 
@@ -280,6 +296,10 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->verbose_rebalance_help = gengetopt_args_info_full_help[31] ;
   args_info->verbose_gc_help = gengetopt_args_info_full_help[32] ;
   args_info->max_pending_user_jobs_help = gengetopt_args_info_full_help[33] ;
+  args_info->blockmgr_pipelines_help = gengetopt_args_info_full_help[34] ;
+  args_info->gc_compact_budget_help = gengetopt_args_info_full_help[35] ;
+  args_info->jobmgr_concurrency_help = gengetopt_args_info_full_help[36] ;
+  args_info->gc_workers_help = gengetopt_args_info_full_help[37] ;
   
 }
 
@@ -403,6 +423,10 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_string_field (&(args_info->worker_max_wait_orig));
   free_string_field (&(args_info->worker_max_requests_orig));
   free_string_field (&(args_info->max_pending_user_jobs_orig));
+  free_string_field (&(args_info->blockmgr_pipelines_orig));
+  free_string_field (&(args_info->gc_compact_budget_orig));
+  free_string_field (&(args_info->jobmgr_concurrency_orig));
+  free_string_field (&(args_info->gc_workers_orig));
   
   
 
@@ -501,6 +525,14 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "verbose-gc", 0, 0 );
   if (args_info->max_pending_user_jobs_given)
     write_into_file(outfile, "max-pending-user-jobs", args_info->max_pending_user_jobs_orig, 0);
+  if (args_info->blockmgr_pipelines_given)
+    write_into_file(outfile, "blockmgr-pipelines", args_info->blockmgr_pipelines_orig, 0);
+  if (args_info->gc_compact_budget_given)
+    write_into_file(outfile, "gc-compact-budget", args_info->gc_compact_budget_orig, 0);
+  if (args_info->jobmgr_concurrency_given)
+    write_into_file(outfile, "jobmgr-concurrency", args_info->jobmgr_concurrency_orig, 0);
+  if (args_info->gc_workers_given)
+    write_into_file(outfile, "gc-workers", args_info->gc_workers_orig, 0);
   
 
   i = EXIT_SUCCESS;
@@ -820,6 +852,10 @@ cmdline_parser_internal (
         { "verbose-rebalance",	0, NULL, 0 },
         { "verbose-gc",	0, NULL, 0 },
         { "max-pending-user-jobs",	1, NULL, 0 },
+        { "blockmgr-pipelines",	1, NULL, 0 },
+        { "gc-compact-budget",	1, NULL, 0 },
+        { "jobmgr-concurrency",	1, NULL, 0 },
+        { "gc-workers",	1, NULL, 0 },
         { 0,  0, 0, 0 }
       };
 
@@ -1275,6 +1311,62 @@ cmdline_parser_internal (
                 additional_error))
               goto failure;
           
+          }
+          /* Maximum number of block transfer batches in flight.  */
+          else if (strcmp (long_options[option_index].name, "blockmgr-pipelines") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->blockmgr_pipelines_arg), 
+                 &(args_info->blockmgr_pipelines_orig), &(args_info->blockmgr_pipelines_given),
+                &(local_args_info.blockmgr_pipelines_given), optarg, 0, "4", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "blockmgr-pipelines", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Maximum amount of data relocated per GC run by the online compaction (0 disables it).  */
+          else if (strcmp (long_options[option_index].name, "gc-compact-budget") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->gc_compact_budget_arg), 
+                 &(args_info->gc_compact_budget_orig), &(args_info->gc_compact_budget_given),
+                &(local_args_info.gc_compact_budget_given), optarg, 0, "1024", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "gc-compact-budget", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Maximum number of jobs in flight.  */
+          else if (strcmp (long_options[option_index].name, "jobmgr-concurrency") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->jobmgr_concurrency_arg), 
+                 &(args_info->jobmgr_concurrency_orig), &(args_info->jobmgr_concurrency_given),
+                &(local_args_info.jobmgr_concurrency_given), optarg, 0, "8", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "jobmgr-concurrency", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Number of GC processes sharing out the hash databases.  */
+          else if (strcmp (long_options[option_index].name, "gc-workers") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->gc_workers_arg), 
+                 &(args_info->gc_workers_orig), &(args_info->gc_workers_given),
+                &(local_args_info.gc_workers_given), optarg, 0, "1", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "gc-workers", '-',
+                additional_error))
+              goto failure;
+          
           }
           
           break;
@@ -126,6 +126,18 @@ struct gengetopt_args_info
   int max_pending_user_jobs_arg;	/**< @brief Maximum number of concurrent jobs a single user can start (default='128').  */
   char * max_pending_user_jobs_orig;	/**< @brief Maximum number of concurrent jobs a single user can start original value given at command line.  */
   const char *max_pending_user_jobs_help; /**< @brief Maximum number of concurrent jobs a single user can start help description.  */
+  int blockmgr_pipelines_arg;	/**< @brief Maximum number of block transfer batches in flight (default='4').  */
+  char * blockmgr_pipelines_orig;	/**< @brief Maximum number of block transfer batches in flight original value given at command line.  */
+  const char *blockmgr_pipelines_help; /**< @brief Maximum number of block transfer batches in flight help description.  */
+  int gc_compact_budget_arg;	/**< @brief Maximum amount of data relocated per GC run by the online compaction (0 disables it) (default='1024').  */
+  char * gc_compact_budget_orig;	/**< @brief Maximum amount of data relocated per GC run by the online compaction (0 disables it) original value given at command line.  */
+  const char *gc_compact_budget_help; /**< @brief Maximum amount of data relocated per GC run by the online compaction (0 disables it) help description.  */
+  int jobmgr_concurrency_arg;	/**< @brief Maximum number of jobs in flight (default='8').  */
+  char * jobmgr_concurrency_orig;	/**< @brief Maximum number of jobs in flight original value given at command line.  */
+  const char *jobmgr_concurrency_help; /**< @brief Maximum number of jobs in flight help description.  */
+  int gc_workers_arg;	/**< @brief Number of GC processes sharing out the hash databases (default='1').  */
+  char * gc_workers_orig;	/**< @brief Number of GC processes sharing out the hash databases original value given at command line.  */
+  const char *gc_workers_help; /**< @brief Number of GC processes sharing out the hash databases help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int full_help_given ;	/**< @brief Whether full-help was given.  */
@@ -161,6 +173,10 @@ struct gengetopt_args_info
   unsigned int verbose_rebalance_given ;	/**< @brief Whether verbose-rebalance was given.  */
   unsigned int verbose_gc_given ;	/**< @brief Whether verbose-gc was given.  */
   unsigned int max_pending_user_jobs_given ;	/**< @brief Whether max-pending-user-jobs was given.  */
+  unsigned int blockmgr_pipelines_given ;	/**< @brief Whether blockmgr-pipelines was given.  */
+  unsigned int gc_compact_budget_given ;	/**< @brief Whether gc-compact-budget was given.  */
+  unsigned int jobmgr_concurrency_given ;	/**< @brief Whether jobmgr-concurrency was given.  */
+  unsigned int gc_workers_given ;	/**< @brief Whether gc-workers was given.  */
 
 } ;
 
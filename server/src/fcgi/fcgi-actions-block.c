@@ -40,7 +40,9 @@
 void fcgi_send_blocks(void) {
     unsigned int blocksize;
     const uint8_t *data;
-    sx_hash_t reqhash;
+    sx_hash_t reqhash[DOWNLOAD_MAX_BLOCKS];
+    uint64_t offset[DOWNLOAD_MAX_BLOCKS], gen[DOWNLOAD_MAX_BLOCKS];
+    int fd[DOWNLOAD_MAX_BLOCKS];
     const char *hpath;
     const char *cond;
     int i, urlen;
@@ -64,11 +66,11 @@ void fcgi_send_blocks(void) {
 
     urlen /= SXI_SHA1_TEXT_LEN;
     for(i=0; i<urlen; i++) {
-	if(hex2bin(hpath + SXI_SHA1_TEXT_LEN*i, SXI_SHA1_TEXT_LEN, reqhash.b, SXI_SHA1_BIN_LEN)) {
+	if(hex2bin(hpath + SXI_SHA1_TEXT_LEN*i, SXI_SHA1_TEXT_LEN, reqhash[i].b, SXI_SHA1_BIN_LEN)) {
             msg_set_reason("Invalid hash %*.s", SXI_SHA1_TEXT_LEN, hpath + SXI_SHA1_TEXT_LEN * i);
             quit_errmsg(400,"invalid hash");
         }
-	s = sx_hashfs_block_get(hashfs, blocksize, &reqhash, NULL);
+	s = sx_hashfs_block_locate(hashfs, blocksize, &reqhash[i], &fd[i], &offset[i], &gen[i]);
 	if(s == ENOENT || s == FAIL_BADBLOCKSIZE)
 	    quit_errmsg(404, "Block not found");
         else if(s != OK) {
@@ -98,10 +100,50 @@ void fcgi_send_blocks(void) {
     if(verb == VERB_HEAD)
 	return;
 
+    if(sx_blockio_is_async(sx_hashfs_blockio(hashfs))) {
+	/* All the reads of the batch (or as much as fits in hashbuf) go out
+	 * in a single submission; relocated blocks are then fetched again */
+	sx_blockio_t *io = sx_hashfs_blockio(hashfs);
+	int j, n, chunk = sizeof(hashbuf) / blocksize;
+	for(i=0; i<urlen; i+=n) {
+	    n = MIN(chunk, urlen - i);
+	    for(j=0; j<n; j++)
+		if(sx_blockio_read(io, fd[i+j], hashbuf + j * blocksize, blocksize, offset[i+j]))
+		    break;
+	    if(j < n) {
+		sx_blockio_reset(io);
+		return;
+	    }
+	    if(sx_blockio_submit(io)) {
+		PWARN("Failed to read blocks");
+		return;
+	    }
+	    for(j=0; j<n; j++) {
+		if(!sx_hashfs_block_moved(hashfs, blocksize, &reqhash[i+j], offset[i+j], &gen[i+j]))
+		    continue;
+		if(sx_hashfs_block_get(hashfs, blocksize, &reqhash[i+j], &data) != OK)
+		    return;
+		memcpy(hashbuf + j * blocksize, data, blocksize);
+	    }
+	    CGI_PUTD(hashbuf, n * blocksize);
+	}
+	return;
+    }
+
     for(i=0; i<urlen; i++) {
-	if(hex2bin(hpath + SXI_SHA1_TEXT_LEN*i, SXI_SHA1_TEXT_LEN, reqhash.b, SXI_SHA1_BIN_LEN))
+	/* Zero-copy from the data file if possible, buffered otherwise
+	 * (including when the block was relocated in the meantime).
+	 * The slot can be relocated, freed or reused at any time, hence the
+	 * position is checked right before the transfer and once more after it */
+	int r = sx_hashfs_block_moved(hashfs, blocksize, &reqhash[i], offset[i], &gen[i]) ? 1 : fcgi_sendfile(fd[i], offset[i], blocksize);
+	if(!r) {
+	    if(!sx_hashfs_block_moved(hashfs, blocksize, &reqhash[i], offset[i], &gen[i]))
+		continue;
+	    WARN("Block relocated while being sent, aborting the response");
+	    fcgi_abort();
 	    break;
-	if(sx_hashfs_block_get(hashfs, blocksize, &reqhash, &data) != OK)
+	}
+	if(r < 0 || sx_hashfs_block_get(hashfs, blocksize, &reqhash[i], &data) != OK)
 	    break;
 	CGI_PUTD(data, blocksize);
     }
@@ -127,6 +169,19 @@ void fcgi_hashop_blocks(enum sxi_hashop_kind kind) {
     uint64_t op_expires_at;
     int replica;
     sx_hash_t reserve_hash, revision_hash, volume_hash;
+    int bin = has_arg("bin");
+    uint8_t bitmap[HASHOP_BIN_MAX_BLOCKS / 8];
+
+    /* Binary requests carry packed hashes in the body and get a presence
+     * bitmap back; the body is part of the signature */
+    if(bin) {
+        int len = content_len();
+        if(len <= 0 || len % SXI_SHA1_BIN_LEN || len > HASHOP_BIN_MAX_BLOCKS * SXI_SHA1_BIN_LEN)
+            quit_errmsg(400, "Invalid hash batch size");
+        if(get_body_chunk(hashbuf, len) != len)
+            quit_errmsg(400, "Failed to read the hash batch");
+        n = len / SXI_SHA1_BIN_LEN;
+    }
 
     auth_complete();
     quit_unless_authed();
@@ -153,7 +208,10 @@ void fcgi_hashop_blocks(enum sxi_hashop_kind kind) {
     }
 
     blocksize = strtol(path, (char **)&hpath, 10);
-    if(*hpath != '/') {
+    if(bin) {
+        if(*hpath)
+            quit_errmsg(400, "Unexpected hashes in the URL of a binary hashop");
+    } else if(*hpath != '/') {
         msg_set_reason("Path must begin with / after blocksize: %s", path);
         quit_errmsg(404, msg_get_reason());
     }
@@ -183,6 +241,25 @@ void fcgi_hashop_blocks(enum sxi_hashop_kind kind) {
         }
     }
 
+    if(bin) {
+        memset(bitmap, 0, sizeof(bitmap));
+        for(idx=0; idx<n; idx++) {
+            int present;
+            memcpy(reqhash.b, hashbuf + idx * SXI_SHA1_BIN_LEN, SXI_SHA1_BIN_LEN);
+            rc = sx_hashfs_hashop_perform(hashfs, blocksize, replica, kind, &reqhash, &volume_hash, &reserve_hash, &revision_hash, 0, &present);
+            if(rc != OK)
+                goto fcgi_hashop_blocks_err;
+            if(present)
+                bitmap[idx / 8] |= 1 << (idx % 8);
+            else
+                missing++;
+        }
+        CGI_PRINTF("Content-type: application/octet-stream\r\nContent-Length: %u\r\n\r\n", (n + 7) / 8);
+        CGI_PUTD(bitmap, (n + 7) / 8);
+        DEBUG("hashop: missing %d, n: %d", missing, n);
+        return;
+    }
+
     CGI_PUTS("Content-type: application/json\r\n\r\n{\"presence\":[");
     while (*hpath) {
 	int present;
@@ -224,6 +301,8 @@ void fcgi_hashop_blocks(enum sxi_hashop_kind kind) {
 fcgi_hashop_blocks_err:
     if (rc != OK) {
         WARN("hashop: %s", rc2str(rc));
+        if (bin)
+            quit_errmsg(rc2http(rc), msg_get_reason());
         CGI_PUTC(']');
         quit_itererr(msg_get_reason(), rc);
     }
@@ -375,12 +454,61 @@ static void cb_inuse_bsend(jparse_t *J, void *ctx) {
 static void blocks_free(blocks_t *blocks)
 {
     unsigned i;
-    for (i=0;i<blocks->n;i++)
+    for (i=0;blocks->all && i<blocks->n;i++)
         free(blocks->all[i].entries);
     free(blocks->all);
     blocks->all = NULL;
 }
 
+/* Binary inuse entry: revision_id[20] has_vol_id[1] global_vol_id[20] replica[4] */
+#define INUSE_BIN_ENTRY_LEN (2 * SXI_SHA1_BIN_LEN + 1 + sizeof(uint32_t))
+#define INUSE_BIN_BLOCK_LEN (SXI_SHA1_BIN_LEN + 2 * sizeof(uint32_t))
+
+/* See sxi_hashop_proto_inuse_bin() for the layout */
+static rc_ty inuse_parse_bin(blocks_t *all, const uint8_t *buf, unsigned int len)
+{
+    block_meta_t meta;
+    sx_hash_t revision_id, global_vol_id;
+    unsigned int i, count;
+    uint32_t u;
+
+    while(len) {
+        if(len < INUSE_BIN_BLOCK_LEN) {
+            msg_set_reason("Truncated block record");
+            return EINVAL;
+        }
+        memset(&meta, 0, sizeof(meta));
+        memcpy(meta.hash.b, buf, SXI_SHA1_BIN_LEN);
+        memcpy(&u, buf + SXI_SHA1_BIN_LEN, sizeof(u));
+        meta.blocksize = ntohl(u);
+        memcpy(&u, buf + SXI_SHA1_BIN_LEN + sizeof(u), sizeof(u));
+        count = ntohl(u);
+        buf += INUSE_BIN_BLOCK_LEN;
+        len -= INUSE_BIN_BLOCK_LEN;
+        if(!count || count > len / INUSE_BIN_ENTRY_LEN) {
+            msg_set_reason("Invalid revision count %u", count);
+            return EINVAL;
+        }
+        for(i=0; i<count; i++) {
+            memcpy(revision_id.b, buf, SXI_SHA1_BIN_LEN);
+            memcpy(global_vol_id.b, buf + SXI_SHA1_BIN_LEN + 1, SXI_SHA1_BIN_LEN);
+            memcpy(&u, buf + 2 * SXI_SHA1_BIN_LEN + 1, sizeof(u));
+            if(meta_add(&meta, buf[SXI_SHA1_BIN_LEN] ? &global_vol_id : NULL, ntohl(u), &revision_id)) {
+                msg_set_reason("Out of memory");
+                return ENOMEM;
+            }
+            buf += INUSE_BIN_ENTRY_LEN;
+            len -= INUSE_BIN_ENTRY_LEN;
+        }
+        if(all_add(all, &meta)) {
+            free(meta.entries);
+            msg_set_reason("Out of memory");
+            return ENOMEM;
+        }
+    }
+    return OK;
+}
+
 /*
  * This is called during rebalance in order to properly create revision ID - blocks reverse maps.
  * At the time the revmap is created we also perform a presence check and return the information
@@ -417,10 +545,62 @@ void fcgi_hashop_inuse(void) {
     int comma = 0;
     unsigned idx = 0;
     jparse_t *J;
+    uint8_t *bitmap = NULL;
 
     struct inuse_ctx yctx;
     memset(&yctx, 0, sizeof(yctx));
 
+    if(has_arg("bin")) {
+        int len = content_len();
+        if(len <= 0)
+            quit_errmsg(400, "Invalid block batch size");
+        if(len > sizeof(hashbuf))
+            quit_errnum(413);
+        if(get_body_chunk(hashbuf, len) != len)
+            quit_errmsg(400, "Failed to read the block batch");
+        rc = inuse_parse_bin(&yctx.all, hashbuf, len);
+        if(rc == OK && !(bitmap = calloc(1, (yctx.all.n + 7) / 8)))
+            rc = ENOMEM;
+        if(rc != OK) {
+            blocks_free(&yctx.all);
+            quit_errmsg(rc2http(rc), rc == ENOMEM ? "Out of memory" : msg_get_reason());
+        }
+        auth_complete();
+        if(!is_authed()) {
+            blocks_free(&yctx.all);
+            free(bitmap);
+            send_authreq();
+            return;
+        }
+        for(i=0; i<yctx.all.n; i++) {
+            const block_meta_t *m = &yctx.all.all[i];
+            rc = FAIL_EINTERNAL;
+            for(j=0; j<m->count; j++) {
+                const block_meta_entry_t *e = &m->entries[j];
+                rc = sx_hashfs_hashop_use_revmap(hashfs, &m->hash, e->has_vol_id ? &e->global_vol_id : NULL, &e->revision_id, m->blocksize, e->replica);
+                if(rc && rc != ENOENT)
+                    break;
+            }
+            if(rc == OK)
+                bitmap[i / 8] |= 1 << (i % 8);
+            else if(rc == ENOENT)
+                missing++;
+            else
+                break;
+        }
+        blocks_free(&yctx.all);
+        if(i < yctx.all.n) {
+            free(bitmap);
+            WARN("hashop: %s", rc2str(rc));
+            quit_errmsg(rc2http(rc), msg_get_reason());
+        }
+        CGI_PRINTF("Content-type: application/octet-stream\r\nContent-Length: %u\r\n\r\n", (unsigned int)(yctx.all.n + 7) / 8);
+        CGI_PUTD(bitmap, (yctx.all.n + 7) / 8);
+        free(bitmap);
+        DEBUG("hashop: missing %d, n: %ld", missing, yctx.all.n);
+        return;
+    }
+
     if(!(J = sxi_jparse_create(&acts, &yctx, 0)))
         quit_errmsg(500, "Cannot allocate json parser");
 
@@ -521,15 +701,12 @@ void fcgi_save_blocks(void) {
     if(!is_authed())
 	quit_errmsg(403, "Bad signature");
 
-    const uint8_t *end = hashbuf + len;
-    for(const uint8_t *src = hashbuf;src < end; src += blocksize) {
-        rc_ty rc;
-	/* Maximum replica used here;
-	 * block_put internally skips ignored nodes and only propagates to effective nodes */
-        if ((rc = sx_hashfs_block_put(hashfs, src, blocksize, replica_count, uid))) {
-            WARN("Cannot store block: %s", rc2str(rc));
-	    quit_errmsg(500, "Cannot store block");
-        }
+    /* Maximum replica used here;
+     * block_put internally skips ignored nodes and only propagates to effective nodes */
+    rc_ty rc = sx_hashfs_block_put_many(hashfs, hashbuf, len / blocksize, blocksize, replica_count, uid);
+    if(rc != OK) {
+	WARN("Cannot store blocks: %s", rc2str(rc));
+	quit_errmsg(500, "Cannot store block");
     }
     if(replica_count > 1)
 	sx_hashfs_xfer_trigger(hashfs);
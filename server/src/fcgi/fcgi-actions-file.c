@@ -152,8 +152,9 @@ static int hash_presence_callback(const char *hexhash, unsigned int index, int c
 {
     hash_presence_ctx_t *ctx = (hash_presence_ctx_t*)context;
     sx_hashfs_t *h = ctx->h;
-    sx_nodelist_t *nodes;
+    const unsigned int *nidx;
     sx_hash_t hash;
+    int nnodes;
     if (code != 200) {
 	if (code < 0)
 	    WARN("Failed to query hash %.*s: %s", 40, hexhash, sx_hashfs_geterrmsg(h));
@@ -161,8 +162,8 @@ static int hash_presence_callback(const char *hexhash, unsigned int index, int c
 	    WARN("hex2bin failed on %.*s", 40, hexhash);
 	    return -1;
 	}
-	nodes = sx_hashfs_putfile_hashnodes(h, &hash);
-	if (!nodes) {
+	nnodes = sx_hashfs_putfile_hashnidx(h, &hash, &nidx);
+	if (nnodes < 0) {
 	    WARN("hashnodes failed");
 	    return -1;
 	}
@@ -175,8 +176,7 @@ static int hash_presence_callback(const char *hexhash, unsigned int index, int c
 	CGI_PUTC(':');
 	/* Although there is no danger in doing so, nodes SHOULD NOT be randomized:
 	 * hdist already does a pretty good job here */
-	send_nodes(nodes);
-	sx_nodelist_delete(nodes);
+	send_nodes_nidx(sx_hashfs_all_nodes(h, NL_NEXT), nidx, nnodes);
     }
     send_keepalive();
     return 0;
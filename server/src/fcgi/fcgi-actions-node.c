@@ -1549,7 +1549,7 @@ void fcgi_node_repaired(void) {
 }
 
 void fcgi_node_status(void) {
-    int64_t sysjobs, usrjobs;
+    int64_t sysjobs, usrjobs, joblag, uhits, umisses, phits, pmisses;
     const sx_nodelist_t *nodes;
     sxi_node_status_t status;
     int comma;
@@ -1633,16 +1633,17 @@ void fcgi_node_status(void) {
         CGI_PRINTF(",\"traffic\":%.*s", (unsigned)status.network_traffic_json_size, status.network_traffic_json);
     CGI_PRINTF("},\"heal\":\"%s\",", status.heal_status);
     CGI_PUTS("\"queueStatus\":{");
-    if(sx_hashfs_stats_jobq(hashfs, &sysjobs, &usrjobs) == OK) {
+    if(sx_hashfs_stats_jobq(hashfs, &sysjobs, &usrjobs, &joblag) == OK) {
 	CGI_PUTS("\"eventQueue\":{\"systemJobs\":"); CGI_PUTLL(sysjobs);
-	CGI_PUTS(",\"userJobs\":"); CGI_PUTLL(usrjobs); CGI_PUTC('}');
+	CGI_PUTS(",\"userJobs\":"); CGI_PUTLL(usrjobs);
+	CGI_PUTS(",\"lag\":"); CGI_PUTLL(joblag); CGI_PUTC('}');
 	comma = 1;
     } else
 	comma = 0;
 
     nodes = sx_hashfs_all_nodes(hashfs, NL_NEXTPREV);
     if(nodes) {
-	int64_t ready, held, unbumps;
+	int64_t ready, lag, held, unbumps;
 	const sx_node_t *node;
 	unsigned int i;
 	CGI_PRINTF("%s\"transferQueue\":{", comma ? "," : "");
@@ -1650,18 +1651,27 @@ void fcgi_node_status(void) {
 	    const sx_uuid_t *nuuid;
 	    node = sx_nodelist_get(nodes, i);
 	    nuuid = sx_node_uuid(node);
-	    if(sx_hashfs_stats_blockq(hashfs, nuuid, &ready, &held, &unbumps) != OK)
+	    if(sx_hashfs_stats_blockq(hashfs, nuuid, &ready, &lag, &held, &unbumps) != OK)
 		break;
 	    CGI_PRINTF("%s\"%s\":{", i ? "," : "", nuuid->string);
 	    CGI_PUTS("\"ready\":"); CGI_PUTLL(ready);
+	    CGI_PUTS(",\"lag\":"); CGI_PUTLL(lag);
 	    CGI_PUTS(",\"held\":"); CGI_PUTLL(held);
 	    CGI_PUTS(",\"unbumps\":"); CGI_PUTLL(unbumps);
 	    CGI_PUTC('}');
 	}
 	CGI_PUTC('}');
     }
- 
-    CGI_PRINTF("}}");
+    CGI_PUTC('}');
+
+    if(sx_hashfs_stats_authcache(hashfs, &uhits, &umisses, &phits, &pmisses) == OK) {
+	CGI_PUTS(",\"authCache\":{\"userHits\":"); CGI_PUTLL(uhits);
+	CGI_PUTS(",\"userMisses\":"); CGI_PUTLL(umisses);
+	CGI_PUTS(",\"privHits\":"); CGI_PUTLL(phits);
+	CGI_PUTS(",\"privMisses\":"); CGI_PUTLL(pmisses); CGI_PUTC('}');
+    }
+
+    CGI_PUTC('}');
 
     sxi_node_status_empty(&status);
 }
@@ -230,7 +230,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
     sx_hash_t etag;
     rc_ty s;
     const char *pattern;
-    int recursive;
+    int recursive, with_meta;
     int64_t i, nmax;
 
     if (int64_arg("limit", &nmax, ~0u))
@@ -240,6 +240,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
 
     pattern = get_arg("filter");
     recursive = has_arg("recursive");
+    with_meta = has_arg("meta");
     if(!pattern)
         pattern = "/";
     s = sx_hashfs_list_etag(hashfs, vol, pattern, recursive, &etag);
@@ -247,7 +248,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
         const char* reason = msg_get_reason();
         quit_errmsg(rc2http(s), *reason ? reason : "failed to calculate etag");
     }
-    if(is_object_fresh(&etag, has_arg("meta") ? 'l' : 'L', NO_LAST_MODIFIED)) {
+    if(is_object_fresh(&etag, with_meta ? 'l' : 'L', NO_LAST_MODIFIED)) {
         return;
     }
     CGI_PUTS("\r\n");
@@ -258,7 +259,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
     CGI_PUTS(",\"volumeUsedSize\":");
     CGI_PUTLL(vol->usage_total);
 
-    s = sx_hashfs_list_first(hashfs, vol, get_arg("filter"), &file, has_arg("recursive"), get_arg("after"), 0);
+    s = sx_hashfs_list_first(hashfs, vol, get_arg("filter"), &file, recursive, get_arg("after"), 0);
     switch(s) {
     case OK:
     case ITER_NO_MORE:
@@ -284,7 +285,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
 	 * and the string terminator */
 
         /* If meta is required, load it before writing a file entry */
-        if(file->revision[0] && has_arg("meta")) {
+        if(file->revision[0] && with_meta) {
             s = sx_hashfs_getfilemeta_begin(hashfs, volume, file->name+1, file->revision, NULL, NULL);
             if(s != OK && s != ENOENT) {
                 CGI_PUTC('}');
@@ -308,7 +309,7 @@ void fcgi_list_volume(const sx_hashfs_volume_t *vol) {
             CGI_PUTT(file->created_at);
             CGI_PRINTF(",\"fileRevision\":\"%s\"", file->revision);
 
-            if(has_arg("meta")) {
+            if(with_meta) {
                 rc_ty t;
                 const char *key;
                 const void *value;
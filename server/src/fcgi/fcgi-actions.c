@@ -36,6 +36,7 @@
 #include "fcgi-actions-file.h"
 #include "fcgi-actions-user.h"
 #include "fcgi-actions-job.h"
+#include "metrics.h"
 #include "hashfs.h"
 #include "sx.h"
 
@@ -90,6 +91,12 @@ void volume_ops(void) {
             return;
         }
 
+        if(!strcmp(volume, ".metrics")) { /* Get request metrics - ADMIN required */
+            quit_unless_has(PRIV_ADMIN);
+            fcgi_metrics();
+            return;
+        }
+
         /* Get basic user information */
         if(!strcmp(volume, ".self")) {
             fcgi_self();
@@ -423,6 +430,8 @@ void file_ops(void) {
                 quit_unless_has(PRIV_CLUSTER);
                 if (arg_is("o","reserve"))
                     fcgi_hashop_blocks(HASHOP_RESERVE);
+                else if (arg_is("o","check") && has_arg("bin"))
+                    fcgi_hashop_blocks(HASHOP_CHECK);
                 else if (arg_is("o", "revmod"))
                     fcgi_revision_op();
                 else
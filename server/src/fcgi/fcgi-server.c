@@ -37,6 +37,10 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include <fastcgi.h>
 #include <fcgiapp.h>
 
@@ -53,11 +57,14 @@
 #include "init.h"
 #include "gc.h"
 #include "hbeat.h"
+#include "metrics.h"
 #include "utils.h"
 
 FCGX_Stream *fcgi_in, *fcgi_out, *fcgi_err;
+uint64_t fcgi_out_bytes, fcgi_in_bytes;
 FCGX_ParamArray envp;
 sx_hashfs_t *hashfs;
+static FCGX_Request *fcgi_req;
 
 static pid_t ownpid;
 
@@ -212,6 +219,128 @@ static sxc_logger_t fcgilog = {
     NULL, NULL, fcgilog_log, NULL
 };
 
+#ifdef HAVE_SYS_SENDFILE_H
+static int sendfile_broken = 0;
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *d = data;
+    while(len) {
+	ssize_t l = write(fd, d, len);
+	if(l < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	d += l;
+	len -= l;
+    }
+    return 0;
+}
+
+/* Completes a record which sendfile() refused to handle */
+static int copy_range(int sock, int fd, off_t *off, size_t len) {
+    uint8_t buf[8192];
+    while(len) {
+	ssize_t l = pread(fd, buf, MIN(len, sizeof(buf)), *off);
+	if(l < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	if(!l || write_all(sock, buf, l))
+	    return -1;
+	*off += l;
+	len -= l;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Sends len bytes of fd at offset as FastCGI stdout records, writing the
+ * data straight from the page cache to the web server socket.
+ * The output stream is flushed first so that ordering is preserved.
+ *
+ * Returns 0 on success, 1 if zero-copy is not available or the range is
+ * past the end of the file (and nothing was sent), -1 on error (the response
+ * is then aborted, see fcgi_abort()).
+ */
+int fcgi_sendfile(int fd, uint64_t offset, unsigned int len) {
+#ifdef HAVE_SYS_SENDFILE_H
+    off_t off = offset;
+    struct stat st;
+
+    /* ipcFd is not part of the public interface, but it's been stable forever */
+    if(sendfile_broken || !fcgi_req || fcgi_req->ipcFd < 0)
+	return 1;
+    /* The record length is sent upfront, the data must be all there */
+    if(fstat(fd, &st) || (uint64_t)st.st_size < offset + len)
+	return 1;
+    if(FCGX_FFlush(fcgi_out) || FCGX_GetError(fcgi_out))
+	return -1;
+
+    while(len) {
+	unsigned int reclen = MIN(len, (FCGI_MAX_LENGTH & ~7));
+	FCGI_Header hdr;
+
+	hdr.version = FCGI_VERSION_1;
+	hdr.type = FCGI_STDOUT;
+	hdr.requestIdB1 = (fcgi_req->requestId >> 8) & 0xff;
+	hdr.requestIdB0 = fcgi_req->requestId & 0xff;
+	hdr.contentLengthB1 = (reclen >> 8) & 0xff;
+	hdr.contentLengthB0 = reclen & 0xff;
+	hdr.paddingLength = 0;
+	hdr.reserved = 0;
+	if(write_all(fcgi_req->ipcFd, &hdr, sizeof(hdr))) {
+	    PWARN("Failed to send record header");
+	    goto sendfile_abort;
+	}
+	len -= reclen;
+	fcgi_out_bytes += reclen;
+
+	while(reclen) {
+	    ssize_t l = sendfile(fcgi_req->ipcFd, fd, &off, reclen);
+	    if(l < 0) {
+		if(errno == EINTR)
+		    continue;
+		if(errno == EINVAL || errno == ENOSYS) {
+		    WARN("sendfile() is not supported here, disabling zero-copy transfers");
+		    sendfile_broken = 1;
+		    if(copy_range(fcgi_req->ipcFd, fd, &off, reclen))
+			goto sendfile_abort;
+		    reclen = 0;
+		    break;
+		}
+		PWARN("sendfile() failed");
+		goto sendfile_abort;
+	    }
+	    if(!l) {
+		WARN("Unexpected end of file");
+		goto sendfile_abort;
+	    }
+	    reclen -= l;
+	}
+    }
+    return 0;
+
+ sendfile_abort:
+    fcgi_abort();
+    return -1;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Drops the connection to the web server, so that a response which can no
+ * longer be completed correctly (short record, stale data) is not mistaken
+ * by the client for a good one.
+ */
+void fcgi_abort(void) {
+    if(fcgi_req && fcgi_req->ipcFd >= 0)
+	shutdown(fcgi_req->ipcFd, SHUT_RDWR);
+}
+
 void OS_LibShutdown(void);
 #include <sys/resource.h>
 static int accept_loop(sxc_client_t *sx, const char *dir, int socket, worker_type_t wtype) {
@@ -253,6 +382,7 @@ static int accept_loop(sxc_client_t *sx, const char *dir, int socket, worker_typ
     ownpid = getpid();
     FCGX_Init();
     FCGX_InitRequest(&req, FCGI_LISTENSOCK_FILENO, FCGI_FAIL_ACCEPT_ON_INTR);
+    fcgi_req = &req;
     for(i=0; !terminate && i < worker_max_requests; i++) {
 	if(FCGX_Accept_r(&req) < 0) {
             if (errno != EINTR)
@@ -268,11 +398,14 @@ static int accept_loop(sxc_client_t *sx, const char *dir, int socket, worker_typ
             continue;
         }
         in_request = 1;
+	metrics_request_begin();
 	send_server_info();
 	handle_request(wtype);
+	metrics_request_end();
         in_request = 0;
     }
     FCGX_Finish_r(&req);
+    fcgi_req = NULL;
     sx_hashfs_close(hashfs);
 
     if(i!=worker_max_requests)
@@ -628,6 +761,30 @@ int main(int argc, char **argv) {
     }
     max_pending_user_jobs = args.max_pending_user_jobs_arg;
 
+    if(args.blockmgr_pipelines_arg <= 0) {
+	CRIT("Invalid number of block transfer pipelines");
+        goto getout;
+    }
+    blockmgr_pipelines = args.blockmgr_pipelines_arg;
+
+    if(args.jobmgr_concurrency_arg <= 0) {
+	CRIT("Invalid number of concurrent jobs");
+        goto getout;
+    }
+    jobmgr_concurrency = args.jobmgr_concurrency_arg;
+
+    if(args.gc_compact_budget_arg < 0) {
+	CRIT("Invalid compaction budget");
+        goto getout;
+    }
+    gc_compact_budget = args.gc_compact_budget_arg;
+
+    if(args.gc_workers_arg <= 0 || args.gc_workers_arg > GC_MAX_WORKERS) {
+	CRIT("Invalid number of GC workers");
+        goto getout;
+    }
+    gc_workers = args.gc_workers_arg;
+
     if(args.children_arg <= 0 || args.children_arg > MAX_CHILDREN) {
 	CRIT("Invalid number of children");
         goto getout;
@@ -787,6 +944,9 @@ int main(int argc, char **argv) {
     else
 	INFO("Bare node in cluster %s starting up", cluster_uuid.string);
 
+    /* Non fatal: requests are just not accounted for */
+    metrics_init();
+
     /* Spawn workers and monitor them */
     while(!terminate) {
 	const char *deadname;
@@ -34,5 +34,10 @@
 extern FCGX_Stream *fcgi_in, *fcgi_out, *fcgi_err;
 extern FCGX_ParamArray envp;
 extern sx_hashfs_t *hashfs;
+extern uint64_t fcgi_out_bytes; /* Sent in the current response */
+extern uint64_t fcgi_in_bytes; /* Read from the current request body */
+
+int fcgi_sendfile(int fd, uint64_t offset, unsigned int len);
+void fcgi_abort(void);
 
 #endif
@@ -47,7 +47,7 @@ uint8_t hashbuf[UPLOAD_CHUNK_SIZE];
 time_t last_flush;
 void send_server_info(void) {
     last_flush = time(NULL);
-    CGI_PRINTF("Server: Skylable SX\r\nSX-Cluster: %s (%s)%s\r\nSX-API-Version: %u\r\nVary: Accept-Encoding\r\n", src_version(), sx_hashfs_uuid(hashfs)->string, sx_hashfs_uses_secure_proto(hashfs) ? " ssl" : "", SRC_API_VERSION);
+    CGI_PRINTF("Server: Skylable SX\r\nSX-Cluster: %s (%s)%s\r\nSX-API-Version: %u\r\nSX-Features: hashop-bin\r\nVary: Accept-Encoding\r\n", src_version(), sx_hashfs_uuid(hashfs)->string, sx_hashfs_uses_secure_proto(hashfs) ? " ssl" : "", SRC_API_VERSION);
 }
 
 static const char *http_err_str(int http_status) {
@@ -207,6 +207,7 @@ static enum authed_t { AUTH_NOTAUTH, AUTH_BODYCHECK, AUTH_BODYCHECKING, AUTH_OK
 int get_body_chunk(char *buf, int buflen) {
     int r = FCGX_GetStr(buf, buflen, fcgi_in);
     if(r>=0) {
+	fcgi_in_bytes += r;
 	if(authed == AUTH_BODYCHECK)
 	    authed = AUTH_BODYCHECKING;
 	if(authed == AUTH_BODYCHECKING && !sxi_sha1_update(body_ctx, buf, r)) {
@@ -397,6 +398,8 @@ void handle_request(worker_type_t wtype) {
 
     msg_new_id();
     verb = VERB_UNSUP;
+    volume = path = NULL;
+    nargs = 0;
     p_method = FCGX_GetParam("REQUEST_METHOD", envp);
     if(p_method) {
 	plen = strlen(p_method);
@@ -807,6 +810,23 @@ void send_nodes(const sx_nodelist_t *nodes) {
     CGI_PUTC(']');
 }
 
+void send_nodes_nidx(const sx_nodelist_t *nodes, const unsigned int *nidx, unsigned int count) {
+    unsigned int i;
+    CGI_PUTC('[');
+    for(i=0; i<count; i++) {
+	const sx_node_t *node = sx_nodelist_get(nodes, nidx[i]);
+
+	if(i)
+	    CGI_PUTC(',');
+
+	if(has_priv(PRIV_CLUSTER))
+	    json_send_qstring(sx_node_internal_addr(node));
+	else
+	    json_send_qstring(sx_node_addr(node));
+    }
+    CGI_PUTC(']');
+}
+
 void send_nodes_randomised(const sx_nodelist_t *nodes) {
     unsigned int nodeno, pos, comma = 0, nnodes;
     unsigned int list[256];
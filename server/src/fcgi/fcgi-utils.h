@@ -39,20 +39,28 @@
 
 #define CGI_PUTD(data, len)			\
     do {					\
-	if(FCGX_PutStr((const char *)(data), len, fcgi_out) < 0)	\
+	int __putlen = FCGX_PutStr((const char *)(data), len, fcgi_out);	\
+	if(__putlen < 0)			\
 	    DEBUG("FCGX_PutStr() failed: %s", strerror(FCGX_GetError(fcgi_out)));	\
+	else					\
+	    fcgi_out_bytes += __putlen;		\
     } while(0)
 
 #define CGI_PUTS(s)				\
     do {					\
-	if(FCGX_PutS(s, fcgi_out) < 0)		\
+	int __putlen = FCGX_PutS(s, fcgi_out);	\
+	if(__putlen < 0)			\
 	    DEBUG("FCGX_PutS() failed");		\
+	else					\
+	    fcgi_out_bytes += __putlen;		\
     } while(0)
 
 #define CGI_PUTC(c)				\
     do {					\
 	if(FCGX_PutChar(c, fcgi_out) < 0)		\
 	    DEBUG("FCGX_PutChar() failed");	\
+	else					\
+	    fcgi_out_bytes++;			\
     } while(0)
 
 static inline int FMT_PRINTF(2,3) FCGX_FPrintF_chk(FCGX_Stream *stream, const char *fmt, ...)
@@ -67,8 +75,11 @@ static inline int FMT_PRINTF(2,3) FCGX_FPrintF_chk(FCGX_Stream *stream, const ch
 
 #define CGI_PRINTF(...)				\
     do {					\
-	if(FCGX_FPrintF_chk(fcgi_out, __VA_ARGS__) < 0)	\
+	int __putlen = FCGX_FPrintF_chk(fcgi_out, __VA_ARGS__);	\
+	if(__putlen < 0)			\
 	    DEBUG("FCGX_FPrintF() failed");	\
+	else					\
+	    fcgi_out_bytes += __putlen;		\
     } while(0)
 
 #define CGI_PUTLL(ll)				\
@@ -126,6 +137,7 @@ void auth_complete(void);
 #define MAX_KEEPALIVE_INTERVAL 10
 void send_keepalive(void);
 void send_nodes(const sx_nodelist_t *nodes);
+void send_nodes_nidx(const sx_nodelist_t *nodes, const unsigned int *nidx, unsigned int count);
 void send_nodes_randomised(const sx_nodelist_t *nodes);
 void send_job_info(job_t job);
 #define NO_LAST_MODIFIED ((time_t)(-1))
@@ -31,6 +31,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "gc.h"
 #include "log.h"
@@ -331,10 +334,125 @@ static rc_ty process_heal(sx_hashfs_t *hashfs, int *terminate)
     return OK;
 }
 
+/* The steps which work on the hash databases one at a time */
+static rc_ty gc_hashdbs_run(sx_hashfs_t *hashfs, sx_hashfs_gc_stats_t *stats, int *terminate)
+{
+    rc_ty (*steps[])(sx_hashfs_t *, int *) = {
+        sx_hashfs_gc_unused_revisions,
+        sx_hashfs_gc_unbumped_revisions,
+        sx_hashfs_gc_candidates,
+        sx_hashfs_gc_slow,
+        sx_hashfs_gc_compact
+    };
+    unsigned int i;
+    rc_ty rc;
+
+    stats->steps = sizeof(steps) / sizeof(*steps);
+    stats->rc = OK;
+    gettimeofday(&stats->start, NULL);
+    for(i = 0; i < stats->steps && !*terminate; i++) {
+        rc = steps[i](hashfs, terminate);
+        if(rc != OK && stats->rc == OK)
+            stats->rc = rc;
+        stats->steps_done++;
+    }
+    gettimeofday(&stats->end, NULL);
+    return stats->rc;
+}
+
+#define GC_WORKERS_INFO_INTERVAL 60
+
+/* Runs the hash database steps in gc_workers processes, each one owning a
+ * disjoint set of hash databases.
+ * The sqlite handles cannot be carried across fork() so the storage is closed
+ * before spawning and reopened afterwards, the returned handle replaces hashfs */
+static sx_hashfs_t *gc_hashdbs_parallel(sxc_client_t *sx, sx_hashfs_t *hashfs, sx_hashfs_gc_stats_t *stats, int *terminate)
+{
+    int job_trigger, xfer_trigger, gc_trigger, gc_expire_trigger, hbeat_trigger;
+    pid_t pids[GC_MAX_WORKERS];
+    unsigned int i, nworkers = 0, running;
+    time_t last_info;
+    int forwarded = 0;
+    char *dir;
+
+    if(!(dir = strdup(sx_hashfs_dir(hashfs)))) {
+        WARN("Out of memory, running the GC serially");
+        sx_hashfs_gc_set_worker(hashfs, stats, 0, 1);
+        gc_hashdbs_run(hashfs, stats, terminate);
+        return hashfs;
+    }
+    sx_hashfs_get_triggers(hashfs, &job_trigger, &xfer_trigger, &gc_trigger, &gc_expire_trigger, &hbeat_trigger);
+    sx_hashfs_close(hashfs);
+
+    for(i = 0; i < (unsigned int)gc_workers && !*terminate; i++) {
+        pids[i] = fork();
+        if(pids[i] < 0) {
+            PWARN("Cannot spawn GC worker %u", i);
+            break;
+        }
+        if(!pids[i]) {
+            sx_hashfs_t *wh = sx_hashfs_open(dir, sx);
+            rc_ty rc;
+
+            if(!wh) {
+                CRIT("GC worker %u failed to open the storage", i);
+                _exit(EXIT_FAILURE);
+            }
+            sx_hashfs_gc_set_worker(wh, &stats[i], i, gc_workers);
+            rc = gc_hashdbs_run(wh, &stats[i], terminate);
+            sx_hashfs_close(wh);
+            _exit(rc == OK ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        nworkers++;
+    }
+
+    hashfs = sx_hashfs_open(dir, sx);
+    free(dir);
+    if(hashfs)
+        sx_hashfs_set_triggers(hashfs, job_trigger, xfer_trigger, gc_trigger, gc_expire_trigger, hbeat_trigger);
+    else
+        CRIT("Failed to reopen the storage");
+
+    INFO("Started %u GC workers", nworkers);
+    last_info = time(NULL);
+    running = nworkers;
+    while(running) {
+        for(i = 0; i < nworkers; i++) {
+            int status;
+            pid_t r;
+
+            if(!pids[i])
+                continue;
+            if(*terminate && !forwarded)
+                kill(pids[i], SIGTERM);
+            r = waitpid(pids[i], &status, WNOHANG);
+            if(r < 0 && errno == EINTR)
+                continue;
+            if(r == pids[i] || r < 0) {
+                if(r > 0 && (!WIFEXITED(status) || WEXITSTATUS(status)))
+                    WARN("GC worker %u (pid %d) failed", i, (int)pids[i]);
+                pids[i] = 0;
+                running--;
+            }
+        }
+        if(*terminate)
+            forwarded = 1;
+        if(!running)
+            break;
+        sleep(1);
+        if(hashfs && time(NULL) - last_info >= GC_WORKERS_INFO_INTERVAL) {
+            sx_hashfs_gc_info(hashfs, stats, nworkers);
+            last_info = time(NULL);
+        }
+    }
+    return hashfs;
+}
+
 int gc(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe, int pipe_expire) {
     struct sigaction act;
     rc_ty rc;
     struct timeval tv0, tv1, tv2;
+    sx_hashfs_gc_stats_t *stats;
 
     sigemptyset(&act.sa_mask);
     act.sa_flags = 0;
@@ -344,6 +462,17 @@ int gc(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe, int pipe_expire) {
     sigaction(SIGQUIT, &act, NULL);
 
     INFO("GC slow check is : %s", gc_slow_check ? "enabled" : "disabled");
+    /* Shared with the GC workers, which report their progress here */
+    stats = mmap(NULL, sizeof(*stats) * gc_workers, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(stats == MAP_FAILED) {
+        PCRIT("Cannot allocate the GC worker stats");
+        sx_hashfs_close(hashfs);
+        return EXIT_FAILURE;
+    }
+    if(gc_workers > 1)
+        INFO("GC workers: %d", gc_workers);
+    /* Populate the block filters right away rather than at the first GC run */
+    sx_hashfs_gc_filter(hashfs, &terminate);
     memset(&tv0, 0, sizeof(tv0));
     while(!terminate) {
         int forced_awake = 0, force_expire = 0;
@@ -385,12 +514,18 @@ int gc(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe, int pipe_expire) {
             if (timediff(&tv0, &tv1) > gc_interval || forced_awake) {
                 INFO("Starting GC");
                 sx_hashfs_gc_periodic(hashfs, &terminate, GC_GRACE_PERIOD);
-                sx_hashfs_gc_unused_revisions(hashfs, &terminate);
-                sx_hashfs_gc_unbumped_revisions(hashfs, &terminate);
-                sx_hashfs_gc_slow(hashfs, &terminate);
+                memset(stats, 0, sizeof(*stats) * gc_workers);
+                if(gc_workers > 1) {
+                    if(!(hashfs = gc_hashdbs_parallel(sx, hashfs, stats, &terminate)))
+                        break;
+                } else {
+                    sx_hashfs_gc_set_worker(hashfs, stats, 0, 1);
+                    gc_hashdbs_run(hashfs, stats, &terminate);
+                }
+                sx_hashfs_gc_filter(hashfs, &terminate);
                 gettimeofday(&tv2, NULL);
                 sx_hashfs_checkpoint_idle(hashfs);
-                sx_hashfs_gc_info(hashfs, &terminate);
+                sx_hashfs_gc_info(hashfs, stats, gc_workers);
                 INFO("GC run completed in %.2lfs", timediff(&tv1, &tv2));
                 memcpy(&tv0, &tv1, sizeof(tv0));
             }
@@ -400,6 +535,7 @@ int gc(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe, int pipe_expire) {
         sx_hashfs_checkpoint_idle(hashfs);
     }
     sx_hashfs_close(hashfs);
+    munmap(stats, sizeof(*stats) * gc_workers);
 
     return terminate ? EXIT_SUCCESS : EXIT_FAILURE;
 }
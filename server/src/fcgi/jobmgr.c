@@ -53,6 +53,9 @@ typedef enum _act_result_t {
     ACT_RESULT_UNSET = 0,
     ACT_RESULT_OK = 1,
 
+    /* The action left its queries in flight: see job_pending_t */
+    ACT_RESULT_PENDING = 2,
+
     /* Heavy/aggressive jobs willingly giving up before completion:
      * same as ACT_RESULT_TEMPFAIL except it's rescheduled without delay */
     ACT_RESULT_NOTFAILED = -1,
@@ -66,6 +69,7 @@ typedef struct _job_data_t {
     unsigned int len;
     uint64_t op_expires_at;
     sx_uid_t owner;
+    struct _job_pending_t *pending;
 } job_data_t;
 
 typedef act_result_t (*job_action_t)(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *node, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl);
@@ -183,6 +187,29 @@ static void query_list_free(query_list_t *qrylist, unsigned nnodes)
     free(qrylist);
 }
 
+/* When job_data->pending is set, an action may return ACT_RESULT_PENDING
+ * instead of waiting for the queries it sent: the queries are stored here
+ * along with the result of the action so far, and jobmgr calls collect()
+ * once they are all finished (see jobmgr_run_job()).
+ * The queries are run on the shared curlev handle, so they keep progressing
+ * while other jobs are being processed. */
+typedef struct _job_pending_t {
+    query_list_t *qrylist;
+    unsigned int nqueries;
+    void *ctx;
+    act_result_t ret;
+    act_result_t (*collect)(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, struct _job_pending_t *pending);
+} job_pending_t;
+
+static int job_pending_finished(const job_pending_t *pending) {
+    unsigned int i;
+
+    for(i=0; i<pending->nqueries; i++)
+	if(pending->qrylist[i].query_sent && !sxi_cbdata_is_finished(pending->qrylist[i].cbdata))
+	    return 0;
+    return 1;
+}
+
 static act_result_t force_phase_success(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
     unsigned int nnode, nnodes;
     nnodes = sx_nodelist_count(nodes);
@@ -881,6 +908,46 @@ static rc_ty filerev_from_jobdata_rev(sx_hashfs_t *hashfs, job_data_t *job_data,
     return sx_hashfs_getinfo_by_revision(hashfs, revision, filerev);
 }
 
+static act_result_t replicateblocks_collect(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, job_pending_t *pending) {
+    sxi_conns_t *clust = sx_hashfs_conns(hashfs);
+    query_list_t *qrylist = pending->qrylist;
+    act_result_t ret = pending->ret;
+    unsigned int i;
+
+    if(qrylist) {
+	for(i=0; i<pending->nqueries; i++) {
+	    if(qrylist[i].query_sent) {
+                long http_status = 0;
+		int rc = sxi_cbdata_wait(qrylist[i].cbdata, sxi_conns_get_curlev(clust), &http_status);
+		if(rc != -2) {
+		    if(rc == -1) {
+			WARN("Query failed with %ld", http_status);
+			action_raise_fail(ACT_RESULT_TEMPFAIL, 503, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
+		    } else if(http_status == 404) {
+			/* Syntactically invalid request (bad token or block size, etc) */
+			action_set_fail(ACT_RESULT_PERMFAIL, 400, "Internal error: replicate block request failed");
+		    } else if(http_status != 200)
+			action_raise_fail(http2actres(http_status), http_status, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
+		} else {
+		    CRIT("Failed to wait for query");
+		    action_set_fail(ACT_RESULT_PERMFAIL, 500, "Internal error in cluster communication");
+		}
+	    }
+	    free(sxi_cbdata_get_context(qrylist[i].cbdata));
+	}
+        query_list_free(qrylist, pending->nqueries);
+	pending->qrylist = NULL;
+    }
+
+    if(ret == ACT_RESULT_OK) {
+        for (i=0;i<sx_nodelist_count(nodes);i++) {
+    	    succeeded[i] = 1;
+        }
+    }
+
+    return ret;
+}
+
 typedef enum { RB_WAIT, RB_NOWAIT_BG } rb_caller;
 static act_result_t replicateblocks_common(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl, rb_caller caller) {
     sxi_conns_t *clust = sx_hashfs_conns(hashfs);
@@ -1156,40 +1223,24 @@ static act_result_t replicateblocks_common(sx_hashfs_t *hashfs, job_t job_id, jo
 	action_error(ACT_RESULT_TEMPFAIL, 500, "Replica not yet completed");
 
  action_failed:
-    if(qrylist) {
-	for(i=0; i<nqueries; i++) {
-	    if(qrylist[i].query_sent) {
-                long http_status = 0;
-		int rc = sxi_cbdata_wait(qrylist[i].cbdata, sxi_conns_get_curlev(clust), &http_status);
-		if(rc != -2) {
-		    if(rc == -1) {
-			WARN("Query failed with %ld", http_status);
-			action_raise_fail(ACT_RESULT_TEMPFAIL, 503, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
-		    } else if(http_status == 404) {
-			/* Syntactically invalid request (bad token or block size, etc) */
-			action_set_fail(ACT_RESULT_PERMFAIL, 400, "Internal error: replicate block request failed");
-		    } else if(http_status != 200)
-			action_raise_fail(http2actres(http_status), http_status, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
-		} else {
-		    CRIT("Failed to wait for query");
-		    action_set_fail(ACT_RESULT_PERMFAIL, 500, "Internal error in cluster communication");
-		}
-	    }
-	    free(sxi_cbdata_get_context(qrylist[i].cbdata));
-	}
-        query_list_free(qrylist, nqueries);
-    }
-
     free(mis);
 
-    if(ret == ACT_RESULT_OK) {
-        unsigned i;
-        for (i=0;i<sx_nodelist_count(nodes);i++) {
-    	    succeeded[i] = 1;
-        }
-    }
+    if(qrylist && job_data->pending) {
+	/* Let jobmgr pick up the push requests once they are complete */
+	job_data->pending->qrylist = qrylist;
+	job_data->pending->nqueries = nqueries;
+	job_data->pending->ret = ret;
+	job_data->pending->collect = replicateblocks_collect;
+	return ACT_RESULT_PENDING;
+    } else {
+	job_pending_t pending;
 
-    return ret;
+	memset(&pending, 0, sizeof(pending));
+	pending.qrylist = qrylist;
+	pending.nqueries = nqueries;
+	pending.ret = ret;
+	return replicateblocks_collect(hashfs, job_id, job_data, nodes, succeeded, fail_code, fail_msg, &pending);
+    }
 }
 
 static act_result_t replicateblocks_commit(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
@@ -1263,8 +1314,7 @@ static act_result_t replicateblocks_fg_commit(sx_hashfs_t *hashfs, job_t job_id,
     return ret;
 }
 
-static act_result_t replicateblocks_bg_commit(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
-    act_result_t ret = replicateblocks_common(hashfs, job_id, job_data, nodes, succeeded, fail_code, fail_msg, adjust_ttl, RB_NOWAIT_BG);
+static act_result_t replicateblocks_bg_done(sx_hashfs_t *hashfs, job_data_t *job_data, act_result_t ret) {
     int64_t tmpfile_id;
 
     if(ret != ACT_RESULT_OK)
@@ -1279,6 +1329,21 @@ static act_result_t replicateblocks_bg_commit(sx_hashfs_t *hashfs, job_t job_id,
     return ret;
 }
 
+static act_result_t replicateblocks_bg_collect(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, job_pending_t *pending) {
+    act_result_t ret = replicateblocks_collect(hashfs, job_id, job_data, nodes, succeeded, fail_code, fail_msg, pending);
+    return replicateblocks_bg_done(hashfs, job_data, ret);
+}
+
+static act_result_t replicateblocks_bg_commit(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
+    act_result_t ret = replicateblocks_common(hashfs, job_id, job_data, nodes, succeeded, fail_code, fail_msg, adjust_ttl, RB_NOWAIT_BG);
+
+    if(ret == ACT_RESULT_PENDING) {
+	job_data->pending->collect = replicateblocks_bg_collect;
+	return ret;
+    }
+    return replicateblocks_bg_done(hashfs, job_data, ret);
+}
+
 static act_result_t replicateblocks_bg_fail(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
     act_result_t ret = ACT_RESULT_OK;
     sx_hashfs_tmpinfo_t *mis = NULL;
@@ -1312,11 +1377,45 @@ static act_result_t replicateblocks_bg_fail(sx_hashfs_t *hashfs, job_t job_id, j
     return ret;
 }
 
+static act_result_t fileflush_remote_collect(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, job_pending_t *pending) {
+    sxi_conns_t *clust = sx_hashfs_conns(hashfs);
+    query_list_t *qrylist = pending->qrylist;
+    act_result_t ret = pending->ret;
+    unsigned int i;
+
+    if(qrylist) {
+	for(i=0; i<pending->nqueries; i++) {
+	    if(qrylist[i].query_sent) {
+                long http_status = 0;
+		int rc = sxi_cbdata_wait(qrylist[i].cbdata, sxi_conns_get_curlev(clust), &http_status);
+		if(rc != -2) {
+		    if(rc == -1) {
+			WARN("Query failed with %ld", http_status);
+			action_raise_fail(ACT_RESULT_TEMPFAIL, 503, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
+		    } else if(http_status != 200 && http_status != 410)
+			action_raise_fail(http2actres(http_status), http_status, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
+		    else
+			succeeded[i] = 1;
+		} else {
+		    CRIT("Failed to wait for query");
+		    action_set_fail(ACT_RESULT_PERMFAIL, 500, "Internal error in cluster communication");
+		}
+	    }
+	}
+        query_list_free(qrylist, pending->nqueries);
+	pending->qrylist = NULL;
+    }
+
+    sxi_query_free(pending->ctx);
+    pending->ctx = NULL;
+    return ret;
+}
+
 static act_result_t fileflush_remote(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl) {
     sxi_conns_t *clust = sx_hashfs_conns(hashfs);
     sxc_client_t *sx = sx_hashfs_client(hashfs);
     const sx_node_t *me = sx_hashfs_self(hashfs);
-    unsigned int i, nnodes;
+    unsigned int i, nnodes = 0;
     act_result_t ret = ACT_RESULT_OK;
     sx_hashfs_tmpinfo_t *mis = NULL;
     query_list_t *qrylist = NULL;
@@ -1413,31 +1512,26 @@ static act_result_t fileflush_remote(sx_hashfs_t *hashfs, job_t job_id, job_data
     }
 
  action_failed:
-    if(qrylist) {
-	for(i=0; i<nnodes; i++) {
-	    if(qrylist[i].query_sent) {
-                long http_status = 0;
-		int rc = sxi_cbdata_wait(qrylist[i].cbdata, sxi_conns_get_curlev(clust), &http_status);
-		if(rc != -2) {
-		    if(rc == -1) {
-			WARN("Query failed with %ld", http_status);
-			action_raise_fail(ACT_RESULT_TEMPFAIL, 503, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
-		    } else if(http_status != 200 && http_status != 410)
-			action_raise_fail(http2actres(http_status), http_status, sxi_cbdata_geterrmsg(qrylist[i].cbdata));
-		    else
-			succeeded[i] = 1;
-		} else {
-		    CRIT("Failed to wait for query");
-		    action_set_fail(ACT_RESULT_PERMFAIL, 500, "Internal error in cluster communication");
-		}
-	    }
-	}
-        query_list_free(qrylist, nnodes);
-    }
-
-    sxi_query_free(proto);
     free(mis);
-    return ret;
+
+    if(qrylist && job_data->pending) {
+	/* Let jobmgr pick up the propagate queries once they are complete */
+	job_data->pending->qrylist = qrylist;
+	job_data->pending->nqueries = nnodes;
+	job_data->pending->ctx = proto;
+	job_data->pending->ret = ret;
+	job_data->pending->collect = fileflush_remote_collect;
+	return ACT_RESULT_PENDING;
+    } else {
+	job_pending_t pending;
+
+	memset(&pending, 0, sizeof(pending));
+	pending.qrylist = qrylist;
+	pending.nqueries = nnodes;
+	pending.ctx = proto;
+	pending.ret = ret;
+	return fileflush_remote_collect(hashfs, job_id, job_data, nodes, succeeded, fail_code, fail_msg, &pending);
+    }
 }
 
 static act_result_t fileflush_local_common(sx_hashfs_t *hashfs, job_t job_id, job_data_t *job_data, const sx_nodelist_t *nodes, int *succeeded, int *fail_code, char *fail_msg, int *adjust_ttl, int keeptmp) {
@@ -2836,10 +2930,20 @@ static act_result_t blockrb_request(sx_hashfs_t *hashfs, job_t job_id, job_data_
 		break;
 
             /* FIXME: proper expiration time */
-	    rbdata[i].proto = sxi_hashop_proto_inuse_begin(sx);
-	    for(j=0; j<rbdata[i].nblocks; j++)
-		rbdata[i].proto = sxi_hashop_proto_inuse_hash(sx, rbdata[i].proto, rbdata[i].blocks[j]);
-	    rbdata[i].proto = sxi_hashop_proto_inuse_end(sx, rbdata[i].proto);
+	    if(sxi_host_has_feature(clust, sx_node_internal_addr(rbdata[i].node), SXI_FEATURE_HASHOP_BIN)) {
+		rbdata[i].proto = sxi_hashop_proto_inuse_bin(sx, rbdata[i].blocks, rbdata[i].nblocks);
+		if(rbdata[i].proto && rbdata[i].proto->content_len > UPLOAD_CHUNK_SIZE) {
+		    /* Too large for the remote body buffer, use the streamed JSON form */
+		    sxi_query_free(rbdata[i].proto);
+		    rbdata[i].proto = NULL;
+		}
+	    }
+	    if(!rbdata[i].proto) {
+		rbdata[i].proto = sxi_hashop_proto_inuse_begin(sx);
+		for(j=0; j<rbdata[i].nblocks; j++)
+		    rbdata[i].proto = sxi_hashop_proto_inuse_hash(sx, rbdata[i].proto, rbdata[i].blocks[j]);
+		rbdata[i].proto = sxi_hashop_proto_inuse_end(sx, rbdata[i].proto);
+	    }
 	    if(!rbdata[i].proto) {
 		FOREACH_BLOCK(i) {
 		    rbl_log(&rbdata[_qno].blocks[_bno]->hash, "inuse_query", 0, "Query allocation failure");
@@ -3672,11 +3776,31 @@ struct rplblocks {
     sx_hashfs_t *hashfs;
     sx_blob_t *b;
     uint8_t block[SX_BS_LARGE];
-    sx_block_meta_index_t lastgood;
-    unsigned int pos, itemsz, ngood;
+    uint8_t batch[UPLOAD_CHUNK_SIZE]; /* Received blocks of batchsz bytes, not stored yet */
+    sx_block_meta_index_t lastgood, batchlast;
+    unsigned int pos, itemsz, ngood, nbatch, batchsz;
     enum replace_state state;
 };
 
+/* Stores the blocks received so far and moves the resume point past them */
+static int rplblocks_flush(struct rplblocks *c) {
+    rc_ty s;
+
+    if(!c->nbatch)
+	return 0;
+    s = sx_hashfs_block_put_many(c->hashfs, c->batch, c->nbatch, c->batchsz, 0, FLOW_DEFAULT_UID); /* Flow is not actually used because of 0 replica */
+    if(s == OK) {
+	c->lastgood = c->batchlast;
+	c->ngood += c->nbatch;
+    }
+    c->nbatch = 0;
+    if(s != OK) {
+	WARN("Failed to store blocks");
+	return 1;
+    }
+    return 0;
+}
+
 static int rplblocks_cb(curlev_context_t *cbdata, void *ctx, const void *data, size_t size) {
     struct rplblocks *c = (struct rplblocks *)ctx;
     uint8_t *input = (uint8_t *)data;
@@ -3727,6 +3851,8 @@ static int rplblocks_cb(curlev_context_t *cbdata, void *ctx, const void *data, s
 		if(!strcmp(signature, "$THEEND$")) {
 		    if(size)
 			INFO("Spurious tail of %u bytes", (unsigned int)size);
+		    if(rplblocks_flush(c))
+			return 1;
 		    c->state = RPL_END;
 		    return 0;
 		} else if(!strcmp(signature, "$RESUMEFROM$")) {
@@ -3735,6 +3861,8 @@ static int rplblocks_cb(curlev_context_t *cbdata, void *ctx, const void *data, s
 			WARN("Invalid block index");
 			return 1;
 		    }
+		    if(rplblocks_flush(c))
+			return 1;
 		    c->lastgood = *bmi;
 		    c->state = RPL_TIMEOUT;
 		    if(size)
@@ -3814,14 +3942,15 @@ static int rplblocks_cb(curlev_context_t *cbdata, void *ctx, const void *data, s
 		    }
 		}
 
-		if(sx_hashfs_block_put(c->hashfs, c->block, c->itemsz, 0, FLOW_DEFAULT_UID)) { /* Flow is not actually used because of 0 replica */
-		    WARN("Failed to mod hash");
+		/* Blocks are stored in batches, one transaction per hash database */
+		if(c->nbatch && (c->itemsz != c->batchsz || (c->nbatch + 1) * c->batchsz > sizeof(c->batch)) && rplblocks_flush(c))
 		    return 1;
-		}
-		c->lastgood = *bmi;
+		memcpy(c->batch + c->nbatch * c->itemsz, c->block, c->itemsz);
+		c->batchsz = c->itemsz;
+		c->batchlast = *bmi;
+		c->nbatch++;
 		sx_blob_free(c->b);
 		c->b = NULL;
-		c->ngood++;
 		c->pos = 0;
 		c->state = RPL_HDRSIZE;
 	    }
@@ -3877,6 +4006,7 @@ static act_result_t replaceblocks_commit(sx_hashfs_t *hashfs, job_t job_id, job_
 	ctx->b = NULL;
 	ctx->pos = 0;
 	ctx->ngood = 0;
+	ctx->nbatch = 0;
 	ctx->state = RPL_HDRSIZE;
 
 	qret = sxi_cluster_query(clust, &hlist, REQ_GET, query, NULL, 0, NULL, rplblocks_cb, ctx);
@@ -3885,6 +4015,10 @@ static act_result_t replaceblocks_commit(sx_hashfs_t *hashfs, job_t job_id, job_
 	    free(ctx);
 	    action_error(ACT_RESULT_TEMPFAIL, 503, "Bad reply from node");
 	}
+	if(rplblocks_flush(ctx)) {
+	    free(ctx);
+	    action_error(ACT_RESULT_TEMPFAIL, 503, "Failed to store blocks");
+	}
 	if(ctx->state == RPL_END) {
 	    if(sx_hashfs_replace_setlastblock(hashfs, sx_node_uuid(source), NULL))
 		WARN("Replace setnode failed");
@@ -5390,6 +5524,7 @@ static act_result_t jobspawn_abort_and_undo(sx_hashfs_t *hashfs, job_t job_id, j
         slave_data.ptr = (void*)slave_job_data;
         slave_data.owner = job_data->owner;
         slave_data.op_expires_at = job_data->op_expires_at;
+        slave_data.pending = NULL;
 
         if(slave_job_type == JOBTYPE_VOLREP_FILES)
             ret = volrep_undo_common(hashfs, job_id, &slave_data, nodes, succeeded, fail_code, fail_msg, adjust_ttl, JOBTYPE_JOBSPAWN, phase, 1);
@@ -5602,6 +5737,7 @@ static act_result_t jobpoll_abort_and_undo(sx_hashfs_t *hashfs, job_t job_id, jo
         slave_data.ptr = (void*)slave_job_data;
         slave_data.owner = job_data->owner;
         slave_data.op_expires_at = job_data->op_expires_at;
+        slave_data.pending = NULL;
 
         if(slave_job_type == JOBTYPE_VOLREP_FILES)
             ret = volrep_undo_common(hashfs, job_id, &slave_data, nodes, succeeded, fail_code, fail_msg, adjust_ttl, JOBTYPE_JOBPOLL, phase, 1);
@@ -6543,6 +6679,7 @@ static rc_ty volrep_blocks_pull(sx_hashfs_t *hashfs, const sx_hashfs_volume_t *v
         ctx->b = NULL;
         ctx->pos = 0;
         ctx->ngood = 0;
+        ctx->nbatch = 0;
         ctx->state = RPL_HDRSIZE;
         qret = sxi_cluster_query(clust, &hlist, REQ_GET, query, NULL, 0, NULL, rplblocks_cb, ctx);
         free(query);
@@ -6552,6 +6689,11 @@ static rc_ty volrep_blocks_pull(sx_hashfs_t *hashfs, const sx_hashfs_volume_t *v
             msg_set_reason("Bad reply from node");
             goto volrep_blocks_pull_err;
         }
+        if(rplblocks_flush(ctx)) {
+            free(ctx);
+            msg_set_reason("Failed to store blocks");
+            goto volrep_blocks_pull_err;
+        }
 
         if(ctx->state == RPL_END) {
             if(sx_hashfs_volrep_setlastblock(hashfs, sx_node_uuid(source), NULL))
@@ -7157,6 +7299,7 @@ static job_data_t *make_jobdata(const void *data, unsigned int data_len, uint64_
     ret->len = data_len;
     ret->op_expires_at = op_expires_at;
     ret->owner = owner;
+    ret->pending = NULL;
     if(data_len)
 	memcpy(ret->ptr, data, data_len);
     return ret;
@@ -7174,6 +7317,33 @@ static void sighandler(int signum) {
 
 #define BATCH_ACT_NUM 64
 
+/* A job being run: up to jobmgr_concurrency of these are kept in flight,
+ * each waiting for the queries left running by its current batch */
+struct jobmgr_job_t {
+    /* The following items are filled in by:
+     * jobmgr_pick_job(): sets job_id, job_type, job_expired, job_failed, job_data (from the db)
+     * jobmgr_start_job(): job_failed gets updated if job fails or expires
+     * jobmgr_get_actions_batch(): sets act_phase and nacts then fills the targets and act_ids arrays
+     * jobmgr_execute_actions_batch(): act_succeeded, pending and fail_reason in case of failure
+     */
+    sx_nodelist_t *targets;
+    job_data_t *job_data;
+    job_pending_t pending;
+    int64_t act_ids[BATCH_ACT_NUM];
+    int act_succeeded[BATCH_ACT_NUM];
+    int job_expired, job_failed;
+    job_t job_id;
+    jobtype_t job_type;
+    unsigned int nacts;
+    int act_phase;
+    int adjust_ttl;
+    int nodelay_reschedule;
+    int http_status;
+    int inflight;
+    struct timeval started;
+    char fail_reason[JOB_FAIL_REASON_SIZE];
+};
+
 struct jobmgr_data_t {
     /* The following items are filled in once by jobmgr() */
     sx_hashfs_t *hashfs;
@@ -7187,69 +7357,36 @@ struct jobmgr_data_t {
     sqlite3_stmt *qdly;
     sqlite3_stmt *qlfe;
     sqlite3_stmt *qvbump;
+    sqlite3_stmt *qinflight_add;
+    sqlite3_stmt *qinflight_del;
     time_t next_vcheck;
+    struct jobmgr_job_t *jobs;
+    unsigned int njobs;
 
-    /* The following items are filled in by:
-     * jobmgr_process_queue(): sets job_id, job_type, job_expired, job_failed, job_data (from the db)
-     * jobmgr_run_job(): job_failed gets updated if job fails or expires
-     * jobmgr_get_actions_batch(): sets act_phase and nacts then fills the targets and act_ids arrays
-     * jobmgr_execute_actions_batch(): fail_reason in case of failure
-     */
-    sx_nodelist_t *targets;
-    job_data_t *job_data;
-    int64_t act_ids[BATCH_ACT_NUM];
-    int job_expired, job_failed;
-    job_t job_id;
-    jobtype_t job_type;
+    /* User and type of the last picked job, used to round robin the queue */
     sx_uid_t user;
-    unsigned int nacts;
-    int act_phase;
-    int adjust_ttl;
-    int nodelay_reschedule;
-    char fail_reason[JOB_FAIL_REASON_SIZE];
+    jobtype_t job_type;
 };
 
 
-static act_result_t jobmgr_execute_actions_batch(int *http_status, struct jobmgr_data_t *q) {
-    act_result_t act_res = ACT_RESULT_UNSET;
-    unsigned int nacts = q->nacts;
-    int act_succeeded[BATCH_ACT_NUM];
+static act_result_t jobmgr_finish_actions_batch(struct jobmgr_data_t *q, struct jobmgr_job_t *j, act_result_t act_res) {
+    unsigned int nacts = j->nacts;
 
-    memset(act_succeeded, 0, sizeof(act_succeeded));
-    *http_status = 0;
-    q->fail_reason[0] = '\0';
-    q->nodelay_reschedule = 0;
-
-    if(q->job_failed) {
-	if(q->act_phase == JOB_PHASE_REQUEST) {
-	    /* Nothing to (un)do */
-	    act_res = ACT_RESULT_OK;
-	} else if(q->act_phase == JOB_PHASE_COMMIT) {
-	    act_res = actions[q->job_type].fn_abort(q->hashfs, q->job_id, q->job_data, q->targets, act_succeeded, http_status, q->fail_reason, &q->adjust_ttl);
-	} else { /* act_phase == JOB_PHASE_DONE */
-	    act_res = actions[q->job_type].fn_undo(q->hashfs, q->job_id, q->job_data, q->targets, act_succeeded, http_status, q->fail_reason, &q->adjust_ttl);
-	}
+    if(j->job_failed) {
 	if(act_res == ACT_RESULT_NOTFAILED) {
 	    WARN("Job failed with GIVEUP; using TEMPFAIL instead");
 	    act_res = ACT_RESULT_TEMPFAIL;
 	}
-        if(act_res == ACT_RESULT_TEMPFAIL && q->job_expired) {
-            CRIT("Some undo action expired for job %lld.", (long long)q->job_id);
+        if(act_res == ACT_RESULT_TEMPFAIL && j->job_expired) {
+            CRIT("Some undo action expired for job %lld.", (long long)j->job_id);
             act_res = ACT_RESULT_OK;
         } else if(act_res == ACT_RESULT_PERMFAIL) {
-	    CRIT("Some undo action permanently failed for job %lld.", (long long)q->job_id);
+	    CRIT("Some undo action permanently failed for job %lld.", (long long)j->job_id);
 	    act_res = ACT_RESULT_OK;
 	}
-    } else {
-	if(q->act_phase == JOB_PHASE_REQUEST) {
-	    act_res = actions[q->job_type].fn_request(q->hashfs, q->job_id, q->job_data, q->targets, act_succeeded, http_status, q->fail_reason, &q->adjust_ttl);
-	} else { /* act_phase == JOB_PHASE_COMMIT */
-	    act_res = actions[q->job_type].fn_commit(q->hashfs, q->job_id, q->job_data, q->targets, act_succeeded, http_status, q->fail_reason, &q->adjust_ttl);
-	}
-	if(act_res == ACT_RESULT_NOTFAILED) {
-	    q->nodelay_reschedule = 1;
-	    act_res = ACT_RESULT_TEMPFAIL;
-	}
+    } else if(act_res == ACT_RESULT_NOTFAILED) {
+	j->nodelay_reschedule = 1;
+	act_res = ACT_RESULT_TEMPFAIL;
     }
     if(act_res != ACT_RESULT_OK && act_res != ACT_RESULT_TEMPFAIL && act_res != ACT_RESULT_PERMFAIL) {
 	WARN("Unknown action return code %d: changing to PERMFAIL", act_res);
@@ -7257,41 +7394,91 @@ static act_result_t jobmgr_execute_actions_batch(int *http_status, struct jobmgr
     }
 
     while(nacts--) { /* Bump phase of successful actions */
-	if(act_succeeded[nacts] || (q->job_failed && act_res == ACT_RESULT_OK)) {
-	    if(qbind_int64(q->qphs, ":act", q->act_ids[nacts]) ||
-	       qbind_int(q->qphs, ":phase", q->job_failed ? JOB_PHASE_FAIL : q->act_phase + 1) ||
+	if(j->act_succeeded[nacts] || (j->job_failed && act_res == ACT_RESULT_OK)) {
+	    if(qbind_int64(q->qphs, ":act", j->act_ids[nacts]) ||
+	       qbind_int(q->qphs, ":phase", j->job_failed ? JOB_PHASE_FAIL : j->act_phase + 1) ||
 	       qstep_noret(q->qphs))
-		WARN("Cannot advance action phase for %lld.%lld", (long long)q->job_id, (long long)q->act_ids[nacts]);
+		WARN("Cannot advance action phase for %lld.%lld", (long long)j->job_id, (long long)j->act_ids[nacts]);
 	    else
-		DEBUG("Action %lld advanced to phase %d", (long long)q->act_ids[nacts], q->job_failed ? JOB_PHASE_FAIL : q->act_phase + 1);
+		DEBUG("Action %lld advanced to phase %d", (long long)j->act_ids[nacts], j->job_failed ? JOB_PHASE_FAIL : j->act_phase + 1);
 	}
     }
 
     return act_res;
 }
 
-static int jobmgr_get_actions_batch(struct jobmgr_data_t *q) {
+/* Returns ACT_RESULT_PENDING if the batch left its queries in flight:
+ * the result is then obtained via jobmgr_collect_actions_batch() */
+static act_result_t jobmgr_execute_actions_batch(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    act_result_t act_res = ACT_RESULT_UNSET;
+
+    memset(j->act_succeeded, 0, sizeof(j->act_succeeded));
+    memset(&j->pending, 0, sizeof(j->pending));
+    j->http_status = 0;
+    j->fail_reason[0] = '\0';
+    j->nodelay_reschedule = 0;
+
+    if(j->job_failed) {
+	if(j->act_phase == JOB_PHASE_REQUEST) {
+	    /* Nothing to (un)do */
+	    act_res = ACT_RESULT_OK;
+	} else if(j->act_phase == JOB_PHASE_COMMIT) {
+	    act_res = actions[j->job_type].fn_abort(q->hashfs, j->job_id, j->job_data, j->targets, j->act_succeeded, &j->http_status, j->fail_reason, &j->adjust_ttl);
+	} else { /* act_phase == JOB_PHASE_DONE */
+	    act_res = actions[j->job_type].fn_undo(q->hashfs, j->job_id, j->job_data, j->targets, j->act_succeeded, &j->http_status, j->fail_reason, &j->adjust_ttl);
+	}
+    } else {
+	/* Only forward actions are allowed to leave their queries in flight */
+	j->job_data->pending = &j->pending;
+	if(j->act_phase == JOB_PHASE_REQUEST) {
+	    act_res = actions[j->job_type].fn_request(q->hashfs, j->job_id, j->job_data, j->targets, j->act_succeeded, &j->http_status, j->fail_reason, &j->adjust_ttl);
+	} else { /* act_phase == JOB_PHASE_COMMIT */
+	    act_res = actions[j->job_type].fn_commit(q->hashfs, j->job_id, j->job_data, j->targets, j->act_succeeded, &j->http_status, j->fail_reason, &j->adjust_ttl);
+	}
+	j->job_data->pending = NULL;
+	if(act_res == ACT_RESULT_PENDING) {
+	    if(j->pending.collect) {
+		DEBUG("Job %lld has got %u queries in flight", (long long)j->job_id, j->pending.nqueries);
+		return act_res;
+	    }
+	    WARN("Job %lld left queries in flight with no way to collect them", (long long)j->job_id);
+	    act_res = ACT_RESULT_PERMFAIL;
+	}
+    }
+
+    return jobmgr_finish_actions_batch(q, j, act_res);
+}
+
+static act_result_t jobmgr_collect_actions_batch(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    act_result_t act_res;
+
+    act_res = j->pending.collect(q->hashfs, j->job_id, j->job_data, j->targets, j->act_succeeded, &j->http_status, j->fail_reason, &j->pending);
+    memset(&j->pending, 0, sizeof(j->pending));
+    return jobmgr_finish_actions_batch(q, j, act_res);
+}
+
+static int jobmgr_get_actions_batch(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
     const sx_node_t *me = sx_hashfs_self(q->hashfs);
     unsigned int nacts;
     int r;
 
-    q->nacts = 0;
+    j->nacts = 0;
 
-    if(qbind_int64(q->qact, ":job", q->job_id) ||
-       qbind_int(q->qact, ":maxphase", q->job_failed ? JOB_PHASE_FAIL : JOB_PHASE_DONE)) {
-	WARN("Cannot lookup actions for job %lld", (long long)q->job_id);
+    if(qbind_int64(q->qact, ":job", j->job_id) ||
+       qbind_int(q->qact, ":maxphase", j->job_failed ? JOB_PHASE_FAIL : JOB_PHASE_DONE)) {
+	WARN("Cannot lookup actions for job %lld", (long long)j->job_id);
 	return -1;
     }
     r = qstep(q->qact);
     if(r == SQLITE_DONE) {
-	if(qbind_int64(q->qcpl, ":job", q->job_id) ||
+	if(qbind_int64(q->qcpl, ":job", j->job_id) ||
 	   qstep_noret(q->qcpl))
-	    WARN("Cannot set job %lld to complete", (long long)q->job_id);
+	    WARN("Cannot set job %lld to complete", (long long)j->job_id);
 	else
-	    DEBUG("No actions for job %lld", (long long)q->job_id);
+	    DEBUG("No actions for job %lld", (long long)j->job_id);
 	return 1; /* Job completed */
     } else if(r == SQLITE_ROW)
-	q->act_phase = sqlite3_column_int(q->qact, 1); /* Define the current batch phase */
+	j->act_phase = sqlite3_column_int(q->qact, 1); /* Define the current batch phase */
 
     for(nacts=0; nacts<BATCH_ACT_NUM; nacts++) {
 	sx_node_t *target;
@@ -7305,17 +7492,17 @@ static int jobmgr_get_actions_batch(struct jobmgr_data_t *q) {
 	    break; /* set batch_size and return success */
 
 	if(r != SQLITE_ROW) {
-	    WARN("Failed to retrieve actions for job %lld", (long long)q->job_id);
+	    WARN("Failed to retrieve actions for job %lld", (long long)j->job_id);
 	    return -1;
 	}
-	if(sqlite3_column_int(q->qact, 1) != q->act_phase)
+	if(sqlite3_column_int(q->qact, 1) != j->act_phase)
 	    break; /* set batch_size and return success */
 
 	act_id = sqlite3_column_int64(q->qact, 0);
 	ptr = sqlite3_column_blob(q->qact, 2);
 	plen = sqlite3_column_bytes(q->qact, 2);
 	if(plen != sizeof(uuid.binary)) {
-	    WARN("Bad action target for job %lld.%lld", (long long)q->job_id, (long long)act_id);
+	    WARN("Bad action target for job %lld.%lld", (long long)j->job_id, (long long)act_id);
 	    sqlite3_reset(q->qact);
 	    return -1;
 	}
@@ -7326,43 +7513,43 @@ static int jobmgr_get_actions_batch(struct jobmgr_data_t *q) {
 	/* else */
 	/*     target = sx_node_dup(node); */
 	if(!sx_node_cmp(me, target)) {
-	    rc = sx_nodelist_prepend(q->targets, target);
+	    rc = sx_nodelist_prepend(j->targets, target);
 	    if(nacts)
-		memmove(&q->act_ids[1], &q->act_ids[0], nacts * sizeof(act_id));
-	    q->act_ids[0] = act_id;
+		memmove(&j->act_ids[1], &j->act_ids[0], nacts * sizeof(act_id));
+	    j->act_ids[0] = act_id;
 	} else {
-	    rc = sx_nodelist_add(q->targets, target);
-	    q->act_ids[nacts] = act_id;
+	    rc = sx_nodelist_add(j->targets, target);
+	    j->act_ids[nacts] = act_id;
 	}
 	if(rc != OK) {
 	    WARN("Cannot add action target");
 	    sqlite3_reset(q->qact);
 	    return -1;
 	}
-	DEBUG("Action %lld (phase %d, target %s) loaded", (long long)act_id, q->act_phase, uuid.string);
+	DEBUG("Action %lld (phase %d, target %s) loaded", (long long)act_id, j->act_phase, uuid.string);
 	r = qstep(q->qact);
     }
 
     sqlite3_reset(q->qact);
-    q->nacts = nacts;
+    j->nacts = nacts;
     return 0;
 }
 
 
-static int set_job_failed(struct jobmgr_data_t *q, int result, const char *reason) {
+static int set_job_failed(struct jobmgr_data_t *q, struct jobmgr_job_t *j, int result, const char *reason) {
     if(qbegin(q->eventdb)) {
-	CRIT("Cannot set job %lld to failed: cannot start transaction", (long long)q->job_id);
+	CRIT("Cannot set job %lld to failed: cannot start transaction", (long long)j->job_id);
 	return -1;
     }
 
-    if(qbind_int64(q->qfail_children, ":job", q->job_id) ||
+    if(qbind_int64(q->qfail_children, ":job", j->job_id) ||
        qbind_int(q->qfail_children, ":res", result) ||
        qbind_text(q->qfail_children, ":reason", reason) ||
        qstep_noret(q->qfail_children))
 	goto setfailed_error;
 
 
-    if(qbind_int64(q->qfail_parent, ":job", q->job_id) ||
+    if(qbind_int64(q->qfail_parent, ":job", j->job_id) ||
        qbind_int(q->qfail_parent, ":res", result) ||
        qbind_text(q->qfail_parent, ":reason", reason) ||
        qstep_noret(q->qfail_parent))
@@ -7374,146 +7561,171 @@ static int set_job_failed(struct jobmgr_data_t *q, int result, const char *reaso
     return 0;
 
  setfailed_error:
-    CRIT("Cannot mark job %lld (and children) as failed", (long long)q->job_id);
+    CRIT("Cannot mark job %lld (and children) as failed", (long long)j->job_id);
     qrollback(q->eventdb);
     return -1;
 }
 
-static rc_ty adjust_job_ttl(struct jobmgr_data_t *q) {
-    if(!q)
+static rc_ty adjust_job_ttl(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    if(!q || !j)
         return EINVAL;
-    if(q->adjust_ttl) {
+    if(j->adjust_ttl) {
         char lifeadj[24];
 
         sqlite3_reset(q->qlfe);
-        snprintf(lifeadj, sizeof(lifeadj), "%d seconds", q->adjust_ttl);
-        if(qbind_int64(q->qlfe, ":job", q->job_id) ||
+        snprintf(lifeadj, sizeof(lifeadj), "%d seconds", j->adjust_ttl);
+        if(qbind_int64(q->qlfe, ":job", j->job_id) ||
            qbind_text(q->qlfe, ":ttldiff", lifeadj) ||
            qstep_noret(q->qlfe)) {
             return FAIL_EINTERNAL;
         } else
-            DEBUG("Lifetime of job %lld adjusted by %s", (long long)q->job_id, lifeadj);
+            DEBUG("Lifetime of job %lld adjusted by %s", (long long)j->job_id, lifeadj);
     }
     return OK;
 }
 
-static rc_ty get_failed_job_expiration_ttl(struct jobmgr_data_t *q) {
-    if(!q)
+static rc_ty get_failed_job_expiration_ttl(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    if(!q || !j)
         return EINVAL;
 
     /* Handle blocks replication jobs using sx_hashfs_job_file_timeout() */
-    if(q->job_type == JOBTYPE_REPLICATE_BLOCKS) {
+    if(j->job_type == JOBTYPE_REPLICATE_BLOCKS) {
 	sx_hashfs_tmpinfo_t *tmpinfo;
         int64_t tmpfile_id;
         rc_ty s;
 
-        if(!q->job_data || !q->job_data->ptr || q->job_data->len != sizeof(tmpfile_id))
+        if(!j->job_data || !j->job_data->ptr || j->job_data->len != sizeof(tmpfile_id))
             return FAIL_EINTERNAL;
 
-        memcpy(&tmpfile_id, q->job_data->ptr, q->job_data->len);
+        memcpy(&tmpfile_id, j->job_data->ptr, j->job_data->len);
 
         /* JOBTYPE_REPLICATE_BLOCKS contains a tempfile ID as job data. Use it to get the tempfile entry. */
         if((s = sx_hashfs_tmp_getinfo(q->hashfs, tmpfile_id, &tmpinfo, 0, 1)) != OK)
             return s;
-        q->adjust_ttl = sx_hashfs_job_file_timeout(q->hashfs, sx_nodelist_count(q->targets), tmpinfo->file_size);
+        j->adjust_ttl = sx_hashfs_job_file_timeout(q->hashfs, sx_nodelist_count(j->targets), tmpinfo->file_size);
         free(tmpinfo);
         return OK;
     }
 
-    if(q->job_type == JOBTYPE_JLOCK || q->job_type == JOBTYPE_DISTRIBUTION) {
-        q->adjust_ttl = JOB_NO_EXPIRY;
+    if(j->job_type == JOBTYPE_JLOCK || j->job_type == JOBTYPE_DISTRIBUTION) {
+        j->adjust_ttl = JOB_NO_EXPIRY;
     } else {
         /* Default timeout, common for all jobs besides the block replication one */
-        q->adjust_ttl = JOBMGR_UNDO_TIMEOUT * sx_nodelist_count(q->targets);
-        if(!q->adjust_ttl) /* in case sx_nodelist_count() returns 0 */
-            q->adjust_ttl = JOBMGR_UNDO_TIMEOUT;
+        j->adjust_ttl = JOBMGR_UNDO_TIMEOUT * sx_nodelist_count(j->targets);
+        if(!j->adjust_ttl) /* in case sx_nodelist_count() returns 0 */
+            j->adjust_ttl = JOBMGR_UNDO_TIMEOUT;
     }
 
     return OK;
 }
 
-static void jobmgr_run_job(struct jobmgr_data_t *q) {
-    int r;
+/* Handles the outcome of a batch of actions: returns 1 if the job is done
+ * for now (rescheduled or error), 0 to go on with the next batch */
+static int jobmgr_batch_done(struct jobmgr_data_t *q, struct jobmgr_job_t *j, act_result_t act_res) {
+    if(adjust_job_ttl(q, j) != OK)
+        WARN("Cannot adjust lifetime of job %lld", (long long)j->job_id);
+
+    /* Temporary failure: mark job as to-be-retried and stop processing it for now */
+    if(act_res == ACT_RESULT_TEMPFAIL) {
+	const char *delay;
+	if(j->nodelay_reschedule)
+	    delay = "0 seconds";
+	else if(j->job_type == JOBTYPE_FLUSH_FILE_REMOTE ||
+		j->job_type == JOBTYPE_FLUSH_FILE_LOCAL ||
+		j->job_type == JOBTYPE_REPLICATE_BLOCKS)
+	    delay = STRIFY(JOBMGR_DELAY_MIN) " seconds";
+	else
+	    delay = STRIFY(JOBMGR_DELAY_MAX) " seconds";
 
-    /* Reload distribution */
-    check_distribution(q->hashfs);
-    if(q->job_expired && !q->job_failed) {
-	/* FIXME: we could keep a trace of the reason of the last delay
-	 * which is stored in db in case of tempfail.
-	 * Of limited use but maybe nice to have */
-	if(set_job_failed(q, 500, "Cluster timeout"))
-	    return;
-	q->job_failed = 1;
-        /* Bump expiration time for abort/undo actions */
-        if(get_failed_job_expiration_ttl(q) != OK) {
-            WARN("Failed to determine expiration time for failed job %lld", (long long)q->job_id);
-            q->adjust_ttl = JOBMGR_UNDO_TIMEOUT;
-        }
-        DEBUG("Job %lld is now expired, bumping expiration time with %d seconds", (long long)q->job_id, q->adjust_ttl);
-        q->job_expired = 0;
+	if(qbind_int64(q->qdly, ":job", j->job_id) ||
+	   qbind_text(q->qdly, ":reason", j->fail_reason[0] ? j->fail_reason : "Unknown delay reason") ||
+	   qbind_text(q->qdly, ":delay", delay) ||
+	   qstep_noret(q->qdly))
+	    CRIT("Cannot reschedule job %lld (you are gonna see this again!)", (long long)j->job_id);
+	else
+	    DEBUG("Job %lld will be retried later", (long long)j->job_id);
+	return 1;
+    }
 
-        if(adjust_job_ttl(q) != OK)
-            WARN("Cannot adjust lifetime of expired job %lld", (long long)q->job_id);
+    /* Permanent failure: mark job as failed and go on (with cleanup actions) */
+    if(act_res == ACT_RESULT_PERMFAIL) {
+	const char *fail_reason = j->fail_reason[0] ? j->fail_reason : "Unknown failure";
+        if (!j->http_status)
+            WARN("Job failed but didn't set fail code, missing action_set_fail/action_error call?");
+	if(set_job_failed(q, j, j->http_status, fail_reason))
+	    return 1;
+	DEBUG("Job %lld failed: %s", (long long)j->job_id, fail_reason);
+	j->job_failed = 1;
     }
 
-    while(!terminate) {
-	act_result_t act_res;
-	int http_status;
+    /* Success: go on with the next batch */
+    return 0;
+}
+
+/* Runs the batches of actions of a job, starting with the one left in flight
+ * if any. Returns 1 if the job has got a batch in flight, 0 if it is
+ * complete or rescheduled */
+static int jobmgr_run_job(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    act_result_t act_res;
+    int r;
+
+    if(j->inflight) {
+	j->inflight = 0;
+	act_res = jobmgr_collect_actions_batch(q, j);
+	if(jobmgr_batch_done(q, j, act_res))
+	    goto run_job_out;
+    }
 
+    while(!terminate) {
 	/* Collect a batch of actions but just for the current phase */
-	sx_nodelist_empty(q->targets);
-	r = jobmgr_get_actions_batch(q);
+	sx_nodelist_empty(j->targets);
+	r = jobmgr_get_actions_batch(q, j);
 	if(r > 0) /* Job complete */
 	    break;
 	if(r < 0) { /* Error getting actions */
-	    WARN("Failed to collect actions for job %lld", (long long)q->job_id);
+	    WARN("Failed to collect actions for job %lld", (long long)j->job_id);
 	    break;
 	}
 
 	/* Execute actions */
-	q->adjust_ttl = 0;
-	act_res = jobmgr_execute_actions_batch(&http_status, q);
-
-        if(adjust_job_ttl(q) != OK)
-            WARN("Cannot adjust lifetime of job %lld", (long long)q->job_id);
-
-	/* Temporary failure: mark job as to-be-retried and stop processing it for now */
-	if(act_res == ACT_RESULT_TEMPFAIL) {
-	    const char *delay;
-	    if(q->nodelay_reschedule)
-		delay = "0 seconds";
-	    else if(q->job_type == JOBTYPE_FLUSH_FILE_REMOTE ||
-		    q->job_type == JOBTYPE_FLUSH_FILE_LOCAL ||
-		    q->job_type == JOBTYPE_REPLICATE_BLOCKS)
-		delay = STRIFY(JOBMGR_DELAY_MIN) " seconds";
-	    else
-		delay = STRIFY(JOBMGR_DELAY_MAX) " seconds";
-
-	    if(qbind_int64(q->qdly, ":job", q->job_id) ||
-	       qbind_text(q->qdly, ":reason", q->fail_reason[0] ? q->fail_reason : "Unknown delay reason") ||
-	       qbind_text(q->qdly, ":delay", delay) ||
-	       qstep_noret(q->qdly))
-		CRIT("Cannot reschedule job %lld (you are gonna see this again!)", (long long)q->job_id);
-	    else
-		DEBUG("Job %lld will be retried later", (long long)q->job_id);
-	    break;
+	j->adjust_ttl = 0;
+	act_res = jobmgr_execute_actions_batch(q, j);
+	if(act_res == ACT_RESULT_PENDING) {
+	    j->inflight = 1;
+	    return 1;
 	}
+	if(jobmgr_batch_done(q, j, act_res))
+	    break;
+    }
 
-	/* Permanent failure: mark job as failed and go on (with cleanup actions) */
-	if(act_res == ACT_RESULT_PERMFAIL) {
-	    const char *fail_reason = q->fail_reason[0] ? q->fail_reason : "Unknown failure";
-            if (!http_status)
-                WARN("Job failed but didn't set fail code, missing action_set_fail/action_error call?");
-	    if(set_job_failed(q, http_status, fail_reason))
-		break;
-	    DEBUG("Job %lld failed: %s", (long long)q->job_id, fail_reason);
-	    q->job_failed = 1;
-	}
+ run_job_out:
+    sx_nodelist_empty(j->targets); /* Explicit free, just in case */
+    return 0;
+}
 
-	/* Success: go on with the next batch */
+static int jobmgr_start_job(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    /* Reload distribution */
+    check_distribution(q->hashfs);
+    if(j->job_expired && !j->job_failed) {
+	/* FIXME: we could keep a trace of the reason of the last delay
+	 * which is stored in db in case of tempfail.
+	 * Of limited use but maybe nice to have */
+	if(set_job_failed(q, j, 500, "Cluster timeout"))
+	    return 0;
+	j->job_failed = 1;
+        /* Bump expiration time for abort/undo actions */
+        if(get_failed_job_expiration_ttl(q, j) != OK) {
+            WARN("Failed to determine expiration time for failed job %lld", (long long)j->job_id);
+            j->adjust_ttl = JOBMGR_UNDO_TIMEOUT;
+        }
+        DEBUG("Job %lld is now expired, bumping expiration time with %d seconds", (long long)j->job_id, j->adjust_ttl);
+        j->job_expired = 0;
+
+        if(adjust_job_ttl(q, j) != OK)
+            WARN("Cannot adjust lifetime of expired job %lld", (long long)j->job_id);
     }
 
-    sx_nodelist_empty(q->targets); /* Explicit free, just in case */
+    return jobmgr_run_job(q, j);
 }
 
 
@@ -7628,16 +7840,18 @@ static void check_version(struct jobmgr_data_t *q) {
     INFO("See http://www.skylable.com/products/sx/release/%s for upgrade instructions", rver.str);
 }
 
-static void jobmgr_process_queue(struct jobmgr_data_t *q, int forced) {
-    while(!terminate) {
-	const void *ptr;
-	unsigned int plen;
-	int r;
+/* Loads the next runnable job into j: returns 1 if a job was loaded, 0 if
+ * there are no more runnable jobs, -1 on error */
+static int jobmgr_pick_job(struct jobmgr_data_t *q, struct jobmgr_job_t *j, int forced) {
+    const void *ptr;
+    unsigned int plen;
+    int r;
 
+    while(!terminate) {
 	if(qbind_int64(q->qjob, ":prevuser", q->user) ||
 	   qbind_int(q->qjob, ":prevtype", q->job_type)) {
 	    WARN("Failed to bind qjob params");
-	    break;
+	    return -1;
 	}
 	r = qstep(q->qjob);
 	if(r == SQLITE_DONE && forced) {
@@ -7650,37 +7864,118 @@ static void jobmgr_process_queue(struct jobmgr_data_t *q, int forced) {
 	    if(r == SQLITE_DONE)
 		DEBUG("Triggered run without jobs");
 	}
-        forced = 0;
+	forced = 0;
 	if(r == SQLITE_DONE) {
 	    DEBUG("No more pending jobs");
-	    break; /* Stop processing jobs */
+	    return 0; /* Stop processing jobs */
 	}
 	if(r != SQLITE_ROW) {
 	    WARN("Failed to retrieve the next job to execute");
-	    break; /* Stop processing jobs */
+	    return -1; /* Stop processing jobs */
 	}
 
-	q->job_id = sqlite3_column_int64(q->qjob, 0);
-	q->job_type = sqlite3_column_int(q->qjob, 1);
+	j->job_id = sqlite3_column_int64(q->qjob, 0);
+	j->job_type = sqlite3_column_int(q->qjob, 1);
 	ptr = sqlite3_column_blob(q->qjob, 2);
 	plen = sqlite3_column_bytes(q->qjob, 2);
-	q->job_expired = sqlite3_column_int(q->qjob, 3);
-	q->job_failed = (sqlite3_column_int(q->qjob, 4) != 0);
+	j->job_expired = sqlite3_column_int(q->qjob, 3);
+	j->job_failed = (sqlite3_column_int(q->qjob, 4) != 0);
 	q->user = sqlite3_column_int64(q->qjob, 6);
-	q->job_data = make_jobdata(ptr, plen, sqlite3_column_int(q->qjob, 5), q->user);
+	q->job_type = j->job_type;
+	j->job_data = make_jobdata(ptr, plen, sqlite3_column_int(q->qjob, 5), q->user);
 	sqlite3_reset(q->qjob);
         current_job_status = 0;
 
-	if(!q->job_data) {
-	    WARN("Job %lld has got invalid data", (long long)q->job_id);
+	if(!j->job_data) {
+	    WARN("Job %lld has got invalid data", (long long)j->job_id);
 	    continue; /* Process next job */
 	}
 
-        DEBUG("Running job %lld (type %d, %s, %s)", (long long)q->job_id, q->job_type, q->job_expired?"expired":"not expired", q->job_failed?"failed":"not failed");
-	jobmgr_run_job(q);
-	free(q->job_data);
-	DEBUG("Finished running job %lld", (long long)q->job_id);
-	/* Process next job */
+	if(qbind_int64(q->qinflight_add, ":job", j->job_id) ||
+	   qstep_noret(q->qinflight_add)) {
+	    WARN("Cannot mark job %lld as running", (long long)j->job_id);
+	    free(j->job_data);
+	    j->job_data = NULL;
+	    return -1;
+	}
+
+	j->inflight = 0;
+	gettimeofday(&j->started, NULL);
+	DEBUG("Running job %lld (type %d, %s, %s)", (long long)j->job_id, j->job_type, j->job_expired?"expired":"not expired", j->job_failed?"failed":"not failed");
+	return 1;
+    }
+
+    return 0;
+}
+
+static void jobmgr_end_job(struct jobmgr_data_t *q, struct jobmgr_job_t *j) {
+    struct timeval now;
+
+    if(qbind_int64(q->qinflight_del, ":job", j->job_id) ||
+       qstep_noret(q->qinflight_del))
+	WARN("Cannot unmark job %lld as running", (long long)j->job_id);
+    free(j->job_data);
+    j->job_data = NULL;
+    gettimeofday(&now, NULL);
+    DEBUG("Finished running job %lld in %.3f seconds", (long long)j->job_id, timediff(&j->started, &now));
+}
+
+/* Keeps up to q->njobs jobs in flight: a job whose batch of actions left its
+ * queries running holds its slot until they complete, while the other slots
+ * pick up and run the next jobs.
+ * Jobs sharing a lock are never in flight at the same time (see qjob) */
+static void jobmgr_process_queue(struct jobmgr_data_t *q, int forced) {
+    curl_events_t *curlev = sxi_conns_get_curlev(sx_hashfs_conns(q->hashfs));
+    unsigned int i, inflight;
+    int r, more = 1, collect = 0;
+
+    while(1) {
+	inflight = 0;
+	for(i=0; i<q->njobs; i++) {
+	    struct jobmgr_job_t *j = &q->jobs[i];
+
+	    if(j->job_data) {
+		/* Resume the job once its queries are complete (or we are quitting) */
+		if(!collect && !terminate && !job_pending_finished(&j->pending)) {
+		    inflight++;
+		    continue;
+		}
+		if(jobmgr_run_job(q, j)) {
+		    inflight++;
+		    continue;
+		}
+		jobmgr_end_job(q, j);
+		more = 1; /* Children of this job may be runnable now */
+	    }
+
+	    while(more && !terminate) {
+		r = jobmgr_pick_job(q, j, forced);
+		forced = 0;
+		if(r <= 0) {
+		    more = 0;
+		    break;
+		}
+		if(jobmgr_start_job(q, j)) {
+		    inflight++;
+		    break;
+		}
+		jobmgr_end_job(q, j);
+	    }
+	}
+	collect = 0;
+
+	if(!inflight)
+	    break;
+
+	r = sxi_curlev_poll(curlev);
+	if(r) {
+	    /* Let the jobs handle the failure of their queries */
+	    if(r == -2)
+		WARN("No running queries with %u jobs in flight", inflight);
+	    else
+		WARN("Failed to poll for job queries: %s", sxc_geterrmsg(sx_hashfs_client(q->hashfs)));
+	    collect = 1;
+	}
     }
 
     if(!terminate)
@@ -7689,9 +7984,10 @@ static void jobmgr_process_queue(struct jobmgr_data_t *q, int forced) {
 
 
 int jobmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
-    sqlite3_stmt *q_vcheck = NULL;
+    sqlite3_stmt *q_vcheck = NULL, *q_inflight = NULL;
     struct jobmgr_data_t q;
     struct sigaction act;
+    unsigned int i;
 
     sigemptyset(&act.sa_mask);
     act.sa_flags = 0;
@@ -7702,15 +7998,30 @@ int jobmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
 
     memset(&q, 0, sizeof(q));
     q.hashfs = hashfs;
-    q.targets = sx_nodelist_new();
-    if(!q.targets) {
-	WARN("Cannot create target nodelist");
+    q.njobs = jobmgr_concurrency;
+    q.jobs = wrap_calloc(q.njobs, sizeof(*q.jobs));
+    if(!q.jobs) {
+	WARN("Cannot allocate job slots");
 	goto jobmgr_err;
     }
+    for(i=0; i<q.njobs; i++) {
+	q.jobs[i].targets = sx_nodelist_new();
+	if(!q.jobs[i].targets) {
+	    WARN("Cannot create target nodelist");
+	    goto jobmgr_err;
+	}
+    }
 
     q.eventdb = sx_hashfs_eventdb(q.hashfs);
 
-    if(qprep(q.eventdb, &q.qjob, "SELECT job, type, data, expiry_time < datetime('now'), result, strftime('%s',expiry_time), user FROM jobs WHERE complete = 0 AND sched_time <= strftime('%Y-%m-%d %H:%M:%f') AND NOT EXISTS (SELECT 1 FROM jobs AS subjobs WHERE subjobs.job = jobs.parent AND subjobs.complete = 0) ORDER BY CASE WHEN user > :prevuser THEN 0 ELSE 1 END, user, CASE WHEN type > :prevtype THEN 0 ELSE 1 END, type, sched_time LIMIT 1") || /* BTREE OK */
+    /* Jobs currently in flight along with the resource they lock (i.e. their lock without the type prefix) */
+    if(qprep(q.eventdb, &q_inflight, "CREATE TEMPORARY TABLE inflight (job INTEGER NOT NULL PRIMARY KEY, resource TEXT NULL)") || qstep_noret(q_inflight)) {
+	WARN("Failed to create the in flight jobs table");
+	goto jobmgr_err;
+    }
+    qnullify(q_inflight);
+
+    if(qprep(q.eventdb, &q.qjob, "SELECT job, type, data, expiry_time < datetime('now'), result, strftime('%s',expiry_time), user FROM jobs WHERE complete = 0 AND sched_time <= strftime('%Y-%m-%d %H:%M:%f') AND NOT EXISTS (SELECT 1 FROM jobs AS subjobs WHERE subjobs.job = jobs.parent AND subjobs.complete = 0) AND job NOT IN (SELECT job FROM inflight) AND (lock IS NULL OR ((lock NOT LIKE '$*$%' OR NOT EXISTS (SELECT 1 FROM inflight)) AND substr(lock, instr(substr(lock, 2), '$') + 2) NOT IN (SELECT resource FROM inflight WHERE resource IS NOT NULL))) ORDER BY CASE WHEN user > :prevuser THEN 0 ELSE 1 END, user, CASE WHEN type > :prevtype THEN 0 ELSE 1 END, type, sched_time LIMIT 1") || /* BTREE OK */
        qprep(q.eventdb, &q.qact, "SELECT id, phase, target, addr, internaladdr, capacity FROM actions WHERE job_id = :job AND phase < :maxphase ORDER BY phase") ||
        qprep(q.eventdb, &q.qfail_children, "WITH RECURSIVE descendents_of(jb) AS (SELECT job FROM jobs WHERE parent = :job UNION ALL SELECT job FROM jobs, descendents_of WHERE jobs.parent = descendents_of.jb) UPDATE jobs SET result = :res, reason = :reason, complete = 1, lock = NULL WHERE job IN (SELECT * FROM descendents_of) AND result = 0") ||
        qprep(q.eventdb, &q.qfail_parent, "UPDATE jobs SET result = :res, reason = :reason WHERE job = :job AND result = 0") ||
@@ -7719,6 +8030,8 @@ int jobmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
        qprep(q.eventdb, &q.qdly, "UPDATE jobs SET sched_time = strftime('%Y-%m-%d %H:%M:%f', 'now', :delay), reason = :reason WHERE job = :job") ||
        qprep(q.eventdb, &q.qlfe, "WITH RECURSIVE descendents_of(jb) AS (VALUES(:job) UNION ALL SELECT job FROM jobs, descendents_of WHERE jobs.parent = descendents_of.jb) UPDATE jobs SET expiry_time = datetime(expiry_time, :ttldiff)  WHERE job IN (SELECT * FROM descendents_of)") ||
        qprep(q.eventdb, &q.qvbump, "INSERT OR REPLACE INTO hashfs (key, value) VALUES ('next_version_check', datetime(:next, 'unixepoch'))") ||
+       qprep(q.eventdb, &q.qinflight_add, "INSERT INTO inflight (job, resource) SELECT job, substr(lock, instr(substr(lock, 2), '$') + 2) FROM jobs WHERE job = :job") ||
+       qprep(q.eventdb, &q.qinflight_del, "DELETE FROM inflight WHERE job = :job") ||
        qprep(q.eventdb, &q_vcheck, "SELECT strftime('%s', value) FROM hashfs WHERE key = 'next_version_check'"))
 	goto jobmgr_err;
 
@@ -7751,8 +8064,15 @@ int jobmgr(sxc_client_t *sx, sx_hashfs_t *hashfs, int pipe) {
     sqlite3_finalize(q.qdly);
     sqlite3_finalize(q.qlfe);
     sqlite3_finalize(q.qvbump);
+    sqlite3_finalize(q.qinflight_add);
+    sqlite3_finalize(q.qinflight_del);
     sqlite3_finalize(q_vcheck);
-    sx_nodelist_delete(q.targets);
+    sqlite3_finalize(q_inflight);
+    if(q.jobs) {
+	for(i=0; i<q.njobs; i++)
+	    sx_nodelist_delete(q.jobs[i].targets);
+	free(q.jobs);
+    }
     sx_hashfs_close(q.hashfs);
     return terminate ? EXIT_SUCCESS : EXIT_FAILURE;
 }
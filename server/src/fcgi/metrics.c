@@ -0,0 +1,229 @@
+/*
+ *  Copyright (C) 2015 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+#include "default.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "fcgi-utils.h"
+#include "metrics.h"
+#include "utils.h"
+#include "log.h"
+
+/* Request actions, as told apart by the request line: the reserved volume
+ * for the internal calls, the object type for the regular ones */
+static const char *actions[] = {
+    "other", "cluster", "volume", "file",
+    ".appendEntries", ".blockrevs", ".challenge", ".clusterMeta", ".clusterSettings",
+    ".data", ".dist", ".faulty", ".gc", ".jlock", ".jobspawn", ".metrics", ".mode",
+    ".pushto", ".replblk", ".replfl", ".requestVote", ".results", ".self", ".status",
+    ".sync", ".upgrade", ".upload", ".users", ".volrepblk", ".volsizes"
+};
+#define NACTIONS (sizeof(actions) / sizeof(actions[0]))
+#define ACTION_RESERVED 4
+
+static const char *methods[] = { "other", "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+#define NMETHODS (sizeof(methods) / sizeof(methods[0]))
+
+/* Upper bounds of the latency buckets, in microseconds; a last, unbounded,
+ * bucket collects the slower requests */
+static const uint64_t bucket_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+#define NBOUNDS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+
+struct metrics_cell {
+    uint64_t buckets[NBOUNDS + 1];
+    uint64_t usecs;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+/* Anonymous shared mapping set up by the master before forking the workers,
+ * which then update it with atomic adds only */
+static struct metrics_cell (*metrics)[NMETHODS];
+static struct timespec req_start;
+
+int metrics_init(void) {
+    void *m = mmap(NULL, sizeof(struct metrics_cell) * NACTIONS * NMETHODS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED) {
+	PWARN("Failed to map the request metrics");
+	return -1;
+    }
+    metrics = m;
+    return 0;
+}
+
+void metrics_request_begin(void) {
+    clock_gettime(CLOCK_MONOTONIC, &req_start);
+    fcgi_out_bytes = 0;
+    fcgi_in_bytes = 0;
+}
+
+static unsigned int request_action(void) {
+    const char *name = volume;
+    unsigned int i;
+
+    if(!volume)
+	return verb == VERB_UNSUP ? 0 : 1;
+    if(*volume != '.')
+	return path ? 3 : 2;
+    if(!strncmp(volume, ".upgrade", lenof(".upgrade")))
+	name = ".upgrade";
+    for(i = ACTION_RESERVED; i < NACTIONS; i++)
+	if(!strcmp(name, actions[i]))
+	    return i;
+    return 0;
+}
+
+void metrics_request_end(void) {
+    struct metrics_cell *cell;
+    struct timespec now;
+    uint64_t usecs;
+    unsigned int i;
+
+    if(!metrics)
+	return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - req_start.tv_sec) * 1000000LL + (now.tv_nsec - req_start.tv_nsec) / 1000;
+    for(i = 0; i < NBOUNDS; i++)
+	if(usecs <= bucket_bounds[i])
+	    break;
+
+    cell = &metrics[request_action()][verb < NMETHODS ? verb : 0];
+    __atomic_add_fetch(&cell->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cell->usecs, usecs, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cell->bytes_out, fcgi_out_bytes, __ATOMIC_RELAXED);
+    /* Not the Content-Length: the body may be rejected before it's read */
+    __atomic_add_fetch(&cell->bytes_in, fcgi_in_bytes, __ATOMIC_RELAXED);
+}
+
+/* FCGX_FPrintF() doesn't know about long longs */
+static void FMT_PRINTF(1,2) send_printf(const char *fmt, ...) {
+    char line[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    CGI_PUTS(line);
+}
+
+static void send_gauge(const char *name, const char *help, int64_t value) {
+    send_printf("# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", name, help, name, name, (long long)value);
+}
+
+void fcgi_metrics(void) {
+    const sx_nodelist_t *nodes;
+    int64_t a, b, c, d;
+    unsigned int i, j, k;
+
+    CGI_PUTS("Content-type: text/plain; version=0.0.4\r\n\r\n");
+    if(verb == VERB_HEAD)
+	return;
+
+    if(metrics) {
+	CGI_PUTS("# HELP sx_request_duration_seconds Time spent handling the request\n# TYPE sx_request_duration_seconds histogram\n");
+	for(i = 0; i < NACTIONS; i++) {
+	    for(j = 0; j < NMETHODS; j++) {
+		struct metrics_cell *cell = &metrics[i][j];
+		uint64_t buckets[NBOUNDS + 1], count = 0;
+		for(k = 0; k <= NBOUNDS; k++) {
+		    buckets[k] = __atomic_load_n(&cell->buckets[k], __ATOMIC_RELAXED);
+		    count += buckets[k];
+		}
+		if(!count)
+		    continue;
+		count = 0;
+		for(k = 0; k < NBOUNDS; k++) {
+		    count += buckets[k];
+		    send_printf("sx_request_duration_seconds_bucket{action=\"%s\",method=\"%s\",le=\"%g\"} %llu\n", actions[i], methods[j], bucket_bounds[k] / 1000000.0, (unsigned long long)count);
+		}
+		count += buckets[NBOUNDS];
+		send_printf("sx_request_duration_seconds_bucket{action=\"%s\",method=\"%s\",le=\"+Inf\"} %llu\n", actions[i], methods[j], (unsigned long long)count);
+		send_printf("sx_request_duration_seconds_sum{action=\"%s\",method=\"%s\"} %.6f\n", actions[i], methods[j], __atomic_load_n(&cell->usecs, __ATOMIC_RELAXED) / 1000000.0);
+		send_printf("sx_request_duration_seconds_count{action=\"%s\",method=\"%s\"} %llu\n", actions[i], methods[j], (unsigned long long)count);
+	    }
+	}
+	for(k = 0; k < 2; k++) {
+	    const char *name = k ? "sx_response_bytes_total" : "sx_request_bytes_total";
+	    send_printf("# HELP %s Bytes %s\n# TYPE %s counter\n", name, k ? "sent in the response bodies" : "received in the request bodies", name);
+	    for(i = 0; i < NACTIONS; i++) {
+		for(j = 0; j < NMETHODS; j++) {
+		    uint64_t bytes = __atomic_load_n(k ? &metrics[i][j].bytes_out : &metrics[i][j].bytes_in, __ATOMIC_RELAXED);
+		    if(bytes)
+			send_printf("%s{action=\"%s\",method=\"%s\"} %llu\n", name, actions[i], methods[j], (unsigned long long)bytes);
+		}
+	    }
+	}
+    }
+
+    if(sx_hashfs_stats_jobq(hashfs, &a, &b, &c) == OK) {
+	send_gauge("sx_jobq_system_jobs", "Pending system jobs", a);
+	send_gauge("sx_jobq_user_jobs", "Pending user jobs", b);
+	send_gauge("sx_jobq_lag_seconds", "Age of the oldest pending job", c);
+    }
+
+    nodes = sx_hashfs_all_nodes(hashfs, NL_NEXTPREV);
+    if(nodes && sx_nodelist_count(nodes)) {
+	static const char *blockq[][2] = {
+	    { "sx_blockq_ready", "Block transfers ready to be sent to the node" },
+	    { "sx_blockq_lag_seconds", "Age of the oldest ready block transfer to the node" },
+	    { "sx_blockq_held", "Block transfers to the node scheduled for later" },
+	    { "sx_blockq_unbumps", "Pending block reference removals on the node" }
+	};
+	int64_t *vals = wrap_malloc(sizeof(*vals) * 4 * sx_nodelist_count(nodes));
+	unsigned int nnodes;
+	if(vals) {
+	    for(nnodes = 0; nnodes < sx_nodelist_count(nodes); nnodes++) {
+		int64_t *v = &vals[nnodes * 4];
+		if(sx_hashfs_stats_blockq(hashfs, sx_node_uuid(sx_nodelist_get(nodes, nnodes)), &v[0], &v[1], &v[2], &v[3]) != OK)
+		    break;
+	    }
+	    for(k = 0; k < 4 && nnodes; k++) {
+		send_printf("# HELP %s %s\n# TYPE %s gauge\n", blockq[k][0], blockq[k][1], blockq[k][0]);
+		for(i = 0; i < nnodes; i++)
+		    send_printf("%s{node=\"%s\"} %lld\n", blockq[k][0], sx_node_uuid_str(sx_nodelist_get(nodes, i)), (long long)vals[i * 4 + k]);
+	    }
+	    free(vals);
+	}
+    }
+
+    if(sx_hashfs_stats_authcache(hashfs, &a, &b, &c, &d) == OK) {
+	CGI_PUTS("# HELP sx_authcache_lookups_total Lookups in the shared user and privilege cache\n# TYPE sx_authcache_lookups_total counter\n");
+	send_printf("sx_authcache_lookups_total{cache=\"user\",result=\"hit\"} %lld\n", (long long)a);
+	send_printf("sx_authcache_lookups_total{cache=\"user\",result=\"miss\"} %lld\n", (long long)b);
+	send_printf("sx_authcache_lookups_total{cache=\"priv\",result=\"hit\"} %lld\n", (long long)c);
+	send_printf("sx_authcache_lookups_total{cache=\"priv\",result=\"miss\"} %lld\n", (long long)d);
+    }
+}
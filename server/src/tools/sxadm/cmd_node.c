@@ -55,6 +55,7 @@ const char *node_args_info_full_help[] = {
   "\nNew node options:",
   "  -k, --cluster-key=FILE        File containing a pre-generated cluster\n                                  authentication token or stdin if \"-\" is\n                                  given (default autogenerate token).",
   "  -u, --cluster-uuid=UUID       The SX cluster UUID (default autogenerate\n                                  UUID).",
+  "      --data-dirs=DIR,DIR...    Comma separated list of directories (e.g. one\n                                  per disk) to spread the block data files\n                                  over (default STORAGE_PATH)",
   "\nCommon options:",
   "  -b, --batch-mode              Turn off interactive confirmations, progress\n                                  notifications and assume yes for all\n                                  questions",
   "  -H, --human-readable          Print human readable sizes  (default=off)",
@@ -83,11 +84,12 @@ init_help_array(void)
   node_args_info_help[14] = node_args_info_full_help[23];
   node_args_info_help[15] = node_args_info_full_help[24];
   node_args_info_help[16] = node_args_info_full_help[25];
-  node_args_info_help[17] = 0; 
+  node_args_info_help[17] = node_args_info_full_help[26];
+  node_args_info_help[18] = 0; 
   
 }
 
-const char *node_args_info_help[18];
+const char *node_args_info_help[19];
 
 typedef enum {ARG_NO
   , ARG_FLAG
@@ -131,6 +133,7 @@ void clear_given (struct node_args_info *args_info)
   args_info->move_db_given = 0 ;
   args_info->cluster_key_given = 0 ;
   args_info->cluster_uuid_given = 0 ;
+  args_info->data_dirs_given = 0 ;
   args_info->batch_mode_given = 0 ;
   args_info->human_readable_given = 0 ;
   args_info->debug_given = 0 ;
@@ -152,6 +155,8 @@ void clear_args (struct node_args_info *args_info)
   args_info->cluster_key_orig = NULL;
   args_info->cluster_uuid_arg = NULL;
   args_info->cluster_uuid_orig = NULL;
+  args_info->data_dirs_arg = NULL;
+  args_info->data_dirs_orig = NULL;
   args_info->human_readable_flag = 0;
   args_info->debug_flag = 0;
   args_info->owner_arg = NULL;
@@ -183,10 +188,11 @@ void init_args_info(struct node_args_info *args_info)
   args_info->move_db_help = node_args_info_full_help[17] ;
   args_info->cluster_key_help = node_args_info_full_help[19] ;
   args_info->cluster_uuid_help = node_args_info_full_help[20] ;
-  args_info->batch_mode_help = node_args_info_full_help[22] ;
-  args_info->human_readable_help = node_args_info_full_help[23] ;
-  args_info->debug_help = node_args_info_full_help[24] ;
-  args_info->owner_help = node_args_info_full_help[25] ;
+  args_info->data_dirs_help = node_args_info_full_help[21] ;
+  args_info->batch_mode_help = node_args_info_full_help[23] ;
+  args_info->human_readable_help = node_args_info_full_help[24] ;
+  args_info->debug_help = node_args_info_full_help[25] ;
+  args_info->owner_help = node_args_info_full_help[26] ;
   
 }
 
@@ -292,6 +298,8 @@ node_cmdline_parser_release (struct node_args_info *args_info)
   free_string_field (&(args_info->cluster_key_orig));
   free_string_field (&(args_info->cluster_uuid_arg));
   free_string_field (&(args_info->cluster_uuid_orig));
+  free_string_field (&(args_info->data_dirs_arg));
+  free_string_field (&(args_info->data_dirs_orig));
   free_string_field (&(args_info->owner_arg));
   free_string_field (&(args_info->owner_orig));
   
@@ -367,6 +375,8 @@ node_cmdline_parser_dump(FILE *outfile, struct node_args_info *args_info)
     write_into_file(outfile, "cluster-key", args_info->cluster_key_orig, 0);
   if (args_info->cluster_uuid_given)
     write_into_file(outfile, "cluster-uuid", args_info->cluster_uuid_orig, 0);
+  if (args_info->data_dirs_given)
+    write_into_file(outfile, "data-dirs", args_info->data_dirs_orig, 0);
   if (args_info->batch_mode_given)
     write_into_file(outfile, "batch-mode", 0, 0 );
   if (args_info->human_readable_given)
@@ -521,6 +531,11 @@ node_cmdline_parser_required2 (struct node_args_info *args_info, const char *pro
       fprintf (stderr, "%s: '--cluster-uuid' ('-u') option depends on option 'new'%s\n", prog_name, (additional_error ? additional_error : ""));
       error_occurred = 1;
     }
+  if (args_info->data_dirs_given && ! args_info->new_given)
+    {
+      fprintf (stderr, "%s: '--data-dirs' option depends on option 'new'%s\n", prog_name, (additional_error ? additional_error : ""));
+      error_occurred = 1;
+    }
 
   return error_occurred;
 }
@@ -684,6 +699,7 @@ node_cmdline_parser_internal (
         { "move-db",	1, NULL, 0 },
         { "cluster-key",	1, NULL, 'k' },
         { "cluster-uuid",	1, NULL, 'u' },
+        { "data-dirs",	1, NULL, 0 },
         { "batch-mode",	0, NULL, 'b' },
         { "human-readable",	0, NULL, 'H' },
         { "debug",	0, NULL, 'D' },
@@ -1009,6 +1025,20 @@ node_cmdline_parser_internal (
                 additional_error))
               goto failure;
           
+          }
+          /* Comma separated list of directories (e.g. one per disk) to spread the block data files over (default STORAGE_PATH).  */
+          else if (strcmp (long_options[option_index].name, "data-dirs") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->data_dirs_arg), 
+                 &(args_info->data_dirs_orig), &(args_info->data_dirs_given),
+                &(local_args_info.data_dirs_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "data-dirs", '-',
+                additional_error))
+              goto failure;
+          
           }
           /* Set ownership of storage to user[:group].  */
           else if (strcmp (long_options[option_index].name, "owner") == 0)
@@ -66,6 +66,9 @@ struct node_args_info
   char * cluster_uuid_arg;	/**< @brief The SX cluster UUID (default autogenerate UUID)..  */
   char * cluster_uuid_orig;	/**< @brief The SX cluster UUID (default autogenerate UUID). original value given at command line.  */
   const char *cluster_uuid_help; /**< @brief The SX cluster UUID (default autogenerate UUID). help description.  */
+  char * data_dirs_arg;	/**< @brief Comma separated list of directories (e.g. one per disk) to spread the block data files over (default STORAGE_PATH).  */
+  char * data_dirs_orig;	/**< @brief Comma separated list of directories (e.g. one per disk) to spread the block data files over (default STORAGE_PATH) original value given at command line.  */
+  const char *data_dirs_help; /**< @brief Comma separated list of directories (e.g. one per disk) to spread the block data files over (default STORAGE_PATH) help description.  */
   const char *batch_mode_help; /**< @brief Turn off interactive confirmations, progress notifications and assume yes for all questions help description.  */
   int human_readable_flag;	/**< @brief Print human readable sizes (default=off).  */
   const char *human_readable_help; /**< @brief Print human readable sizes help description.  */
@@ -94,6 +97,7 @@ struct node_args_info
   unsigned int move_db_given ;	/**< @brief Whether move-db was given.  */
   unsigned int cluster_key_given ;	/**< @brief Whether cluster-key was given.  */
   unsigned int cluster_uuid_given ;	/**< @brief Whether cluster-uuid was given.  */
+  unsigned int data_dirs_given ;	/**< @brief Whether data-dirs was given.  */
   unsigned int batch_mode_given ;	/**< @brief Whether batch-mode was given.  */
   unsigned int human_readable_given ;	/**< @brief Whether human-readable was given.  */
   unsigned int debug_given ;	/**< @brief Whether debug was given.  */
@@ -182,9 +182,63 @@ static int handle_owner(struct node_args_info *args) {
     return 0;
 }
 
+/* Splits --data-dirs and creates the missing directories, with the same
+ * ownership as the storage directory */
+static int prepare_data_dirs(struct node_args_info *args, char **list, const char ***dirs, unsigned int *ndirs) {
+    char *dir, *saveptr = NULL;
+    unsigned int n = 1;
+
+    *list = NULL;
+    *dirs = NULL;
+    *ndirs = 0;
+    if(!args->data_dirs_given)
+	return 0;
+
+    for(dir = args->data_dirs_arg; *dir; dir++)
+	if(*dir == ',')
+	    n++;
+    *list = strdup(args->data_dirs_arg);
+    *dirs = malloc(n * sizeof(**dirs));
+    if(!*list || !*dirs) {
+	printf("Out of memory\n");
+	return 1;
+    }
+
+    for(dir = strtok_r(*list, ",", &saveptr); dir; dir = strtok_r(NULL, ",", &saveptr)) {
+	if(*dir != '/') {
+	    printf("Data directory %s is not an absolute path\n", dir);
+	    return 1;
+	}
+	if(mkdir(dir, 0770) && errno != EEXIST) {
+	    printf("Cannot create data directory %s: %s\n", dir, strerror(errno));
+	    return 1;
+	}
+	if(args->owner_given) {
+	    uid_t uid;
+	    gid_t gid;
+	    if(parse_usergroup(args->owner_arg, &uid, &gid))
+		return 1;
+	    if(chown(dir, uid, gid)) {
+		printf("Can't set ownership of %s to %u:%u\n", dir, (unsigned int) uid, (unsigned int) gid);
+		return 1;
+	    }
+	}
+	(*dirs)[(*ndirs)++] = dir;
+    }
+    if(!*ndirs) {
+	printf("No data directory provided\n");
+	return 1;
+    }
+    return 0;
+}
+
 static int create_node(struct node_args_info *args) {
     struct token_pair_t auth;
     sx_uuid_t cluster_uuid;
+    const char **datadirs;
+    unsigned int ndatadirs;
+    char *datadirs_list;
+    rc_ty create_fail;
 
     if(args->cluster_uuid_given) {
 	if(uuid_from_string(&cluster_uuid, args->cluster_uuid_arg)) {
@@ -210,9 +264,20 @@ static int create_node(struct node_args_info *args) {
 	return 1;
     }
 
-    if(handle_owner(args))
+    if(prepare_data_dirs(args, &datadirs_list, &datadirs, &ndatadirs)) {
+	free(datadirs_list);
+	free(datadirs);
+	return 1;
+    }
+
+    if(handle_owner(args)) {
+	free(datadirs_list);
+	free(datadirs);
         return 1;
-    rc_ty create_fail = sx_storage_create(args->inputs[0], &cluster_uuid, auth.key, sizeof(auth.key));
+    }
+    create_fail = sx_storage_create(args->inputs[0], &cluster_uuid, auth.key, sizeof(auth.key), datadirs, ndatadirs);
+    free(datadirs_list);
+    free(datadirs);
     if(create_fail) {
 	printf("Failed to create storage for new node: %s\n", rc2str(create_fail));
 	return 1;
@@ -1250,6 +1315,30 @@ static int info_node(sxc_client_t *sx, const char *path, struct node_args_info *
     fmt_capa(dsk_used, capastr, sizeof(capastr), args->human_readable_flag);
     printf("Actual data size: %s\n", capastr);
 
+    if(sx_hashfs_device_count(h)) {
+	unsigned int i, ndevs = sx_hashfs_device_count(h);
+	printf("Data directories:\n");
+	for(i=0; i<ndevs; i++) {
+	    sx_hashfs_device_t dev;
+	    char availstr[32], sizestr[32];
+	    if(sx_hashfs_device_info(h, i, &dev) != OK) {
+		printf("Error while retrieving the data directory usage\n");
+		break;
+	    }
+	    fmt_capa(dev.data_size, capastr, sizeof(capastr), args->human_readable_flag);
+	    if(dev.fs_size > 0 && dev.fs_avail >= 0) {
+		fmt_capa(dev.fs_avail, availstr, sizeof(availstr), args->human_readable_flag);
+		fmt_capa(dev.fs_size, sizestr, sizeof(sizestr), args->human_readable_flag);
+		printf("\t %s: %u data files, %s used, %s of %s free (%u%% full)\n", dev.path, dev.datafiles, capastr, availstr, sizestr,
+		       (unsigned int)(100 - dev.fs_avail * 100 / dev.fs_size));
+	    } else
+		printf("\t %s: %u data files, %s used\n", dev.path, dev.datafiles, capastr);
+	    fmt_capa(dev.read_bytes, capastr, sizeof(capastr), args->human_readable_flag);
+	    fmt_capa(dev.write_bytes, sizestr, sizeof(sizestr), args->human_readable_flag);
+	    printf("\t   reads: %llu (%s), writes: %llu (%s)\n", (unsigned long long)dev.reads, capastr, (unsigned long long)dev.writes, sizestr);
+	}
+    }
+
     nodes = sx_hashfs_all_nodes(h, NL_NEXT);
     if(nodes && sx_nodelist_count(nodes)) {
 	unsigned int i, nnodes = sx_nodelist_count(nodes);
@@ -2026,17 +2115,24 @@ static void print_status(sxc_client_t *sx, int http_code, const sxi_node_status_
         printf("        Swap free: N/A\n");
 
     printf("    Queues:\n");
-    printf("        Events: %lld job(s) queued (%lld user, %lld system)\n",
+    printf("        Events: %lld job(s) queued (%lld user, %lld system)",
 	   (long long)(status->usrjobs + status->sysjobs),
 	   (long long)status->usrjobs, (long long)status->sysjobs);
+    if(status->joblag > 0)
+	printf(", lagging %llds behind", (long long)status->joblag);
+    printf("\n");
     if(status->nbq) {
 	printf("        Block operations:\n");
-	for(i=0; i<status->nbq; i++)
-	    printf("            - %s: %lld blocks to transfer (%lld ready, %lld held), %lld block revisions to unlink\n",
+	for(i=0; i<status->nbq; i++) {
+	    printf("            - %s: %lld blocks to transfer (%lld ready, %lld held), %lld block revisions to unlink",
 		   status->bqstat[i].node,
 		   (long long)status->bqstat[i].ready + (long long)status->bqstat[i].held,
 		   (long long)status->bqstat[i].ready, (long long)status->bqstat[i].held,
 		   (long long)status->bqstat[i].unbumps);
+	    if(status->bqstat[i].lag > 0)
+		printf(", lagging %llds behind", (long long)status->bqstat[i].lag);
+	    printf("\n");
+	}
     }
     printf("\n");
 }
@@ -2269,6 +2365,7 @@ static int gc_node(sxc_client_t *sx, const char *path, int force_expire)
     gc_slow_check = 0;
     rc_ty s = sx_hashfs_gc_periodic(hashfs, &term, force_expire ? -1 : GC_GRACE_PERIOD);
     s |= sx_hashfs_gc_unused_revisions(hashfs, &term);
+    s |= sx_hashfs_gc_candidates(hashfs, &term);
     s |= sx_hashfs_gc_slow(hashfs, &term);
     sx_hashfs_close(hashfs);
     return s == OK ? 0 : 1;
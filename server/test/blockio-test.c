@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2015 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+/* Exercises the block I/O queue on a data file in a scratch directory
+ * (TMPDIR or /tmp); run with --debug to get the spam */
+
+#include "default.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "blockio.h"
+#include "log.h"
+#include "init.h"
+
+#define GTFO(...) do { CRIT(__VA_ARGS__); goto out; } while(0)
+
+#define BS 4096
+#define NBLOCKS 37 /* more than the queue depth, not a multiple of it */
+#define DEPTH 8
+
+static uint8_t wbuf[NBLOCKS][BS], rbuf[NBLOCKS][BS];
+
+/* Two runs of contiguous slots with a hole in between */
+static unsigned int slot_of(unsigned int i) {
+    return i < NBLOCKS / 2 ? i : i + 3;
+}
+
+static int write_all(sx_blockio_t *io, int fd) {
+    unsigned int i;
+    for(i = 0; i < NBLOCKS; i++)
+	if(sx_blockio_write(io, fd, wbuf[i], BS, (uint64_t)slot_of(i) * BS))
+	    return -1;
+    return sx_blockio_submit(io);
+}
+
+static int read_all(sx_blockio_t *io, int fd) {
+    unsigned int i;
+    memset(rbuf, 0, sizeof(rbuf));
+    /* Queue in reverse order, completions may come in any order anyway */
+    for(i = NBLOCKS; i--; )
+	if(sx_blockio_read(io, fd, rbuf[i], BS, (uint64_t)slot_of(i) * BS))
+	    return -1;
+    if(sx_blockio_submit(io))
+	return -1;
+    return memcmp(wbuf, rbuf, sizeof(wbuf)) ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    sxc_client_t *sx = sx_init(NULL, NULL, NULL, 0, argc, argv);
+    sx_blockio_t *io = NULL;
+    const char *tmp = getenv("TMPDIR");
+    char dir[1024] = "", file[1100];
+    unsigned int i, j;
+    int fd = -1, ret = 1, status;
+    pid_t pid;
+
+    if(!sx)
+	GTFO("Failed to init library");
+
+    if(argc == 2 && !strcmp(argv[1], "--debug"))
+	log_setminlevel(sx, SX_LOG_DEBUG);
+
+    snprintf(dir, sizeof(dir), "%s/blockio-test-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if(!mkdtemp(dir)) {
+	CRIT("Failed to create scratch directory %s: %s", dir, strerror(errno));
+	dir[0] = '\0';
+	goto out;
+    }
+    snprintf(file, sizeof(file), "%s/datafile", dir);
+    fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+	GTFO("Failed to create %s: %s", file, strerror(errno));
+
+    if(!(io = sx_blockio_new(DEPTH)))
+	GTFO("Failed to create the I/O queue");
+    INFO("Block I/O backend: %s", sx_blockio_backend(io));
+
+    for(i = 0; i < NBLOCKS; i++)
+	for(j = 0; j < BS; j++)
+	    wbuf[i][j] = (i * 131 + j) & 0xff;
+
+    if(write_all(io, fd))
+	GTFO("Batched write failed: %s", strerror(errno));
+    if(read_all(io, fd))
+	GTFO("Batched read returned bad data");
+
+    /* An empty submission is a no-op */
+    if(sx_blockio_submit(io))
+	GTFO("Empty submission failed");
+
+    /* Reading past the end of file must fail */
+    if(sx_blockio_read(io, fd, rbuf[0], BS, (uint64_t)(slot_of(NBLOCKS - 1) + 1) * BS))
+	GTFO("Failed to queue read");
+    if(!sx_blockio_submit(io))
+	GTFO("Read past EOF did not fail");
+
+    /* A reset queue does not perform anything */
+    if(sx_blockio_read(io, -1, rbuf[0], BS, 0) != -1)
+	GTFO("Bad file descriptor accepted");
+    if(sx_blockio_write(io, fd, rbuf[0], BS, 0))
+	GTFO("Failed to queue write");
+    sx_blockio_reset(io);
+    if(sx_blockio_submit(io) || read_all(io, fd))
+	GTFO("Reset queue was performed");
+
+    /* A forked child must be able to use the inherited handle */
+    pid = fork();
+    if(pid < 0)
+	GTFO("fork failed: %s", strerror(errno));
+    if(!pid) {
+	for(i = 0; i < NBLOCKS; i++)
+	    memset(wbuf[i], 0xff - i, BS);
+	_exit(write_all(io, fd) || read_all(io, fd) ? 1 : 0);
+    }
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+	GTFO("Child process failed");
+    for(i = 0; i < NBLOCKS; i++)
+	memset(wbuf[i], 0xff - i, BS);
+    if(read_all(io, fd))
+	GTFO("Data written by the child does not match");
+
+    INFO("All tests passed");
+    ret = 0;
+
+ out:
+    sx_blockio_free(io);
+    if(fd >= 0) {
+	close(fd);
+	unlink(file);
+    }
+    if(*dir)
+	rmdir(dir);
+    sx_done(&sx);
+    return ret;
+}
@@ -0,0 +1,592 @@
+/*
+ *  Copyright (C) 2012-2015 Skylable Ltd. <info-copyright@skylable.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *  Special exception for linking this software with OpenSSL:
+ *
+ *  In addition, as a special exception, Skylable Ltd. gives permission to
+ *  link the code of this program with the OpenSSL library and distribute
+ *  linked combinations including the two. You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  OpenSSL. You may extend this exception to your version of the program,
+ *  but you are not obligated to do so. If you do not wish to do so, delete
+ *  this exception statement from your version.
+ */
+
+/* Micro benchmarks for the hashfs storage primitives.
+ *
+ * A scratch single node storage is created and activated, then each
+ * primitive is timed at every block size (and dedup ratio, where that
+ * makes sense). Results are printed to stdout as a JSON document so that
+ * runs can be compared between commits; logging goes to stderr.
+ *
+ * usage: hashfs-bench [--debug] [--ops N] [--list N]... [--keep] [scratch-dir]
+ * or from the build tree: make bench BENCHFLAGS="--ops 5000"
+ *
+ * Each --list N grows a separate set of empty files to N entries and times
+ * a recursive and a fake dir listing over it. Populating goes through
+ * createfile_commit, so large sets (10M and up) take a long while to build;
+ * the listing benchmarks only run when asked for.
+ */
+
+#include "default.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "hashfs.h"
+#include "nodes.h"
+#include "utils.h"
+#include "log.h"
+#include "init.h"
+#include "../libsxclient/src/misc.h"
+#include "../libsxclient/src/vcrypto.h"
+
+#define GTFO(...) do { CRIT(__VA_ARGS__); goto out; } while(0)
+
+#define BENCH_VOLUME "bench"
+#define BENCH_DEFAULT_OPS 2000
+/* Caps the amount of data written per run at each block size */
+#define BENCH_MAX_BYTES (256 * 1024 * 1024)
+#define BENCH_FILES 64
+#define BENCH_LIST_MAX 8
+#define BENCH_LIST_DIRS 1000
+/* Latency samples kept per result, later ops only count towards the rate */
+#define BENCH_MAX_SAMPLES (1024 * 1024)
+
+static const unsigned int bench_bs[] = { SX_BS_SMALL, SX_BS_MEDIUM, SX_BS_LARGE };
+/* File sizes which size_to_blocks() maps to each of the block sizes above */
+static const int64_t bench_fsize[] = { 64 * 1024, 1024 * 1024, 130 * 1024 * 1024 };
+static const unsigned int bench_dedup[] = { 0, 50, 90 };
+
+struct bench_stat {
+    double *lat;
+    double total;
+    unsigned int n, max;
+    uint64_t ops;
+    uint64_t bytes;
+};
+
+static int first_result = 1;
+
+static int timing_init(struct bench_stat *st, unsigned int max) {
+    memset(st, 0, sizeof(*st));
+    st->lat = malloc(max * sizeof(*st->lat));
+    if(!st->lat)
+	return -1;
+    st->max = max;
+    return 0;
+}
+
+static void timing_add(struct bench_stat *st, const struct timeval *t1, const struct timeval *t2, uint64_t bytes) {
+    double lat = sxi_timediff(t2, t1);
+
+    if(st->n < st->max)
+	st->lat[st->n++] = lat;
+    st->ops++;
+    st->total += lat;
+    st->bytes += bytes;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static double percentile(const struct bench_stat *st, unsigned int pct) {
+    unsigned int i;
+    if(!st->n)
+	return 0;
+    i = (st->n * pct + 99) / 100;
+    if(i)
+	i--;
+    return st->lat[i];
+}
+
+/* Prints one result object and releases the stat; rates only account for
+ * the time spent inside the measured call, not for the test data setup */
+static void timing_report(struct bench_stat *st, const char *name, unsigned int bs, int dedup) {
+    double elapsed = st->total > 0 ? st->total : 1e-9;
+
+    qsort(st->lat, st->n, sizeof(*st->lat), cmp_double);
+
+    printf("%s\n    {\"name\":\"%s\",\"block_size\":%u,", first_result ? "" : ",", name, bs);
+    if(dedup >= 0)
+	printf("\"dedup\":%.2f,", dedup / 100.0);
+    else
+	printf("\"dedup\":null,");
+    printf("\"ops\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.2f,\"p50_usec\":%.2f,\"p99_usec\":%.2f,\"bytes_per_sec\":%.2f}",
+	   (unsigned long long)st->ops, elapsed, st->ops / elapsed, percentile(st, 50) * 1000000, percentile(st, 99) * 1000000, st->bytes / elapsed);
+    fflush(stdout);
+    first_result = 0;
+    free(st->lat);
+    st->lat = NULL;
+}
+
+/* Unique content for block number idx; seq keeps separate runs apart */
+static void fill_block(uint8_t *buf, unsigned int bs, uint64_t seq, uint64_t idx) {
+    unsigned int i;
+    uint64_t x = (seq << 40) ^ (idx + 1) ^ ((uint64_t)bs << 20);
+
+    for(i = 0; i + sizeof(x) <= bs; i += sizeof(x)) {
+	/* xorshift64 */
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	memcpy(buf + i, &x, sizeof(x));
+    }
+}
+
+static int make_revision(sxc_client_t *sx, char *rev, sx_hash_t *revid) {
+    struct timeval tv;
+    uint8_t rnd[TOKEN_RAND_BYTES];
+
+    gettimeofday(&tv, NULL);
+    if(sx_hashfs_timeval2str(&tv, rev) || sxi_rand_pseudo_bytes(rnd, sizeof(rnd)))
+	return -1;
+    rev[REV_TIME_LEN] = ':';
+    bin2hex(rnd, sizeof(rnd), rev + REV_TIME_LEN + 1, TOKEN_RAND_BYTES * 2 + 1);
+    return sx_unique_fileid(sx, rev, revid);
+}
+
+static int rmtree_cb(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+struct bench_ctx {
+    sxc_client_t *sx;
+    sx_hashfs_t *h;
+    sx_uuid_t cluster;
+    const sx_hashfs_volume_t *vol;
+    uint8_t user[AUTH_UID_LEN];
+    int64_t uid;
+    unsigned int ops;
+    uint64_t seq;
+    uint8_t *buf;
+    sx_hash_t *hashes;
+    uint64_t list_files;
+};
+
+/* block_put at the given dedup ratio; hashes[] gets the content of every put */
+static int bench_block_put(struct bench_ctx *c, unsigned int bs, unsigned int nops, unsigned int dedup) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    unsigned int i, uniq = 0;
+
+    if(timing_init(&st, nops))
+	return -1;
+    c->seq++;
+    for(i = 0; i < nops; i++) {
+	uint64_t idx;
+	if(uniq && i % 100 < dedup)
+	    idx = (i * 2654435761U) % uniq;
+	else
+	    idx = uniq++;
+	fill_block(c->buf, bs, c->seq, idx);
+	if(sx_hashfs_hash_buf(c->cluster.string, strlen(c->cluster.string), c->buf, bs, &c->hashes[i])) {
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t1, NULL);
+	if(sx_hashfs_block_put(c->h, c->buf, bs, 1, c->uid) != OK) {
+	    CRIT("block_put failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t2, NULL);
+	timing_add(&st, &t1, &t2, bs);
+    }
+    timing_report(&st, "block_put", bs, dedup);
+    return 0;
+}
+
+static int bench_block_get(struct bench_ctx *c, unsigned int bs, unsigned int nops) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    const uint8_t *block;
+    unsigned int i;
+
+    if(timing_init(&st, nops))
+	return -1;
+    for(i = 0; i < nops; i++) {
+	gettimeofday(&t1, NULL);
+	if(sx_hashfs_block_get(c->h, bs, &c->hashes[(i * 2654435761U) % nops], &block) != OK) {
+	    CRIT("block_get failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t2, NULL);
+	timing_add(&st, &t1, &t2, bs);
+    }
+    timing_report(&st, "block_get", bs, -1);
+    return 0;
+}
+
+/* Presence checks where dedup percent of the hashes are stored */
+static int bench_hashop(struct bench_ctx *c, unsigned int bs, unsigned int nops, unsigned int dedup) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    unsigned int i;
+    sx_hash_t missing;
+    int present;
+
+    if(timing_init(&st, nops))
+	return -1;
+    for(i = 0; i < nops; i++) {
+	const sx_hash_t *hash = &c->hashes[i];
+	if(i % 100 >= dedup) {
+	    fill_block(c->buf, 64, ~c->seq, i);
+	    if(sx_hashfs_hash_buf(NULL, 0, c->buf, 64, &missing)) {
+		free(st.lat);
+		return -1;
+	    }
+	    hash = &missing;
+	}
+	gettimeofday(&t1, NULL);
+	if(sx_hashfs_hashop_perform(c->h, bs, 1, HASHOP_CHECK, hash, NULL, NULL, NULL, 0, &present) != OK) {
+	    CRIT("hashop_perform failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t2, NULL);
+	timing_add(&st, &t1, &t2, 0);
+    }
+    timing_report(&st, "hashop_perform", bs, dedup);
+    return 0;
+}
+
+static int bench_gettoken(struct bench_ctx *c, unsigned int bs, int64_t fsize, unsigned int nblocks) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    const char *token;
+    char name[64];
+    unsigned int i, j;
+    rc_ty s;
+
+    if(timing_init(&st, BENCH_FILES))
+	return -1;
+    for(i = 0; i < BENCH_FILES; i++) {
+	snprintf(name, sizeof(name), "tmp/%u/%u", bs, i);
+	if(sx_hashfs_putfile_begin(c->h, c->uid, BENCH_VOLUME, name, NULL) != OK) {
+	    CRIT("putfile_begin failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	for(j = 0; j < nblocks; j++)
+	    if(sx_hashfs_putfile_putblock(c->h, &c->hashes[(i + j) % c->ops]) != OK)
+		break;
+	if(j < nblocks) {
+	    sx_hashfs_putfile_end(c->h);
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t1, NULL);
+	s = sx_hashfs_putfile_gettoken(c->h, c->user, fsize, 0, &token, NULL, NULL);
+	gettimeofday(&t2, NULL);
+	sx_hashfs_putfile_end(c->h);
+	if(s != OK) {
+	    CRIT("putfile_gettoken failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	timing_add(&st, &t1, &t2, 0);
+    }
+    timing_report(&st, "putfile_gettoken", bs, -1);
+    return 0;
+}
+
+static int bench_createfile(struct bench_ctx *c, unsigned int bs, int64_t fsize, unsigned int nblocks) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    char name[64], rev[REV_LEN + 1];
+    sx_hash_t revid;
+    unsigned int i, j;
+    rc_ty s;
+
+    if(timing_init(&st, BENCH_FILES))
+	return -1;
+    for(i = 0; i < BENCH_FILES; i++) {
+	snprintf(name, sizeof(name), "files/%u/%u", bs, i);
+	if(make_revision(c->sx, rev, &revid)) {
+	    free(st.lat);
+	    return -1;
+	}
+	if(sx_hashfs_createfile_begin(c->h) != OK) {
+	    free(st.lat);
+	    return -1;
+	}
+	for(j = 0; j < nblocks; j++)
+	    if(sx_hashfs_putfile_putblock(c->h, &c->hashes[(i + j) % c->ops]) != OK)
+		break;
+	if(j < nblocks) {
+	    sx_hashfs_createfile_end(c->h);
+	    free(st.lat);
+	    return -1;
+	}
+	gettimeofday(&t1, NULL);
+	s = sx_hashfs_createfile_commit(c->h, c->vol, name, rev, &revid, fsize, 0);
+	gettimeofday(&t2, NULL);
+	if(s != OK) {
+	    CRIT("createfile_commit failed: %s", msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	timing_add(&st, &t1, &t2, 0);
+    }
+    timing_report(&st, "createfile_commit", bs, -1);
+    return 0;
+}
+
+/* Each list_first/list_next step counts as an op */
+static int bench_list(struct bench_ctx *c, unsigned int bs) {
+    const sx_hashfs_file_t *file;
+    struct bench_stat st;
+    struct timeval t1, t2;
+    char pattern[64];
+    rc_ty s;
+
+    if(timing_init(&st, BENCH_FILES + 1))
+	return -1;
+    snprintf(pattern, sizeof(pattern), "files/%u/", bs);
+    gettimeofday(&t1, NULL);
+    for(s = sx_hashfs_list_first(c->h, c->vol, pattern, &file, 1, NULL, 0); s == OK; s = sx_hashfs_list_next(c->h)) {
+	gettimeofday(&t2, NULL);
+	timing_add(&st, &t1, &t2, 0);
+	t1 = t2;
+    }
+    if(s != ITER_NO_MORE) {
+	CRIT("Listing failed: %s", msg_get_reason());
+	free(st.lat);
+	return -1;
+    }
+    timing_report(&st, "list_first_next", bs, -1);
+    return 0;
+}
+
+/* Adds empty files to the list set until it holds count entries */
+static int bench_list_populate(struct bench_ctx *c, uint64_t count) {
+    char name[64], rev[REV_LEN + 1];
+    sx_hash_t revid;
+    rc_ty s;
+
+    for(; c->list_files < count; c->list_files++) {
+	snprintf(name, sizeof(name), "list/%03u/%llu", (unsigned int)(c->list_files % BENCH_LIST_DIRS), (unsigned long long)c->list_files);
+	if(make_revision(c->sx, rev, &revid) || sx_hashfs_createfile_begin(c->h) != OK)
+	    return -1;
+	s = sx_hashfs_createfile_commit(c->h, c->vol, name, rev, &revid, 0, 0);
+	if(s != OK) {
+	    CRIT("createfile_commit failed: %s", msg_get_reason());
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* Rows/s over the whole list set, recursively and folded into fake dirs */
+static int bench_list_scale(struct bench_ctx *c, uint64_t count) {
+    const sx_hashfs_file_t *file;
+    struct bench_stat st;
+    struct timeval t1, t2;
+    uint64_t rows, expect;
+    unsigned int recurse;
+    rc_ty s;
+
+    if(bench_list_populate(c, count))
+	return -1;
+    for(recurse = 0; recurse < 2; recurse++) {
+	expect = recurse ? count : MIN(count, BENCH_LIST_DIRS);
+	if(timing_init(&st, MIN(expect, BENCH_MAX_SAMPLES)))
+	    return -1;
+	rows = 0;
+	gettimeofday(&t1, NULL);
+	for(s = sx_hashfs_list_first(c->h, c->vol, "list/", &file, recurse, NULL, 0); s == OK; s = sx_hashfs_list_next(c->h)) {
+	    gettimeofday(&t2, NULL);
+	    timing_add(&st, &t1, &t2, 0);
+	    t1 = t2;
+	    rows++;
+	}
+	if(s != ITER_NO_MORE || rows != expect) {
+	    CRIT("Listing returned %llu rows out of %llu: %s", (unsigned long long)rows, (unsigned long long)expect, msg_get_reason());
+	    free(st.lat);
+	    return -1;
+	}
+	timing_report(&st, recurse ? "list_recursive" : "list_fakedirs", 0, -1);
+    }
+    return 0;
+}
+
+/* A single pass over everything the other benchmarks left behind */
+static int bench_gc(struct bench_ctx *c) {
+    struct bench_stat st;
+    struct timeval t1, t2;
+    int terminate = 0;
+
+    if(timing_init(&st, 1))
+	return -1;
+    /* Same batching as sxadm node --gc-expire */
+    gc_max_batch_time = 1;
+    gc_yield_time = 1.1;
+    gettimeofday(&t1, NULL);
+    if(sx_hashfs_gc_periodic(c->h, &terminate, -1) != OK) {
+	CRIT("gc_periodic failed: %s", msg_get_reason());
+	free(st.lat);
+	return -1;
+    }
+    gettimeofday(&t2, NULL);
+    timing_add(&st, &t1, &t2, 0);
+    timing_report(&st, "gc_periodic", 0, -1);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    sxc_client_t *sx = sx_init(NULL, NULL, NULL, 0, argc, argv);
+    char tmpdir[] = "/tmp/hashfs-bench.XXXXXX", *dir = NULL, *storage = NULL;
+    sx_node_t *node = NULL;
+    sx_uuid_t node_uuid;
+    uint8_t key[AUTH_KEY_LEN], admin_key[AUTH_KEY_LEN];
+    sx_hash_t gid;
+    struct bench_ctx c;
+    unsigned int i, j, nlists = 0;
+    uint64_t lists[BENCH_LIST_MAX];
+    int ops = BENCH_DEFAULT_OPS, keep = 0, ret = 1;
+
+    memset(&c, 0, sizeof(c));
+    if(!sx) {
+	fprintf(stderr, "Failed to init library\n");
+	return 1;
+    }
+    log_setminlevel(sx, SX_LOG_WARNING);
+    for(i = 1; i < (unsigned int)argc; i++) {
+	if(!strcmp(argv[i], "--debug"))
+	    log_setminlevel(sx, SX_LOG_DEBUG);
+	else if(!strcmp(argv[i], "--keep"))
+	    keep = 1;
+	else if(!strcmp(argv[i], "--ops") && i + 1 < (unsigned int)argc)
+	    ops = atoi(argv[++i]);
+	else if(!strcmp(argv[i], "--list") && i + 1 < (unsigned int)argc && nlists < BENCH_LIST_MAX) {
+	    long long n = atoll(argv[++i]);
+	    if(n <= 0)
+		GTFO("Invalid --list size %s", argv[i]);
+	    lists[nlists++] = n;
+	} else if(argv[i][0] != '-' && !dir)
+	    dir = argv[i];
+	else {
+	    fprintf(stderr, "usage: %s [--debug] [--ops N] [--list N]... [--keep] [scratch-dir]\n", argv[0]);
+	    goto out;
+	}
+    }
+    if(ops < 100)
+	GTFO("At least 100 ops are required");
+    c.ops = ops;
+
+    if(!dir) {
+	if(!mkdtemp(tmpdir))
+	    GTFO("Failed to create scratch directory");
+	dir = tmpdir;
+    }
+    storage = malloc(strlen(dir) + sizeof("/storage"));
+    if(!storage)
+	GTFO("Out of memory");
+    sprintf(storage, "%s/storage", dir);
+    c.sx = sx;
+
+    if(uuid_generate(&c.cluster) || uuid_generate(&node_uuid) || sxi_rand_pseudo_bytes(key, sizeof(key)) ||
+       sxi_rand_pseudo_bytes(admin_key, sizeof(admin_key)))
+	GTFO("Failed to generate cluster identifiers");
+    if(mkdir(storage, 0770))
+	GTFO("Cannot create storage directory %s", storage);
+    if(sx_storage_create(storage, &c.cluster, key, sizeof(key), NULL, 0) != OK)
+	GTFO("Failed to create storage");
+    if(!(c.h = sx_hashfs_open(storage, sx)))
+	GTFO("Failed to open storage");
+    if(!(node = sx_node_new(&node_uuid, "127.0.0.1", "127.0.0.1", 1024LL * 1024 * 1024 * 1024)))
+	GTFO("Failed to create node");
+    /* The admin user created on activation owns everything */
+    if(sx_hashfs_hash_buf(NULL, 0, "admin", 5, &gid))
+	GTFO("Failed to compute admin user id");
+    memcpy(c.user, gid.b, sizeof(c.user));
+    if(sx_storage_activate(c.h, "bench", node, c.user, sizeof(c.user), admin_key, sizeof(admin_key), 0, NULL) != OK)
+	GTFO("Failed to activate storage: %s", msg_get_reason());
+    /* Reopen to pick up the new distribution model */
+    sx_hashfs_close(c.h);
+    if(!(c.h = sx_hashfs_open(storage, sx)))
+	GTFO("Failed to reopen storage");
+    if(sx_hashfs_get_uid(c.h, "admin", &c.uid) != OK)
+	GTFO("Failed to look up admin user");
+    if(sx_hashfs_hash_buf(c.cluster.string, strlen(c.cluster.string), BENCH_VOLUME, strlen(BENCH_VOLUME), &gid))
+	GTFO("Failed to compute volume id");
+    sx_hashfs_volume_new_begin(c.h);
+    if(sx_hashfs_volume_new_finish(c.h, BENCH_VOLUME, &gid, 512LL * 1024 * 1024 * 1024, 1, 1, c.uid, 1) != OK ||
+       sx_hashfs_volume_enable(c.h, &gid) != OK ||
+       sx_hashfs_volume_by_name(c.h, BENCH_VOLUME, &c.vol) != OK)
+	GTFO("Failed to create volume: %s", msg_get_reason());
+
+    if(!(c.buf = malloc(SX_BS_LARGE)) || !(c.hashes = malloc(c.ops * sizeof(*c.hashes))))
+	GTFO("Out of memory");
+
+    printf("{\"benchmarks\":[");
+    for(i = 0; i < sizeof(bench_bs) / sizeof(bench_bs[0]); i++) {
+	unsigned int bs = bench_bs[i], nops = MIN(c.ops, BENCH_MAX_BYTES / bs);
+	unsigned int nblocks = (bench_fsize[i] + bs - 1) / bs;
+
+	for(j = 0; j < sizeof(bench_dedup) / sizeof(bench_dedup[0]); j++) {
+	    if(bench_block_put(&c, bs, nops, bench_dedup[j]) ||
+	       bench_hashop(&c, bs, nops, bench_dedup[j]))
+		goto out;
+	}
+	/* hashes[] now holds the blocks of the last (most deduped) put run */
+	if(bench_block_get(&c, bs, nops) ||
+	   bench_gettoken(&c, bs, bench_fsize[i], nblocks) ||
+	   bench_createfile(&c, bs, bench_fsize[i], nblocks) ||
+	   bench_list(&c, bs))
+	    goto out;
+    }
+    /* The list set only grows, so go from the smallest size up */
+    for(i = 1; i < nlists; i++)
+	for(j = i; j > 0 && lists[j - 1] > lists[j]; j--) {
+	    uint64_t t = lists[j];
+	    lists[j] = lists[j - 1];
+	    lists[j - 1] = t;
+	}
+    for(i = 0; i < nlists; i++)
+	if(bench_list_scale(&c, lists[i]))
+	    goto out;
+    if(bench_gc(&c))
+	goto out;
+    printf("\n]}\n");
+    ret = 0;
+
+ out:
+    if(ret && !first_result)
+	printf("\n]}\n");
+    free(c.buf);
+    free(c.hashes);
+    sx_node_delete(node);
+    if(c.h)
+	sx_hashfs_close(c.h);
+    if(storage && !keep) {
+	if(dir == tmpdir)
+	    nftw(dir, rmtree_cb, 16, FTW_DEPTH | FTW_PHYS);
+	else
+	    nftw(storage, rmtree_cb, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    free(storage);
+    sx_done(&sx);
+    return ret;
+}
@@ -636,6 +636,8 @@ const struct hashtest hashtests2[HASHES_NUM] = {
 static int locate_cmp(sxi_hdist_t *model1, sxi_hdist_t *model2, uint64_t hash, int replica, int bidx, const struct hashtest *ht)
 {
     sx_nodelist_t *nodelist1, *nodelist2;
+    const sx_nodelist_t *buildlist;
+    unsigned int nidx[64];
     int i;
 
     nodelist1 = sxi_hdist_locate(model1, hash, replica, bidx);
@@ -658,6 +660,14 @@ static int locate_cmp(sxi_hdist_t *model1, sxi_hdist_t *model2, uint64_t hash, i
 	return 1;
     }
 
+    if(replica > sizeof(nidx) / sizeof(nidx[0]) || sxi_hdist_locate_many(model2, &hash, 1, replica, bidx, nidx)) {
+	CRIT("Can't batch locate hash with model2");
+	sx_nodelist_delete(nodelist1);
+	sx_nodelist_delete(nodelist2);
+	return 1;
+    }
+    buildlist = sxi_hdist_nodelist(model2, bidx);
+
     if(dbg)
 	fprintf(stderr, "Locate (hash: %llx, replica: %u, bidx: %d) = ", (unsigned long long) hash, replica, bidx);
 
@@ -669,6 +679,12 @@ static int locate_cmp(sxi_hdist_t *model1, sxi_hdist_t *model2, uint64_t hash, i
 	    sx_nodelist_delete(nodelist2);
 	    return 1;
 	}
+	if(strcmp(sx_node_uuid_str(sx_nodelist_get(nodelist1, i)), sx_node_uuid_str(sx_nodelist_get(buildlist, nidx[i])))) {
+	    CRIT("Different nodes reported by batch locate");
+	    sx_nodelist_delete(nodelist1);
+	    sx_nodelist_delete(nodelist2);
+	    return 1;
+	}
 	if(ht) {
 	    if(strcmp(addr, ht->res[replica - 1][i])) {
 		CRIT("Invalid result for hash %llx and replica %u (got: %s, expected: %s)", (unsigned long long) hash, replica, addr, ht->res[replica - 1][i]);